@@ -0,0 +1,691 @@
+/**
+ * A CPU engine for the int matrix product of matrixMul in mm_multiplication.cu, C = A B, organized the way of Goto and van de
+ * Geijn ("Anatomy of high-performance matrix multiplication", TOMS 2008) and of BLIS:
+ *
+ *   for every block of nc columns of B and C                         (the packed block of B stays in L3)
+ *     for every block of kc rows of that block of B                  pack it into panels of nr columns, in parallel
+ *       for every block of mc rows of A and C, one per pool item     pack it into slivers of mr rows (stays in L2)
+ *         for every panel of B and every sliver of A                 the micro-kernel: an mr x nr tile of C in registers,
+ *                                                                    kc rank-1 updates from L1, then added to C
+ *
+ * Packing copies the blocks into the order the micro-kernel reads them, so the inner loop walks both operands contiguously
+ * whatever the leading dimensions, and pads the edges with zeros so that the micro-kernel always computes a full tile.
+ *
+ * The micro-kernels broadcast an element of A and multiply it with one or two vectors of B with vpmulld. The AVX2 kernel keeps
+ * a 6 x 16 tile in 12 of the 16 ymm registers and the AVX-512 kernel a 12 x 32 tile in 24 of the 32 zmm registers, enough
+ * independent sums to cover the latency of the multiplication. They are compiled for their instruction set with a target
+ * attribute and picked at run time with __builtin_cpu_supports, like the random number kernels of counter_rng.h; every kernel
+ * gives the same product, with the wrap-around of int arithmetic on overflow.
+ *
+ * The row blocks of C are the items of a WorkStealingPool job, so the threads are created once for all the products of a
+ * program and a slow thread does not hold up the others.
+ * */
+#ifndef CPU_GEMM_H
+#define CPU_GEMM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parallel_monte_carlo/work_stealing_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_GEMM_X86 1
+#endif
+
+// the default blocking: a 256-row sliver of B is 32 KB for the widest kernel, a packed block of A 96 KB and a packed block of
+// B 4 MB
+#define GEMM_DEFAULT_MC 96
+#define GEMM_DEFAULT_KC 256
+#define GEMM_DEFAULT_NC 4096
+
+// the largest tile of the kernels
+#define GEMM_MAX_MR 12
+#define GEMM_MAX_NR 32
+
+typedef enum {
+    AUTO_GEMM_KERNEL,
+    SCALAR_GEMM_KERNEL,
+    AVX2_GEMM_KERNEL,
+    AVX512_GEMM_KERNEL
+} GemmKernel;
+
+static const char *GEMM_KERNEL_NAMES[] = { "auto", "scalar", "avx2", "avx512" };
+
+// whether a product reads an operand or its transpose
+typedef enum {
+    GEMM_NO_TRANSPOSE,
+    GEMM_TRANSPOSE
+} GemmTranspose;
+
+// adds the product of a packed sliver of A (kc columns of mr rows) and a packed panel of B (kc rows of nr columns) to the
+// mr x nr tile of C at c
+typedef void (*GemmTileFunction)(long kc, const int *a, const int *b, int *c, long ldc);
+
+
+/***************************************************************************************************************************************
+ *                        Micro-kernels
+ * *************************************************************************************************************************************/
+
+static inline void multiplyTileScalar(long kc, const int *a, const int *b, int *c, long ldc) {
+    int sums[4][8];
+    memset(sums, 0, sizeof(sums));
+    for (long p = 0; p < kc; p++) {
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 8; j++) {
+                sums[i][j] += a[i] * b[j];
+            }
+        }
+        a += 4;
+        b += 8;
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 8; j++) {
+            c[i * ldc + j] += sums[i][j];
+        }
+    }
+}
+
+
+#ifdef CPU_GEMM_X86
+
+__attribute__((target("avx2")))
+static inline void multiplyTileAvx2(long kc, const int *a, const int *b, int *c, long ldc) {
+    __m256i sums[6][2];
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        sums[i][0] = _mm256_setzero_si256();
+        sums[i][1] = _mm256_setzero_si256();
+    }
+    for (long p = 0; p < kc; p++) {
+        __m256i b0 = _mm256_load_si256((const __m256i *) b);
+        __m256i b1 = _mm256_load_si256((const __m256i *) (b + 8));
+#pragma GCC unroll 6
+        for (int i = 0; i < 6; i++) {
+            __m256i element = _mm256_set1_epi32(a[i]);
+            sums[i][0] = _mm256_add_epi32(sums[i][0], _mm256_mullo_epi32(element, b0));
+            sums[i][1] = _mm256_add_epi32(sums[i][1], _mm256_mullo_epi32(element, b1));
+        }
+        a += 6;
+        b += 16;
+    }
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        __m256i *row = (__m256i *) (c + i * ldc);
+        _mm256_storeu_si256(row, _mm256_add_epi32(_mm256_loadu_si256(row), sums[i][0]));
+        _mm256_storeu_si256(row + 1, _mm256_add_epi32(_mm256_loadu_si256(row + 1), sums[i][1]));
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static inline void multiplyTileAvx512(long kc, const int *a, const int *b, int *c, long ldc) {
+    __m512i sums[12][2];
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++) {
+        sums[i][0] = _mm512_setzero_si512();
+        sums[i][1] = _mm512_setzero_si512();
+    }
+    for (long p = 0; p < kc; p++) {
+        __m512i b0 = _mm512_load_si512((const void *) b);
+        __m512i b1 = _mm512_load_si512((const void *) (b + 16));
+#pragma GCC unroll 12
+        for (int i = 0; i < 12; i++) {
+            __m512i element = _mm512_set1_epi32(a[i]);
+            sums[i][0] = _mm512_add_epi32(sums[i][0], _mm512_mullo_epi32(element, b0));
+            sums[i][1] = _mm512_add_epi32(sums[i][1], _mm512_mullo_epi32(element, b1));
+        }
+        a += 12;
+        b += 32;
+    }
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++) {
+        int *row = c + i * ldc;
+        _mm512_storeu_si512((void *) row, _mm512_add_epi32(_mm512_loadu_si512((const void *) row), sums[i][0]));
+        _mm512_storeu_si512((void *) (row + 16), _mm512_add_epi32(_mm512_loadu_si512((const void *) (row + 16)), sums[i][1]));
+    }
+}
+
+#endif
+
+
+/**
+ * The kernel for a --kernel value, or -1 for an unknown name.
+ * */
+static inline int findGemmKernel(const char *name) {
+    for (int kernel = AUTO_GEMM_KERNEL; kernel <= AVX512_GEMM_KERNEL; kernel++) {
+        if (strcmp(name, GEMM_KERNEL_NAMES[kernel]) == 0) {
+            return kernel;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * Resolves the auto kernel to the widest one the processor supports; returns -1 when a requested kernel is not supported.
+ * */
+static inline int chooseGemmKernel(GemmKernel requested) {
+#ifdef CPU_GEMM_X86
+    bool hasAvx512 = __builtin_cpu_supports("avx512f");
+    bool hasAvx2 = __builtin_cpu_supports("avx2");
+#else
+    bool hasAvx512 = false;
+    bool hasAvx2 = false;
+#endif
+    if (requested == AUTO_GEMM_KERNEL) {
+        return hasAvx512 ? AVX512_GEMM_KERNEL : (hasAvx2 ? AVX2_GEMM_KERNEL : SCALAR_GEMM_KERNEL);
+    }
+    if ((requested == AVX512_GEMM_KERNEL && !hasAvx512) || (requested == AVX2_GEMM_KERNEL && !hasAvx2)) {
+        return -1;
+    }
+    return requested;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Engine
+ * *************************************************************************************************************************************/
+
+/**
+ * The kernel, the blocking and the packing buffers of the products: one packed block of B shared by the threads and a packed
+ * block of A per thread, and for the products a thread computes on its own, a packed block of B per thread, allocated on its
+ * first use.
+ * */
+typedef struct {
+    WorkStealingPool *pool;
+    GemmKernel kernel;
+    GemmTileFunction multiplyTile;
+    int mr;
+    int nr;
+    long mc;
+    long kc;
+    long nc;
+    int *packedB;
+    int **packedA;
+    int **workerPackedB;
+} GemmEngine;
+
+
+static inline int *allocatePackingBuffer(long count) {
+    int *buffer;
+    if (posix_memalign((void **) &buffer, 64, count * sizeof(int)) != 0) {
+        printf("Could not allocate a packing buffer of %ld ints.\n", count);
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+
+/**
+ * An engine running on the threads of pool with a kernel chosen by chooseGemmKernel; mc and nc are rounded up to whole slivers
+ * and panels of the kernel.
+ * */
+static inline GemmEngine *createGemmEngine(WorkStealingPool *pool, GemmKernel kernel, long mc, long kc, long nc) {
+
+    GemmEngine *engine = (GemmEngine *) malloc(sizeof(GemmEngine));
+    engine->pool = pool;
+    engine->kernel = kernel;
+    switch (kernel) {
+#ifdef CPU_GEMM_X86
+        case AVX512_GEMM_KERNEL:
+            engine->multiplyTile = multiplyTileAvx512;
+            engine->mr = 12;
+            engine->nr = 32;
+            break;
+        case AVX2_GEMM_KERNEL:
+            engine->multiplyTile = multiplyTileAvx2;
+            engine->mr = 6;
+            engine->nr = 16;
+            break;
+#endif
+        default:
+            engine->multiplyTile = multiplyTileScalar;
+            engine->mr = 4;
+            engine->nr = 8;
+    }
+    engine->mc = (mc + engine->mr - 1) / engine->mr * engine->mr;
+    engine->kc = kc;
+    engine->nc = (nc + engine->nr - 1) / engine->nr * engine->nr;
+
+    engine->packedB = allocatePackingBuffer(engine->kc * engine->nc);
+    engine->packedA = (int **) malloc(pool->threadCount * sizeof(int *));
+    engine->workerPackedB = (int **) calloc(pool->threadCount, sizeof(int *));
+    for (int i = 0; i < pool->threadCount; i++) {
+        engine->packedA[i] = allocatePackingBuffer(engine->mc * engine->kc);
+    }
+    return engine;
+}
+
+
+static inline void destroyGemmEngine(GemmEngine *engine) {
+    for (int i = 0; i < engine->pool->threadCount; i++) {
+        free(engine->packedA[i]);
+        free(engine->workerPackedB[i]);
+    }
+    free(engine->packedA);
+    free(engine->workerPackedB);
+    free(engine->packedB);
+    free(engine);
+}
+
+
+/**
+ * A product being computed and the block of it the pool is working on. Element (i, p) of A is a[i * aRowStride + p *
+ * aColumnStride], and likewise for B, so that the packing reads a matrix or its transpose.
+ * */
+typedef struct {
+    GemmEngine *engine;
+    long m;
+    long n;
+    long k;
+    const int *a;
+    long aRowStride;
+    long aColumnStride;
+    const int *b;
+    long bRowStride;
+    long bColumnStride;
+    int *c;
+    long ldc;
+    // the packed block of B: the shared one, or that of the worker computing the product on its own
+    int *packedB;
+    // the current block: the columns [jc, jc + nb) of B and C, the rows [pc, pc + kb) of B, and row blocks of mc rows
+    long jc;
+    long nb;
+    long pc;
+    long kb;
+    long mc;
+} GemmJob;
+
+
+/**
+ * Packs the panels [firstItem, endItem) of the current block of B: panel j holds kb rows of the nr columns from jc + j * nr,
+ * row by row, with zeros past the last column.
+ * */
+static inline void packPanelsOfB(void *context, int workerId, long firstItem, long endItem) {
+
+    GemmJob *job = (GemmJob *) context;
+    int nr = job->engine->nr;
+    for (long panel = firstItem; panel < endItem; panel++) {
+        int *packed = job->packedB + panel * job->kb * nr;
+        long firstColumn = job->jc + panel * nr;
+        long columns = (job->jc + job->nb - firstColumn < nr) ? job->jc + job->nb - firstColumn : nr;
+        for (long p = 0; p < job->kb; p++) {
+            const int *row = job->b + (job->pc + p) * job->bRowStride + firstColumn * job->bColumnStride;
+            for (long j = 0; j < columns; j++) {
+                packed[j] = row[j * job->bColumnStride];
+            }
+            for (long j = columns; j < nr; j++) {
+                packed[j] = 0;
+            }
+            packed += nr;
+        }
+    }
+}
+
+
+/**
+ * Packs rows [firstRow, firstRow + rows) of the current block of A into slivers of mr rows, column by column, with zeros past
+ * the last row.
+ * */
+static inline void packSliversOfA(const GemmJob *job, long firstRow, long rows, int *packed) {
+
+    int mr = job->engine->mr;
+    for (long sliver = 0; sliver < rows; sliver += mr) {
+        long sliverRows = (rows - sliver < mr) ? rows - sliver : mr;
+        for (long p = 0; p < job->kb; p++) {
+            const int *column = job->a + (firstRow + sliver) * job->aRowStride + (job->pc + p) * job->aColumnStride;
+            for (long i = 0; i < sliverRows; i++) {
+                packed[i] = column[i * job->aRowStride];
+            }
+            for (long i = sliverRows; i < mr; i++) {
+                packed[i] = 0;
+            }
+            packed += mr;
+        }
+    }
+}
+
+
+/**
+ * Multiplies the row blocks [firstItem, endItem) of A with the packed block of B into C. The first block of rows of B clears
+ * the block of C first. Full tiles go straight to C; a tile on the edge of C is computed in a buffer and its part inside C added.
+ * */
+static inline void multiplyRowBlocks(void *context, int workerId, long firstItem, long endItem) {
+
+    GemmJob *job = (GemmJob *) context;
+    GemmEngine *engine = job->engine;
+    int mr = engine->mr;
+    int nr = engine->nr;
+    int *packedA = engine->packedA[workerId];
+    for (long block = firstItem; block < endItem; block++) {
+        long ic = block * job->mc;
+        long mb = (job->m - ic < job->mc) ? job->m - ic : job->mc;
+        if (job->pc == 0) {
+            for (long i = ic; i < ic + mb; i++) {
+                memset(job->c + i * job->ldc + job->jc, 0, job->nb * sizeof(int));
+            }
+        }
+        packSliversOfA(job, ic, mb, packedA);
+
+        for (long jr = 0; jr < job->nb; jr += nr) {
+            const int *panel = job->packedB + (jr / nr) * job->kb * nr;
+            long columns = (job->nb - jr < nr) ? job->nb - jr : nr;
+            for (long ir = 0; ir < mb; ir += mr) {
+                const int *sliver = packedA + (ir / mr) * job->kb * mr;
+                int *tile = job->c + (ic + ir) * job->ldc + job->jc + jr;
+                long rows = (mb - ir < mr) ? mb - ir : mr;
+                if (rows == mr && columns == nr) {
+                    engine->multiplyTile(job->kb, sliver, panel, tile, job->ldc);
+                }
+                else {
+                    int edge[GEMM_MAX_MR * GEMM_MAX_NR];
+                    memset(edge, 0, sizeof(edge));
+                    engine->multiplyTile(job->kb, sliver, panel, edge, nr);
+                    for (long i = 0; i < rows; i++) {
+                        for (long j = 0; j < columns; j++) {
+                            tile[i * job->ldc + j] += edge[i * nr + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * Sets up job for C = A B, where element (i, p) of the m x k matrix A is a[i * aRowStride + p * aColumnStride], likewise for the
+ * k x n matrix B, and C is row-major with leading dimension ldc.
+ * */
+static inline void initGemmJob(GemmJob *job, GemmEngine *engine, long m, long n, long k, const int *a, long aRowStride,
+        long aColumnStride, const int *b, long bRowStride, long bColumnStride, int *c, long ldc) {
+    job->engine = engine;
+    job->m = m;
+    job->n = n;
+    job->k = k;
+    job->a = a;
+    job->aRowStride = aRowStride;
+    job->aColumnStride = aColumnStride;
+    job->b = b;
+    job->bRowStride = bRowStride;
+    job->bColumnStride = bColumnStride;
+    job->c = c;
+    job->ldc = ldc;
+}
+
+
+/**
+ * Runs the loops over the blocks of the product of job: on the threads of the pool, or with sequentialWorker >= 0 all on the
+ * calling thread with the packing buffers of that worker, for a task that is itself running on the pool.
+ * */
+static inline void runGemmJob(GemmJob *job, int sequentialWorker) {
+
+    GemmEngine *engine = job->engine;
+    if (job->k == 0) {
+        for (long i = 0; i < job->m; i++) {
+            memset(job->c + i * job->ldc, 0, job->n * sizeof(int));
+        }
+        return;
+    }
+
+    job->mc = engine->mc;
+    if (sequentialWorker < 0) {
+        job->packedB = engine->packedB;
+        // smaller row blocks when there are fewer blocks than threads, so that every thread gets one
+        int threadCount = engine->pool->threadCount;
+        if ((job->m + job->mc - 1) / job->mc < threadCount) {
+            long rowsPerThread = (job->m + threadCount - 1) / threadCount;
+            job->mc = (rowsPerThread + engine->mr - 1) / engine->mr * engine->mr;
+        }
+    }
+    else {
+        if (engine->workerPackedB[sequentialWorker] == NULL) {
+            engine->workerPackedB[sequentialWorker] = allocatePackingBuffer(engine->kc * engine->nc);
+        }
+        job->packedB = engine->workerPackedB[sequentialWorker];
+    }
+    long rowBlockCount = (job->m + job->mc - 1) / job->mc;
+
+    for (job->jc = 0; job->jc < job->n; job->jc += engine->nc) {
+        job->nb = (job->n - job->jc < engine->nc) ? job->n - job->jc : engine->nc;
+        long panelCount = (job->nb + engine->nr - 1) / engine->nr;
+        for (job->pc = 0; job->pc < job->k; job->pc += engine->kc) {
+            job->kb = (job->k - job->pc < engine->kc) ? job->k - job->pc : engine->kc;
+            if (sequentialWorker < 0) {
+                runPool(engine->pool, panelCount, 1, packPanelsOfB, job);
+                runPool(engine->pool, rowBlockCount, 1, multiplyRowBlocks, job);
+            }
+            else {
+                packPanelsOfB(job, sequentialWorker, 0, panelCount);
+                multiplyRowBlocks(job, sequentialWorker, 0, rowBlockCount);
+            }
+        }
+    }
+}
+
+
+/**
+ * C = A B for the m x k matrix A, the k x n matrix B and the m x n matrix C, all row-major with leading dimensions lda, ldb and
+ * ldc, on the threads of the pool. C must not overlap A or B.
+ * */
+static inline void multiplyMatrices(GemmEngine *engine, long m, long n, long k, const int *a, long lda, const int *b, long ldb,
+        int *c, long ldc) {
+    GemmJob job;
+    initGemmJob(&job, engine, m, n, k, a, lda, 1, b, ldb, 1, c, ldc);
+    runGemmJob(&job, -1);
+}
+
+
+/**
+ * multiplyMatrices on worker workerId alone, for a task running on the pool of the engine.
+ * */
+static inline void multiplyMatricesOnWorker(GemmEngine *engine, int workerId, long m, long n, long k, const int *a, long lda,
+        const int *b, long ldb, int *c, long ldc) {
+    GemmJob job;
+    initGemmJob(&job, engine, m, n, k, a, lda, 1, b, ldb, 1, c, ldc);
+    runGemmJob(&job, workerId);
+}
+
+/**
+ * C = op(A) op(B) for the m x k matrix op(A), the k x n matrix op(B) and the m x n matrix C, where op(X) is X or, with
+ * GEMM_TRANSPOSE, its transpose. All three are row-major with leading dimensions lda, ldb and ldc, so a transposed A is stored as
+ * k rows of lda ints; the packing reads the transposes in place. C must not overlap A or B.
+ * */
+static inline void multiplyGeneralMatrices(GemmEngine *engine, GemmTranspose transposeA, GemmTranspose transposeB, long m, long n,
+        long k, const int *a, long lda, const int *b, long ldb, int *c, long ldc) {
+    GemmJob job;
+    initGemmJob(&job, engine, m, n, k, a, (transposeA == GEMM_TRANSPOSE) ? 1 : lda, (transposeA == GEMM_TRANSPOSE) ? lda : 1,
+            b, (transposeB == GEMM_TRANSPOSE) ? 1 : ldb, (transposeB == GEMM_TRANSPOSE) ? ldb : 1, c, ldc);
+    runGemmJob(&job, -1);
+}
+
+
+// a small product is computed in rows of GEMM_SMALL_ROWS and columns of GEMM_SMALL_COLUMNS
+#define GEMM_SMALL_ROWS 4
+#define GEMM_SMALL_COLUMNS 16
+// the most multiply-adds of a product of a batch that skips the blocking; past 16 x 16 x 16 the packed kernels are faster
+#define GEMM_SMALL_WORK (16 * 16 * 16)
+
+
+/**
+ * C = A B for a small product whose A is packed in groups of GEMM_SMALL_ROWS rows (row i, column p at packedA[(i / 4) * 4 * k
+ * + p * 4 + i % 4]) and whose B is packed row by row with columns rounded up to GEMM_SMALL_COLUMNS, both padded with zeros.
+ * The loops have fixed bounds, so the compiler keeps the 4 x 16 sums in vector registers; this is the body of
+ * multiplySmallMatrices, inlined into one copy per instruction set.
+ * */
+__attribute__((always_inline))
+static inline void multiplySmallPacked(long m, long n, long k, const int *packedA, const int *packedB, long ldb, int *c,
+        long ldc) {
+    for (long i = 0; i < m; i += GEMM_SMALL_ROWS) {
+        const int *rows = packedA + i * k;
+        long rowCount = (m - i < GEMM_SMALL_ROWS) ? m - i : GEMM_SMALL_ROWS;
+        for (long j = 0; j < n; j += GEMM_SMALL_COLUMNS) {
+            int sums[GEMM_SMALL_ROWS][GEMM_SMALL_COLUMNS];
+            memset(sums, 0, sizeof(sums));
+            for (long p = 0; p < k; p++) {
+                const int *row = packedB + p * ldb + j;
+#pragma GCC unroll 8
+                for (int r = 0; r < GEMM_SMALL_ROWS; r++) {
+                    int element = rows[p * GEMM_SMALL_ROWS + r];
+#pragma GCC unroll 16
+                    for (int l = 0; l < GEMM_SMALL_COLUMNS; l++) {
+                        sums[r][l] += element * row[l];
+                    }
+                }
+            }
+            long columnCount = (n - j < GEMM_SMALL_COLUMNS) ? n - j : GEMM_SMALL_COLUMNS;
+            for (long r = 0; r < rowCount; r++) {
+                memcpy(c + (i + r) * ldc + j, sums[r], columnCount * sizeof(int));
+            }
+        }
+    }
+}
+
+
+static inline void multiplySmallPackedScalar(long m, long n, long k, const int *packedA, const int *packedB, long ldb, int *c,
+        long ldc) {
+    multiplySmallPacked(m, n, k, packedA, packedB, ldb, c, ldc);
+}
+
+
+#ifdef CPU_GEMM_X86
+
+__attribute__((target("avx2")))
+static inline void multiplySmallPackedAvx2(long m, long n, long k, const int *packedA, const int *packedB, long ldb, int *c,
+        long ldc) {
+    multiplySmallPacked(m, n, k, packedA, packedB, ldb, c, ldc);
+}
+
+
+__attribute__((target("avx512f")))
+static inline void multiplySmallPackedAvx512(long m, long n, long k, const int *packedA, const int *packedB, long ldb, int *c,
+        long ldc) {
+    multiplySmallPacked(m, n, k, packedA, packedB, ldb, c, ldc);
+}
+
+#endif
+
+
+/**
+ * The ints of the packed operands of a small product, or -1 when the product is larger than GEMM_SMALL_WORK or they do not fit
+ * in the packed block of A of a worker, which is where they go.
+ * */
+static inline long getSmallPackingCount(const GemmEngine *engine, long m, long n, long k) {
+    if (m * n * k > GEMM_SMALL_WORK) {
+        return -1;
+    }
+    long rows = (m + GEMM_SMALL_ROWS - 1) / GEMM_SMALL_ROWS * GEMM_SMALL_ROWS;
+    long columns = (n + GEMM_SMALL_COLUMNS - 1) / GEMM_SMALL_COLUMNS * GEMM_SMALL_COLUMNS;
+    long count = (rows + columns) * k;
+    return (count <= engine->mc * engine->kc) ? count : -1;
+}
+
+
+/**
+ * The product of job on worker workerId, for a product small enough for getSmallPackingCount: the whole of op(A) and op(B) is
+ * packed at once into the packed block of A of the worker and multiplied without blocking, which would cost more than the
+ * product. Tiles of 4 x 16 instead of the 12 x 32 of the AVX-512 kernel waste less on the edges of an 8 x 8 product.
+ * */
+static inline void multiplySmallMatrices(const GemmJob *job, int workerId) {
+
+    long m = job->m, n = job->n, k = job->k;
+    long rows = (m + GEMM_SMALL_ROWS - 1) / GEMM_SMALL_ROWS * GEMM_SMALL_ROWS;
+    long ldb = (n + GEMM_SMALL_COLUMNS - 1) / GEMM_SMALL_COLUMNS * GEMM_SMALL_COLUMNS;
+    int *packedA = job->engine->packedA[workerId];
+    int *packedB = packedA + rows * k;
+    for (long i = 0; i < rows; i++) {
+        int *packed = packedA + (i / GEMM_SMALL_ROWS) * GEMM_SMALL_ROWS * k + i % GEMM_SMALL_ROWS;
+        for (long p = 0; p < k; p++) {
+            packed[p * GEMM_SMALL_ROWS] = (i < m) ? job->a[i * job->aRowStride + p * job->aColumnStride] : 0;
+        }
+    }
+    for (long p = 0; p < k; p++) {
+        for (long j = 0; j < ldb; j++) {
+            packedB[p * ldb + j] = (j < n) ? job->b[p * job->bRowStride + j * job->bColumnStride] : 0;
+        }
+    }
+
+    switch (job->engine->kernel) {
+#ifdef CPU_GEMM_X86
+        case AVX512_GEMM_KERNEL:
+            multiplySmallPackedAvx512(m, n, k, packedA, packedB, ldb, job->c, job->ldc);
+            return;
+        case AVX2_GEMM_KERNEL:
+            multiplySmallPackedAvx2(m, n, k, packedA, packedB, ldb, job->c, job->ldc);
+            return;
+#endif
+        default:
+            multiplySmallPackedScalar(m, n, k, packedA, packedB, ldb, job->c, job->ldc);
+    }
+}
+
+
+/**
+ * A batch of products of the same shape; product i reads a[i] and b[i] and writes c[i].
+ * */
+typedef struct {
+    GemmEngine *engine;
+    GemmTranspose transposeA;
+    GemmTranspose transposeB;
+    long m;
+    long n;
+    long k;
+    const int *const *a;
+    long lda;
+    const int *const *b;
+    long ldb;
+    int *const *c;
+    long ldc;
+} GemmBatchJob;
+
+
+static inline void multiplyBatchItems(void *context, int workerId, long firstItem, long endItem) {
+
+    GemmBatchJob *batch = (GemmBatchJob *) context;
+    bool transposeA = (batch->transposeA == GEMM_TRANSPOSE);
+    bool transposeB = (batch->transposeB == GEMM_TRANSPOSE);
+    bool small = (batch->k > 0 && getSmallPackingCount(batch->engine, batch->m, batch->n, batch->k) >= 0);
+    for (long item = firstItem; item < endItem; item++) {
+        GemmJob job;
+        initGemmJob(&job, batch->engine, batch->m, batch->n, batch->k, batch->a[item], transposeA ? 1 : batch->lda,
+                transposeA ? batch->lda : 1, batch->b[item], transposeB ? 1 : batch->ldb, transposeB ? batch->ldb : 1,
+                batch->c[item], batch->ldc);
+        if (small) {
+            multiplySmallMatrices(&job, workerId);
+        }
+        else {
+            runGemmJob(&job, workerId);
+        }
+    }
+}
+
+
+/**
+ * The count products c[i] = op(a[i]) op(b[i]) of the shape and leading dimensions of multiplyGeneralMatrices. Every product is
+ * computed whole by one thread, so a batch of thousands of small products keeps all the threads busy without splitting any;
+ * the threads take the products in runs of about 2^18 multiply-adds. Products of up to GEMM_SMALL_WORK multiply-adds skip the
+ * blocking (multiplySmallMatrices).
+ * */
+static inline void multiplyMatrixBatch(GemmEngine *engine, GemmTranspose transposeA, GemmTranspose transposeB, long m, long n,
+        long k, const int *const *a, long lda, const int *const *b, long ldb, int *const *c, long ldc, long count) {
+    GemmBatchJob batch;
+    batch.engine = engine;
+    batch.transposeA = transposeA;
+    batch.transposeB = transposeB;
+    batch.m = m;
+    batch.n = n;
+    batch.k = k;
+    batch.a = a;
+    batch.lda = lda;
+    batch.b = b;
+    batch.ldb = ldb;
+    batch.c = c;
+    batch.ldc = ldc;
+    long work = m * n * k;
+    long grain = (work < 1) ? (1L << 18) : (work < (1L << 18)) ? (1L << 18) / work : 1;
+    runPool(engine->pool, count, grain, multiplyBatchItems, &batch);
+}
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu_gemm.h"
+
+// Checks and times the general and batched products of cpu_gemm.h: a rectangular product in the four combinations of
+// transposes, with leading dimensions larger than the rows, and batches of small square products. Every result is compared
+// with a plain loop over the same operands, and the initialization, the product and the check are timed separately.
+
+double getSeconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Fills rows x columns ints of a matrix with leading dimension ld with rand() % 100 - 50, and the padding of the rows with
+// a value the products must never read
+void fillMatrix(int* a, long rows, long columns, long ld) {
+	for (long i = 0; i < rows; i++) {
+		for (long j = 0; j < ld; j++) {
+			a[i * ld + j] = (j < columns) ? rand() % 100 - 50 : 1 << 30;
+		}
+	}
+}
+
+// C = op(A) op(B) by the definition
+void multiplyReference(GemmTranspose transposeA, GemmTranspose transposeB, long m, long n, long k, const int* a, long lda,
+		const int* b, long ldb, int* c, long ldc) {
+	for (long i = 0; i < m; i++) {
+		for (long j = 0; j < n; j++) {
+			int sum = 0;
+			for (long p = 0; p < k; p++) {
+				int aElement = (transposeA == GEMM_TRANSPOSE) ? a[p * lda + i] : a[i * lda + p];
+				int bElement = (transposeB == GEMM_TRANSPOSE) ? b[j * ldb + p] : b[p * ldb + j];
+				sum += aElement * bElement;
+			}
+			c[i * ldc + j] = sum;
+		}
+	}
+}
+
+// The number of the m x n ints of c that differ from those of reference
+long countDifferences(long m, long n, const int* c, long ldc, const int* reference, long ldr) {
+	long differences = 0;
+	for (long i = 0; i < m; i++) {
+		for (long j = 0; j < n; j++) {
+			differences += (c[i * ldc + j] != reference[i * ldr + j]);
+		}
+	}
+	return differences;
+}
+
+int THREAD_COUNT = getHardwareThreadCount();
+GemmKernel KERNEL = AUTO_GEMM_KERNEL;
+// the shape of the general product, and the products of every batch
+long M = 1000;
+long N = 700;
+long K = 300;
+long BATCH_COUNT = 4096;
+int REPEAT_COUNT = 3;
+
+// Times and checks op(A) op(B) of M x N x K with the given transposes; returns the number of wrong ints
+long runGeneralProduct(GemmEngine* engine, GemmTranspose transposeA, GemmTranspose transposeB) {
+	double start = getSeconds();
+	// the stored shapes of A and B, with 3 ints of padding per row
+	long aRows = (transposeA == GEMM_TRANSPOSE) ? K : M;
+	long aColumns = (transposeA == GEMM_TRANSPOSE) ? M : K;
+	long bRows = (transposeB == GEMM_TRANSPOSE) ? N : K;
+	long bColumns = (transposeB == GEMM_TRANSPOSE) ? K : N;
+	long lda = aColumns + 3, ldb = bColumns + 3, ldc = N + 3;
+	int* a = (int*)malloc(aRows * lda * sizeof(int));
+	int* b = (int*)malloc(bRows * ldb * sizeof(int));
+	int* c = (int*)calloc(M * ldc, sizeof(int));
+	int* reference = (int*)malloc(M * N * sizeof(int));
+	fillMatrix(a, aRows, aColumns, lda);
+	fillMatrix(b, bRows, bColumns, ldb);
+	double initSeconds = getSeconds() - start;
+
+	double bestSeconds = 0;
+	for (int run = 0; run < REPEAT_COUNT; run++) {
+		start = getSeconds();
+		multiplyGeneralMatrices(engine, transposeA, transposeB, M, N, K, a, lda, b, ldb, c, ldc);
+		double seconds = getSeconds() - start;
+		bestSeconds = (run == 0 || seconds < bestSeconds) ? seconds : bestSeconds;
+	}
+
+	start = getSeconds();
+	multiplyReference(transposeA, transposeB, M, N, K, a, lda, b, ldb, reference, N);
+	long differences = countDifferences(M, N, c, ldc, reference, N);
+	double verifySeconds = getSeconds() - start;
+
+	printf("%c%c , %ld x %ld x %ld , init -> %f s , compute -> %f s , %.2f GOPS , verify -> %f s , %s\n",
+			(transposeA == GEMM_TRANSPOSE) ? 'T' : 'N', (transposeB == GEMM_TRANSPOSE) ? 'T' : 'N', M, N, K, initSeconds,
+			bestSeconds, 2.0 * M * N * K / bestSeconds / 1e9, verifySeconds, (differences == 0) ? "OK" : "WRONG");
+	free(a);
+	free(b);
+	free(c);
+	free(reference);
+	return differences;
+}
+
+// Times and checks a batch of BATCH_COUNT products of size x size matrices, B transposed; returns the number of wrong ints
+long runBatch(GemmEngine* engine, long size) {
+	double start = getSeconds();
+	long elements = size * size;
+	int* storage = (int*)malloc(3 * BATCH_COUNT * elements * sizeof(int));
+	const int** a = (const int**)malloc(BATCH_COUNT * sizeof(int*));
+	const int** b = (const int**)malloc(BATCH_COUNT * sizeof(int*));
+	int** c = (int**)malloc(BATCH_COUNT * sizeof(int*));
+	for (long i = 0; i < BATCH_COUNT; i++) {
+		int* matrices = storage + 3 * i * elements;
+		fillMatrix(matrices, size, size, size);
+		fillMatrix(matrices + elements, size, size, size);
+		a[i] = matrices;
+		b[i] = matrices + elements;
+		c[i] = matrices + 2 * elements;
+	}
+	double initSeconds = getSeconds() - start;
+
+	double bestSeconds = 0;
+	for (int run = 0; run < REPEAT_COUNT; run++) {
+		start = getSeconds();
+		multiplyMatrixBatch(engine, GEMM_NO_TRANSPOSE, GEMM_TRANSPOSE, size, size, size, a, size, b, size, c, size, BATCH_COUNT);
+		double seconds = getSeconds() - start;
+		bestSeconds = (run == 0 || seconds < bestSeconds) ? seconds : bestSeconds;
+	}
+
+	start = getSeconds();
+	int* reference = (int*)malloc(elements * sizeof(int));
+	long differences = 0;
+	for (long i = 0; i < BATCH_COUNT; i++) {
+		multiplyReference(GEMM_NO_TRANSPOSE, GEMM_TRANSPOSE, size, size, size, a[i], size, b[i], size, reference, size);
+		differences += countDifferences(size, size, c[i], size, reference, size);
+	}
+	double verifySeconds = getSeconds() - start;
+
+	printf("Batch of %ld , %ld x %ld x %ld , init -> %f s , compute -> %f s , %.2f GOPS , verify -> %f s , %s\n", BATCH_COUNT, size,
+			size, size, initSeconds, bestSeconds, 2.0 * BATCH_COUNT * size * size * size / bestSeconds / 1e9, verifySeconds,
+			(differences == 0) ? "OK" : "WRONG");
+	free(reference);
+	free(storage);
+	free(a);
+	free(b);
+	free(c);
+	return differences;
+}
+
+void parseOptions(int argc, const char* argv[]);
+
+int main(int argc, const char* argv[]) {
+	parseOptions(argc, argv);
+
+	WorkStealingPool* pool = createPool(THREAD_COUNT, false);
+	GemmEngine* engine = createGemmEngine(pool, KERNEL, GEMM_DEFAULT_MC, GEMM_DEFAULT_KC, GEMM_DEFAULT_NC);
+	printf("Threads -> %d , kernel -> %s (%d x %d tiles)\n", THREAD_COUNT, GEMM_KERNEL_NAMES[engine->kernel], engine->mr,
+			engine->nr);
+
+	long differences = 0;
+	for (int transposes = 0; transposes < 4; transposes++) {
+		differences += runGeneralProduct(engine, (transposes & 2) ? GEMM_TRANSPOSE : GEMM_NO_TRANSPOSE,
+				(transposes & 1) ? GEMM_TRANSPOSE : GEMM_NO_TRANSPOSE);
+	}
+	for (long size = 8; size <= 64; size *= 2) {
+		differences += runBatch(engine, size);
+	}
+
+	destroyGemmEngine(engine);
+	destroyPool(pool);
+	if (differences > 0) {
+		printf("%ld ints of the products are wrong\n", differences);
+		return 1;
+	}
+	printf("All the products agree with the reference\n");
+	return 0;
+}
+
+void parseOptions(int argc, const char* argv[]) {
+	const char* error = NULL;
+	for (int i = 1; i < argc && error == NULL; i++) {
+		if (strncmp(argv[i], "--threads=", 10) == 0) {
+			THREAD_COUNT = atoi(argv[i] + 10);
+			if (THREAD_COUNT < 1) {
+				error = "The thread count must be a positive integer.";
+			}
+		}
+		else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+			int kernel = findGemmKernel(argv[i] + 9);
+			if (kernel < 0) {
+				error = "Unknown kernel.";
+			}
+			else {
+				KERNEL = (GemmKernel) kernel;
+			}
+		}
+		else if (strncmp(argv[i], "--shape=", 8) == 0) {
+			if (sscanf(argv[i] + 8, "%ldx%ldx%ld", &M, &N, &K) != 3 || M < 1 || N < 1 || K < 0) {
+				error = "The shape must be MxNxK.";
+			}
+		}
+		else if (strncmp(argv[i], "--batch=", 8) == 0) {
+			BATCH_COUNT = atol(argv[i] + 8);
+			if (BATCH_COUNT < 1) {
+				error = "The batch size must be a positive integer.";
+			}
+		}
+		else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+			REPEAT_COUNT = atoi(argv[i] + 9);
+			if (REPEAT_COUNT < 1) {
+				error = "The number of runs must be a positive integer.";
+			}
+		}
+		else {
+			error = "Unknown option.";
+		}
+	}
+	if (error == NULL) {
+		int kernel = chooseGemmKernel(KERNEL);
+		if (kernel < 0) {
+			error = "This processor does not support the chosen kernel.";
+		}
+		KERNEL = (GemmKernel) kernel;
+	}
+
+	if (error != NULL) {
+		printf("%s\n", error);
+		printf("Usage: ./program_name [options]\n");
+		printf("Options:\n");
+		printf("\t--threads=N                 threads of the products (default: the processors of the process)\n");
+		printf("\t--kernel=auto|scalar|avx2|avx512  micro-kernel (default: auto, the widest supported)\n");
+		printf("\t--shape=MxNxK               shape of the general product (default: 1000x700x300)\n");
+		printf("\t--batch=N                   products of every batch of 8 x 8 to 64 x 64 matrices (default: 4096)\n");
+		printf("\t--repeat=N                  timed runs of every product (default: 3)\n");
+		exit(1);
+	}
+}
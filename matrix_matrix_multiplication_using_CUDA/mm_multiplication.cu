@@ -37,6 +37,28 @@ void matrix_init(int* a, int n) {
 	}
 }
 
+// The first rows of the product by the same loop on the CPU; returns the number of wrong ints of c among them
+long verify_rows(const int* a, const int* b, const int* c, int n, int rows) {
+	long differences = 0;
+	for (int row = 0; row < rows; row++) {
+		for (int col = 0; col < n; col++) {
+			int temp_sum = 0;
+			for (int k = 0; k < n; k++) {
+				temp_sum += a[row * n + k] * b[k * n + col];
+			}
+			differences += (c[row * n + col] != temp_sum);
+		}
+	}
+	return differences;
+}
+
+// Seconds between two events recorded on the default stream
+double elapsed_seconds_between(cudaEvent_t start, cudaEvent_t end) {
+	float milliseconds = 0;
+	cudaEventElapsedTime(&milliseconds, start, end);
+	return milliseconds / 1e3;
+}
+
 // This program multiplies two squire matrix. Therefore, a single constant for matrix dimension is sufficient
 int dim;  // Default value 4096
 // the block size for blocked matrix-matrix multiplication
@@ -52,7 +74,12 @@ int main(int argc, const char* argv[]) {
 		// Assigning default param values here.
 		dim = 4096;
 		blockSize = 16;
-		printf("Assigning default value dim = %d and blockSize = %d", dim, blockSize);
+		printf("Assigning default value dim = %d and blockSize = %d\n", dim, blockSize);
+	}
+	// a block has blockSize x blockSize threads, and CUDA allows at most 1024 threads per block
+	if (dim < 1 || blockSize < 1 || blockSize * blockSize > 1024) {
+		printf("dim must be positive and blockSize between 1 and 32\n");
+		exit(1);
 	}
 
 	// Taking the start time
@@ -61,8 +88,8 @@ int main(int argc, const char* argv[]) {
 	// Matrix size of 4096 x 4096;
 	int n = dim;
 
-	// Size (in bytes) of matrix
-	size_t bytes = n * n * sizeof(int);
+	// Size (in bytes) of matrix; n * n overflows an int from n = 46341
+	size_t bytes = (size_t)n * n * sizeof(int);
 
 	// Host pointers
 	int* h_a, * h_b, * h_c;
@@ -73,26 +100,42 @@ int main(int argc, const char* argv[]) {
 	h_c = (int*)malloc(bytes);
 
 	// Device pointers
-	int* d_a, * d_b, * d_c;
+	int* d_a = NULL, * d_b = NULL, * d_c = NULL;
 
 	// Allocated device memory
 	cudaMalloc(&d_a, bytes);
 	cudaMalloc(&d_b, bytes);
 	cudaMalloc(&d_c, bytes);
 
+	if (h_a == NULL || h_b == NULL || h_c == NULL || d_a == NULL || d_b == NULL || d_c == NULL) {
+		printf("Could not allocate 3 matrices of %zu bytes\n", bytes);
+		exit(1);
+	}
+
 	// Initialize matrices
 	matrix_init(h_a, n);
 	matrix_init(h_b, n);
+	auto initialized = std::chrono::system_clock::now();
+
+	// The copies and the kernel are timed with events on the default stream
+	cudaEvent_t copy_start, copied, computed, copied_back;
+	cudaEventCreate(&copy_start);
+	cudaEventCreate(&copied);
+	cudaEventCreate(&computed);
+	cudaEventCreate(&copied_back);
 
 	// Copy data to the device
+	cudaEventRecord(copy_start);
 	cudaMemcpy(d_a, h_a, bytes, cudaMemcpyHostToDevice);
 	cudaMemcpy(d_b, h_b, bytes, cudaMemcpyHostToDevice);
+	cudaEventRecord(copied);
 
 	// Threads per block
-	int BLOCK_SIZE = 16;
+	int BLOCK_SIZE = blockSize;
 
-	// Blocks in each dimension (No padding)
-	int GRID_SIZE = n / BLOCK_SIZE;
+	// Blocks in each dimension, rounded up so that the last rows and columns get threads when n is not a multiple of
+	// BLOCK_SIZE; the kernel skips the threads past n
+	int GRID_SIZE = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
 	// Use dim3 objects
 	dim3 grid(GRID_SIZE, GRID_SIZE);
@@ -100,9 +143,24 @@ int main(int argc, const char* argv[]) {
 
 	// Launch kernel
 	matrixMul << <grid, threads >> > (d_a, d_b, d_c, n);
+	cudaEventRecord(computed);
 
 	// Copy back to the host
 	cudaMemcpy(h_c, d_c, bytes, cudaMemcpyDeviceToHost);
+	cudaEventRecord(copied_back);
+	cudaEventSynchronize(copied_back);
+	cudaError_t error = cudaGetLastError();
+	if (error != cudaSuccess) {
+		printf("CUDA error: %s\n", cudaGetErrorString(error));
+		exit(1);
+	}
+
+	// Check the first rows and the last one, which the rounded up grid covers
+	auto verify_start = std::chrono::system_clock::now();
+	int rows = (n < 4) ? n : 4;
+	long differences = verify_rows(h_a, h_b, h_c, n, rows);
+	differences += verify_rows(h_a + (size_t)(n - 1) * n, h_b, h_c + (size_t)(n - 1) * n, n, 1);
+	auto verified = std::chrono::system_clock::now();
 
 	// Free memory on host
 	free(h_a);
@@ -114,6 +172,15 @@ int main(int argc, const char* argv[]) {
 	cudaFree(d_b);
 	cudaFree(d_c);
 
+	cudaEventDestroy(copy_start);
+	cudaEventDestroy(copied);
+	cudaEventDestroy(computed);
+	cudaEventDestroy(copied_back);
+
+	if (differences > 0) {
+		printf("%ld ints of the checked rows are wrong\n", differences);
+		return 1;
+	}
 	printf("\nCalculated the matrix successfully...\n");
 
 	// Getting the end time
@@ -121,8 +188,16 @@ int main(int argc, const char* argv[]) {
 
 	// Calculating elapsed_seconds
 	std::chrono::duration<double> elapsed_seconds = end - start;
+	std::chrono::duration<double> init_seconds = initialized - start;
+	std::chrono::duration<double> verify_seconds = verified - verify_start;
+	double kernel_seconds = elapsed_seconds_between(copied, computed);
 
 	// Print elasped time in seconds
+	std::cout << "init time: " << init_seconds.count() << "s" << std::endl;
+	std::cout << "host to device time: " << elapsed_seconds_between(copy_start, copied) << "s" << std::endl;
+	std::cout << "kernel time: " << kernel_seconds << "s (" << 2.0 * n * n * n / kernel_seconds / 1e9 << " GOPS)" << std::endl;
+	std::cout << "device to host time: " << elapsed_seconds_between(computed, copied_back) << "s" << std::endl;
+	std::cout << "verify time (" << rows + 1 << " rows): " << verify_seconds.count() << "s" << std::endl;
 	std::cout << "elapsed time: " << elapsed_seconds.count() << "s" << std::endl;
 
 	return 0;
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "strassen_gemm.h"
+
+// The CPU version of mm_multiplication.cu: the same int product of two random dim x dim matrices, computed by the blocked,
+// packed and vectorized engine of cpu_gemm.h on a pool of threads, timed against the triple loop of matrixMul.
+
+// Initialization function for matrices
+void matrix_init(int* a, int n) {
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			a[i * n + j] = rand() % 100;
+		}
+	}
+}
+
+// The loop of matrixMul for the rows [firstRow, endRow) of c
+void matrixMulReference(const int* a, const int* b, int* c, int n, int firstRow, int endRow) {
+	for (int row = firstRow; row < endRow; row++) {
+		for (int col = 0; col < n; col++) {
+			int temp_sum = 0;
+			for (int k = 0; k < n; k++) {
+				temp_sum += a[row * n + k] * b[k * n + col];
+			}
+			c[row * n + col] = temp_sum;
+		}
+	}
+}
+
+double getSeconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// This program multiplies two squire matrix. Therefore, a single constant for matrix dimension is sufficient
+int dim = 4096;
+// threads of the pool, and whether they are pinned to their own processors
+int THREAD_COUNT = getHardwareThreadCount();
+bool PIN_THREADS = false;
+GemmKernel KERNEL = AUTO_GEMM_KERNEL;
+long MC = GEMM_DEFAULT_MC;
+long KC = GEMM_DEFAULT_KC;
+long NC = GEMM_DEFAULT_NC;
+// the cutoff of Strassen-Winograd multiplication, 0 for the blocked product alone, and whether to look for its crossover size
+long STRASSEN_CUTOFF = 0;
+bool FIND_CROSSOVER = false;
+// timed runs of the blocked product, and rows of the product computed again by the triple loop to time it and to check them
+int REPEAT_COUNT = 3;
+int REFERENCE_ROWS = 16;
+
+void parseOptions(int argc, const char* argv[]);
+
+// The best time of REPEAT_COUNT products of n x n matrices, blocked or with a Strassen plan
+double timeProduct(GemmEngine* engine, StrassenPlan* plan, int n, const int* a, const int* b, int* c) {
+	double bestSeconds = 0;
+	for (int run = 0; run < REPEAT_COUNT; run++) {
+		double start = getSeconds();
+		if (plan != NULL) {
+			multiplyStrassen(plan, a, n, b, n, c, n);
+		}
+		else {
+			multiplyMatrices(engine, n, n, n, a, n, b, n, c, n);
+		}
+		double seconds = getSeconds() - start;
+		bestSeconds = (run == 0 || seconds < bestSeconds) ? seconds : bestSeconds;
+	}
+	return bestSeconds;
+}
+
+// Times the blocked product against one level of Strassen-Winograd over it for sizes up to dim, and prints the smallest size
+// from which the level is faster on every size timed: the products larger than the size below it should recurse, so that
+// size is the cutoff to use
+void findCrossover(GemmEngine* engine) {
+	printf("Crossover of one Strassen-Winograd level over the blocked product:\n");
+	long crossover = 0;
+	long lastBlockedSize = 0;
+	// the sizes 128, 192, 256, 384, 512, 768, ...
+	for (int size = 128; size <= dim; size = (size % 3 == 0) ? size / 3 * 4 : size / 2 * 3) {
+		size_t bytes = (size_t) size * size * sizeof(int);
+		int* a = (int*)malloc(bytes);
+		int* b = (int*)malloc(bytes);
+		int* c = (int*)malloc(bytes);
+		matrix_init(a, size);
+		matrix_init(b, size);
+
+		StrassenPlan* plan = createStrassenPlan(engine, size, size / 2);
+		double blockedSeconds = timeProduct(engine, NULL, size, a, b, c);
+		double strassenSeconds = timeProduct(engine, plan, size, a, b, c);
+		printf("Size -> %d , blocked -> %f s , one level -> %f s , ratio -> %.3f\n", size, blockedSeconds, strassenSeconds,
+				strassenSeconds / blockedSeconds);
+		if (strassenSeconds < blockedSeconds) {
+			crossover = (crossover == 0) ? size : crossover;
+		}
+		else {
+			crossover = 0;
+			lastBlockedSize = size;
+		}
+		destroyStrassenPlan(plan);
+		free(a);
+		free(b);
+		free(c);
+	}
+	if (crossover > 0) {
+		printf("Crossover -> %ld ; one level is faster from there on, so use --strassen=%ld\n", crossover,
+				(lastBlockedSize > 0) ? lastBlockedSize : crossover / 2);
+	}
+	else {
+		printf("Crossover -> none up to %d ; the blocked product is faster on all the sizes timed\n", dim);
+	}
+}
+
+int main(int argc, const char* argv[]) {
+	parseOptions(argc, argv);
+	int n = dim;
+
+	WorkStealingPool* pool = createPool(THREAD_COUNT, PIN_THREADS);
+	GemmEngine* engine = createGemmEngine(pool, KERNEL, MC, KC, NC);
+	printf("Matrix -> %d x %d , threads -> %d , kernel -> %s (%d x %d tiles) , blocking mc -> %ld , kc -> %ld , nc -> %ld\n", n, n,
+			THREAD_COUNT, GEMM_KERNEL_NAMES[engine->kernel], engine->mr, engine->nr, engine->mc, engine->kc, engine->nc);
+
+	// Size (in bytes) of matrix
+	size_t bytes = (size_t) n * n * sizeof(int);
+
+	// Allocate and initialize the matrices
+	double start = getSeconds();
+	int* h_a = (int*)malloc(bytes);
+	int* h_b = (int*)malloc(bytes);
+	int* h_c = (int*)malloc(bytes);
+	matrix_init(h_a, n);
+	matrix_init(h_b, n);
+	memset(h_c, 0, bytes);
+	printf("Initialized the matrices in %f s\n", getSeconds() - start);
+
+	// the blocked product, best and mean of the runs
+	double operations = 2.0 * n * n * n;
+	double bestSeconds = 0;
+	double totalSeconds = 0;
+	for (int run = 0; run < REPEAT_COUNT; run++) {
+		start = getSeconds();
+		multiplyMatrices(engine, n, n, n, h_a, n, h_b, n, h_c, n);
+		double seconds = getSeconds() - start;
+		bestSeconds = (run == 0 || seconds < bestSeconds) ? seconds : bestSeconds;
+		totalSeconds += seconds;
+	}
+	printf("Blocked product -> best %f s , mean %f s over %d runs , %.2f GOPS , %.2f GOPS per thread\n", bestSeconds,
+			totalSeconds / REPEAT_COUNT, REPEAT_COUNT, operations / bestSeconds / 1e9, operations / bestSeconds / 1e9 / THREAD_COUNT);
+
+	// Strassen-Winograd over the blocked product, which must give the same ints
+	if (STRASSEN_CUTOFF > 0) {
+		StrassenPlan* plan = createStrassenPlan(engine, n, STRASSEN_CUTOFF);
+		int* h_s = (int*)malloc(bytes);
+		double strassenSeconds = timeProduct(engine, plan, n, h_a, h_b, h_s);
+		printf("Strassen-Winograd product -> cutoff %ld , best %f s over %d runs , %.2f effective GOPS , %.2f times the blocked product\n",
+				STRASSEN_CUTOFF, strassenSeconds, REPEAT_COUNT, operations / strassenSeconds / 1e9, bestSeconds / strassenSeconds);
+		if (memcmp(h_s, h_c, bytes) != 0) {
+			printf("The Strassen-Winograd product differs from the blocked product\n");
+			exit(1);
+		}
+		printf("Verified the Strassen-Winograd product against the blocked product\n");
+		free(h_s);
+		destroyStrassenPlan(plan);
+	}
+	if (FIND_CROSSOVER) {
+		findCrossover(engine);
+	}
+
+	// the triple loop on the first rows, which is too slow to run on all of them
+	int rows = (REFERENCE_ROWS < n) ? REFERENCE_ROWS : n;
+	if (rows > 0) {
+		int* reference = (int*)malloc((size_t) rows * n * sizeof(int));
+		start = getSeconds();
+		matrixMulReference(h_a, h_b, reference, n, 0, rows);
+		double referenceSeconds = getSeconds() - start;
+		double referenceOperations = 2.0 * rows * n * n;
+		printf("Naive triple loop -> %d rows in %f s , %.2f GOPS on one thread , blocked product %.1f times faster\n", rows,
+				referenceSeconds, referenceOperations / referenceSeconds / 1e9,
+				(operations / bestSeconds) / (referenceOperations / referenceSeconds));
+
+		for (long i = 0; i < (long) rows * n; i++) {
+			if (reference[i] != h_c[i]) {
+				printf("The blocked product differs from the triple loop at row %ld, column %ld: %d instead of %d\n", i / n, i % n,
+						h_c[i], reference[i]);
+				exit(1);
+			}
+		}
+		printf("Verified the first %d rows against the triple loop\n", rows);
+		free(reference);
+	}
+
+	free(h_a);
+	free(h_b);
+	free(h_c);
+	destroyGemmEngine(engine);
+	destroyPool(pool);
+
+	return 0;
+}
+
+void parseOptions(int argc, const char* argv[]) {
+	const char* error = NULL;
+	int firstOption = 1;
+	if (argc > 1 && argv[1][0] != '-') {
+		dim = atoi(argv[1]);
+		firstOption = 2;
+		if (dim < 1) {
+			error = "The matrix dimension must be a positive integer.";
+		}
+	}
+	else {
+		printf("Assigning default value dim = %d\n", dim);
+	}
+
+	for (int i = firstOption; i < argc && error == NULL; i++) {
+		if (strncmp(argv[i], "--threads=", 10) == 0) {
+			THREAD_COUNT = atoi(argv[i] + 10);
+			if (THREAD_COUNT < 1) {
+				error = "The thread count must be a positive integer.";
+			}
+		}
+		else if (strcmp(argv[i], "--pin") == 0) {
+			PIN_THREADS = true;
+		}
+		else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+			int kernel = findGemmKernel(argv[i] + 9);
+			if (kernel < 0) {
+				error = "Unknown kernel.";
+			}
+			else {
+				KERNEL = (GemmKernel) kernel;
+			}
+		}
+		else if (strncmp(argv[i], "--mc=", 5) == 0) {
+			MC = atol(argv[i] + 5);
+		}
+		else if (strncmp(argv[i], "--kc=", 5) == 0) {
+			KC = atol(argv[i] + 5);
+		}
+		else if (strncmp(argv[i], "--nc=", 5) == 0) {
+			NC = atol(argv[i] + 5);
+		}
+		else if (strcmp(argv[i], "--strassen") == 0) {
+			STRASSEN_CUTOFF = STRASSEN_DEFAULT_CUTOFF;
+		}
+		else if (strncmp(argv[i], "--strassen=", 11) == 0) {
+			STRASSEN_CUTOFF = atol(argv[i] + 11);
+			if (STRASSEN_CUTOFF < 1) {
+				error = "The Strassen cutoff must be a positive integer.";
+			}
+		}
+		else if (strcmp(argv[i], "--crossover") == 0) {
+			FIND_CROSSOVER = true;
+		}
+		else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+			REPEAT_COUNT = atoi(argv[i] + 9);
+			if (REPEAT_COUNT < 1) {
+				error = "The number of runs must be a positive integer.";
+			}
+		}
+		else if (strncmp(argv[i], "--reference-rows=", 17) == 0) {
+			REFERENCE_ROWS = atoi(argv[i] + 17);
+		}
+		else {
+			error = "Unknown option.";
+		}
+	}
+	if (error == NULL && (MC < 1 || KC < 1 || NC < 1)) {
+		error = "The block sizes must be positive integers.";
+	}
+	if (error == NULL) {
+		int kernel = chooseGemmKernel(KERNEL);
+		if (kernel < 0) {
+			error = "This processor does not support the chosen kernel.";
+		}
+		KERNEL = (GemmKernel) kernel;
+	}
+
+	if (error != NULL) {
+		printf("%s\n", error);
+		printf("Usage: ./program_name [dim] [options]\n");
+		printf("Options:\n");
+		printf("\t--threads=N                 threads of the product (default: the processors of the process)\n");
+		printf("\t--pin                       pin every thread to its own processor\n");
+		printf("\t--kernel=auto|scalar|avx2|avx512  micro-kernel (default: auto, the widest supported)\n");
+		printf("\t--mc=N --kc=N --nc=N        rows of a packed block of A, rows and columns of a packed block of B (default: %d, %d, %d)\n",
+				GEMM_DEFAULT_MC, GEMM_DEFAULT_KC, GEMM_DEFAULT_NC);
+		printf("\t--strassen[=CUTOFF]         also multiply with Strassen-Winograd down to CUTOFF rows (default: %d)\n",
+				STRASSEN_DEFAULT_CUTOFF);
+		printf("\t--crossover                 time one Strassen-Winograd level against the blocked product up to dim\n");
+		printf("\t--repeat=N                  timed runs of the product (default: 3)\n");
+		printf("\t--reference-rows=N          rows computed again by the triple loop to time and check it (default: 16)\n");
+		exit(1);
+	}
+}
@@ -0,0 +1,399 @@
+/**
+ * Strassen-Winograd multiplication of square int matrices on top of the blocked engine of cpu_gemm.h.
+ *
+ * A product larger than the cutoff is split into quadrants and computed with the 7 half-size products and 15 additions of
+ * Winograd's variant of Strassen's algorithm, in the schedule of Boyer, Dumas, Pernet and Zhou ("Memory efficient scheduling of
+ * Strassen-Winograd's matrix multiplication algorithm", ISSAC 2009), which needs two temporary quadrants besides C. Products of
+ * at most cutoff rows go to the blocked engine. An odd size is peeled: the even part is multiplied recursively and the last
+ * row and column are added with a rank-1 update and two matrix-vector products, so no padded copy is made.
+ *
+ * The temporaries come from an arena per worker, allocated once by createStrassenPlan for the largest size and taken by the
+ * recursion level by level, so no level allocates. On more than one thread, the products of the first level are the items of
+ * a pool job (in Strassen's original form, whose products have independent operands), each computed by the recursion on its
+ * worker, and their combination into C is a second job over the rows. With more than 7 threads the first two levels are
+ * split into their 49 products, so that the threads past the seventh do not idle, or, when the products of the first level
+ * are already small enough for the blocked engine, they are computed one after the other on the whole pool.
+ *
+ * int arithmetic wraps around, so the additions and subtractions are exact modulo 2^32 and the result equals the blocked
+ * product bit for bit.
+ * */
+#ifndef STRASSEN_GEMM_H
+#define STRASSEN_GEMM_H
+
+#include "cpu_gemm.h"
+
+// the default size at or below which a product goes to the blocked engine
+#define STRASSEN_DEFAULT_CUTOFF 1024
+
+typedef struct {
+    GemmEngine *engine;
+    long cutoff;
+    // the size of the products the plan is for
+    long n;
+    // the temporaries of the recursion, one arena per worker
+    long arenaCount;
+    int **arenas;
+    // the levels split into products on the pool, 0 on one thread, their productCount products of productSize rows, and
+    // whether each product runs on the whole pool instead of on one worker
+    int levels;
+    long productCount;
+    long productSize;
+    bool productsOnPool;
+    int *products;
+} StrassenPlan;
+
+// the coefficients of the quadrants 11, 12, 21 and 22 of A and of B in the 7 products of Strassen's form, and of the products in
+// the quadrants of C
+static const int STRASSEN_A_TERMS[7][4] = {
+    { 1, 0, 0, 1 }, { 0, 0, 1, 1 }, { 1, 0, 0, 0 }, { 0, 0, 0, 1 }, { 1, 1, 0, 0 }, { -1, 0, 1, 0 }, { 0, 1, 0, -1 }
+};
+static const int STRASSEN_B_TERMS[7][4] = {
+    { 1, 0, 0, 1 }, { 1, 0, 0, 0 }, { 0, 1, 0, -1 }, { -1, 0, 1, 0 }, { 0, 0, 0, 1 }, { 1, 1, 0, 0 }, { 0, 0, 1, 1 }
+};
+static const int STRASSEN_C_TERMS[7][4] = {
+    { 1, 0, 0, 1 }, { 0, 0, 1, -1 }, { 0, 1, 0, 1 }, { 1, 0, 1, 0 }, { -1, 1, 0, 0 }, { 0, 0, 0, 1 }, { 1, 0, 0, 0 }
+};
+
+
+/**
+ * The ints of temporaries the recursion takes for a product of size n: two quadrants per level.
+ * */
+static inline long getWinogradArenaCount(long n, long cutoff) {
+    long count = 0;
+    while (n > cutoff) {
+        long half = n / 2;
+        count += 2 * half * half;
+        n = half;
+    }
+    return count;
+}
+
+
+static inline StrassenPlan *createStrassenPlan(GemmEngine *engine, long n, long cutoff) {
+
+    StrassenPlan *plan = (StrassenPlan *) malloc(sizeof(StrassenPlan));
+    plan->engine = engine;
+    plan->cutoff = (cutoff > 1) ? cutoff : 1;
+    plan->n = n;
+    plan->arenaCount = getWinogradArenaCount(n, plan->cutoff);
+    int threadCount = engine->pool->threadCount;
+    plan->arenas = (int **) malloc(threadCount * sizeof(int *));
+    for (int i = 0; i < threadCount; i++) {
+        plan->arenas[i] = allocatePackingBuffer(plan->arenaCount + 1);
+    }
+    long half = n / 2;
+    plan->levels = 0;
+    if (threadCount > 1 && n > plan->cutoff) {
+        plan->levels = (threadCount > 7 && half > plan->cutoff && half % 2 == 0) ? 2 : 1;
+    }
+    plan->productCount = (plan->levels == 2) ? 49 : 7;
+    plan->productSize = (plan->levels == 2) ? half / 2 : half;
+    plan->productsOnPool = (threadCount > 7 && plan->levels == 1 && half <= plan->cutoff);
+    long productInts = plan->productCount * plan->productSize * plan->productSize;
+    plan->products = (plan->levels > 0) ? allocatePackingBuffer(productInts) : NULL;
+    return plan;
+}
+
+
+static inline void destroyStrassenPlan(StrassenPlan *plan) {
+    for (int i = 0; i < plan->engine->pool->threadCount; i++) {
+        free(plan->arenas[i]);
+    }
+    free(plan->arenas);
+    free(plan->products);
+    free(plan);
+}
+
+
+// z = x + y and z = x - y for rows x columns blocks
+static inline void addBlocks(long rows, long columns, const int *x, long ldx, const int *y, long ldy, int *z, long ldz) {
+    for (long i = 0; i < rows; i++) {
+        for (long j = 0; j < columns; j++) {
+            z[i * ldz + j] = x[i * ldx + j] + y[i * ldy + j];
+        }
+    }
+}
+
+
+static inline void subtractBlocks(long rows, long columns, const int *x, long ldx, const int *y, long ldy, int *z, long ldz) {
+    for (long i = 0; i < rows; i++) {
+        for (long j = 0; j < columns; j++) {
+            z[i * ldz + j] = x[i * ldx + j] - y[i * ldy + j];
+        }
+    }
+}
+
+
+/**
+ * Completes C = A B of size n = even + 1 when C holds the product of the leading even x even blocks: adds the last column of A
+ * times the last row of B to that block, and computes the last column and the last row of C.
+ * */
+static inline void addPeeledEdges(long n, const int *a, long lda, const int *b, long ldb, int *c, long ldc) {
+
+    long even = n - 1;
+    for (long i = 0; i < even; i++) {
+        int element = a[i * lda + even];
+        for (long j = 0; j < even; j++) {
+            c[i * ldc + j] += element * b[even * ldb + j];
+        }
+    }
+    for (long i = 0; i < even; i++) {
+        int sum = 0;
+        for (long p = 0; p < n; p++) {
+            sum += a[i * lda + p] * b[p * ldb + even];
+        }
+        c[i * ldc + even] = sum;
+    }
+    int *lastRow = c + even * ldc;
+    memset(lastRow, 0, n * sizeof(int));
+    for (long p = 0; p < n; p++) {
+        int element = a[even * lda + p];
+        for (long j = 0; j < n; j++) {
+            lastRow[j] += element * b[p * ldb + j];
+        }
+    }
+}
+
+
+/**
+ * C = A B for n x n matrices with Winograd's variant, on worker workerId alone, taking its temporaries from arena.
+ * */
+static inline void multiplyWinograd(StrassenPlan *plan, int workerId, long n, const int *a, long lda, const int *b, long ldb,
+        int *c, long ldc, int *arena) {
+
+    if (n <= plan->cutoff) {
+        multiplyMatricesOnWorker(plan->engine, workerId, n, n, n, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    long h = n / 2;
+    const int *a11 = a, *a12 = a + h, *a21 = a + h * lda, *a22 = a + h * lda + h;
+    const int *b11 = b, *b12 = b + h, *b21 = b + h * ldb, *b22 = b + h * ldb + h;
+    int *c11 = c, *c12 = c + h, *c21 = c + h * ldc, *c22 = c + h * ldc + h;
+    int *x = arena;
+    int *y = arena + h * h;
+    int *rest = arena + 2 * h * h;
+
+    subtractBlocks(h, h, a11, lda, a21, lda, x, h);                        // S3 = A11 - A21
+    subtractBlocks(h, h, b22, ldb, b12, ldb, y, h);                        // T3 = B22 - B12
+    multiplyWinograd(plan, workerId, h, x, h, y, h, c21, ldc, rest);       // P7 = S3 T3
+    addBlocks(h, h, a21, lda, a22, lda, x, h);                             // S1 = A21 + A22
+    subtractBlocks(h, h, b12, ldb, b11, ldb, y, h);                        // T1 = B12 - B11
+    multiplyWinograd(plan, workerId, h, x, h, y, h, c22, ldc, rest);       // P5 = S1 T1
+    subtractBlocks(h, h, x, h, a11, lda, x, h);                            // S2 = S1 - A11
+    subtractBlocks(h, h, b22, ldb, y, h, y, h);                            // T2 = B22 - T1
+    multiplyWinograd(plan, workerId, h, x, h, y, h, c12, ldc, rest);       // P6 = S2 T2
+    subtractBlocks(h, h, a12, lda, x, h, x, h);                            // S4 = A12 - S2
+    multiplyWinograd(plan, workerId, h, x, h, b22, ldb, c11, ldc, rest);   // P3 = S4 B22
+    multiplyWinograd(plan, workerId, h, a11, lda, b11, ldb, x, h, rest);   // P1 = A11 B11
+    addBlocks(h, h, x, h, c12, ldc, c12, ldc);                             // U2 = P1 + P6
+    addBlocks(h, h, c12, ldc, c21, ldc, c21, ldc);                         // U3 = U2 + P7
+    addBlocks(h, h, c12, ldc, c22, ldc, c12, ldc);                         // U4 = U2 + P5
+    addBlocks(h, h, c21, ldc, c22, ldc, c22, ldc);                         // U7 = U3 + P5, C22
+    addBlocks(h, h, c12, ldc, c11, ldc, c12, ldc);                         // U5 = U4 + P3, C12
+    subtractBlocks(h, h, y, h, b21, ldb, y, h);                            // T4 = T2 - B21
+    multiplyWinograd(plan, workerId, h, a22, lda, y, h, c11, ldc, rest);   // P4 = A22 T4
+    subtractBlocks(h, h, c21, ldc, c11, ldc, c21, ldc);                    // U6 = U3 - P4, C21
+    multiplyWinograd(plan, workerId, h, a12, lda, b21, ldb, c11, ldc, rest);  // P2 = A12 B21
+    addBlocks(h, h, x, h, c11, ldc, c11, ldc);                             // U1 = P1 + P2, C11
+
+    if (n % 2 != 0) {
+        addPeeledEdges(n, a, lda, b, ldb, c, ldc);
+    }
+}
+
+
+/**
+ * The coefficient of block of a matrix split levels times into quadrants in product of as many levels of Strassen's form, from
+ * the terms of one level. The base-4 digits of block and the base-7 digits of product are its quadrants and products level by
+ * level, the first level in the lowest digit.
+ * */
+static inline int getStrassenCoefficient(const int terms[7][4], int levels, long product, long block) {
+    int coefficient = 1;
+    for (int level = 0; level < levels; level++) {
+        coefficient *= terms[product % 7][block % 4];
+        product /= 7;
+        block /= 4;
+    }
+    return coefficient;
+}
+
+
+// the offset of block in a matrix with leading dimension ld whose first level quadrants have half rows
+static inline long getStrassenBlockOffset(long ld, long half, int levels, long block) {
+    long offset = 0;
+    for (int level = 0; level < levels; level++) {
+        offset += (block % 4 / 2) * half * ld + (block % 2) * half;
+        block /= 4;
+        half /= 2;
+    }
+    return offset;
+}
+
+
+/**
+ * The products of the levels of the plan on the pool, over the quadrants of A and B of size half.
+ * */
+typedef struct {
+    StrassenPlan *plan;
+    long half;
+    const int *a;
+    long lda;
+    const int *b;
+    long ldb;
+    int *c;
+    long ldc;
+} StrassenJob;
+
+
+/**
+ * The operand of product from matrix, a signed sum of its blocks with the terms of one level, for example A11 + A22 for the
+ * first product of one level:
+ *
+ *   M1 = (A11 + A22)(B11 + B22)   M2 = (A21 + A22) B11   M3 = A11 (B12 - B22)   M4 = A22 (B21 - B11)
+ *   M5 = (A11 + A12) B22          M6 = (A21 - A11)(B11 + B12)                   M7 = (A12 - A22)(B21 + B22)
+ *
+ * A single block is returned in place; a sum is formed in sum and returned with leading dimension productSize. Every operand has
+ * a block of coefficient 1, which the sum starts from.
+ * */
+static inline const int *formStrassenOperand(const StrassenJob *job, const int terms[7][4], long product, const int *matrix,
+        long ld, int *sum, long *operandLd) {
+
+    const StrassenPlan *plan = job->plan;
+    long size = plan->productSize;
+    long blockCount = (plan->levels == 2) ? 16 : 4;
+    long first = -1;
+    int termCount = 0;
+    for (long block = 0; block < blockCount; block++) {
+        int coefficient = getStrassenCoefficient(terms, plan->levels, product, block);
+        termCount += (coefficient != 0);
+        if (coefficient > 0 && first < 0) {
+            first = block;
+        }
+    }
+    const int *x = matrix + getStrassenBlockOffset(ld, job->half, plan->levels, first);
+    *operandLd = ld;
+    if (termCount == 1) {
+        return x;
+    }
+    for (long block = 0; block < blockCount; block++) {
+        int coefficient = getStrassenCoefficient(terms, plan->levels, product, block);
+        if (coefficient == 0 || block == first) {
+            continue;
+        }
+        const int *y = matrix + getStrassenBlockOffset(ld, job->half, plan->levels, block);
+        if (coefficient > 0) {
+            addBlocks(size, size, x, *operandLd, y, ld, sum, size);
+        }
+        else {
+            subtractBlocks(size, size, x, *operandLd, y, ld, sum, size);
+        }
+        x = sum;
+        *operandLd = size;
+    }
+    return sum;
+}
+
+
+/**
+ * Computes the products [firstItem, endItem) of the levels of the plan, each into its place in plan->products. The operands are
+ * formed in the arena of the worker, ahead of the temporaries of the recursion.
+ * */
+static inline void multiplyStrassenProducts(void *context, int workerId, long firstItem, long endItem) {
+
+    StrassenJob *job = (StrassenJob *) context;
+    long size = job->plan->productSize;
+    int *left = job->plan->arenas[workerId];
+    int *right = left + size * size;
+    int *rest = right + size * size;
+
+    for (long product = firstItem; product < endItem; product++) {
+        long ldx, ldy;
+        const int *x = formStrassenOperand(job, STRASSEN_A_TERMS, product, job->a, job->lda, left, &ldx);
+        const int *y = formStrassenOperand(job, STRASSEN_B_TERMS, product, job->b, job->ldb, right, &ldy);
+        multiplyWinograd(job->plan, workerId, size, x, ldx, y, ldy, job->plan->products + product * size * size, size, rest);
+    }
+}
+
+
+/**
+ * Combines the rows [firstItem, endItem) of the products into the blocks of C, for one level
+ * C11 = M1 + M4 - M5 + M7, C12 = M3 + M5, C21 = M2 + M4, C22 = M1 - M2 + M3 + M6.
+ * */
+static inline void combineStrassenProducts(void *context, int workerId, long firstItem, long endItem) {
+
+    StrassenJob *job = (StrassenJob *) context;
+    const StrassenPlan *plan = job->plan;
+    long size = plan->productSize;
+    long blockCount = (plan->levels == 2) ? 16 : 4;
+    for (long block = 0; block < blockCount; block++) {
+        int *c = job->c + getStrassenBlockOffset(job->ldc, job->half, plan->levels, block);
+        for (long i = firstItem; i < endItem; i++) {
+            int *row = c + i * job->ldc;
+            memset(row, 0, size * sizeof(int));
+            for (long product = 0; product < plan->productCount; product++) {
+                int coefficient = getStrassenCoefficient(STRASSEN_C_TERMS, plan->levels, product, block);
+                const int *m = plan->products + product * size * size + i * size;
+                if (coefficient > 0) {
+                    for (long j = 0; j < size; j++) {
+                        row[j] += m[j];
+                    }
+                }
+                else if (coefficient < 0) {
+                    for (long j = 0; j < size; j++) {
+                        row[j] -= m[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * C = A B for the n x n matrices of the plan, row-major with leading dimensions lda, ldb and ldc. C must not overlap A or B.
+ * */
+static inline void multiplyStrassen(StrassenPlan *plan, const int *a, long lda, const int *b, long ldb, int *c, long ldc) {
+
+    long n = plan->n;
+    if (plan->products == NULL) {
+        // one thread, or a product small enough for the blocked engine on all of them
+        if (n <= plan->cutoff) {
+            multiplyMatrices(plan->engine, n, n, n, a, lda, b, ldb, c, ldc);
+        }
+        else {
+            multiplyWinograd(plan, 0, n, a, lda, b, ldb, c, ldc, plan->arenas[0]);
+        }
+        return;
+    }
+
+    StrassenJob job;
+    job.plan = plan;
+    job.half = n / 2;
+    job.a = a;
+    job.lda = lda;
+    job.b = b;
+    job.ldb = ldb;
+    job.c = c;
+    job.ldc = ldc;
+    long size = plan->productSize;
+    if (plan->productsOnPool) {
+        int *left = plan->arenas[0];
+        int *right = left + size * size;
+        for (long product = 0; product < plan->productCount; product++) {
+            long ldx, ldy;
+            const int *x = formStrassenOperand(&job, STRASSEN_A_TERMS, product, a, lda, left, &ldx);
+            const int *y = formStrassenOperand(&job, STRASSEN_B_TERMS, product, b, ldb, right, &ldy);
+            multiplyMatrices(plan->engine, size, size, size, x, ldx, y, ldy, plan->products + product * size * size, size);
+        }
+    }
+    else {
+        runPool(plan->engine->pool, plan->productCount, 1, multiplyStrassenProducts, &job);
+    }
+    runPool(plan->engine->pool, size, 16, combineStrassenProducts, &job);
+    if (n % 2 != 0) {
+        addPeeledEdges(n, a, lda, b, ldb, c, ldc);
+    }
+}
+
+#endif
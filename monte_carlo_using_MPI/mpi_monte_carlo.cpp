@@ -3,11 +3,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-#include <sys/time.h>
 
 #include <sstream>
 #include <iostream>
 
+#include "../parallel_monte_carlo/monte_carlo_integrand.h"
+#include "../parallel_monte_carlo/work_stealing_pool.h"
+
 
 typedef struct {
     int top;
@@ -16,74 +18,394 @@ typedef struct {
     int bottom;
 } Rectangle;
 
+Rectangle sorroundingShape;
+
+// the seed of the random streams, the random number kernel and the region or integrand to estimate
+uint64_t SEED = 1;
+SamplingKernel SAMPLING_KERNEL = AUTO_KERNEL;
+SamplingMethod SAMPLING_METHOD = RANDOM_SAMPLING;
+monte_carlo::IntegrandOptions INTEGRAND_OPTIONS = monte_carlo::getDefaultIntegrandOptions();
+// sampling threads per rank, and whether they are pinned to the processors the rank may run on
+int THREAD_COUNT = 1;
+bool PIN_THREADS = false;
+// static gives every rank an equal share of the chunks; dynamic lets the ranks take chunks from a shared counter as they go
+bool DYNAMIC_SCHEDULE = false;
+// a dynamic rank asks for about this much work at a time, measured by its own sampling rate
+const double DYNAMIC_REQUEST_SECONDS = 0.05;
+// while its threads sample, rank 0 calls into MPI this often so that the requests of the other ranks for chunks progress
+const long COUNTER_PROGRESS_NANOSECONDS = 50000;
+// trials of the benchmark mode, after one warm-up trial; 0 runs the estimate once
+int BENCHMARK_TRIALS = 0;
+// epochs of the progressive mode, each reduced while the next one is sampled; 0 reduces once at the end
+int EPOCH_COUNT = 0;
+// the file the progressive mode keeps its running sums in after every epoch, and resumes from
+const char *CHECKPOINT_PATH = NULL;
+
+/**
+ * What a rank did, in doubles so that rank 0 gathers the ranks in one MPI_Gather.
+ * */
 typedef struct {
-    int x;
-    int y;
-} Point;
+	double chunks;
+	double samples;
+	double requests;
+	double samplingSeconds;
+	double waitingSeconds;
+} RankWork;
 
-Rectangle sorroundingShape;
+#define RANK_WORK_FIELDS 5
 
-int isPointInsideTheCurve(Point point) {
-    double x_square = point.x * point.x;
-    double y_square = point.y * point.y;
-    double position = (x_square / 10000) + (y_square / 2500) - 1;
-    if (position <= 0.0) {
-        return true;
-    } else {
-        return false;
-    }
+/**
+ * The seconds a rank spent in the phases of a trial, timed with MPI_Wtime from the barrier that starts the trial. The reduction
+ * phase includes the wait for the slowest rank, and total runs to the barrier that ends the trial.
+ * */
+typedef struct {
+	double sampling;
+	double reduction;
+	double total;
+} TrialTimes;
+
+#define TRIAL_TIME_FIELDS 3
+
+/**
+ * The running sums of the progressive mode: the moments of the samples and of the chunk means, all in doubles so that they are
+ * reduced in one MPI_Ireduce.
+ * */
+typedef struct {
+	double sum;
+	double sumOfSquares;
+	double count;
+	double replicateSum;
+	double replicateSumOfSquares;
+	double replicateCount;
+} RunningSums;
+
+#define RUNNING_SUM_FIELDS 6
+
+/**
+ * The ranks of a node and the node leaders. The ranks of a node put their sums in a window of memory they share, the first rank
+ * of the node adds them up, and only the first ranks of the nodes take part in the MPI_Reduce, so the reduction across the
+ * network has a message per node instead of one per rank.
+ * */
+typedef struct {
+	MPI_Comm nodeComm;
+	int nodeRank;
+	int nodeSize;
+	// the first ranks of the nodes, ordered by world rank, so world rank 0 is rank 0 here; MPI_COMM_NULL on the other ranks
+	MPI_Comm leaderComm;
+	int nodeCount;
+	MPI_Win window;
+	// nodeSize doubles in the memory of the node's first rank, one per rank of the node
+	double *nodeSums;
+} NodeTopology;
+
+void createNodeTopology(NodeTopology *topology, int rank) {
+
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &topology->nodeComm);
+	MPI_Comm_rank(topology->nodeComm, &topology->nodeRank);
+	MPI_Comm_size(topology->nodeComm, &topology->nodeSize);
+	MPI_Comm_split(MPI_COMM_WORLD, (topology->nodeRank == 0) ? 0 : MPI_UNDEFINED, rank, &topology->leaderComm);
+	int isLeader = (topology->nodeRank == 0) ? 1 : 0;
+	MPI_Allreduce(&isLeader, &topology->nodeCount, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+	double *base;
+	MPI_Aint size = (topology->nodeRank == 0) ? topology->nodeSize * (MPI_Aint) sizeof(double) : 0;
+	MPI_Win_allocate_shared(size, sizeof(double), MPI_INFO_NULL, topology->nodeComm, &base, &topology->window);
+	MPI_Aint leaderSize;
+	int unit;
+	MPI_Win_shared_query(topology->window, 0, &leaderSize, &unit, &topology->nodeSums);
 }
 
-Point generateRandomPointInsideBox(Rectangle box, unsigned int *seed) {
+void freeNodeTopology(NodeTopology *topology) {
+	MPI_Win_free(&topology->window);
+	if (topology->leaderComm != MPI_COMM_NULL) {
+		MPI_Comm_free(&topology->leaderComm);
+	}
+	MPI_Comm_free(&topology->nodeComm);
+}
 
-    int horizontal = (box.right - box.left);
-    int vertical = (box.top - box.bottom);
-                
-    // random point generation; the modulus then adding the left and bottom bound push the arbitrary random point within the
-    // bounding box
-    int x = (rand_r(seed) % horizontal) + box.left;
-    int y = (rand_r(seed) % vertical) + box.bottom;
+/**
+ * The sum of value over all ranks, at world rank 0: added up in shared memory within every node, then reduced across the nodes.
+ * */
+double reduceOverNodes(NodeTopology *topology, double value) {
+
+	MPI_Win_fence(0, topology->window);
+	topology->nodeSums[topology->nodeRank] = value;
+	MPI_Win_fence(0, topology->window);
+
+	double total = 0;
+	if (topology->leaderComm != MPI_COMM_NULL) {
+		double nodeSum = 0;
+		for (int i = 0; i < topology->nodeSize; i++) {
+			nodeSum += topology->nodeSums[i];
+		}
+		MPI_Reduce(&nodeSum, &total, 1, MPI_DOUBLE, MPI_SUM, 0, topology->leaderComm);
+	}
+	return total;
+}
 
-    // generate and return the point
-    Point randomPoint;
-    randomPoint.x = x;
-    randomPoint.y = y;
-    return randomPoint;
+/**
+ * The chunks of a rank as the items of its thread pool; item i is chunk firstChunk + i.
+ * */
+template <typename Integrand>
+struct RankJob {
+	const Integrand *integrand;
+	monte_carlo::SamplingDomain<Integrand::DIMENSIONS> domain;
+	long totalSampleCount;
+	long firstChunk;
+	monte_carlo::Moments *chunkMoments;
+};
+
+template <typename Integrand>
+void sampleRankChunks(void *context, int workerId, long firstItem, long endItem) {
+
+	RankJob<Integrand> *job = (RankJob<Integrand> *) context;
+	for (long item = firstItem; item < endItem; item++) {
+		long chunk = job->firstChunk + item;
+		job->chunkMoments[item] = monte_carlo::sampleChunk(*job->integrand, job->domain, SEED, (uint64_t) chunk,
+				monte_carlo::getChunkSampleCount(chunk, job->totalSampleCount), SAMPLING_KERNEL, SAMPLING_METHOD);
+	}
 }
 
-long countInsideTargetAreaPoints(int rankId, Rectangle boundingBox, long sampleCount) {
-    
-    // using a rankID to create rankIdSeed
-	srand(rand());
-    unsigned int rankIdSeed = rankId + (unsigned int)rand();
+/**
+ * Samples the chunks [firstChunk, endChunk) with the threads of the rank; the moments of chunk c go to
+ * chunkMoments[c - firstChunk]. With progressMpi the main thread polls MPI until the threads are done instead of sleeping in
+ * runPool: an MPI that moves one-sided operations only inside MPI calls of the target otherwise holds the MPI_Fetch_and_op of
+ * every other rank on the counter of rank 0 until rank 0 is done with its chunks.
+ * */
+template <typename Integrand>
+void sampleChunkRange(WorkStealingPool *pool, const Integrand &integrand,
+		const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain, long totalSampleCount, long firstChunk, long endChunk,
+		monte_carlo::Moments *chunkMoments, bool progressMpi, RankWork *work) {
+
+	RankJob<Integrand> job;
+	job.integrand = &integrand;
+	job.domain = domain;
+	job.totalSampleCount = totalSampleCount;
+	job.firstChunk = firstChunk;
+	job.chunkMoments = chunkMoments;
+	double start = MPI_Wtime();
+	startPool(pool, endChunk - firstChunk, 1, sampleRankChunks<Integrand>, &job);
+	if (progressMpi) {
+		struct timespec pause = { 0, COUNTER_PROGRESS_NANOSECONDS };
+		while (!isPoolDone(pool)) {
+			int flag;
+			MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+			nanosleep(&pause, NULL);
+		}
+	}
+	waitPool(pool);
+	work->samplingSeconds += MPI_Wtime() - start;
+	work->chunks += endChunk - firstChunk;
+	for (long chunk = firstChunk; chunk < endChunk; chunk++) {
+		work->samples += monte_carlo::getChunkSampleCount(chunk, totalSampleCount);
+	}
+}
 
-    // also initialize a variable to count the number of points we found to be inside the curve
-    long insidePoints = 0;
+/**
+ * The sum of the integrand over the chunks of samples of this rank. The ranks split the chunks evenly and the threads of the
+ * rank share its chunks, and every chunk is drawn from its own stream, so the samples are the ones modified_program.cpp draws
+ * with the same seed whatever the number of ranks and threads.
+ * */
+template <typename Integrand>
+double sumInsideValues(WorkStealingPool *pool, int rankId, int procCount, const Integrand &integrand,
+		const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain, long totalSampleCount, RankWork *work) {
 
-    // doing iteration count number of sampling experiments
-    for (long i = 0; i < sampleCount; i++) {
-        Point randomPoint = generateRandomPointInsideBox(boundingBox, &rankIdSeed);
-        if (isPointInsideTheCurve(randomPoint)) {
-            insidePoints++;
-        }
-    }
-    //printf("Point inside target found by rank ->  %d is %ld \n", rankId, insidePoints);
+	long chunkCount = monte_carlo::getChunkCount(totalSampleCount);
+	long firstChunk = chunkCount * rankId / procCount;
+	long endChunk = chunkCount * (rankId + 1) / procCount;
+
+	monte_carlo::Moments *chunkMoments = (monte_carlo::Moments *) calloc(endChunk - firstChunk + 1, sizeof(monte_carlo::Moments));
+	sampleChunkRange(pool, integrand, domain, totalSampleCount, firstChunk, endChunk, chunkMoments, false, work);
 
-    return insidePoints;
+	double insideValue = 0;
+	for (long item = 0; item < endChunk - firstChunk; item++) {
+		insideValue += chunkMoments[item].sum;
+	}
+	free(chunkMoments);
+    //printf("Point inside target found by rank ->  %d is %f \n", rankId, insideValue);
+
+    return insideValue;
+}
+
+/**
+ * Samples chunks taken from a counter in the memory of rank 0 until they run out; the sum of chunk c goes to chunkSums[c], which
+ * has a place for every chunk. Every request adds its size to the counter with MPI_Fetch_and_op and gets the chunks from the
+ * old value on, so no rank waits for another and a slow or busy rank just takes fewer chunks. The size follows the rank's own
+ * sampling rate, DYNAMIC_REQUEST_SECONDS of work, and shrinks toward the end so that the last requests are spread over the
+ * ranks. Rank 0 holds the counter and samples too, so it keeps MPI progressing while its threads sample.
+ * */
+template <typename Integrand>
+void sumChunksDynamically(WorkStealingPool *pool, int rankId, int procCount, const Integrand &integrand,
+		const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain, long totalSampleCount, MPI_Win counter,
+		double *chunkSums, RankWork *work) {
+
+	long chunkCount = monte_carlo::getChunkCount(totalSampleCount);
+	long request = THREAD_COUNT;
+	double chunksPerSecond = 0;
+	long momentCount = 0;
+	monte_carlo::Moments *chunkMoments = NULL;
+	MPI_Win_lock_all(0, counter);
+	while (true) {
+		double start = MPI_Wtime();
+		long firstChunk;
+		MPI_Fetch_and_op(&request, &firstChunk, MPI_LONG, 0, 0, MPI_SUM, counter);
+		MPI_Win_flush(0, counter);
+		work->waitingSeconds += MPI_Wtime() - start;
+		work->requests++;
+		if (firstChunk >= chunkCount) {
+			break;
+		}
+
+		long endChunk = (firstChunk + request < chunkCount) ? firstChunk + request : chunkCount;
+		if (endChunk - firstChunk > momentCount) {
+			momentCount = endChunk - firstChunk;
+			chunkMoments = (monte_carlo::Moments *) realloc(chunkMoments, momentCount * sizeof(monte_carlo::Moments));
+		}
+		double samplingStart = work->samplingSeconds;
+		bool hostsCounter = (rankId == 0 && procCount > 1);
+		sampleChunkRange(pool, integrand, domain, totalSampleCount, firstChunk, endChunk, chunkMoments, hostsCounter, work);
+		for (long chunk = firstChunk; chunk < endChunk; chunk++) {
+			chunkSums[chunk] = chunkMoments[chunk - firstChunk].sum;
+		}
+		double seconds = work->samplingSeconds - samplingStart;
+		if (seconds > 0) {
+			double rate = (endChunk - firstChunk) / seconds;
+			chunksPerSecond = (chunksPerSecond > 0) ? (chunksPerSecond + rate) / 2 : rate;
+		}
+
+		request = (long) (chunksPerSecond * DYNAMIC_REQUEST_SECONDS);
+		long fairShare = (chunkCount - endChunk) / (2 * procCount);
+		if (request > fairShare) {
+			request = fairShare;
+		}
+		if (request < THREAD_COUNT) {
+			request = THREAD_COUNT;
+		}
+	}
+	MPI_Win_unlock_all(counter);
+	free(chunkMoments);
 }
 
-double estimateArea(long totalInsidePoints, Rectangle boundingBox, long sampleCount) {
+double estimateArea(double totalInsideValue, double boxVolume, long sampleCount) {
 
     // estimate the area under the curve from the area of the bounding box
-    double boxArea = (boundingBox.right - boundingBox.left) * (boundingBox.top - boundingBox.bottom);
-    double curveArea = (boxArea * totalInsidePoints) / sampleCount;
+    double curveArea = (boxVolume * totalInsideValue) / sampleCount;
 
     // return the area estimate for the curve
     return curveArea;
 }
 
+/**
+ * Writes the running sums after completedEpochs epochs to CHECKPOINT_PATH. The sums go to a temporary file that is renamed over
+ * the checkpoint, so a job killed while writing leaves the previous checkpoint. The first line names the run, so that only the
+ * same run resumes from the file.
+ * */
+void writeCheckpoint(const char *runName, int completedEpochs, const RunningSums &sums) {
+
+	char temporaryPath[4096];
+	snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", CHECKPOINT_PATH);
+	FILE *file = fopen(temporaryPath, "w");
+	if (file == NULL) {
+		printf("Could not write the checkpoint %s.\n", temporaryPath);
+		return;
+	}
+	fprintf(file, "%s\n%d\n%.17g %.17g %.17g %.17g %.17g %.17g\n", runName, completedEpochs, sums.sum, sums.sumOfSquares,
+			sums.count, sums.replicateSum, sums.replicateSumOfSquares, sums.replicateCount);
+	bool written = (fclose(file) == 0);
+	if (!written || rename(temporaryPath, CHECKPOINT_PATH) != 0) {
+		printf("Could not replace the checkpoint %s with %s; it still holds an earlier epoch.\n", CHECKPOINT_PATH,
+				temporaryPath);
+	}
+}
+
+/**
+ * Reads the epochs done and the running sums of the run from CHECKPOINT_PATH. No file is a run that starts from the first
+ * epoch; returns an error message if the file is of another run or cannot be read.
+ * */
+const char *readCheckpoint(const char *runName, int *completedEpochs, RunningSums *sums) {
+
+	*completedEpochs = 0;
+	memset(sums, 0, sizeof(RunningSums));
+	FILE *file = fopen(CHECKPOINT_PATH, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	const char *error = NULL;
+	char line[512];
+	if (fgets(line, sizeof(line), file) == NULL || strncmp(line, runName, strlen(runName)) != 0 ||
+			line[strlen(runName)] != '\n') {
+		error = "The checkpoint is of another run; remove it or give the options of that run.";
+	}
+	else if (fscanf(file, "%d %lg %lg %lg %lg %lg %lg", completedEpochs, &sums->sum, &sums->sumOfSquares, &sums->count,
+			&sums->replicateSum, &sums->replicateSumOfSquares, &sums->replicateCount) != 7 || *completedEpochs < 0 ||
+			*completedEpochs > EPOCH_COUNT) {
+		error = "The checkpoint cannot be read.";
+	}
+	fclose(file);
+	return error;
+}
+
+/**
+ * Names the run in runName from every option the estimate depends on, so that a checkpoint resumes only the run that wrote it.
+ * The vertices of a polygon are named by their count and a hash of their coordinates.
+ * */
+void getRunName(char *runName, size_t size, long totalSampleCount) {
+	uint64_t vertexHash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < INTEGRAND_OPTIONS.vertexX.size(); i++) {
+		float coordinates[2] = { INTEGRAND_OPTIONS.vertexX[i], INTEGRAND_OPTIONS.vertexY[i] };
+		const unsigned char *bytes = (const unsigned char *) coordinates;
+		for (size_t b = 0; b < sizeof(coordinates); b++) {
+			// FNV-1a
+			vertexHash = (vertexHash ^ bytes[b]) * 0x100000001B3ULL;
+		}
+	}
+	snprintf(runName, size, "samples %ld seed %llu sampling %s epochs %d box %d %d %d %d %s %s dimensions %d radius %.9g "
+			"vertices %zu %016llx", totalSampleCount, (unsigned long long) SEED, METHOD_NAMES[SAMPLING_METHOD], EPOCH_COUNT,
+			sorroundingShape.left, sorroundingShape.bottom, sorroundingShape.right, sorroundingShape.top,
+			monte_carlo::getRegionName(INTEGRAND_OPTIONS),
+			(INTEGRAND_OPTIONS.integrand == monte_carlo::AREA_INTEGRAND) ? "area" : "moment", INTEGRAND_OPTIONS.dimensions,
+			INTEGRAND_OPTIONS.radius, INTEGRAND_OPTIONS.vertexX.size(), (unsigned long long) vertexHash);
+}
+
 // function declarations
-void reductionSum(int myRank, int procCount, long sampleCount);
+void parseOptions(int argc, char** argv, int rank);
+
+/**
+ * Calls reductionSum with the integrand chosen on the command line; runWithIntegrand instantiates it for every integrand type.
+ * */
+struct ReductionSum {
+	int rank;
+	int procCount;
+	long totalSampleCount;
+	WorkStealingPool *pool;
+	NodeTopology *topology;
+	// the chunk counter of the dynamic schedule and, on rank 0, its memory
+	MPI_Win counter;
+	long *nextChunk;
+	// what the progressive mode checkpoints: the run, the epochs done and, on rank 0, their running sums
+	char runName[256];
+	int firstEpoch;
+	RunningSums resumedSums;
+
+	void resetChunkCounter();
+	void resume();
+	void reportEpoch(int epoch, const RunningSums &reducedSums, double boxVolume, double seconds);
+
+	template <typename Integrand>
+	double sampleProgressively(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain,
+			RankWork *work);
+
+	template <typename Integrand>
+	double sampleAndReduce(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain,
+			RankWork *work, TrialTimes *times);
+
+	template <typename Integrand>
+	void benchmark(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain);
+
+	template <typename Integrand>
+	void operator()(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain);
+};
 
 int main(int argc, char** argv) {
 
@@ -92,7 +414,24 @@ int main(int argc, char** argv) {
         printf("\tFirst the number of samples for the Monte Carlo sampling experiments.\n");
         printf("\tSecond the bounding area within which the samples should be generated.\n");	
         printf("The format of using the program:\n");
-        printf("\t./program_name sample_count bottom_left_x, bottom_left_y, top_right_x, top_right_y\n");
+        printf("\t./program_name sample_count bottom_left_x, bottom_left_y, top_right_x, top_right_y [options]\n");
+        printf("Options:\n");
+        printf("\t--threads=N                 sampling threads per rank; give every rank that many cores, for example with\n");
+        printf("\t                            mpirun --map-by slot:PE=N (default: 1)\n");
+        printf("\t--pin                       pin every sampling thread to its own processor of the rank\n");
+        printf("\t--schedule=static|dynamic  static gives every rank an equal share of the samples; dynamic lets every rank\n");
+        printf("\t                            take chunks from a shared counter at its own pace (default: static)\n");
+        printf("\t--benchmark=N               time N trials in this job, after a warm-up trial, and print a CSV row per trial\n");
+        printf("\t--progressive=K             sample in K epochs; rank 0 prints the estimate and its error after every epoch\n");
+        printf("\t--checkpoint=FILE           with --progressive, save the sums after every epoch and resume from FILE\n");
+        printf("\t--seed=N                    seed of the random streams; the same seed gives the same estimate (default: 1)\n");
+        printf("\t--kernel=auto|scalar|avx2|avx512  random number kernel (default: auto, the widest supported)\n");
+        printf("\t--sampling=random|sobol|halton|stratified|latin  points of every chunk (default: random)\n");
+        printf("\t--region=ellipse|polygon|superellipse|ball  region to estimate (default: the ellipse x^2/10000 + y^2/2500 <= 1)\n");
+        printf("\t--vertices=X,Y,X,Y,...      vertices of the polygon region\n");
+        printf("\t--dimensions=N              dimensions of the ball region, 2 to 8 (default: 3)\n");
+        printf("\t--radius=R                  radius of the ball region, centered at the origin (default: 1)\n");
+        printf("\t--integrand=area|moment     estimate the area (volume) of the region or the integral of x.x over it\n");
 		exit(1);
     }
 
@@ -102,13 +441,9 @@ int main(int argc, char** argv) {
     sorroundingShape.right = atoi(argv[4]);
     sorroundingShape.top = atoi(argv[5]);
 
-	// starting execution timer clock
-	struct timeval start;
-	gettimeofday(&start, NULL);
-	
-	
-
-	MPI_Init(NULL, NULL);
+	// only the main thread of a rank calls MPI; the sampling threads never do
+	int threadSupport;
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &threadSupport);
 
 	int procCount;
     MPI_Comm_size(MPI_COMM_WORLD, &procCount);
@@ -116,15 +451,53 @@ int main(int argc, char** argv) {
 	int rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-	reductionSum(rank, procCount, totalSampleCount);
+	parseOptions(argc, argv, rank);
+	if (threadSupport < MPI_THREAD_FUNNELED && THREAD_COUNT > 1) {
+		if (rank == 0) {
+			printf("This MPI library does not support threads; run with --threads=1.\n");
+		}
+		MPI_Finalize();
+		exit(1);
+	}
+
+	NodeTopology topology;
+	createNodeTopology(&topology, rank);
+	if (rank == 0) {
+		printf("Ranks -> %d , threads per rank -> %d , nodes -> %d , processors of rank 0 -> %d , %s schedule\n", procCount,
+				THREAD_COUNT, topology.nodeCount, getHardwareThreadCount(), DYNAMIC_SCHEDULE ? "dynamic" : "static");
+	}
+
+	ReductionSum reduction;
+	reduction.rank = rank;
+	reduction.procCount = procCount;
+	reduction.totalSampleCount = totalSampleCount;
+	reduction.pool = createPool(THREAD_COUNT, PIN_THREADS);
+	reduction.topology = &topology;
+	getRunName(reduction.runName, sizeof(reduction.runName), totalSampleCount);
+	reduction.resume();
+
+	// the next chunk of the dynamic schedule, in the memory of rank 0
+	MPI_Win_allocate((rank == 0) ? sizeof(long) : 0, sizeof(long), MPI_INFO_NULL, MPI_COMM_WORLD, &reduction.nextChunk,
+			&reduction.counter);
+
+	// starting execution timer clock once every rank is set up, so that the start of the processes is not timed
+	MPI_Barrier(MPI_COMM_WORLD);
+	double start = MPI_Wtime();
+
+	monte_carlo::runWithIntegrand(INTEGRAND_OPTIONS, sorroundingShape.left, sorroundingShape.bottom, sorroundingShape.right,
+			sorroundingShape.top, reduction);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	double runningTime = MPI_Wtime() - start;
+
+	MPI_Win_free(&reduction.counter);
+	destroyPool(reduction.pool);
+	freeNodeTopology(&topology);
 
 	MPI_Finalize();
 
 	//-------------------------------- calculate running time -------------------------------------------
 	if (rank == 0) {
-    	struct timeval end;
-    	gettimeofday(&end, NULL);
-    	double runningTime = ((end.tv_sec + end.tv_usec / 1000000.0) - (start.tv_sec + start.tv_usec / 1000000.0));
 		printf("Average time taken for one iteration is -> %f seconds\n", runningTime);
 		printf("%f", runningTime);
 		printf("\n\n");
@@ -135,25 +508,366 @@ int main(int argc, char** argv) {
 
 
 /**
- * This function illustrates how the sum of output of all processes can be collected in a single process directly using a
- * reduction primitive.
+ * Reads the options after the bounding box. All ranks read them; a bad option ends all of them, with rank 0 printing the error.
+ * */
+void parseOptions(int argc, char** argv, int rank) {
+
+	const char *error = NULL;
+	for (int i = 6; i < argc && error == NULL; i++) {
+		if (strncmp(argv[i], "--threads=", 10) == 0) {
+			THREAD_COUNT = atoi(argv[i] + 10);
+			if (THREAD_COUNT < 1) {
+				error = "The thread count must be a positive integer.";
+			}
+		}
+		else if (strcmp(argv[i], "--pin") == 0) {
+			PIN_THREADS = true;
+		}
+		else if (strncmp(argv[i], "--schedule=", 11) == 0) {
+			if (strcmp(argv[i] + 11, "dynamic") == 0) {
+				DYNAMIC_SCHEDULE = true;
+			}
+			else if (strcmp(argv[i] + 11, "static") == 0) {
+				DYNAMIC_SCHEDULE = false;
+			}
+			else {
+				error = "Unknown schedule.";
+			}
+		}
+		else if (strncmp(argv[i], "--benchmark=", 12) == 0) {
+			BENCHMARK_TRIALS = atoi(argv[i] + 12);
+			if (BENCHMARK_TRIALS < 1) {
+				error = "The number of benchmark trials must be a positive integer.";
+			}
+		}
+		else if (strncmp(argv[i], "--progressive=", 14) == 0) {
+			EPOCH_COUNT = atoi(argv[i] + 14);
+			if (EPOCH_COUNT < 1) {
+				error = "The number of epochs must be a positive integer.";
+			}
+		}
+		else if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+			CHECKPOINT_PATH = argv[i] + 13;
+		}
+		else if (strncmp(argv[i], "--seed=", 7) == 0) {
+			SEED = strtoull(argv[i] + 7, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+			int kernel = findSamplingKernel(argv[i] + 9);
+			if (kernel < 0) {
+				error = "Unknown random number kernel.";
+			}
+			else {
+				SAMPLING_KERNEL = (SamplingKernel) kernel;
+			}
+		}
+		else if (strncmp(argv[i], "--sampling=", 11) == 0) {
+			int method = findSamplingMethod(argv[i] + 11);
+			if (method < 0) {
+				error = "Unknown sampling method.";
+			}
+			else {
+				SAMPLING_METHOD = (SamplingMethod) method;
+			}
+		}
+		else if (!monte_carlo::parseIntegrandOption(argv[i], &INTEGRAND_OPTIONS, &error)) {
+			error = "Unknown option.";
+		}
+	}
+	if (error == NULL) {
+		error = monte_carlo::checkIntegrandOptions(INTEGRAND_OPTIONS);
+	}
+	if (error == NULL && EPOCH_COUNT > 0 && (DYNAMIC_SCHEDULE || BENCHMARK_TRIALS > 0)) {
+		error = "The progressive mode runs once with the static schedule.";
+	}
+	if (error == NULL && CHECKPOINT_PATH != NULL && EPOCH_COUNT == 0) {
+		error = "A checkpoint needs the progressive mode.";
+	}
+	if (error == NULL) {
+		int kernel = chooseSamplingKernel(SAMPLING_KERNEL);
+		if (kernel < 0) {
+			error = "This processor does not support the chosen random number kernel.";
+		}
+		SAMPLING_KERNEL = (SamplingKernel) kernel;
+	}
+
+	if (error != NULL) {
+		if (rank == 0) {
+			printf("%s\n", error);
+		}
+		MPI_Finalize();
+		exit(1);
+	}
+}
+
+
+/**
+ * Sets the chunk counter of the dynamic schedule back to 0 before a trial; no rank takes chunks before every rank is past the
+ * barrier.
+ * */
+void ReductionSum::resetChunkCounter() {
+
+	if (rank == 0) {
+		MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, counter);
+		*nextChunk = 0;
+		MPI_Win_unlock(0, counter);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/**
+ * Reads the checkpoint, if there is one, on rank 0 and tells the other ranks the epoch to start from; a checkpoint of another
+ * run ends all ranks.
+ * */
+void ReductionSum::resume() {
+
+	firstEpoch = 0;
+	memset(&resumedSums, 0, sizeof(resumedSums));
+	if (CHECKPOINT_PATH == NULL) {
+		return;
+	}
+
+	int failed = 0;
+	if (rank == 0) {
+		const char *error = readCheckpoint(runName, &firstEpoch, &resumedSums);
+		if (error != NULL) {
+			printf("%s\n", error);
+			failed = 1;
+		}
+		else if (firstEpoch == EPOCH_COUNT) {
+			printf("All %d epochs are in the checkpoint %s\n", EPOCH_COUNT, CHECKPOINT_PATH);
+		}
+		else if (firstEpoch > 0) {
+			printf("Resuming from epoch -> %d/%d of %s\n", firstEpoch + 1, EPOCH_COUNT, CHECKPOINT_PATH);
+		}
+	}
+	MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (failed) {
+		MPI_Finalize();
+		exit(1);
+	}
+	MPI_Bcast(&firstEpoch, 1, MPI_INT, 0, MPI_COMM_WORLD);
+}
+
+/**
+ * Prints the estimate after the given epoch with its standard error, on rank 0, and checkpoints the running sums. The error of a
+ * random estimate comes from the variance of its samples, and that of a quasi-Monte Carlo or stratified one from its chunks.
+ * */
+void ReductionSum::reportEpoch(int epoch, const RunningSums &reducedSums, double boxVolume, double seconds) {
+
+	if (rank != 0) {
+		return;
+	}
+	RunningSums sums = reducedSums;
+	sums.sum += resumedSums.sum;
+	sums.sumOfSquares += resumedSums.sumOfSquares;
+	sums.count += resumedSums.count;
+	sums.replicateSum += resumedSums.replicateSum;
+	sums.replicateSumOfSquares += resumedSums.replicateSumOfSquares;
+	sums.replicateCount += resumedSums.replicateCount;
+
+	monte_carlo::Moments moments = { sums.sum, sums.sumOfSquares, (long) sums.count };
+	monte_carlo::Moments replicates = { sums.replicateSum, sums.replicateSumOfSquares, (long) sums.replicateCount };
+	double standardError = boxVolume * ((SAMPLING_METHOD == RANDOM_SAMPLING) ? monte_carlo::getStandardError(moments) :
+			monte_carlo::getStandardError(replicates));
+	printf("Epoch -> %d/%d , samples -> %ld , estimate -> %lf , standard error -> %g , seconds -> %f\n", epoch + 1, EPOCH_COUNT,
+			moments.count, estimateArea(sums.sum, boxVolume, moments.count), standardError, seconds);
+	fflush(stdout);
+
+	if (CHECKPOINT_PATH != NULL) {
+		writeCheckpoint(runName, epoch + 1, sums);
+	}
+}
+
+/**
+ * Samples the chunks in EPOCH_COUNT epochs of consecutive chunks, from the epoch the checkpoint got to, with every rank taking
+ * an equal share of every epoch. The running sums of the rank after an epoch are reduced with MPI_Ireduce while the next epoch
+ * is sampled, and rank 0 reports them when they arrive. Returns the sum of the integrand over all the epochs on rank 0 and 0 on
+ * the other ranks.
+ * */
+template <typename Integrand>
+double ReductionSum::sampleProgressively(const Integrand &integrand,
+		const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain, RankWork *work) {
+
+	double start = MPI_Wtime();
+	long chunkCount = monte_carlo::getChunkCount(totalSampleCount);
+	// the share of a rank in an epoch is at most this many chunks
+	long shareCount = (chunkCount / EPOCH_COUNT + 1) / procCount + 2;
+	monte_carlo::Moments *chunkMoments = (monte_carlo::Moments *) calloc(shareCount, sizeof(monte_carlo::Moments));
+
+	RunningSums rankSums, sentSums, reducedSums;
+	memset(&rankSums, 0, sizeof(rankSums));
+	memset(&reducedSums, 0, sizeof(reducedSums));
+	MPI_Request request = MPI_REQUEST_NULL;
+	for (int epoch = firstEpoch; epoch < EPOCH_COUNT; epoch++) {
+		long epochStart = chunkCount * epoch / EPOCH_COUNT;
+		long epochLength = chunkCount * (epoch + 1) / EPOCH_COUNT - epochStart;
+		long firstChunk = epochStart + epochLength * rank / procCount;
+		long endChunk = epochStart + epochLength * (rank + 1) / procCount;
+		sampleChunkRange(pool, integrand, domain, totalSampleCount, firstChunk, endChunk, chunkMoments, false, work);
+
+		for (long item = 0; item < endChunk - firstChunk; item++) {
+			monte_carlo::Moments *moments = &chunkMoments[item];
+			double mean = monte_carlo::getMean(*moments);
+			rankSums.sum += moments->sum;
+			rankSums.sumOfSquares += moments->sumOfSquares;
+			rankSums.count += moments->count;
+			rankSums.replicateSum += mean;
+			rankSums.replicateSumOfSquares += mean * mean;
+			rankSums.replicateCount++;
+		}
+
+		// the sums of the previous epoch were reduced while this one was sampled
+		if (request != MPI_REQUEST_NULL) {
+			MPI_Wait(&request, MPI_STATUS_IGNORE);
+			reportEpoch(epoch - 1, reducedSums, domain.volume(), MPI_Wtime() - start);
+		}
+		sentSums = rankSums;
+		MPI_Ireduce(&sentSums, &reducedSums, RUNNING_SUM_FIELDS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &request);
+	}
+	if (request != MPI_REQUEST_NULL) {
+		MPI_Wait(&request, MPI_STATUS_IGNORE);
+		reportEpoch(EPOCH_COUNT - 1, reducedSums, domain.volume(), MPI_Wtime() - start);
+	}
+	free(chunkMoments);
+
+	return (rank == 0) ? resumedSums.sum + reducedSums.sum : 0;
+}
+
+/**
+ * This function illustrates how the sum of output of all processes can be collected in a single process: the ranks of a node
+ * add up their sums in shared memory, and a reduction primitive collects the sums of the nodes. The sum is returned on rank 0;
+ * the other ranks return 0.
  * */
-void reductionSum(int myRank, int procCount, long totalSampleCount) {
+template <typename Integrand>
+double ReductionSum::sampleAndReduce(const Integrand &integrand,
+		const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain, RankWork *work, TrialTimes *times) {
+
+	resetChunkCounter();
+	double start = MPI_Wtime();
+	double reducedSumOfInsideValues = 0;
+	if (EPOCH_COUNT > 0) {
+		reducedSumOfInsideValues = sampleProgressively(integrand, domain, work);
+		times->sampling = MPI_Wtime() - start;
+	}
+	else if (DYNAMIC_SCHEDULE) {
+		// any rank may run any chunk, so the sums of all chunks are reduced and added in chunk order; a chunk is sampled by one
+		// rank and is 0 on the others, so the reduction adds nothing but zeros to it and the estimate does not depend on the
+		// schedule
+		long chunkCount = monte_carlo::getChunkCount(totalSampleCount);
+		double *chunkSums = (double *) calloc(chunkCount + 1, sizeof(double));
+		double *reducedChunkSums = (double *) calloc(chunkCount + 1, sizeof(double));
+		sumChunksDynamically(pool, rank, procCount, integrand, domain, totalSampleCount, counter, chunkSums, work);
+		times->sampling = MPI_Wtime() - start;
+		MPI_Reduce(chunkSums, reducedChunkSums, (int) chunkCount, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+		for (long chunk = 0; chunk < chunkCount; chunk++) {
+			reducedSumOfInsideValues += reducedChunkSums[chunk];
+		}
+		free(chunkSums);
+		free(reducedChunkSums);
+	}
+	else {
+		double insideValue = sumInsideValues(pool, rank, procCount, integrand, domain, totalSampleCount, work);
+		times->sampling = MPI_Wtime() - start;
+		reducedSumOfInsideValues = reduceOverNodes(topology, insideValue);
+	}
+	times->reduction = MPI_Wtime() - start - times->sampling;
+	MPI_Barrier(MPI_COMM_WORLD);
+	times->total = MPI_Wtime() - start;
 
-	long sampleCount = totalSampleCount/procCount;
+	return reducedSumOfInsideValues;
+}
 
-    long insidePoints = countInsideTargetAreaPoints(myRank, sorroundingShape, sampleCount);
+/**
+ * Runs a warm-up trial and then BENCHMARK_TRIALS timed ones in this job. For every trial, rank 0 prints a CSV row with the
+ * smallest, largest and mean seconds of the ranks in the sampling and reduction phases, and the seconds of the trial, which is
+ * the largest total of the ranks.
+ * */
+template <typename Integrand>
+void ReductionSum::benchmark(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain) {
 
-	long reducedSumOfInsidePoints = 0;
-	int root = 0;
-	int count = 1;
+	if (rank == 0) {
+		printf("benchmark,trial,ranks,threads,samples,schedule,sampling_min,sampling_max,sampling_mean,"
+				"reduction_min,reduction_max,reduction_mean,seconds\n");
+	}
 
-	MPI_Reduce(&insidePoints, &reducedSumOfInsidePoints, count, MPI_LONG, MPI_SUM, root, MPI_COMM_WORLD);
+	double reducedSumOfInsideValues = 0;
+	double smallestSeconds = INFINITY;
+	double largestSeconds = 0;
+	double totalSeconds = 0;
+	for (int trial = 0; trial <= BENCHMARK_TRIALS; trial++) {
+		RankWork work;
+		memset(&work, 0, sizeof(work));
+		TrialTimes times;
+		reducedSumOfInsideValues = sampleAndReduce(integrand, domain, &work, &times);
+
+		TrialTimes smallest, largest, sum;
+		MPI_Reduce(&times, &smallest, TRIAL_TIME_FIELDS, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+		MPI_Reduce(&times, &largest, TRIAL_TIME_FIELDS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+		MPI_Reduce(&times, &sum, TRIAL_TIME_FIELDS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+		// trial 0 is the warm-up: it pays for the first touch of the pages and the start of the threads
+		if (rank == 0 && trial > 0) {
+			printf("benchmark,%d,%d,%d,%ld,%s,%f,%f,%f,%f,%f,%f,%f\n", trial, procCount, THREAD_COUNT, totalSampleCount,
+					DYNAMIC_SCHEDULE ? "dynamic" : "static", smallest.sampling, largest.sampling, sum.sampling / procCount,
+					smallest.reduction, largest.reduction, sum.reduction / procCount, largest.total);
+			smallestSeconds = (largest.total < smallestSeconds) ? largest.total : smallestSeconds;
+			largestSeconds = (largest.total > largestSeconds) ? largest.total : largestSeconds;
+			totalSeconds += largest.total;
+		}
+	}
 
-	if(myRank == 0){
-		printf("Proc rank  -> %d  reducedSumOfInsidePoints -> %ld\n", myRank, reducedSumOfInsidePoints);
-		double curveArea = estimateArea(reducedSumOfInsidePoints, sorroundingShape, totalSampleCount);
-		printf("The estimated area is -> %lf unitSquare \n", curveArea);
+	if (rank == 0) {
+		printf("Benchmark -> %d trials , seconds min -> %f , mean -> %f , max -> %f , estimate -> %lf\n", BENCHMARK_TRIALS,
+				smallestSeconds, totalSeconds / BENCHMARK_TRIALS, largestSeconds,
+				estimateArea(reducedSumOfInsideValues, domain.volume(), totalSampleCount));
 	}
 }
 
+/**
+ * Estimates once and prints the estimate with what every rank did, or runs the benchmark.
+ * */
+template <typename Integrand>
+void ReductionSum::operator()(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain) {
+
+	if (BENCHMARK_TRIALS > 0) {
+		benchmark(integrand, domain);
+		return;
+	}
+
+	RankWork work;
+	memset(&work, 0, sizeof(work));
+	TrialTimes times;
+	double reducedSumOfInsideValues = sampleAndReduce(integrand, domain, &work, &times);
+
+	RankWork *allWork = (RankWork *) malloc(procCount * sizeof(RankWork));
+	MPI_Gather(&work, RANK_WORK_FIELDS, MPI_DOUBLE, allWork, RANK_WORK_FIELDS, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+	if(rank == 0){
+		double curveArea = estimateArea(reducedSumOfInsideValues, domain.volume(), totalSampleCount);
+		if (INTEGRAND_OPTIONS.integrand == monte_carlo::AREA_INTEGRAND) {
+			printf("Proc rank  -> %d  reducedSumOfInsidePoints -> %ld\n", rank, (long) reducedSumOfInsideValues);
+			printf("The estimated area is -> %lf unitSquare \n", curveArea);
+		}
+		else {
+			printf("Proc rank  -> %d  reducedSumOfInsideValues -> %f\n", rank, reducedSumOfInsideValues);
+			printf("The estimated integral is -> %lf \n", curveArea);
+		}
+
+		double totalSeconds = 0;
+		double largestSeconds = 0;
+		for (int i = 0; i < procCount; i++) {
+			RankWork *rankWork = &allWork[i];
+			printf("Rank -> %d , chunks -> %.0f , samples -> %.0f , requests -> %.0f , sampling -> %.4f s , waiting -> %.4f s , "
+					"rate -> %.1f million samples per second\n", i, rankWork->chunks, rankWork->samples, rankWork->requests,
+					rankWork->samplingSeconds, rankWork->waitingSeconds,
+					(rankWork->samplingSeconds > 0) ? rankWork->samples / rankWork->samplingSeconds / 1e6 : 0);
+			totalSeconds += rankWork->samplingSeconds;
+			if (rankWork->samplingSeconds > largestSeconds) {
+				largestSeconds = rankWork->samplingSeconds;
+			}
+		}
+		printf("Load imbalance -> %.3f , the longest sampling rank over the mean\n",
+				(totalSeconds > 0) ? largestSeconds * procCount / totalSeconds : 1.0);
+	}
+	free(allWork);
+}
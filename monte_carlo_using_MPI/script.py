@@ -1,22 +1,70 @@
+import os
 import subprocess
 import sys
 
+# Runs the strong and the weak scaling sweeps over the number of ranks on this host. Every run is one MPI job that times its
+# trials itself (--benchmark), so the start of mpirun and of the processes is not part of the times.
+#
+#   python script.py sample_count iteration_number [max_ranks] [program options...]
+#
+# Strong scaling keeps sample_count for every rank count; weak scaling gives every rank sample_count samples. The rows go to
+# scaling.csv with the speedup and the parallel efficiency against one rank.
+
+
+def get_rank_counts(max_ranks):
+    rank_counts = []
+    ranks = 1
+    while ranks < max_ranks:
+        rank_counts.append(ranks)
+        ranks *= 2
+    rank_counts.append(max_ranks)
+    return rank_counts
+
+
+def run_benchmark(ranks, sample_count, number_of_iteration, options):
+    p = subprocess.run(f"mpirun -np {ranks} --host localhost:{ranks} ./a.out {sample_count} 0 0 100 100 "
+                       f"--benchmark={number_of_iteration} {options}", stdout=subprocess.PIPE, shell=True, text=True)
+    if p.returncode != 0:
+        sys.exit(f'mpirun -np {ranks} failed:\n{p.stdout}')
+
+    # benchmark,trial,ranks,threads,samples,schedule,sampling_min,sampling_max,sampling_mean,reduction_min,reduction_max,
+    # reduction_mean,seconds
+    rows = [line.split(',') for line in p.stdout.splitlines() if line.startswith('benchmark,') and line[10].isdigit()]
+    seconds = [float(row[12]) for row in rows]
+    return {
+        'seconds_min': min(seconds),
+        'seconds_mean': sum(seconds) / len(seconds),
+        'seconds_max': max(seconds),
+        'sampling_mean': sum(float(row[8]) for row in rows) / len(rows),
+        'reduction_mean': sum(float(row[11]) for row in rows) / len(rows),
+    }
+
+
 if __name__ == '__main__':
-    total_runtime = 0
     sampleCount = int(sys.argv[1])
     number_of_iteration = int(sys.argv[2])
-    with open('result.txt', 'a') as f:      
-        f.write(f'Sample count {sampleCount} iteration count -> {number_of_iteration}\n\n')
+    max_ranks = int(sys.argv[3]) if len(sys.argv) > 3 else os.cpu_count()
+    options = ' '.join(sys.argv[4:])
 
-    for i in range(0, number_of_iteration):
-        p = subprocess.run(f"mpirun -np 8 --host localhost:8 ./a.out {sampleCount} 0 0 100 100 >> result.txt", stdout=subprocess.PIPE, shell=True, text=True)
-        with open('result.txt', 'r') as f:
-            this_runtime = float(f.readlines()[-2])
-            total_runtime += this_runtime
+    with open('scaling.csv', 'w') as f:
+        f.write('scaling,ranks,samples,seconds_min,seconds_mean,seconds_max,sampling_mean,reduction_mean,speedup,efficiency\n')
+        for scaling in ['strong', 'weak']:
+            one_rank_seconds = None
+            for ranks in get_rank_counts(max_ranks):
+                samples = sampleCount if scaling == 'strong' else sampleCount * ranks
+                times = run_benchmark(ranks, samples, number_of_iteration, options)
+                if one_rank_seconds is None:
+                    one_rank_seconds = times['seconds_mean']
 
-    with open('result.txt', 'a') as f:      
-        f.write(f'Average runtime for the MPI program for {number_of_iteration} iteration is -> {total_runtime/number_of_iteration}')   
-   
-    print(f'Average runtime for the MPI program for {number_of_iteration} iteration is -> {total_runtime/number_of_iteration}')
+                # strong scaling should divide the time by the ranks, weak scaling should keep it
+                if scaling == 'strong':
+                    speedup = one_rank_seconds / times['seconds_mean']
+                else:
+                    speedup = ranks * one_rank_seconds / times['seconds_mean']
+                efficiency = speedup / ranks
 
-    
\ No newline at end of file
+                f.write(f"{scaling},{ranks},{samples},{times['seconds_min']:.6f},{times['seconds_mean']:.6f},"
+                        f"{times['seconds_max']:.6f},{times['sampling_mean']:.6f},{times['reduction_mean']:.6f},"
+                        f"{speedup:.4f},{efficiency:.4f}\n")
+                print(f"{scaling} scaling , ranks -> {ranks} , samples -> {samples} , mean seconds -> {times['seconds_mean']:.6f} , "
+                      f"speedup -> {speedup:.2f} , efficiency -> {efficiency:.2f}")
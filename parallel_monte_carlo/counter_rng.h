@@ -0,0 +1,286 @@
+/**
+ * Philox4x32-10, the counter-based random number generator of Salmon, Moraes, Dror and Shaw ("Parallel random numbers: as easy
+ * as 1, 2, 3", SC 2011). Its output is a pure function of a 128-bit counter and a 64-bit key: there is no state to share or to
+ * seed, any thread can produce any part of any stream, and a stream is reproduced exactly from its key and counter. Giving every
+ * stream its own counter words makes the streams independent, unlike seeding rand_r with neighbouring seeds.
+ *
+ * philox4x32 computes one block of four 32-bit outputs. philox4x32x8 and philox4x32x16 compute the blocks of 8 or 16
+ * counters at once with AVX2 or AVX-512; they are compiled for their instruction set with a target attribute, so the program
+ * can pick one at run time with __builtin_cpu_supports. fillRandomGroups fills a buffer of stream words with the kernel picked
+ * by chooseSamplingKernel; every kernel gives the same words.
+ * */
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COUNTER_RNG_X86 1
+#endif
+
+// the round multipliers and the key increments (Weyl sequence) of Philox4x32
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+
+static inline void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4]) {
+
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        uint64_t product0 = (uint64_t) PHILOX_M0 * c0;
+        uint64_t product1 = (uint64_t) PHILOX_M1 * c2;
+        uint32_t next0 = (uint32_t) (product1 >> 32) ^ c1 ^ k0;
+        uint32_t next2 = (uint32_t) (product0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t) product1;
+        c3 = (uint32_t) product0;
+        c0 = next0;
+        c2 = next2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+
+/**
+ * The top 24 bits of a random word as a float in [0, 1); every value is exact, so the result is the same on every kernel.
+ * */
+static inline float toUnitFloat(uint32_t bits) {
+    return (float) (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+
+#ifdef COUNTER_RNG_X86
+
+/**
+ * The high and low halves of the 32 x 32 bit products of every lane of a with multiplier.
+ * */
+__attribute__((target("avx2")))
+static inline void multiplyHighLow8(__m256i a, __m256i multiplier, __m256i *high, __m256i *low) {
+    // _mm256_mul_epu32 multiplies the even lanes into 64-bit products; the odd lanes are shifted down into even position first
+    __m256i evenProducts = _mm256_mul_epu32(a, multiplier);
+    __m256i oddProducts = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), multiplier);
+    *low = _mm256_blend_epi32(evenProducts, _mm256_slli_epi64(oddProducts, 32), 0xAA);
+    *high = _mm256_blend_epi32(_mm256_srli_epi64(evenProducts, 32), oddProducts, 0xAA);
+}
+
+
+/**
+ * Philox4x32-10 on eight counters at once: lane i of counter[j] is word j of the i-th counter, and lane i of output[j] is word j
+ * of its block.
+ * */
+__attribute__((target("avx2")))
+static inline void philox4x32x8(const __m256i counter[4], const uint32_t key[2], __m256i output[4]) {
+
+    __m256i c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    const __m256i m0 = _mm256_set1_epi32((int) PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi32((int) PHILOX_M1);
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        __m256i high0, low0, high1, low1;
+        multiplyHighLow8(c0, m0, &high0, &low0);
+        multiplyHighLow8(c2, m1, &high1, &low1);
+        c0 = _mm256_xor_si256(_mm256_xor_si256(high1, c1), _mm256_set1_epi32((int) k0));
+        c2 = _mm256_xor_si256(_mm256_xor_si256(high0, c3), _mm256_set1_epi32((int) k1));
+        c1 = low1;
+        c3 = low0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+
+__attribute__((target("avx512f")))
+static inline void multiplyHighLow16(__m512i a, __m512i multiplier, __m512i *high, __m512i *low) {
+    __m512i evenProducts = _mm512_mul_epu32(a, multiplier);
+    __m512i oddProducts = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), multiplier);
+    *low = _mm512_mask_blend_epi32(0xAAAA, evenProducts, _mm512_slli_epi64(oddProducts, 32));
+    *high = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(evenProducts, 32), oddProducts);
+}
+
+
+/**
+ * Philox4x32-10 on sixteen counters at once, laid out like philox4x32x8.
+ * */
+__attribute__((target("avx512f")))
+static inline void philox4x32x16(const __m512i counter[4], const uint32_t key[2], __m512i output[4]) {
+
+    __m512i c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    const __m512i m0 = _mm512_set1_epi32((int) PHILOX_M0);
+    const __m512i m1 = _mm512_set1_epi32((int) PHILOX_M1);
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        __m512i high0, low0, high1, low1;
+        multiplyHighLow16(c0, m0, &high0, &low0);
+        multiplyHighLow16(c2, m1, &high1, &low1);
+        // one ternary logic instruction computes the three-way xor
+        c0 = _mm512_ternarylogic_epi32(high1, c1, _mm512_set1_epi32((int) k0), 0x96);
+        c2 = _mm512_ternarylogic_epi32(high0, c3, _mm512_set1_epi32((int) k1), 0x96);
+        c1 = low1;
+        c3 = low0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+#endif
+
+
+/***************************************************************************************************************************************
+ *                        Streams of random words
+ *
+ * Block b of stream s is the Philox output of the counter (b, 0, s low, s high). The words of a stream come in groups of 16
+ * consecutive blocks stored word-major, word j of block i of the group at words[j * 16 + i], which is the layout the 16-lane
+ * kernel produces without any shuffling.
+ * *************************************************************************************************************************************/
+
+#define PHILOX_GROUP_BLOCKS 16
+#define PHILOX_GROUP_WORDS 64
+
+typedef enum {
+    AUTO_KERNEL,
+    SCALAR_KERNEL,
+    AVX2_KERNEL,
+    AVX512_KERNEL
+} SamplingKernel;
+
+static const char *KERNEL_NAMES[] = { "auto", "scalar", "avx2", "avx512" };
+
+
+static inline void fillRandomGroupsScalar(const uint32_t key[2], uint64_t stream, uint32_t firstGroup, int groupCount,
+        uint32_t *words) {
+    for (int group = 0; group < groupCount; group++) {
+        for (int i = 0; i < PHILOX_GROUP_BLOCKS; i++) {
+            uint32_t counter[4] = { (firstGroup + group) * PHILOX_GROUP_BLOCKS + i, 0, (uint32_t) stream, (uint32_t) (stream >> 32) };
+            uint32_t block[4];
+            philox4x32(counter, key, block);
+            for (int j = 0; j < 4; j++) {
+                words[group * PHILOX_GROUP_WORDS + j * PHILOX_GROUP_BLOCKS + i] = block[j];
+            }
+        }
+    }
+}
+
+
+#ifdef COUNTER_RNG_X86
+
+__attribute__((target("avx2")))
+static void fillRandomGroupsAvx2(const uint32_t key[2], uint64_t stream, uint32_t firstGroup, int groupCount, uint32_t *words) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i counter[4];
+    counter[1] = _mm256_setzero_si256();
+    counter[2] = _mm256_set1_epi32((int) (uint32_t) stream);
+    counter[3] = _mm256_set1_epi32((int) (uint32_t) (stream >> 32));
+    for (int group = 0; group < groupCount; group++) {
+        // the two halves of the group, 8 blocks each
+        for (int half = 0; half < 2; half++) {
+            uint32_t firstBlock = (firstGroup + group) * PHILOX_GROUP_BLOCKS + half * 8;
+            counter[0] = _mm256_add_epi32(_mm256_set1_epi32((int) firstBlock), lanes);
+            __m256i block[4];
+            philox4x32x8(counter, key, block);
+            for (int j = 0; j < 4; j++) {
+                _mm256_storeu_si256((__m256i *) (words + group * PHILOX_GROUP_WORDS + j * PHILOX_GROUP_BLOCKS + half * 8), block[j]);
+            }
+        }
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static void fillRandomGroupsAvx512(const uint32_t key[2], uint64_t stream, uint32_t firstGroup, int groupCount,
+        uint32_t *words) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m512i counter[4];
+    counter[1] = _mm512_setzero_si512();
+    counter[2] = _mm512_set1_epi32((int) (uint32_t) stream);
+    counter[3] = _mm512_set1_epi32((int) (uint32_t) (stream >> 32));
+    for (int group = 0; group < groupCount; group++) {
+        counter[0] = _mm512_add_epi32(_mm512_set1_epi32((int) ((firstGroup + group) * PHILOX_GROUP_BLOCKS)), lanes);
+        __m512i block[4];
+        philox4x32x16(counter, key, block);
+        for (int j = 0; j < 4; j++) {
+            _mm512_storeu_si512((void *) (words + group * PHILOX_GROUP_WORDS + j * PHILOX_GROUP_BLOCKS), block[j]);
+        }
+    }
+}
+
+#endif
+
+
+/**
+ * Fills words with the groups [firstGroup, firstGroup + groupCount) of the stream, groupCount * PHILOX_GROUP_WORDS words.
+ * */
+static inline void fillRandomGroups(SamplingKernel kernel, const uint32_t key[2], uint64_t stream, uint32_t firstGroup,
+        int groupCount, uint32_t *words) {
+    switch (kernel) {
+#ifdef COUNTER_RNG_X86
+        case AVX512_KERNEL:
+            fillRandomGroupsAvx512(key, stream, firstGroup, groupCount, words);
+            return;
+        case AVX2_KERNEL:
+            fillRandomGroupsAvx2(key, stream, firstGroup, groupCount, words);
+            return;
+#endif
+        default:
+            fillRandomGroupsScalar(key, stream, firstGroup, groupCount, words);
+    }
+}
+
+
+/**
+ * The kernel for a --kernel value, or -1 for an unknown name.
+ * */
+static inline int findSamplingKernel(const char *name) {
+    for (int kernel = AUTO_KERNEL; kernel <= AVX512_KERNEL; kernel++) {
+        if (strcmp(name, KERNEL_NAMES[kernel]) == 0) {
+            return kernel;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * Resolves the auto kernel to the widest one the processor supports; returns -1 when a requested kernel is not supported.
+ * */
+static inline int chooseSamplingKernel(SamplingKernel requested) {
+#ifdef COUNTER_RNG_X86
+    bool hasAvx512 = __builtin_cpu_supports("avx512f");
+    bool hasAvx2 = __builtin_cpu_supports("avx2");
+#else
+    bool hasAvx512 = false;
+    bool hasAvx2 = false;
+#endif
+    if (requested == AUTO_KERNEL) {
+        return hasAvx512 ? AVX512_KERNEL : (hasAvx2 ? AVX2_KERNEL : SCALAR_KERNEL);
+    }
+    if ((requested == AVX512_KERNEL && !hasAvx512) || (requested == AVX2_KERNEL && !hasAvx2)) {
+        return -1;
+    }
+    return requested;
+}
+
+#endif
@@ -0,0 +1,380 @@
+/**
+ * Randomized quasi-Monte Carlo and stratified point sets, which fill the sample buffer of a chunk in place of the random words.
+ *
+ * Plain random sampling has an error of order 1/sqrt(N). The point sets here cover the sampling box more evenly:
+ *
+ *      sobol           the Sobol sequence with the Joe-Kuo direction numbers, scrambled by a random linear matrix and a digital
+ *                      shift (Matousek), error close to 1/N for smooth integrands
+ *      halton          the Halton sequence in the first prime bases, every digit passed through a random permutation of its
+ *                      base (Kocis and Whiten)
+ *      stratified      the box cut into k^D equal cells, one uniform sample in each cell
+ *      latin           Latin hypercube sampling, every axis cut into N slices and every slice hit by exactly one sample
+ *
+ * Every chunk is a complete point set of its own with its own randomization, drawn from the Philox stream of the chunk, so the
+ * chunks are independent and identically distributed estimates: the threads and ranks own disjoint chunks exactly as they do
+ * for random sampling, and the spread of the chunk means gives an honest standard error, which the variance of the samples
+ * within a chunk would not. A coordinate is a 32-bit fixed point fraction, like the random words, so the sampling loop
+ * converts both the same way.
+ * */
+#ifndef LOW_DISCREPANCY_H
+#define LOW_DISCREPANCY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "counter_rng.h"
+
+// the Sobol and Halton tables cover this many dimensions; stratified and Latin hypercube sampling take any number
+#define SEQUENCE_MAX_DIMENSIONS 8
+#define SOBOL_BITS 32
+// digits of a 32-bit fraction in base 2, the longest of the Halton bases
+#define HALTON_MAX_DIGITS 32
+#define HALTON_MAX_BASE 19
+
+typedef enum {
+    RANDOM_SAMPLING,
+    SOBOL_SAMPLING,
+    HALTON_SAMPLING,
+    STRATIFIED_SAMPLING,
+    LATIN_HYPERCUBE_SAMPLING
+} SamplingMethod;
+
+static const char *METHOD_NAMES[] = { "random", "sobol", "halton", "stratified", "latin" };
+
+// the degree s, the coefficients a and the initial direction numbers m of the primitive polynomials of dimensions 2 to 8, from
+// the new-joe-kuo-6.21201 table of Joe and Kuo; dimension 1 is the van der Corput sequence
+static const int SOBOL_DEGREES[SEQUENCE_MAX_DIMENSIONS] = { 0, 1, 2, 3, 3, 4, 4, 5 };
+static const uint32_t SOBOL_COEFFICIENTS[SEQUENCE_MAX_DIMENSIONS] = { 0, 0, 1, 1, 2, 1, 4, 2 };
+static const uint32_t SOBOL_INITIAL[SEQUENCE_MAX_DIMENSIONS][5] = {
+    { 0 }, { 1 }, { 1, 3 }, { 1, 3, 1 }, { 1, 1, 1 }, { 1, 1, 3, 3 }, { 1, 3, 5, 13 }, { 1, 1, 5, 5, 17 }
+};
+
+static const int HALTON_BASES[SEQUENCE_MAX_DIMENSIONS] = { 2, 3, 5, 7, 11, 13, 17, 19 };
+
+/**
+ * The randomization of one chunk's point set.
+ * */
+typedef struct {
+    SamplingMethod method;
+    int dimensions;
+    long sampleCount;
+
+    // sobol: the scrambled direction numbers and the digital shift of every dimension
+    uint32_t directions[SEQUENCE_MAX_DIMENSIONS][SOBOL_BITS];
+    uint32_t shifts[SEQUENCE_MAX_DIMENSIONS];
+
+    // halton: the contribution to the fraction of digit d at position i, the permuted digit times base^-(i + 1) in fixed point
+    int digitCounts[SEQUENCE_MAX_DIMENSIONS];
+    uint32_t contributions[SEQUENCE_MAX_DIMENSIONS][HALTON_MAX_DIGITS][HALTON_MAX_BASE];
+
+    // stratified: cellsPerAxis^dimensions cells, the samples past them are left uniform
+    long cellsPerAxis;
+    long cellCount;
+
+    // latin: the key of the permutation of the slices of every axis
+    uint32_t permutationKeys[SEQUENCE_MAX_DIMENSIONS];
+} ChunkSequence;
+
+
+/**
+ * The method for a --sampling value, or -1 for an unknown name.
+ * */
+static inline int findSamplingMethod(const char *name) {
+    for (int method = RANDOM_SAMPLING; method <= LATIN_HYPERCUBE_SAMPLING; method++) {
+        if (strcmp(name, METHOD_NAMES[method]) == 0) {
+            return method;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * Word index of the words that randomize the point set of a chunk. The sample words of a chunk come from the counters
+ * (b, 0, chunk) and these from (b, 1, chunk), so the two never overlap.
+ * */
+static inline uint32_t getScrambleWord(const uint32_t key[2], uint64_t chunk, uint32_t index) {
+    uint32_t counter[4] = { index / 4, 1, (uint32_t) chunk, (uint32_t) (chunk >> 32) };
+    uint32_t block[4];
+    philox4x32(counter, key, block);
+    return block[index % 4];
+}
+
+
+static inline int countOnes(uint32_t bits) {
+    return __builtin_popcount(bits);
+}
+
+
+/**
+ * A bijection of [0, length) chosen by key, evaluated at index without storing it: a hash that is a bijection on the next
+ * power of two, walked until it lands inside the range, then rotated by offset, which is key % length (Kensler, "Correlated
+ * multi-jittered sampling", 2013). The caller computes the offset once instead of dividing for every index.
+ * */
+static inline uint32_t permuteIndex(uint32_t index, uint32_t length, uint32_t key, uint32_t offset) {
+    uint32_t mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    do {
+        index ^= key;
+        index *= 0xe170893d;
+        index ^= key >> 16;
+        index ^= (index & mask) >> 4;
+        index ^= key >> 8;
+        index *= 0x0929eb3f;
+        index ^= key >> 23;
+        index ^= (index & mask) >> 1;
+        index *= 1 | key >> 27;
+        index *= 0x6935fa69;
+        index ^= (index & mask) >> 11;
+        index *= 0x74dcb303;
+        index ^= (index & mask) >> 2;
+        index *= 0x9e501cc3;
+        index ^= (index & mask) >> 2;
+        index *= 0xc860a3df;
+        index &= mask;
+        index ^= index >> 5;
+    } while (index >= length);
+    index += offset;
+    return (index >= length) ? index - length : index;
+}
+
+
+/**
+ * The fixed point fraction (slice + fraction / 2^32) / sliceCount, the point at the given fraction of a slice of an axis.
+ * */
+static inline uint32_t placeInSlice(long slice, uint32_t fraction, double inverseSliceCount) {
+    double scaled = ((double) slice * 4294967296.0 + fraction) * inverseSliceCount;
+    return (scaled >= 4294967295.0) ? 0xFFFFFFFFu : (uint32_t) scaled;
+}
+
+
+static void initSobol(ChunkSequence *sequence, const uint32_t key[2], uint64_t chunk) {
+
+    uint32_t word = 0;
+    for (int k = 0; k < sequence->dimensions; k++) {
+        uint32_t directions[SOBOL_BITS];
+        int degree = SOBOL_DEGREES[k];
+        for (int i = 0; i < SOBOL_BITS; i++) {
+            if (k == 0) {
+                directions[i] = 1u << (SOBOL_BITS - 1 - i);
+            } else if (i < degree) {
+                directions[i] = SOBOL_INITIAL[k][i] << (SOBOL_BITS - 1 - i);
+            } else {
+                directions[i] = directions[i - degree] ^ (directions[i - degree] >> degree);
+                for (int j = 1; j < degree; j++) {
+                    if ((SOBOL_COEFFICIENTS[k] >> (degree - 1 - j)) & 1) {
+                        directions[i] ^= directions[i - j];
+                    }
+                }
+            }
+        }
+
+        // a random lower triangular matrix with a unit diagonal: digit r of a scrambled number is digit r of the number plus
+        // a random combination of its more significant digits, which keeps the point set a net
+        uint32_t rows[SOBOL_BITS];
+        for (int r = 0; r < SOBOL_BITS; r++) {
+            uint32_t digit = 1u << (SOBOL_BITS - 1 - r);
+            uint32_t moreSignificant = ~(digit | (digit - 1));
+            rows[r] = digit | (getScrambleWord(key, chunk, word++) & moreSignificant);
+        }
+        for (int i = 0; i < SOBOL_BITS; i++) {
+            uint32_t scrambled = 0;
+            for (int r = 0; r < SOBOL_BITS; r++) {
+                scrambled |= (uint32_t) (countOnes(rows[r] & directions[i]) & 1) << (SOBOL_BITS - 1 - r);
+            }
+            sequence->directions[k][i] = scrambled;
+        }
+        sequence->shifts[k] = getScrambleWord(key, chunk, word++);
+    }
+}
+
+
+static void initHalton(ChunkSequence *sequence, const uint32_t key[2], uint64_t chunk) {
+
+    uint32_t word = 0;
+    for (int k = 0; k < sequence->dimensions; k++) {
+        int base = HALTON_BASES[k];
+        // a random permutation of the digits, by Fisher-Yates
+        int permutation[HALTON_MAX_BASE];
+        for (int d = 0; d < base; d++) {
+            permutation[d] = d;
+        }
+        for (int d = base - 1; d > 0; d--) {
+            int other = (int) (getScrambleWord(key, chunk, word++) % (uint32_t) (d + 1));
+            int swap = permutation[d];
+            permutation[d] = permutation[other];
+            permutation[other] = swap;
+        }
+
+        // the digits whose weight is still at least one unit of the fraction; every position is permuted, also the leading
+        // zeros of the index, so the sum of the contributions of a position stays below its share of 2^32
+        double weight = 4294967296.0 / base;
+        int position = 0;
+        while (weight >= 1 && position < HALTON_MAX_DIGITS) {
+            for (int d = 0; d < base; d++) {
+                sequence->contributions[k][position][d] = (uint32_t) (permutation[d] * weight);
+            }
+            weight /= base;
+            position++;
+        }
+        sequence->digitCounts[k] = position;
+    }
+}
+
+
+/**
+ * Draws the randomization of the point set of a chunk of sampleCount samples in the given dimensions.
+ * */
+static void initChunkSequence(ChunkSequence *sequence, SamplingMethod method, int dimensions, const uint32_t key[2],
+        uint64_t chunk, long sampleCount) {
+
+    sequence->method = method;
+    sequence->dimensions = dimensions;
+    sequence->sampleCount = sampleCount;
+    if ((method == SOBOL_SAMPLING || method == HALTON_SAMPLING) && dimensions > SEQUENCE_MAX_DIMENSIONS) {
+        printf("The %s sequence has at most %d dimensions.\n", METHOD_NAMES[method], SEQUENCE_MAX_DIMENSIONS);
+        exit(EXIT_FAILURE);
+    }
+
+    switch (method) {
+        case SOBOL_SAMPLING:
+            initSobol(sequence, key, chunk);
+            break;
+        case HALTON_SAMPLING:
+            initHalton(sequence, key, chunk);
+            break;
+        case STRATIFIED_SAMPLING: {
+            // the largest k with k^dimensions <= sampleCount
+            long cells = (long) pow((double) sampleCount, 1.0 / dimensions);
+            while (pow((double) (cells + 1), dimensions) <= (double) sampleCount) {
+                cells++;
+            }
+            while (cells > 1 && pow((double) cells, dimensions) > (double) sampleCount) {
+                cells--;
+            }
+            sequence->cellsPerAxis = (cells > 0) ? cells : 1;
+            sequence->cellCount = (long) pow((double) sequence->cellsPerAxis, dimensions);
+            break;
+        }
+        case LATIN_HYPERCUBE_SAMPLING:
+            for (int k = 0; k < dimensions; k++) {
+                sequence->permutationKeys[k] = getScrambleWord(key, chunk, (uint32_t) k);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Whether the point set needs the random words of the chunk: stratified and Latin hypercube samples are placed at random
+ * inside their cells, the Sobol and Halton points are fixed once the chunk's randomization is drawn.
+ * */
+static inline bool usesRandomWords(SamplingMethod method) {
+    return method == RANDOM_SAMPLING || method == STRATIFIED_SAMPLING || method == LATIN_HYPERCUBE_SAMPLING;
+}
+
+
+/**
+ * Writes the points [first, first + batchSamples) of the chunk's point set into words, coordinate k of point first + i at
+ * words[k * batchSamples + i]. For the stratified and Latin hypercube sets words must hold the random words of the batch,
+ * which place every point inside its cell; points past the chunk's sample count are left as they are.
+ * */
+static void fillSequenceBatch(const ChunkSequence *sequence, long first, int batchSamples, uint32_t *words) {
+
+    int dimensions = sequence->dimensions;
+    switch (sequence->method) {
+        case SOBOL_SAMPLING:
+            // in Gray code order point i + 1 differs from point i by one direction number, the one of the lowest zero bit of i
+            for (int k = 0; k < dimensions; k++) {
+                uint32_t gray = (uint32_t) (first ^ (first >> 1));
+                uint32_t point = sequence->shifts[k];
+                for (int bit = 0; gray != 0; bit++, gray >>= 1) {
+                    if (gray & 1) {
+                        point ^= sequence->directions[k][bit];
+                    }
+                }
+                for (int i = 0; i < batchSamples; i++) {
+                    words[k * batchSamples + i] = point;
+                    point ^= sequence->directions[k][__builtin_ctzl((unsigned long) (first + i + 1))];
+                }
+            }
+            break;
+
+        case HALTON_SAMPLING:
+            for (int k = 0; k < dimensions; k++) {
+                int base = HALTON_BASES[k];
+                int digitCount = sequence->digitCounts[k];
+                const uint32_t (*contributions)[HALTON_MAX_BASE] = sequence->contributions[k];
+                int digits[HALTON_MAX_DIGITS];
+                uint32_t point = 0;
+                long index = first;
+                for (int position = 0; position < digitCount; position++) {
+                    digits[position] = (int) (index % base);
+                    index /= base;
+                    point += contributions[position][digits[position]];
+                }
+                for (int i = 0; i < batchSamples; i++) {
+                    words[k * batchSamples + i] = point;
+                    // add one to the index, a carry at a time
+                    for (int position = 0; position < digitCount; position++) {
+                        int digit = digits[position];
+                        int next = (digit + 1 < base) ? digit + 1 : 0;
+                        point += contributions[position][next] - contributions[position][digit];
+                        digits[position] = next;
+                        if (next != 0) {
+                            break;
+                        }
+                    }
+                }
+            }
+            break;
+
+        case STRATIFIED_SAMPLING: {
+            // point i is in cell i, numbered with the first axis fastest
+            long cells[dimensions];
+            long remaining = first;
+            for (int k = 0; k < dimensions; k++) {
+                cells[k] = remaining % sequence->cellsPerAxis;
+                remaining /= sequence->cellsPerAxis;
+            }
+            double inverseCellsPerAxis = 1.0 / sequence->cellsPerAxis;
+            for (int i = 0; i < batchSamples && first + i < sequence->cellCount; i++) {
+                for (int k = 0; k < dimensions; k++) {
+                    words[k * batchSamples + i] = placeInSlice(cells[k], words[k * batchSamples + i], inverseCellsPerAxis);
+                }
+                for (int k = 0; k < dimensions && ++cells[k] == sequence->cellsPerAxis; k++) {
+                    cells[k] = 0;
+                }
+            }
+            break;
+        }
+
+        case LATIN_HYPERCUBE_SAMPLING: {
+            uint32_t sliceCount = (uint32_t) sequence->sampleCount;
+            double inverseSliceCount = 1.0 / sliceCount;
+            for (int k = 0; k < dimensions; k++) {
+                uint32_t key = sequence->permutationKeys[k];
+                uint32_t offset = key % sliceCount;
+                for (int i = 0; i < batchSamples && first + i < sequence->sampleCount; i++) {
+                    uint32_t slice = permuteIndex((uint32_t) (first + i), sliceCount, key, offset);
+                    words[k * batchSamples + i] = placeInSlice(slice, words[k * batchSamples + i], inverseSliceCount);
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+#endif
@@ -7,14 +7,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <deque>
+#include <vector>
+#include <algorithm>
 #include <sys/time.h>
 #include <time.h>
 #include <math.h>
+#include <stdint.h>
 #include <pthread.h>
 
+#include "monte_carlo_integrand.h"
+#include "work_stealing_pool.h"
+
 using namespace std;
 
-double getTimeForAreaEstimation(int iteration, long sampleCount);
+void parseOptions(int argc, char *argv[], int firstOption);
+const char * getOptionValue(const char *argument, const char *name);
+void prepareSampling();
 
 typedef struct {
     int top;
@@ -25,111 +33,891 @@ typedef struct {
 
 Rectangle sorroundingShape;
 
+double estimateArea(double totalInsideValue, double boxVolume, long sampleCount) {
+
+    // estimate the area under the curve from the area of the bounding box
+    double curveArea = (boxVolume * totalInsideValue) / sampleCount;
+
+    // return the area estimate for the curve
+    return curveArea;
+}
+
+
+// 0 sizes the pool from the processors the program may run on
+int THREAD_COUNT = 0;
+bool PIN_THREADS = false;
+SamplingKernel SAMPLING_KERNEL = AUTO_KERNEL;
+uint64_t SEED = 1;
+// the region and integrand to estimate, the assignment's ellipse by default
+monte_carlo::IntegrandOptions INTEGRAND_OPTIONS = monte_carlo::getDefaultIntegrandOptions();
+// with a target error the sample count is a budget: sampling stops once the confidence interval of the estimate is within
+// TARGET_ERROR of it, relative to the estimate; 0 draws every sample
+double TARGET_ERROR = 0;
+double CONFIDENCE = 0.95;
+// random points, or one of the quasi-Monte Carlo and stratified point sets of low_discrepancy.h in every chunk
+SamplingMethod SAMPLING_METHOD = RANDOM_SAMPLING;
+// compare the error of every sampling method for growing sample counts instead of estimating
+bool CONVERGENCE_BENCHMARK = false;
+// the exact value for the benchmark, when it is known
+double REFERENCE_VALUE = NAN;
+
+// write a Chrome trace of the pool's task calls, steals and jobs to this file
+const char *TRACE_PATH = NULL;
+
+/***************************************************************************************************************************************
+ *                        Sample codes to help the students
+ * *************************************************************************************************************************************/
+
+/**
+ * What a thread did in one estimation. The sampling task adds to insideValue and samplePoll as it runs, so every thread has
+ * its own cache line; the rest is added up from the statistics of the pool after every job.
+ * */
 typedef struct {
-    int x;
-    int y;
-} Point;
+    double insideValue;
+    long samplePoll;
+    long chunks;
+    long steals;
+    double busySeconds;
+    double idleSeconds;
+    long latencyCounts[POOL_LATENCY_BUCKETS];
+} __attribute__((aligned(64))) ThreadMetrics;
 
+/**
+ * One estimation: the pool runs the chunks of the samples as its items, item i being chunk firstChunk + i. The moments of
+ * every chunk are kept apart and added in chunk order, so the estimate does not depend on which worker ran which chunk.
+ * */
+template <typename Integrand>
+struct EstimationJob {
+    const Integrand *integrand;
+    monte_carlo::SamplingDomain<Integrand::DIMENSIONS> domain;
+    long totalSampleCount;
+    long firstChunk;
+    uint64_t seed;
+    SamplingMethod method;
+    monte_carlo::Moments* chunkMoments;
+    ThreadMetrics* threadMetrics;
+};
 
 
-int isPointInsideTheCurve(Point point) {
-    double x_square = point.x * point.x;
-    double y_square = point.y * point.y;
-    double position = (x_square / 10000) + (y_square / 2500) - 1;
-    if (position <= 0.0) {
-        return true;
+template <typename Integrand>
+void sampleChunks(void *context, int workerId, long firstItem, long endItem) {
+
+    EstimationJob<Integrand> *job = (EstimationJob<Integrand> *) context;
+    for (long chunk = job->firstChunk + firstItem; chunk < job->firstChunk + endItem; chunk++) {
+        long chunkSamples = monte_carlo::getChunkSampleCount(chunk, job->totalSampleCount);
+        job->chunkMoments[chunk] = monte_carlo::sampleChunk(*job->integrand, job->domain, job->seed, (uint64_t) chunk, chunkSamples,
+                SAMPLING_KERNEL, job->method);
+        job->threadMetrics[workerId].insideValue += job->chunkMoments[chunk].sum;
+        job->threadMetrics[workerId].samplePoll += chunkSamples;
+    }
+}
+
+/***************************************************************************************************************************************
+ *                             Sample Code End
+ * *************************************************************************************************************************************/
+
+
+ThreadMetrics *createThreadMetrics() {
+    ThreadMetrics *metrics;
+    if (posix_memalign((void **) &metrics, 64, THREAD_COUNT * sizeof(ThreadMetrics)) != 0) {
+        std::cout << "Could not allocate the thread metrics.\n";
+        std::exit(EXIT_FAILURE);
+    }
+    memset(metrics, 0, THREAD_COUNT * sizeof(ThreadMetrics));
+    return metrics;
+}
+
+
+/**
+ * Adds the statistics of the pool's last job to the metrics of its threads.
+ * */
+void collectPoolMetrics(const WorkStealingPool *pool, ThreadMetrics *metrics) {
+    for (int j = 0; j < THREAD_COUNT; j++) {
+        const PoolWorker *worker = &pool->workers[j];
+        metrics[j].chunks += worker->itemsRun;
+        metrics[j].steals += worker->steals;
+        metrics[j].busySeconds += worker->busySeconds;
+        metrics[j].idleSeconds += worker->idleSeconds;
+        for (int bucket = 0; bucket < POOL_LATENCY_BUCKETS; bucket++) {
+            metrics[j].latencyCounts[bucket] += worker->latencyCounts[bucket];
+        }
+    }
+}
+
+
+/**
+ * Prints what every thread did, the load imbalance and the histogram of the chunk latencies; returns the time the threads were
+ * busy sampling, added up.
+ * */
+double printThreadMetrics(const ThreadMetrics *metrics) {
+
+    bool isArea = (INTEGRAND_OPTIONS.integrand == monte_carlo::AREA_INTEGRAND);
+    double totalBusySeconds = 0;
+    double largestBusySeconds = 0;
+    long latencyCounts[POOL_LATENCY_BUCKETS] = { 0 };
+    for(int j = 0; j < THREAD_COUNT; j++) {
+        const ThreadMetrics *thread = &metrics[j];
+        printf("Thread -> %d , samplePoll -> %ld , chunks -> %ld , steals -> %ld , busy -> %.4f s , idle -> %.4f s , "
+                "rate -> %.1f million samples per busy second \n", j, thread->samplePoll, thread->chunks, thread->steals,
+                thread->busySeconds, thread->idleSeconds, (thread->busySeconds > 0) ? thread->samplePoll / thread->busySeconds / 1e6 : 0);
+        if (isArea) {
+            printf("Point inside target found by thread ->  %d is %.0f \n", j, thread->insideValue);
+        } else {
+            printf("Integrand sum found by thread ->  %d is %g \n", j, thread->insideValue);
+        }
+        totalBusySeconds += thread->busySeconds;
+        if (thread->busySeconds > largestBusySeconds) {
+            largestBusySeconds = thread->busySeconds;
+        }
+        for (int bucket = 0; bucket < POOL_LATENCY_BUCKETS; bucket++) {
+            latencyCounts[bucket] += thread->latencyCounts[bucket];
+        }
+    }
+
+    // 1 when every thread sampled equally long; the iteration takes this many times as long as a perfect split would
+    printf("Load imbalance -> %.3f , the busiest thread over the mean\n",
+            (totalBusySeconds > 0) ? largestBusySeconds * THREAD_COUNT / totalBusySeconds : 1.0);
+    printf("Chunk latency histogram ->");
+    const char *separator = " ";
+    for (int bucket = 0; bucket < POOL_LATENCY_BUCKETS; bucket++) {
+        if (latencyCounts[bucket] > 0) {
+            printf("%s[%g, %g) ms: %ld", separator, (1L << bucket) / 1000.0, (2L << bucket) / 1000.0, latencyCounts[bucket]);
+            separator = " , ";
+        }
+    }
+    printf("\n");
+    return totalBusySeconds;
+}
+
+
+/**
+ * The standard error of the mean value of the integrand. Random samples are independent, so it follows from their variance;
+ * the points of the other methods are not, and it follows from the spread of the chunk means, the replicates.
+ * */
+double getEstimateError(const monte_carlo::Moments &moments, const monte_carlo::Moments &replicates) {
+    return (SAMPLING_METHOD == RANDOM_SAMPLING) ? monte_carlo::getStandardError(moments) :
+            monte_carlo::getStandardError(replicates);
+}
+
+
+/**
+ * The number of standard errors in the half-width of the CONFIDENCE interval. The error of random samples comes from millions
+ * of them and the normal quantile applies; the replicate error comes from a few chunk means, so it takes the Student-t
+ * quantile with one degree of freedom less than the chunks.
+ * */
+double getIntervalQuantile(const monte_carlo::Moments &replicates) {
+    if (SAMPLING_METHOD == RANDOM_SAMPLING || replicates.count < 2) {
+        return monte_carlo::getNormalQuantile(CONFIDENCE);
+    }
+    return monte_carlo::getStudentQuantile(CONFIDENCE, replicates.count - 1);
+}
+
+
+/**
+ * Prints the estimate from the moments of its samples, with its standard error and confidence interval.
+ * */
+template <typename Integrand>
+void printEstimate(const monte_carlo::Moments &moments, const monte_carlo::Moments &replicates, double boxVolume) {
+
+    double curveArea = estimateArea(moments.sum, boxVolume, moments.count);
+    bool isArea = (INTEGRAND_OPTIONS.integrand == monte_carlo::AREA_INTEGRAND);
+    if (isArea && Integrand::DIMENSIONS == 2) {
+        std::cout << "The estimated area is "<< curveArea << " unitSquare with samples " << moments.count << " where " << (long) moments.sum << " points were found inside target curve\n";
+    } else if (isArea) {
+        printf("The estimated volume of the %d-dimensional %s is %g with samples %ld where %ld points were found inside it\n",
+                Integrand::DIMENSIONS, monte_carlo::getRegionName(INTEGRAND_OPTIONS), curveArea, moments.count, (long) moments.sum);
     } else {
+        printf("The estimated integral over the %s is %g with samples %ld\n", monte_carlo::getRegionName(INTEGRAND_OPTIONS),
+                curveArea, moments.count);
+    }
+
+    double standardError = boxVolume * getEstimateError(moments, replicates);
+    double halfWidth = getIntervalQuantile(replicates) * standardError;
+    printf("Standard error -> %g , %g%% confidence interval -> [%g, %g] , relative half-width -> %.3g\n", standardError,
+            100 * CONFIDENCE, curveArea - halfWidth, curveArea + halfWidth, halfWidth / fabs(curveArea));
+}
+
+
+template <typename Integrand>
+double getTimeForAreaEstimation(WorkStealingPool *pool, int iteration, long sampleCount, const Integrand &integrand,
+        const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain) {
+    printf("Starting iteration -> %d\n\n", iteration);
+    
+    // starting execution timer clock
+    struct timeval start;
+    gettimeofday(&start, NULL);
+
+    // every sample belongs to exactly one chunk, the last chunk holding the remainder, and the pool runs every chunk once
+    long chunkCount = monte_carlo::getChunkCount(sampleCount);
+    EstimationJob<Integrand> job;
+    job.integrand = &integrand;
+    job.domain = domain;
+    job.totalSampleCount = sampleCount;
+    job.firstChunk = 0;
+    job.seed = SEED;
+    job.method = SAMPLING_METHOD;
+    job.chunkMoments = (monte_carlo::Moments *) calloc(chunkCount + 1, sizeof(monte_carlo::Moments));
+    job.threadMetrics = createThreadMetrics();
+
+    runPool(pool, chunkCount, 1, sampleChunks<Integrand>, &job);
+    collectPoolMetrics(pool, job.threadMetrics);
+    double totalBusySeconds = printThreadMetrics(job.threadMetrics);
+
+    monte_carlo::Moments total = { 0, 0, 0 };
+    monte_carlo::Moments replicates = { 0, 0, 0 };
+    for (long chunk = 0; chunk < chunkCount; chunk++) {
+        monte_carlo::addMoments(&total, job.chunkMoments[chunk]);
+        monte_carlo::addReplicate(&replicates, job.chunkMoments[chunk]);
+    }
+    printEstimate<Integrand>(total, replicates, domain.volume());
+    
+    free(job.chunkMoments);
+    free(job.threadMetrics);
+    
+    //-------------------------------- calculate running time -------------------------------------------
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    double runningTime = ((end.tv_sec + end.tv_usec / 1000000.0) - (start.tv_sec + start.tv_usec / 1000000.0));
+    std::cout << "Execution Time -> " << runningTime << " Seconds, for iteration -> " << iteration << std::endl;
+    printf("Sampling rate -> %.1f million samples per second, %.1f million per thread\n", sampleCount / runningTime / 1e6,
+            sampleCount / runningTime / 1e6 / THREAD_COUNT);
+    // the share of the threads' time spent sampling; the rest is waiting for work at the end of the iteration and scheduling
+    printf("Thread utilization -> %.1f%% busy\n\n", 100.0 * totalBusySeconds / (runningTime * THREAD_COUNT));
+    return runningTime;
+}
+
+
+// the fewest chunks whose replicate error an adaptive estimation trusts; the spread of two or three chunk means is itself
+// too uncertain, and can even be 0
+const long MIN_REPLICATES = 8;
+
+
+/**
+ * Whether the confidence interval of the estimate from these moments is within TARGET_ERROR of the estimate.
+ * */
+bool hasConverged(const monte_carlo::Moments &moments, const monte_carlo::Moments &replicates) {
+    if (SAMPLING_METHOD != RANDOM_SAMPLING && replicates.count < MIN_REPLICATES) {
         return false;
     }
+    double mean = monte_carlo::getMean(moments);
+    return mean != 0 && getIntervalQuantile(replicates) * getEstimateError(moments, replicates) <= TARGET_ERROR * fabs(mean);
 }
 
 
-Point generateRandomPointInsideBox(Rectangle box, unsigned int *seed) {
+/**
+ * An estimation that stops once the estimate is precise enough, with sampleCount samples at most. The chunks are sampled in
+ * rounds; after a round the chunks are added in order and the estimate is the first prefix of chunks that converges. Which
+ * prefix that is depends only on the seed, so the estimate is the same for every thread count and kernel, and it would be the
+ * same if every chunk had been checked as soon as it was sampled. A round may sample a few chunks past that prefix; they are
+ * counted in the samples drawn but not in the estimate.
+ *
+ * The first round has a chunk per thread, and MIN_REPLICATES chunks at least when the error comes from the chunk replicates.
+ * Every following round is sized from the error seen so far, which falls with the square root of the samples: the estimate
+ * needs about n * (t * error / (TARGET_ERROR * mean))^2 samples after n, and the round samples the chunks still missing to
+ * that count, at least a chunk per thread so that every thread has work. An error from few chunks can be far too large as well
+ * as too small, so a round samples at most as many chunks as all the rounds before it.
+ * */
+template <typename Integrand>
+double getTimeForAdaptiveEstimation(WorkStealingPool *pool, int iteration, long sampleCount, const Integrand &integrand,
+        const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain) {
+    printf("Starting iteration -> %d\n\n", iteration);
+
+    struct timeval start;
+    gettimeofday(&start, NULL);
+
+    long chunkCount = monte_carlo::getChunkCount(sampleCount);
+    EstimationJob<Integrand> job;
+    job.integrand = &integrand;
+    job.domain = domain;
+    job.totalSampleCount = sampleCount;
+    job.firstChunk = 0;
+    job.seed = SEED;
+    job.method = SAMPLING_METHOD;
+    job.chunkMoments = (monte_carlo::Moments *) calloc(chunkCount + 1, sizeof(monte_carlo::Moments));
+    // the pool's statistics describe one round, so they are added up after every round
+    job.threadMetrics = createThreadMetrics();
+
+    monte_carlo::Moments total = { 0, 0, 0 };
+    monte_carlo::Moments replicates = { 0, 0, 0 };
+    long checkedChunks = 0;
+    long sampledChunks = 0;
+    long samplesDrawn = 0;
+    int roundCount = 0;
+    bool converged = false;
+    long roundChunks = THREAD_COUNT;
+    if (SAMPLING_METHOD != RANDOM_SAMPLING && roundChunks < MIN_REPLICATES) {
+        roundChunks = MIN_REPLICATES;
+    }
+    while (!converged && sampledChunks < chunkCount) {
+        if (roundChunks > chunkCount - sampledChunks) {
+            roundChunks = chunkCount - sampledChunks;
+        }
+        job.firstChunk = sampledChunks;
+        runPool(pool, roundChunks, 1, sampleChunks<Integrand>, &job);
+        collectPoolMetrics(pool, job.threadMetrics);
+        for (long chunk = sampledChunks; chunk < sampledChunks + roundChunks; chunk++) {
+            samplesDrawn += job.chunkMoments[chunk].count;
+        }
+        sampledChunks += roundChunks;
+        roundCount++;
+
+        while (!converged && checkedChunks < sampledChunks) {
+            monte_carlo::addMoments(&total, job.chunkMoments[checkedChunks]);
+            monte_carlo::addReplicate(&replicates, job.chunkMoments[checkedChunks]);
+            checkedChunks++;
+            converged = hasConverged(total, replicates);
+        }
+
+        double mean = monte_carlo::getMean(total);
+        double error = getEstimateError(total, replicates);
+        if (mean != 0 && isfinite(error)) {
+            double t = getIntervalQuantile(replicates);
+            double neededSamples = total.count * pow(t * error / (TARGET_ERROR * fabs(mean)), 2);
+            double neededChunks = ceil(neededSamples / monte_carlo::CHUNK_SAMPLES) - sampledChunks;
+            roundChunks = (neededChunks < (double) sampledChunks) ? (long) neededChunks : sampledChunks;
+        } else {
+            // nothing seen yet to size the round from; the replicate error needs two chunks
+            roundChunks = sampledChunks;
+        }
+        if (roundChunks < THREAD_COUNT) {
+            roundChunks = THREAD_COUNT;
+        }
+    }
+
+    double totalBusySeconds = printThreadMetrics(job.threadMetrics);
 
-    int horizontal = (box.right - box.left);
-    int vertical = (box.top - box.bottom);
-                
-    // random point generation; the modulus then adding the left and bottom bound push the arbitrary random point within the
-    // bounding box
-    int x = (rand_r(seed) % horizontal) + box.left;
-    int y = (rand_r(seed) % vertical) + box.bottom;
+    if (converged) {
+        printf("Reached the target error %g after %ld of the %ld budgeted samples, in %d rounds drawing %ld samples\n",
+                TARGET_ERROR, total.count, sampleCount, roundCount, samplesDrawn);
+    } else {
+        printf("Did not reach the target error %g within the %ld budgeted samples, in %d rounds\n", TARGET_ERROR, sampleCount,
+                roundCount);
+    }
+    printEstimate<Integrand>(total, replicates, domain.volume());
 
-    // generate and return the point
-    Point randomPoint;
-    randomPoint.x = x;
-    randomPoint.y = y;
-    return randomPoint;
+    free(job.chunkMoments);
+    free(job.threadMetrics);
+
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    double runningTime = ((end.tv_sec + end.tv_usec / 1000000.0) - (start.tv_sec + start.tv_usec / 1000000.0));
+    std::cout << "Execution Time -> " << runningTime << " Seconds, for iteration -> " << iteration << std::endl;
+    printf("Sampling rate -> %.1f million samples per second, %.1f million per thread\n", samplesDrawn / runningTime / 1e6,
+            samplesDrawn / runningTime / 1e6 / THREAD_COUNT);
+    printf("Thread utilization -> %.1f%% busy\n\n", 100.0 * totalBusySeconds / (runningTime * THREAD_COUNT));
+    return runningTime;
 }
 
-double estimateArea(long totalInsidePoints, Rectangle boundingBox, long sampleCount) {
 
-    // estimate the area under the curve from the area of the bounding box
-    double boxArea = (boundingBox.right - boundingBox.left) * (boundingBox.top - boundingBox.bottom);
-    double curveArea = (boxArea * totalInsidePoints) / sampleCount;
+/**
+ * One estimate of the integral with the given method and seed, without any output.
+ * */
+template <typename Integrand>
+double estimateQuietly(WorkStealingPool *pool, long sampleCount, const Integrand &integrand,
+        const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain, SamplingMethod method, uint64_t seed) {
 
-    // return the area estimate for the curve
-    return curveArea;
+    long chunkCount = monte_carlo::getChunkCount(sampleCount);
+    EstimationJob<Integrand> job;
+    job.integrand = &integrand;
+    job.domain = domain;
+    job.totalSampleCount = sampleCount;
+    job.firstChunk = 0;
+    job.seed = seed;
+    job.method = method;
+    job.chunkMoments = (monte_carlo::Moments *) calloc(chunkCount + 1, sizeof(monte_carlo::Moments));
+    job.threadMetrics = createThreadMetrics();
+
+    runPool(pool, chunkCount, 1, sampleChunks<Integrand>, &job);
+
+    monte_carlo::Moments total = { 0, 0, 0 };
+    for (long chunk = 0; chunk < chunkCount; chunk++) {
+        monte_carlo::addMoments(&total, job.chunkMoments[chunk]);
+    }
+    free(job.chunkMoments);
+    free(job.threadMetrics);
+    return estimateArea(total.sum, domain.volume(), total.count);
 }
 
-long countInsideTargetAreaPoints(int threadId, Rectangle boundingBox, long sampleCount) {
-    
-    // using a threadId to create threadIdSeed
-    unsigned int threadIdSeed = threadId + (unsigned int)time(NULL);
 
-    // also initialize a variable to count the number of points we found to be inside the curve
-    long insidePoints = 0;
+/**
+ * Compares the sampling methods: the root mean square error of repeatCount estimates with different seeds, and their mean
+ * time, for sample counts growing fourfold up to maxSamples. The error is measured against REFERENCE_VALUE when it is given,
+ * and otherwise against the mean of the Sobol estimates at the largest sample count, which makes the Sobol error at that
+ * count an underestimate.
+ * */
+template <typename Integrand>
+void runConvergenceBenchmark(WorkStealingPool *pool, int repeatCount, long maxSamples, const Integrand &integrand,
+        const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain) {
 
-    // doing iteration count number of sampling experiments
-    for (long i = 0; i < sampleCount; i++) {
-        Point randomPoint = generateRandomPointInsideBox(boundingBox, &threadIdSeed);
-        if (isPointInsideTheCurve(randomPoint)) {
-            insidePoints++;
+    double reference = REFERENCE_VALUE;
+    if (isnan(reference)) {
+        reference = 0;
+        for (int repeat = 0; repeat < repeatCount; repeat++) {
+            reference += estimateQuietly(pool, maxSamples, integrand, domain, SOBOL_SAMPLING, SEED + repeat);
         }
+        reference /= repeatCount;
+        printf("Reference value -> %.10g , the mean of %d sobol estimates with %ld samples\n\n", reference, repeatCount,
+                maxSamples);
+    } else {
+        printf("Reference value -> %.10g\n\n", reference);
     }
-    printf("Point inside target found by thread ->  %d is %ld \n", threadId, insidePoints);
 
-    return insidePoints;
+    printf("method,samples,seconds,rms_error,relative_error\n");
+    for (int method = RANDOM_SAMPLING; method <= LATIN_HYPERCUBE_SAMPLING; method++) {
+        for (long samples = 1L << 14; samples <= maxSamples; samples *= 4) {
+            double squareErrors = 0;
+            double seconds = 0;
+            for (int repeat = 0; repeat < repeatCount; repeat++) {
+                double start = getPoolTime();
+                double estimate = estimateQuietly(pool, samples, integrand, domain, (SamplingMethod) method, SEED + repeat);
+                seconds += getPoolTime() - start;
+                squareErrors += (estimate - reference) * (estimate - reference);
+            }
+            double error = sqrt(squareErrors / repeatCount);
+            printf("%s,%ld,%.6f,%.6g,%.6g\n", METHOD_NAMES[method], samples, seconds / repeatCount, error,
+                    error / fabs(reference));
+        }
+    }
 }
 
+
+/**
+ * Runs the iterations for the integrand chosen on the command line; runWithIntegrand calls it with the concrete integrand type.
+ * */
+struct EstimationRunner {
+    WorkStealingPool *pool;
+    int iterationCount;
+    long sampleCount;
+    double totalRunningTime;
+
+    template <typename Integrand>
+    void operator()(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &domain) {
+        if (CONVERGENCE_BENCHMARK) {
+            runConvergenceBenchmark(pool, (iterationCount > 1) ? iterationCount : 2, sampleCount, integrand, domain);
+            return;
+        }
+        for (int i = 0; i < iterationCount; i++) {
+            if (TARGET_ERROR > 0) {
+                totalRunningTime += getTimeForAdaptiveEstimation(pool, i, sampleCount, integrand, domain);
+            } else {
+                totalRunningTime += getTimeForAreaEstimation(pool, i, sampleCount, integrand, domain);
+            }
+        }
+    }
+};
+
+
 /***************************************************************************************************************************************
- *                        Sample codes to help the students
+ *                        Batch job server
+ *
+ * With --serve the program reads jobs from a file or stdin, one per line,
+ *
+ *      left bottom right top sample_count [seed]
+ *
+ * and estimates each with the region and options of the command line, printing a line per job as soon as it is done. A reader
+ * thread queues the jobs while the pool samples; the scheduler runs the chunks of the jobs as windows of a bounded number of
+ * chunks, each window the items of one pool job. Every job with chunks left gets an even share of a window and the share a small
+ * job leaves goes to the others, so small jobs run side by side and a large job takes at most one window at a time and carries
+ * the rest of its chunks over to the next windows, where the jobs queued meanwhile join it. The worker that finishes the last
+ * chunk of a job adds up the job's chunks in order and prints its result, so a job gives the same estimate as an estimation of
+ * its box with its seed.
  * *************************************************************************************************************************************/
 
-int THREAD_COUNT = 8;
+// the chunks of a window, per thread; a job that arrives while a window runs waits at most for the end of the window
+const long WINDOW_CHUNKS_PER_THREAD = 16;
 
 typedef struct {
-    int threadId;
+    long id;
+    float left;
+    float bottom;
+    float right;
+    float top;
     long sampleCount;
-    long* insidePointsCountArrayPointer;
-} ThreadArg;
+    uint64_t seed;
+    // when the line was read, for the latency of the job
+    double submittedAt;
+    // why the line is not a job, or NULL
+    const char *error;
+} BatchJob;
 
+typedef struct {
+    FILE *input;
+    pthread_mutex_t lock;
+    pthread_cond_t jobsQueued;
+    std::deque<BatchJob> *jobs;
+    bool finished;
+} JobQueue;
 
-void *threadFunction(void *arg) {
-    
-    ThreadArg *argument = (ThreadArg *) arg;
-    int threadId = argument->threadId;
-    long samplePoll = argument->sampleCount;
-    
-    long *insidePointsCountArrayPointer = argument->insidePointsCountArrayPointer;
-    printf("Thread -> %d , samplePoll -> %ld \n", threadId, samplePoll);
-    long insidePoints = countInsideTargetAreaPoints(threadId, sorroundingShape, samplePoll);
-    *insidePointsCountArrayPointer = insidePoints;
+
+/**
+ * Reads a job line; returns false for a blank line or a comment, which are not jobs.
+ * */
+bool parseJob(const char *line, BatchJob *job) {
+
+    while (isspace((unsigned char) *line)) {
+        line++;
+    }
+    if (*line == '\0' || *line == '#') {
+        return false;
+    }
+    job->seed = SEED;
+    job->error = NULL;
+    int length = 0;
+    if (sscanf(line, "%f %f %f %f %ld%n", &job->left, &job->bottom, &job->right, &job->top, &job->sampleCount, &length) != 5) {
+        job->error = "expected left bottom right top sample_count [seed]";
+        return true;
+    }
+    char *end;
+    unsigned long long seed = strtoull(line + length, &end, 10);
+    if (end != line + length) {
+        job->seed = seed;
+    }
+    if (job->sampleCount <= 0) {
+        job->error = "the sample count must be positive";
+    } else if (!(job->right > job->left && job->top > job->bottom)) {
+        job->error = "the box must have its top right corner above and right of its bottom left corner";
+    }
+    return true;
+}
+
+
+void *readJobs(void *arg) {
+
+    JobQueue *queue = (JobQueue *) arg;
+    char *line = NULL;
+    size_t capacity = 0;
+    long nextId = 1;
+    while (getline(&line, &capacity, queue->input) != -1) {
+        BatchJob job;
+        if (!parseJob(line, &job)) {
+            continue;
+        }
+        job.id = nextId++;
+        job.submittedAt = getPoolTime();
+        pthread_mutex_lock(&queue->lock);
+        queue->jobs->push_back(job);
+        pthread_cond_signal(&queue->jobsQueued);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    free(line);
+
+    pthread_mutex_lock(&queue->lock);
+    queue->finished = true;
+    pthread_cond_signal(&queue->jobsQueued);
+    pthread_mutex_unlock(&queue->lock);
     return NULL;
 }
 
-/***************************************************************************************************************************************
- *                             Sample Code End
- * *************************************************************************************************************************************/
+
+typedef struct {
+    pthread_mutex_t lock;
+    long jobsDone;
+    long jobsFailed;
+    long samples;
+    std::vector<double> *latencies;
+} ServerStatistics;
+
+
+/**
+ * A job taken from the queue. Its chunks may be spread over several windows, so the moments of every chunk are kept with the job
+ * until its last chunk is sampled.
+ * */
+template <typename Integrand>
+struct ServedJob {
+    BatchJob job;
+    monte_carlo::SamplingDomain<Integrand::DIMENSIONS> domain;
+    long chunkCount;
+    // the chunks given to a window so far
+    long scheduledChunks;
+    long chunksLeft;
+    std::vector<monte_carlo::Moments> chunkMoments;
+};
+
+
+/**
+ * The chunks of one window. Item i of the pool job is chunk firstChunks[j] + i - firstItems[j] of jobs[j], for the j with
+ * firstItems[j] <= i < firstItems[j + 1].
+ * */
+template <typename Integrand>
+struct JobWindow {
+    const Integrand *integrand;
+    std::vector<ServedJob<Integrand> *> jobs;
+    std::vector<long> firstChunks;
+    std::vector<long> firstItems;
+    ServerStatistics *statistics;
+};
+
+
+template <typename Integrand>
+void finishJob(const ServedJob<Integrand> *servedJob, ServerStatistics *statistics) {
+
+    const BatchJob &job = servedJob->job;
+    monte_carlo::Moments total = { 0, 0, 0 };
+    monte_carlo::Moments replicates = { 0, 0, 0 };
+    for (long chunk = 0; chunk < servedJob->chunkCount; chunk++) {
+        monte_carlo::addMoments(&total, servedJob->chunkMoments[chunk]);
+        monte_carlo::addReplicate(&replicates, servedJob->chunkMoments[chunk]);
+    }
+    double volume = servedJob->domain.volume();
+    double estimate = estimateArea(total.sum, volume, total.count);
+    double standardError = volume * getEstimateError(total, replicates);
+    double latency = getPoolTime() - job.submittedAt;
+
+    pthread_mutex_lock(&statistics->lock);
+    printf("Job -> %ld , box -> [%g, %g, %g, %g] , samples -> %ld , seed -> %llu , estimate -> %.10g , standard error -> %g , "
+            "latency -> %.3f ms\n", job.id, job.left, job.bottom, job.right, job.top, job.sampleCount,
+            (unsigned long long) job.seed, estimate, standardError, latency * 1e3);
+    fflush(stdout);
+    statistics->jobsDone++;
+    statistics->samples += job.sampleCount;
+    statistics->latencies->push_back(latency);
+    pthread_mutex_unlock(&statistics->lock);
+}
+
+
+template <typename Integrand>
+void sampleJobChunks(void *context, int workerId, long firstItem, long endItem) {
+
+    JobWindow<Integrand> *window = (JobWindow<Integrand> *) context;
+    for (long item = firstItem; item < endItem; item++) {
+        long j = std::upper_bound(window->firstItems.begin(), window->firstItems.end(), item) - window->firstItems.begin() - 1;
+        long chunk = window->firstChunks[j] + item - window->firstItems[j];
+        ServedJob<Integrand> *servedJob = window->jobs[j];
+        const BatchJob &job = servedJob->job;
+        servedJob->chunkMoments[chunk] = monte_carlo::sampleChunk(*window->integrand, servedJob->domain, job.seed,
+                (uint64_t) chunk, monte_carlo::getChunkSampleCount(chunk, job.sampleCount), SAMPLING_KERNEL, SAMPLING_METHOD);
+        // the worker that samples the last chunk of the job reports it; the other chunks, of this window or of earlier ones,
+        // are visible to it through the ordering of the decrements and the end of the earlier pool jobs
+        if (__atomic_sub_fetch(&servedJob->chunksLeft, 1, __ATOMIC_ACQ_REL) == 0) {
+            finishJob(servedJob, window->statistics);
+        }
+    }
+}
+
+
+/**
+ * The q-th quantile of the sorted values by the nearest rank rule: the value of rank ceil(q * count), so that p50 <= p99 <= max
+ * for any count.
+ * */
+double getPercentile(const std::vector<double> &sorted, double q) {
+    long count = (long) sorted.size();
+    long index = (long) ceil(q * count) - 1;
+    return sorted[(index < 0) ? 0 : (index > count - 1) ? count - 1 : index];
+}
+
+
+/**
+ * Serves the jobs of the input with the integrand of the command line; runWithIntegrand calls it with the concrete integrand
+ * type, and the domain of every job is made from its own box.
+ * */
+struct JobServer {
+    WorkStealingPool *pool;
+    FILE *input;
+
+    template <typename Integrand>
+    void operator()(const Integrand &integrand, const monte_carlo::SamplingDomain<Integrand::DIMENSIONS> &) {
+
+        std::deque<BatchJob> queuedJobs;
+        JobQueue queue;
+        queue.input = input;
+        pthread_mutex_init(&queue.lock, NULL);
+        pthread_cond_init(&queue.jobsQueued, NULL);
+        queue.jobs = &queuedJobs;
+        queue.finished = false;
+        pthread_t reader;
+        if (pthread_create(&reader, NULL, readJobs, &queue) != 0) {
+            std::cout << "Could not start the job reader.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::vector<double> latencies;
+        ServerStatistics statistics;
+        pthread_mutex_init(&statistics.lock, NULL);
+        statistics.jobsDone = 0;
+        statistics.jobsFailed = 0;
+        statistics.samples = 0;
+        statistics.latencies = &latencies;
+
+        double start = getPoolTime();
+        long windowChunks = WINDOW_CHUNKS_PER_THREAD * THREAD_COUNT;
+        // the jobs with chunks not yet given to a window, in the order they arrived
+        std::vector<ServedJob<Integrand> *> activeJobs;
+        while (true) {
+            // wait for a job unless one is still running, then take all of the jobs queued meanwhile
+            pthread_mutex_lock(&queue.lock);
+            while (activeJobs.empty() && queuedJobs.empty() && !queue.finished) {
+                pthread_cond_wait(&queue.jobsQueued, &queue.lock);
+            }
+            while (!queuedJobs.empty()) {
+                BatchJob job = queuedJobs.front();
+                queuedJobs.pop_front();
+                if (job.error != NULL) {
+                    printf("Job -> %ld , error -> %s\n", job.id, job.error);
+                    fflush(stdout);
+                    statistics.jobsFailed++;
+                    continue;
+                }
+                ServedJob<Integrand> *servedJob = new ServedJob<Integrand>();
+                servedJob->job = job;
+                servedJob->domain = monte_carlo::makeSamplingDomain<Integrand::DIMENSIONS>(job.left, job.bottom, job.right,
+                        job.top);
+                servedJob->chunkCount = monte_carlo::getChunkCount(job.sampleCount);
+                servedJob->scheduledChunks = 0;
+                servedJob->chunksLeft = servedJob->chunkCount;
+                servedJob->chunkMoments.resize(servedJob->chunkCount);
+                activeJobs.push_back(servedJob);
+            }
+            bool finished = queue.finished;
+            pthread_mutex_unlock(&queue.lock);
+            if (activeJobs.empty()) {
+                if (finished) {
+                    break;
+                }
+                continue;
+            }
+
+            // a first pass gives every job up to its share of the window, and a second one gives the chunks the small jobs
+            // left to the others in order
+            JobWindow<Integrand> window;
+            window.integrand = &integrand;
+            window.statistics = &statistics;
+            window.firstItems.push_back(0);
+            long share = std::max(1L, windowChunks / (long) activeJobs.size());
+            long freeChunks = windowChunks;
+            for (int pass = 0; pass < 2 && freeChunks > 0; pass++) {
+                for (size_t j = 0; j < activeJobs.size() && freeChunks > 0; j++) {
+                    ServedJob<Integrand> *servedJob = activeJobs[j];
+                    long chunks = std::min(servedJob->chunkCount - servedJob->scheduledChunks, freeChunks);
+                    if (pass == 0) {
+                        chunks = std::min(chunks, share);
+                    }
+                    if (chunks == 0) {
+                        continue;
+                    }
+                    window.jobs.push_back(servedJob);
+                    window.firstChunks.push_back(servedJob->scheduledChunks);
+                    window.firstItems.push_back(window.firstItems.back() + chunks);
+                    servedJob->scheduledChunks += chunks;
+                    freeChunks -= chunks;
+                }
+            }
+
+            // the jobs this window schedules completely leave the active ones, and are done when the window is
+            std::vector<ServedJob<Integrand> *> scheduledJobs;
+            size_t activeCount = 0;
+            for (size_t j = 0; j < activeJobs.size(); j++) {
+                if (activeJobs[j]->scheduledChunks == activeJobs[j]->chunkCount) {
+                    scheduledJobs.push_back(activeJobs[j]);
+                } else {
+                    activeJobs[activeCount++] = activeJobs[j];
+                }
+            }
+            activeJobs.resize(activeCount);
+
+            runPool(pool, window.firstItems.back(), 1, sampleJobChunks<Integrand>, &window);
+            for (size_t j = 0; j < scheduledJobs.size(); j++) {
+                delete scheduledJobs[j];
+            }
+        }
+        pthread_join(reader, NULL);
+
+        double seconds = getPoolTime() - start;
+        std::sort(latencies.begin(), latencies.end());
+        long jobCount = (long) latencies.size();
+        double latencySum = 0;
+        for (long i = 0; i < jobCount; i++) {
+            latencySum += latencies[i];
+        }
+        printf("\nServed %ld jobs, %ld failed, in %.3f s -> %.1f jobs per second , %.1f million samples per second\n",
+                statistics.jobsDone, statistics.jobsFailed, seconds, statistics.jobsDone / seconds,
+                statistics.samples / seconds / 1e6);
+        if (jobCount > 0) {
+            printf("Job latency -> mean %.3f ms , p50 %.3f ms , p99 %.3f ms , max %.3f ms\n", latencySum / jobCount * 1e3,
+                    getPercentile(latencies, 0.5) * 1e3, getPercentile(latencies, 0.99) * 1e3, latencies[jobCount - 1] * 1e3);
+        }
+
+        pthread_mutex_destroy(&statistics.lock);
+        pthread_mutex_destroy(&queue.lock);
+        pthread_cond_destroy(&queue.jobsQueued);
+    }
+};
+
+
+/**
+ * The --serve mode: ./program_name --serve[=FILE] [options], reading stdin without a file.
+ * */
+int serveJobs(int argc, char *argv[]) {
+
+    const char *path = getOptionValue(argv[1], "--serve");
+    parseOptions(argc, argv, 2);
+    if (TARGET_ERROR > 0 || CONVERGENCE_BENCHMARK) {
+        std::cout << "--target-error and --benchmark do not apply to the jobs of --serve.\n";
+        std::exit(EXIT_FAILURE);
+    }
+    FILE *input = stdin;
+    if (path != NULL) {
+        input = fopen(path, "r");
+        if (input == NULL) {
+            std::cout << "Could not open the job file " << path << ".\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    prepareSampling();
+
+    JobServer server;
+    server.pool = createPool(THREAD_COUNT, PIN_THREADS);
+    if (TRACE_PATH != NULL) {
+        enablePoolTrace(server.pool);
+    }
+    server.input = input;
+    // the box only picks the integrand here; every job brings its own
+    monte_carlo::runWithIntegrand(INTEGRAND_OPTIONS, 0, 0, 1, 1, server);
+    if (TRACE_PATH != NULL && !writePoolTrace(server.pool, TRACE_PATH)) {
+        std::cout << "Could not write the trace to " << TRACE_PATH << ".\n";
+    }
+    destroyPool(server.pool);
+    if (input != stdin) {
+        fclose(input);
+    }
+    return 0;
+}
 
 
 int main(int argc, char *argv[]) {
+
+    if (argc >= 2 && (strcmp(argv[1], "--serve") == 0 || getOptionValue(argv[1], "--serve") != NULL)) {
+        return serveJobs(argc, argv);
+    }
     
     if (argc < 7) {
         std::cout << "To run the program you have to provide two things.\n";
         std::cout << "\tFirst the number of samples for the Monte Carlo sampling experiments.\n";
         std::cout << "\tSecond the bounding area within which the samples should be generated.\n";
         std::cout << "The format of using the program:\n";
-        std::cout << "\t./program_name sample_count bottom_left_x, bottom_left_y, top_right_x, top_right_y\n";
+        std::cout << "\t./program_name sample_count bottom_left_x, bottom_left_y, top_right_x, top_right_y iteration_count [options]\n";
+        std::cout << "\t./program_name --serve[=FILE] [options]\n";
+        std::cout << "\tThe second form reads jobs from the file or stdin, one per line as left bottom right top sample_count [seed],\n";
+        std::cout << "\tand prints the estimate of every job as soon as it is done.\n";
+        std::cout << "Options:\n";
+        std::cout << "\t--threads=N                 number of sampling threads (default: number of processors)\n";
+        std::cout << "\t--pin                       pin every sampling thread to its own processor\n";
+        std::cout << "\t--seed=N                    seed of the random streams; the same seed gives the same estimate (default: 1)\n";
+        std::cout << "\t--kernel=auto|scalar|avx2|avx512  random number kernel (default: auto, the widest supported)\n";
+        std::cout << "\t--region=ellipse|polygon|superellipse|ball  region to estimate (default: the ellipse x^2/10000 + y^2/2500 <= 1)\n";
+        std::cout << "\t--vertices=X,Y,X,Y,...      vertices of the polygon region\n";
+        std::cout << "\t--dimensions=N              dimensions of the ball region, 2 to 8 (default: 3)\n";
+        std::cout << "\t--radius=R                  radius of the ball region, centered at the origin (default: 1)\n";
+        std::cout << "\t--integrand=area|moment     estimate the area (volume) of the region or the integral of x.x over it\n";
+        std::cout << "\t--target-error=E            stop once the confidence interval is within E of the estimate, relative to it;\n";
+        std::cout << "\t                            sample_count is then the most samples to draw (default: 0, draw them all)\n";
+        std::cout << "\t--confidence=C              confidence level of the interval, between 0 and 1 (default: 0.95)\n";
+        std::cout << "\t--sampling=random|sobol|halton|stratified|latin  points of every chunk: random, a scrambled Sobol or Halton\n";
+        std::cout << "\t                            sequence, one point per cell of a grid, or a Latin hypercube (default: random)\n";
+        std::cout << "\t--benchmark                 print the error and time of every sampling method for sample counts up to\n";
+        std::cout << "\t                            sample_count, over iteration_count seeds, as CSV\n";
+        std::cout << "\t--reference=V               exact value the benchmark measures the error against (default: the mean of\n";
+        std::cout << "\t                            the sobol estimates with sample_count samples)\n";
+        std::cout << "\t--trace=FILE                write a Chrome trace (chrome://tracing, ui.perfetto.dev) of every chunk and steal\n";
         std::exit(EXIT_FAILURE);
     }
 
@@ -143,63 +931,132 @@ int main(int argc, char *argv[]) {
     sorroundingShape.top = atoi(argv[5]);
 
     int number_of_iteration = atoi(argv[6]);
-    double total_running_time = 0;
-    
-    for (int i = 0; i < number_of_iteration; i++) {
-        total_running_time += getTimeForAreaEstimation(i, sampleCount);
+    parseOptions(argc, argv, 7);
+    prepareSampling();
+
+    // the threads are started once and serve every iteration
+    EstimationRunner runner;
+    runner.pool = createPool(THREAD_COUNT, PIN_THREADS);
+    if (TRACE_PATH != NULL) {
+        enablePoolTrace(runner.pool);
+    }
+    runner.iterationCount = number_of_iteration;
+    runner.sampleCount = sampleCount;
+    runner.totalRunningTime = 0;
+    monte_carlo::runWithIntegrand(INTEGRAND_OPTIONS, sorroundingShape.left, sorroundingShape.bottom, sorroundingShape.right,
+            sorroundingShape.top, runner);
+    if (TRACE_PATH != NULL && !writePoolTrace(runner.pool, TRACE_PATH)) {
+        std::cout << "Could not write the trace to " << TRACE_PATH << ".\n";
     }
+    destroyPool(runner.pool);
+    double total_running_time = runner.totalRunningTime;
 
+    if (CONVERGENCE_BENCHMARK) {
+        return 0;
+    }
     printf("\n\nAverage time taken to estimate area of the curve for %d iterations is: %f seconds\n", number_of_iteration, (total_running_time/number_of_iteration));
     return 0;
 }
 
-double getTimeForAreaEstimation(int iteration, long sampleCount) {
-    printf("Starting iteration -> %d\n\n", iteration);
-    
-    // starting execution timer clock
-    struct timeval start;
-    gettimeofday(&start, NULL);
+/**
+ * Resolves the kernel and the thread count and prints what the sampling will use.
+ * */
+void prepareSampling() {
+    int kernel = chooseSamplingKernel(SAMPLING_KERNEL);
+    if (kernel < 0) {
+        std::cout << "This processor does not support the " << KERNEL_NAMES[SAMPLING_KERNEL] << " kernel.\n";
+        std::exit(EXIT_FAILURE);
+    }
+    SAMPLING_KERNEL = (SamplingKernel) kernel;
+    if (THREAD_COUNT == 0) {
+        THREAD_COUNT = getHardwareThreadCount();
+    }
+    std::cout << "Sampling with the " << KERNEL_NAMES[SAMPLING_KERNEL] << " kernel on " << THREAD_COUNT << (PIN_THREADS ? " pinned" : "")
+            << " threads, seed " << SEED << ", region " << monte_carlo::getRegionName(INTEGRAND_OPTIONS) << ", "
+            << METHOD_NAMES[SAMPLING_METHOD] << " points" << std::endl << std::endl;
+}
 
-    pthread_t *threads;
-    ThreadArg *threadArgs;
-    long *insidePointsCountArray;
-    
-    threads = (pthread_t *) malloc(THREAD_COUNT * sizeof(pthread_t));
-    threadArgs = (ThreadArg *) malloc(THREAD_COUNT * sizeof(ThreadArg));
-    insidePointsCountArray = (long *) malloc(THREAD_COUNT * sizeof(long));
-    
-    for (int i = 0; i < THREAD_COUNT; i++) {
-        threadArgs[i].threadId = i;
-        threadArgs[i].sampleCount = sampleCount/THREAD_COUNT;
-        threadArgs[i].insidePointsCountArrayPointer = &insidePointsCountArray[i];
-        pthread_create(&threads[i], NULL, threadFunction, (void *) &threadArgs[i]);
+
+const char * getOptionValue(const char *argument, const char *name) {
+    size_t length = strlen(name);
+    if (strncmp(argument, name, length) == 0 && argument[length] == '=') {
+        return argument + length + 1;
     }
+    return NULL;
+}
 
-    for (int i = 0; i < THREAD_COUNT; i++) {
-            pthread_join(threads[i], NULL);
+
+void parseOptions(int argc, char *argv[], int firstOption) {
+    for (int i = firstOption; i < argc; i++) {
+        const char *value;
+        const char *error;
+        if ((value = getOptionValue(argv[i], "--threads")) != NULL) {
+            THREAD_COUNT = atoi(value);
+            if (THREAD_COUNT < 1) {
+                std::cout << "The thread count must be a positive integer.\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--pin") == 0) {
+            PIN_THREADS = true;
+        }
+        else if ((value = getOptionValue(argv[i], "--seed")) != NULL) {
+            SEED = strtoull(value, NULL, 10);
+        }
+        else if ((value = getOptionValue(argv[i], "--kernel")) != NULL) {
+            int kernel = findSamplingKernel(value);
+            if (kernel < 0) {
+                std::cout << "Unknown sampling kernel " << value << ".\n";
+                std::exit(EXIT_FAILURE);
+            }
+            SAMPLING_KERNEL = (SamplingKernel) kernel;
+        }
+        else if ((value = getOptionValue(argv[i], "--target-error")) != NULL) {
+            TARGET_ERROR = atof(value);
+            if (TARGET_ERROR <= 0) {
+                std::cout << "The target error must be a positive number.\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if ((value = getOptionValue(argv[i], "--sampling")) != NULL) {
+            int method = findSamplingMethod(value);
+            if (method < 0) {
+                std::cout << "Unknown sampling method " << value << ".\n";
+                std::exit(EXIT_FAILURE);
+            }
+            SAMPLING_METHOD = (SamplingMethod) method;
+        }
+        else if ((value = getOptionValue(argv[i], "--trace")) != NULL) {
+            TRACE_PATH = value;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            CONVERGENCE_BENCHMARK = true;
+        }
+        else if ((value = getOptionValue(argv[i], "--reference")) != NULL) {
+            REFERENCE_VALUE = atof(value);
+        }
+        else if ((value = getOptionValue(argv[i], "--confidence")) != NULL) {
+            CONFIDENCE = atof(value);
+            if (CONFIDENCE <= 0 || CONFIDENCE >= 1) {
+                std::cout << "The confidence must be between 0 and 1.\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if (monte_carlo::parseIntegrandOption(argv[i], &INTEGRAND_OPTIONS, &error)) {
+            if (error != NULL) {
+                std::cout << error << "\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            std::cout << "Unknown option " << argv[i] << ".\n";
+            std::exit(EXIT_FAILURE);
+        }
     }
 
-    
-    long totalInsidePointCount = 0;
-    for(int j = 0; j < THREAD_COUNT; j++) {
-        long* jThreadInsidePointsCountPointer = &insidePointsCountArray[j];
-        totalInsidePointCount += *jThreadInsidePointsCountPointer;
+    const char *error = monte_carlo::checkIntegrandOptions(INTEGRAND_OPTIONS);
+    if (error != NULL) {
+        std::cout << error << "\n";
+        std::exit(EXIT_FAILURE);
     }
-    
-    
-    double curveArea = estimateArea(totalInsidePointCount, sorroundingShape, sampleCount);
-    std::cout << "The estimated area is "<< curveArea << " unitSquare with samples " << sampleCount << " where " << totalInsidePointCount << " points were found inside target curve\n";
-     
-    
-    free(threads);
-    free(threadArgs);
-    free(insidePointsCountArray);
-    
-    //-------------------------------- calculate running time -------------------------------------------
-    struct timeval end;
-    gettimeofday(&end, NULL);
-    double runningTime = ((end.tv_sec + end.tv_usec / 1000000.0) - (start.tv_sec + start.tv_usec / 1000000.0));
-    std::cout << "Execution Time -> " << runningTime << " Seconds, for iteration -> " << iteration << std::endl << std::endl;
-    return runningTime;
 }
-
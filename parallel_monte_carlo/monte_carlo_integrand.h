@@ -0,0 +1,703 @@
+/**
+ * Regions and integrands for the Monte Carlo programs, and the sampling loop that estimates their volumes and integrals.
+ *
+ * An integrand is any type with a DIMENSIONS constant and a
+ *
+ *      float operator()(const float *point) const
+ *
+ * that gives its value at a point of DIMENSIONS coordinates. A region is the integrand that is 1 inside the region and 0
+ * outside, so the integral of a region is its area or volume. sampleChunk takes the integrand as a template parameter, so the
+ * integrand is inlined into the loop over the samples and a new shape costs no call per sample.
+ *
+ *      monte_carlo::Ellipse(centerX, centerY, radiusX, radiusY)      the inside of an ellipse
+ *      monte_carlo::Polygon(vertexCount, x, y)                       the inside of a simple polygon, by the even-odd rule
+ *      monte_carlo::makeImplicitRegion<D>(f)                         the points where f(point) <= 0
+ *      monte_carlo::Box<D>(lower, upper)                             an axis aligned box in D dimensions
+ *      monte_carlo::Ball<D>(center, radius)                          a ball in D dimensions
+ *      monte_carlo::makeFunction<D>(f)                               the function f itself, to integrate it over the sampling box
+ *      monte_carlo::restrictTo(region, f)                            f inside the region and 0 outside, to integrate f over it
+ *
+ * The samples are drawn uniformly from a SamplingDomain, a box that holds the region, and the integral is the volume of the box
+ * times the mean value of the integrand. They come from the counter-based streams of counter_rng.h: the samples are numbered
+ * and cut into chunks of CHUNK_SAMPLES, chunk c is drawn from stream c, and the coordinates of a sample are consecutive words of
+ * its stream. The sum over a chunk therefore depends only on the seed, the chunk and the integrand, whichever thread, rank or
+ * random kernel computes it. sampleChunk also returns the sum of squares, from which the standard error of the estimate follows.
+ *
+ * Instead of random points a chunk can hold one of the point sets of low_discrepancy.h, a scrambled Sobol or Halton sequence
+ * or a stratified or Latin hypercube sample. Those points are not independent, so the standard error then comes from the
+ * spread of the chunk means, which are (see addReplicate).
+ * */
+#ifndef MONTE_CARLO_INTEGRAND_H
+#define MONTE_CARLO_INTEGRAND_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "counter_rng.h"
+#include "low_discrepancy.h"
+
+namespace monte_carlo {
+
+// samples per chunk and per random stream. The chunk is also the unit of work of the threads and ranks, so it is a few
+// milliseconds of sampling
+const long CHUNK_SAMPLES = 1L << 20;
+
+// samples evaluated per buffer of random words; a multiple of the 64 words of a group of the streams
+const int BATCH_SAMPLES = 256;
+
+// independent partial sums of the integrand values, one vector of floats
+const int SUM_LANES = 8;
+
+
+template <int Dimensions>
+struct SamplingDomain {
+    float lower[Dimensions];
+    float upper[Dimensions];
+
+    double volume() const {
+        double volume = 1;
+        for (int k = 0; k < Dimensions; k++) {
+            volume *= (double) upper[k] - lower[k];
+        }
+        return volume;
+    }
+};
+
+
+/***************************************************************************************************************************************
+ *                        Regions
+ * *************************************************************************************************************************************/
+
+struct Ellipse {
+    static const int DIMENSIONS = 2;
+    float centerX;
+    float centerY;
+    // the ellipse is ((x - centerX) / radiusX)^2 + ((y - centerY) / radiusY)^2 <= 1, tested with multiplications by the inverses
+    float inverseXSquare;
+    float inverseYSquare;
+
+    Ellipse(float centerX, float centerY, float radiusX, float radiusY) : centerX(centerX), centerY(centerY),
+            inverseXSquare(1.0f / (radiusX * radiusX)), inverseYSquare(1.0f / (radiusY * radiusY)) {
+    }
+
+    float operator()(const float *point) const {
+        float x = point[0] - centerX;
+        float y = point[1] - centerY;
+        return (x * x * inverseXSquare + y * y * inverseYSquare <= 1.0f) ? 1.0f : 0.0f;
+    }
+};
+
+
+struct Polygon {
+    static const int DIMENSIONS = 2;
+    std::vector<float> x;
+    std::vector<float> y;
+
+    Polygon(int vertexCount, const float *vertexX, const float *vertexY) : x(vertexX, vertexX + vertexCount),
+            y(vertexY, vertexY + vertexCount) {
+    }
+
+    float operator()(const float *point) const {
+        // a point is inside when a ray from it towards +x crosses the edges an odd number of times
+        bool inside = false;
+        int vertexCount = (int) x.size();
+        for (int i = 0, j = vertexCount - 1; i < vertexCount; j = i++) {
+            if ((y[i] > point[1]) != (y[j] > point[1]) &&
+                    point[0] < (x[j] - x[i]) * (point[1] - y[i]) / (y[j] - y[i]) + x[i]) {
+                inside = !inside;
+            }
+        }
+        return inside ? 1.0f : 0.0f;
+    }
+};
+
+
+template <int Dimensions, typename Function>
+struct ImplicitRegion {
+    static const int DIMENSIONS = Dimensions;
+    Function function;
+
+    explicit ImplicitRegion(Function function) : function(function) {
+    }
+
+    float operator()(const float *point) const {
+        return (function(point) <= 0) ? 1.0f : 0.0f;
+    }
+};
+
+
+template <int Dimensions, typename Function>
+ImplicitRegion<Dimensions, Function> makeImplicitRegion(Function function) {
+    return ImplicitRegion<Dimensions, Function>(function);
+}
+
+
+template <int Dimensions>
+struct Box {
+    static const int DIMENSIONS = Dimensions;
+    float lower[Dimensions];
+    float upper[Dimensions];
+
+    Box(const float *lowerCorner, const float *upperCorner) {
+        memcpy(lower, lowerCorner, sizeof(lower));
+        memcpy(upper, upperCorner, sizeof(upper));
+    }
+
+    float operator()(const float *point) const {
+        bool inside = true;
+        for (int k = 0; k < Dimensions; k++) {
+            inside &= (point[k] >= lower[k]) & (point[k] <= upper[k]);
+        }
+        return inside ? 1.0f : 0.0f;
+    }
+};
+
+
+template <int Dimensions>
+struct Ball {
+    static const int DIMENSIONS = Dimensions;
+    float center[Dimensions];
+    float radiusSquare;
+
+    Ball(const float *ballCenter, float radius) : radiusSquare(radius * radius) {
+        memcpy(center, ballCenter, sizeof(center));
+    }
+
+    float operator()(const float *point) const {
+        float distanceSquare = 0;
+        for (int k = 0; k < Dimensions; k++) {
+            float difference = point[k] - center[k];
+            distanceSquare += difference * difference;
+        }
+        return (distanceSquare <= radiusSquare) ? 1.0f : 0.0f;
+    }
+};
+
+
+/***************************************************************************************************************************************
+ *                        Integrands
+ * *************************************************************************************************************************************/
+
+template <int Dimensions, typename Function>
+struct FunctionIntegrand {
+    static const int DIMENSIONS = Dimensions;
+    Function function;
+
+    explicit FunctionIntegrand(Function function) : function(function) {
+    }
+
+    float operator()(const float *point) const {
+        return function(point);
+    }
+};
+
+
+template <int Dimensions, typename Function>
+FunctionIntegrand<Dimensions, Function> makeFunction(Function function) {
+    return FunctionIntegrand<Dimensions, Function>(function);
+}
+
+
+template <typename Region, typename Function>
+struct RestrictedIntegrand {
+    static const int DIMENSIONS = Region::DIMENSIONS;
+    Region region;
+    Function function;
+
+    RestrictedIntegrand(const Region &region, Function function) : region(region), function(function) {
+    }
+
+    float operator()(const float *point) const {
+        return (region(point) != 0) ? function(point) : 0.0f;
+    }
+};
+
+
+template <typename Region, typename Function>
+RestrictedIntegrand<Region, Function> restrictTo(const Region &region, Function function) {
+    return RestrictedIntegrand<Region, Function>(region, function);
+}
+
+
+/***************************************************************************************************************************************
+ *                        Sampling
+ * *************************************************************************************************************************************/
+
+/**
+ * The sum and the sum of squares of the integrand over count samples, from which the mean and its standard error follow.
+ * */
+struct Moments {
+    double sum;
+    double sumOfSquares;
+    long count;
+};
+
+
+inline void addMoments(Moments *total, const Moments &part) {
+    total->sum += part.sum;
+    total->sumOfSquares += part.sumOfSquares;
+    total->count += part.count;
+}
+
+
+inline double getMean(const Moments &moments) {
+    return (moments.count > 0) ? moments.sum / moments.count : 0;
+}
+
+
+/**
+ * The standard error of the mean, from the unbiased sample variance.
+ * */
+inline double getStandardError(const Moments &moments) {
+    if (moments.count < 2) {
+        return INFINITY;
+    }
+    double mean = getMean(moments);
+    double variance = (moments.sumOfSquares - moments.sum * mean) / (moments.count - 1);
+    return sqrt((variance > 0 ? variance : 0) / moments.count);
+}
+
+
+/**
+ * Adds the mean of a chunk to the moments of the chunk means. Every chunk of a quasi-Monte Carlo or stratified point set is an
+ * independent estimate, so the standard error of the mean of these replicates is the error of the estimate.
+ * */
+inline void addReplicate(Moments *replicates, const Moments &chunk) {
+    double mean = getMean(chunk);
+    replicates->sum += mean;
+    replicates->sumOfSquares += mean * mean;
+    replicates->count++;
+}
+
+
+/**
+ * The z such that a normal variable lies within z standard deviations of its mean with the given probability, for example
+ * 1.96 for 0.95. Found by bisection, since erf is increasing.
+ * */
+inline double getNormalQuantile(double confidence) {
+    double low = 0;
+    double high = 40;
+    for (int i = 0; i < 100; i++) {
+        double middle = (low + high) / 2;
+        if (erf(middle / sqrt(2.0)) < confidence) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return (low + high) / 2;
+}
+
+
+/**
+ * The probability that a Student-t variable with the given degrees of freedom lies within t of 0, by the finite series of
+ * Abramowitz and Stegun 26.7.3 and 26.7.4 in theta = atan(t / sqrt(degreesOfFreedom)).
+ * */
+inline double getStudentProbability(double t, long degreesOfFreedom) {
+    double theta = atan(t / sqrt((double) degreesOfFreedom));
+    double cosineSquared = cos(theta) * cos(theta);
+    double term = 1;
+    double series = 1;
+    for (long k = (degreesOfFreedom % 2 == 1) ? 3 : 2; k <= degreesOfFreedom - 2; k += 2) {
+        term *= cosineSquared * (k - 1.0) / k;
+        series += term;
+    }
+    if (degreesOfFreedom % 2 == 0) {
+        return sin(theta) * series;
+    }
+    if (degreesOfFreedom == 1) {
+        return 2 * theta / M_PI;
+    }
+    return 2 / M_PI * (theta + sin(theta) * cos(theta) * series);
+}
+
+
+/**
+ * The t such that a Student-t variable with the given degrees of freedom lies within t of 0 with the given probability, for
+ * example 12.71 for 0.95 and one degree of freedom. Found by bisection for up to 30 degrees of freedom, and from the normal
+ * quantile by the Cornish-Fisher expansion in 1 / degreesOfFreedom above, where it is within 1e-5 of the exact value.
+ * */
+inline double getStudentQuantile(double confidence, long degreesOfFreedom) {
+    double z = getNormalQuantile(confidence);
+    if (degreesOfFreedom > 30) {
+        double n = (double) degreesOfFreedom;
+        double z2 = z * z;
+        return z + z * (z2 + 1) / (4 * n) + z * ((5 * z2 + 16) * z2 + 3) / (96 * n * n) +
+                z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) / (384 * n * n * n);
+    }
+    double low = z;
+    double high = 1e7;
+    for (int i = 0; i < 100; i++) {
+        double middle = (low + high) / 2;
+        if (getStudentProbability(middle, degreesOfFreedom) < confidence) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return (low + high) / 2;
+}
+
+
+/**
+ * The moments of the integrand over the first sampleCount samples of the chunk, with the random words of the given kernel and
+ * the points of the given method. This is the body of sampleChunk; it is inlined into one copy per instruction set.
+ * */
+template <typename Integrand>
+__attribute__((always_inline))
+inline Moments sumChunk(const Integrand &sharedIntegrand, const SamplingDomain<Integrand::DIMENSIONS> &domain, uint64_t seed,
+        uint64_t chunk, long sampleCount, SamplingKernel kernel, SamplingMethod method) {
+
+    const int dimensions = Integrand::DIMENSIONS;
+    // a private copy, so that the compiler knows that the stores of the values do not change the integrand's parameters
+    const Integrand integrand(sharedIntegrand);
+    // a batch of samples takes BATCH_SAMPLES * dimensions words, which are whole groups of the stream; coordinate k of sample i
+    // of the batch is words[k * BATCH_SAMPLES + i]
+    const int batchGroups = BATCH_SAMPLES * dimensions / PHILOX_GROUP_WORDS;
+    uint32_t words[BATCH_SAMPLES * dimensions];
+    uint32_t key[2] = { (uint32_t) seed, (uint32_t) (seed >> 32) };
+    ChunkSequence sequence;
+    if (method != RANDOM_SAMPLING) {
+        initChunkSequence(&sequence, method, dimensions, key, chunk, sampleCount);
+    }
+    float lower[dimensions];
+    float width[dimensions];
+    for (int k = 0; k < dimensions; k++) {
+        lower[k] = domain.lower[k];
+        width[k] = domain.upper[k] - domain.lower[k];
+    }
+
+    double sums[SUM_LANES] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    double squareSums[SUM_LANES] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    float values[BATCH_SAMPLES];
+    for (long first = 0; first < sampleCount; first += BATCH_SAMPLES) {
+        if (usesRandomWords(method)) {
+            fillRandomGroups(kernel, key, chunk, (uint32_t) (first / BATCH_SAMPLES * batchGroups), batchGroups, words);
+        }
+        if (method != RANDOM_SAMPLING) {
+            fillSequenceBatch(&sequence, first, BATCH_SAMPLES, words);
+        }
+        // the whole batch is evaluated, so that the loop has a fixed trip count and the compiler can vectorize it
+        for (int i = 0; i < BATCH_SAMPLES; i++) {
+            float point[dimensions];
+            for (int k = 0; k < dimensions; k++) {
+                point[k] = toUnitFloat(words[k * BATCH_SAMPLES + i]) * width[k] + lower[k];
+            }
+            values[i] = integrand(point);
+        }
+        int batchSamples = (sampleCount - first < BATCH_SAMPLES) ? (int) (sampleCount - first) : BATCH_SAMPLES;
+        for (int i = batchSamples; i < BATCH_SAMPLES; i++) {
+            values[i] = 0;
+        }
+        // SUM_LANES sums in a fixed order: the additions of a row of lanes are one vector addition, and the total is the same on
+        // every run. The values of a batch are added in float and the batch totals in double
+        float batchSums[SUM_LANES];
+        float batchSquareSums[SUM_LANES];
+        for (int lane = 0; lane < SUM_LANES; lane++) {
+            batchSums[lane] = values[lane];
+            batchSquareSums[lane] = values[lane] * values[lane];
+        }
+        for (int i = SUM_LANES; i < BATCH_SAMPLES; i += SUM_LANES) {
+            for (int lane = 0; lane < SUM_LANES; lane++) {
+                batchSums[lane] += values[i + lane];
+                batchSquareSums[lane] += values[i + lane] * values[i + lane];
+            }
+        }
+        for (int lane = 0; lane < SUM_LANES; lane++) {
+            sums[lane] += batchSums[lane];
+            squareSums[lane] += batchSquareSums[lane];
+        }
+    }
+
+    Moments moments;
+    moments.sum = ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+    moments.sumOfSquares = ((squareSums[0] + squareSums[1]) + (squareSums[2] + squareSums[3])) +
+            ((squareSums[4] + squareSums[5]) + (squareSums[6] + squareSums[7]));
+    moments.count = sampleCount;
+    return moments;
+}
+
+
+#ifdef COUNTER_RNG_X86
+
+/**
+ * sumChunk compiled for AVX2 and AVX-512, whose vectors hold 8 and 16 samples instead of 4. Contracting a multiplication and an
+ * addition into a fused multiply-add would round differently from the baseline copy, so it is turned off and every copy
+ * gives the same moments.
+ * */
+template <typename Integrand>
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+Moments sumChunkAvx2(const Integrand &integrand, const SamplingDomain<Integrand::DIMENSIONS> &domain, uint64_t seed,
+        uint64_t chunk, long sampleCount, SamplingMethod method) {
+    return sumChunk(integrand, domain, seed, chunk, sampleCount, AVX2_KERNEL, method);
+}
+
+
+template <typename Integrand>
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+Moments sumChunkAvx512(const Integrand &integrand, const SamplingDomain<Integrand::DIMENSIONS> &domain, uint64_t seed,
+        uint64_t chunk, long sampleCount, SamplingMethod method) {
+    return sumChunk(integrand, domain, seed, chunk, sampleCount, AVX512_KERNEL, method);
+}
+
+#endif
+
+
+/**
+ * The moments of the integrand over the first sampleCount samples of the chunk; the random words are generated with the given
+ * kernel, and with a method other than random sampling they place the points of that method's point set. The integrand is
+ * evaluated with the same operations whatever the kernel, so the moments are the same for every kernel.
+ * */
+template <typename Integrand>
+Moments sampleChunk(const Integrand &integrand, const SamplingDomain<Integrand::DIMENSIONS> &domain, uint64_t seed,
+        uint64_t chunk, long sampleCount, SamplingKernel kernel, SamplingMethod method = RANDOM_SAMPLING) {
+#ifdef COUNTER_RNG_X86
+    if (kernel == AVX512_KERNEL) {
+        return sumChunkAvx512(integrand, domain, seed, chunk, sampleCount, method);
+    }
+    if (kernel == AVX2_KERNEL) {
+        return sumChunkAvx2(integrand, domain, seed, chunk, sampleCount, method);
+    }
+#endif
+    return sumChunk(integrand, domain, seed, chunk, sampleCount, SCALAR_KERNEL, method);
+}
+
+
+/**
+ * The number of samples of chunk out of totalSampleCount samples; only the last chunk can be short.
+ * */
+inline long getChunkSampleCount(long chunk, long totalSampleCount) {
+    long chunkStart = chunk * CHUNK_SAMPLES;
+    return (totalSampleCount - chunkStart < CHUNK_SAMPLES) ? totalSampleCount - chunkStart : CHUNK_SAMPLES;
+}
+
+
+inline long getChunkCount(long totalSampleCount) {
+    return (totalSampleCount + CHUNK_SAMPLES - 1) / CHUNK_SAMPLES;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Built-in integrands of the command line
+ *
+ * Both programs take the same --region, --integrand, --vertices, --dimensions and --radius options, and runWithIntegrand hands
+ * the integrand they describe to a visitor with a templated operator(). Each combination is instantiated once here, so the
+ * choice is a single switch before sampling starts.
+ * *************************************************************************************************************************************/
+
+typedef enum {
+    ELLIPSE_REGION,
+    POLYGON_REGION,
+    SUPERELLIPSE_REGION,
+    BALL_REGION
+} RegionKind;
+
+typedef enum {
+    AREA_INTEGRAND,
+    MOMENT_INTEGRAND
+} IntegrandKind;
+
+const int MAX_DIMENSIONS = 8;
+
+typedef struct {
+    RegionKind region;
+    IntegrandKind integrand;
+    std::vector<float> vertexX;
+    std::vector<float> vertexY;
+    int dimensions;
+    float radius;
+} IntegrandOptions;
+
+
+inline IntegrandOptions getDefaultIntegrandOptions() {
+    IntegrandOptions options;
+    options.region = ELLIPSE_REGION;
+    options.integrand = AREA_INTEGRAND;
+    options.dimensions = 3;
+    options.radius = 1;
+    return options;
+}
+
+
+inline const char *getRegionName(const IntegrandOptions &options) {
+    static const char *names[] = { "ellipse", "polygon", "superellipse", "ball" };
+    return names[options.region];
+}
+
+
+/**
+ * Reads argument if it is one of the integrand options; returns false if it is not. A bad value sets *error to a message.
+ * */
+inline bool parseIntegrandOption(const char *argument, IntegrandOptions *options, const char **error) {
+
+    *error = NULL;
+    if (strncmp(argument, "--region=", 9) == 0) {
+        const char *value = argument + 9;
+        static const char *names[] = { "ellipse", "polygon", "superellipse", "ball" };
+        int region = 0;
+        while (region <= BALL_REGION && strcmp(value, names[region]) != 0) {
+            region++;
+        }
+        if (region > BALL_REGION) {
+            *error = "Unknown region.";
+        }
+        options->region = (RegionKind) region;
+    }
+    else if (strncmp(argument, "--integrand=", 12) == 0) {
+        const char *value = argument + 12;
+        if (strcmp(value, "area") == 0) {
+            options->integrand = AREA_INTEGRAND;
+        }
+        else if (strcmp(value, "moment") == 0) {
+            options->integrand = MOMENT_INTEGRAND;
+        }
+        else {
+            *error = "Unknown integrand.";
+        }
+    }
+    else if (strncmp(argument, "--vertices=", 11) == 0) {
+        options->vertexX.clear();
+        options->vertexY.clear();
+        const char *value = argument + 11;
+        while (*value != '\0') {
+            char *end;
+            float x = strtof(value, &end);
+            if (end == value || *end != ',') {
+                *error = "The vertices must be given as X,Y,X,Y,...";
+                return true;
+            }
+            value = end + 1;
+            float y = strtof(value, &end);
+            if (end == value || (*end != ',' && *end != '\0')) {
+                *error = "The vertices must be given as X,Y,X,Y,...";
+                return true;
+            }
+            options->vertexX.push_back(x);
+            options->vertexY.push_back(y);
+            value = (*end == ',') ? end + 1 : end;
+        }
+        if (options->vertexX.size() < 3) {
+            *error = "A polygon needs at least 3 vertices.";
+        }
+    }
+    else if (strncmp(argument, "--dimensions=", 13) == 0) {
+        options->dimensions = atoi(argument + 13);
+        if (options->dimensions < 2 || options->dimensions > MAX_DIMENSIONS) {
+            *error = "The ball dimensions must be between 2 and 8.";
+        }
+    }
+    else if (strncmp(argument, "--radius=", 9) == 0) {
+        options->radius = strtof(argument + 9, NULL);
+        if (!(options->radius > 0)) {
+            *error = "The radius must be positive.";
+        }
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Checks the options that only make sense together; returns a message, or NULL when they are fine.
+ * */
+inline const char *checkIntegrandOptions(const IntegrandOptions &options) {
+    if (options.region == POLYGON_REGION && options.vertexX.size() < 3) {
+        return "--region=polygon needs the vertices of the polygon in --vertices.";
+    }
+    return NULL;
+}
+
+
+/**
+ * The sampling domain of a region: the first coordinate spans [left, right] and every other one [bottom, top].
+ * */
+template <int Dimensions>
+SamplingDomain<Dimensions> makeSamplingDomain(float left, float bottom, float right, float top) {
+    SamplingDomain<Dimensions> domain;
+    for (int k = 0; k < Dimensions; k++) {
+        domain.lower[k] = (k == 0) ? left : bottom;
+        domain.upper[k] = (k == 0) ? right : top;
+    }
+    return domain;
+}
+
+
+// the square of the distance from the origin; its integral over a region is the region's polar moment of inertia
+template <int Dimensions>
+struct SquareDistance {
+    float operator()(const float *point) const {
+        float distanceSquare = 0;
+        for (int k = 0; k < Dimensions; k++) {
+            distanceSquare += point[k] * point[k];
+        }
+        return distanceSquare;
+    }
+};
+
+
+// |x / 100|^4 + |y / 50|^4 - 1, a superellipse that fits in the bounding box of the assignment's ellipse
+struct Superellipse {
+    float operator()(const float *point) const {
+        float x = point[0] * (1.0f / 100) * (point[0] * (1.0f / 100));
+        float y = point[1] * (1.0f / 50) * (point[1] * (1.0f / 50));
+        return x * x + y * y - 1.0f;
+    }
+};
+
+
+template <typename Region, typename Visitor>
+void runWithRegion(const Region &region, const IntegrandOptions &options, const SamplingDomain<Region::DIMENSIONS> &domain,
+        Visitor &visitor) {
+    if (options.integrand == MOMENT_INTEGRAND) {
+        visitor(restrictTo(region, SquareDistance<Region::DIMENSIONS>()), domain);
+    }
+    else {
+        visitor(region, domain);
+    }
+}
+
+
+template <int Dimensions, typename Visitor>
+void runWithBall(const IntegrandOptions &options, float left, float bottom, float right, float top, Visitor &visitor) {
+    if (options.dimensions != Dimensions) {
+        runWithBall<(Dimensions < MAX_DIMENSIONS ? Dimensions + 1 : 2)>(options, left, bottom, right, top, visitor);
+        return;
+    }
+    float center[Dimensions] = { 0 };
+    runWithRegion(Ball<Dimensions>(center, options.radius), options, makeSamplingDomain<Dimensions>(left, bottom, right, top),
+            visitor);
+}
+
+
+/**
+ * Calls visitor(integrand, domain) with the integrand described by the options, sampled in the box [left, right] x
+ * [bottom, top] (for a ball, [left, right] x [bottom, top]^(dimensions - 1)).
+ * */
+template <typename Visitor>
+void runWithIntegrand(const IntegrandOptions &options, float left, float bottom, float right, float top, Visitor &visitor) {
+    SamplingDomain<2> plane = makeSamplingDomain<2>(left, bottom, right, top);
+    switch (options.region) {
+        case POLYGON_REGION:
+            runWithRegion(Polygon((int) options.vertexX.size(), options.vertexX.data(), options.vertexY.data()), options, plane,
+                    visitor);
+            break;
+        case SUPERELLIPSE_REGION:
+            runWithRegion(makeImplicitRegion<2>(Superellipse()), options, plane, visitor);
+            break;
+        case BALL_REGION:
+            runWithBall<2>(options, left, bottom, right, top, visitor);
+            break;
+        default:
+            // the curve of the assignment, x^2 / 10000 + y^2 / 2500 = 1
+            runWithRegion(Ellipse(0, 0, 100, 50), options, plane, visitor);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,482 @@
+/**
+ * A persistent pool of worker threads that runs jobs of independent items by work stealing.
+ *
+ * The threads are created once and wait between jobs, so repeated jobs do not pay for thread creation. A job of itemCount
+ * items starts with every worker owning an equal range of the items; a worker takes grain items at a time from the front of
+ * its own range, and when its range is empty it steals the back half of the largest range left, so a slow or preempted
+ * worker only delays the job by the items it is running. Every item is run exactly once whatever the split.
+ *
+ * The ranges are guarded by a mutex per worker: an item is a large piece of work (a chunk of samples), so the locks are taken
+ * a few hundred times per second per worker and a lock-free deque would not be measurable.
+ *
+ * Every worker keeps its statistics in its own cache line: the items it ran, its steals, its busy and idle time and a histogram
+ * of the latency of its task calls, which cost two clock reads per call. With enablePoolTrace the workers also record every
+ * task call and steal, and writePoolTrace saves them as a Chrome trace (chrome://tracing or ui.perfetto.dev) with a row per
+ * worker and a row for the jobs.
+ * */
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+// runs the items [begin, end) of the current job on worker workerId
+typedef void (*PoolTask)(void *context, int workerId, long begin, long end);
+
+// bucket b of the latency histograms counts the task calls of [2^b, 2^(b+1)) microseconds, the first one also the shorter ones
+#define POOL_LATENCY_BUCKETS 24
+
+typedef enum {
+    POOL_TASK_EVENT,
+    POOL_STEAL_EVENT,
+    POOL_JOB_EVENT
+} PoolEventKind;
+
+/**
+ * An entry of the trace: a task call on the items [first, last), a steal of last items from worker first, or a job of last
+ * items. The times are seconds since the pool was created.
+ * */
+typedef struct {
+    PoolEventKind kind;
+    double start;
+    double end;
+    long first;
+    long last;
+} PoolTraceEvent;
+
+typedef struct {
+    PoolTraceEvent *events;
+    long count;
+    long capacity;
+} PoolTrace;
+
+/**
+ * A worker's range of items and its statistics for the last job; aligned to a cache line so that the workers do not share one.
+ * */
+typedef struct {
+    pthread_mutex_t lock;
+    long next;
+    long end;
+    long itemsRun;
+    long steals;
+    double busySeconds;
+    double idleSeconds;
+    long latencyCounts[POOL_LATENCY_BUCKETS];
+    PoolTrace trace;
+} __attribute__((aligned(64))) PoolWorker;
+
+typedef struct WorkStealingPool {
+    int threadCount;
+    bool pinThreads;
+    pthread_t *threads;
+    PoolWorker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;
+    pthread_cond_t jobDone;
+    long generation;
+    int finishedWorkers;
+    bool stopping;
+
+    // the current job
+    PoolTask task;
+    void *context;
+    long grain;
+    long itemCount;
+    double jobStart;
+
+    double createdAt;
+    bool tracing;
+    // the jobs, recorded by the thread that runs them
+    PoolTrace jobTrace;
+} WorkStealingPool;
+
+typedef struct {
+    WorkStealingPool *pool;
+    int workerId;
+} PoolThreadArg;
+
+
+static inline double getPoolTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static inline void addTraceEvent(PoolTrace *trace, PoolEventKind kind, double start, double end, long first, long last) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = (trace->capacity > 0) ? 2 * trace->capacity : 1024;
+        trace->events = (PoolTraceEvent *) realloc(trace->events, trace->capacity * sizeof(PoolTraceEvent));
+        if (trace->events == NULL) {
+            printf("Could not allocate the trace of the thread pool.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    PoolTraceEvent *event = &trace->events[trace->count++];
+    event->kind = kind;
+    event->start = start;
+    event->end = end;
+    event->first = first;
+    event->last = last;
+}
+
+
+/**
+ * The histogram bucket of a task call of the given length.
+ * */
+static inline int getLatencyBucket(double seconds) {
+    long microseconds = (long) (seconds * 1e6);
+    int bucket = 0;
+    while (microseconds > 1 && bucket < POOL_LATENCY_BUCKETS - 1) {
+        microseconds >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+
+/**
+ * The number of processors the process may run on, the default size of a pool.
+ * */
+static inline int getHardwareThreadCount() {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0) {
+        return CPU_COUNT(&allowed);
+    }
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return (processors > 0) ? (int) processors : 1;
+}
+
+
+/**
+ * Pins the calling thread to the workerId-th processor the process may run on, wrapping around when there are more workers.
+ * */
+static inline void pinToProcessor(int workerId) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    int index = workerId % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+            cpu_set_t single;
+            CPU_ZERO(&single);
+            CPU_SET(cpu, &single);
+            pthread_setaffinity_np(pthread_self(), sizeof(single), &single);
+            return;
+        }
+    }
+}
+
+
+/**
+ * Takes up to grain items from the front of the worker's own range; returns false when the range is empty.
+ * */
+static inline bool takeOwnItems(PoolWorker *worker, long grain, long *begin, long *end) {
+    pthread_mutex_lock(&worker->lock);
+    bool found = worker->next < worker->end;
+    if (found) {
+        *begin = worker->next;
+        *end = (worker->end - worker->next > grain) ? worker->next + grain : worker->end;
+        __atomic_store_n(&worker->next, *end, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+
+/**
+ * Moves the back half of the largest range of the other workers into the worker's own range; returns false when every range is
+ * empty, which ends the worker's part of the job. Items in flight between two workers always belong to the thief, so a worker
+ * that finds nothing left can stop.
+ * */
+static inline bool stealItems(WorkStealingPool *pool, int workerId) {
+    while (true) {
+        int victim = -1;
+        long largest = 0;
+        for (int i = 1; i < pool->threadCount; i++) {
+            int candidate = (workerId + i) % pool->threadCount;
+            // an unlocked look to pick the victim; the range is checked again under its lock
+            long remaining = __atomic_load_n(&pool->workers[candidate].end, __ATOMIC_RELAXED) -
+                    __atomic_load_n(&pool->workers[candidate].next, __ATOMIC_RELAXED);
+            if (remaining > largest) {
+                largest = remaining;
+                victim = candidate;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+
+        PoolWorker *target = &pool->workers[victim];
+        pthread_mutex_lock(&target->lock);
+        long remaining = target->end - target->next;
+        long stolenBegin = target->end - (remaining + 1) / 2;
+        long stolenEnd = target->end;
+        if (remaining > 0) {
+            __atomic_store_n(&target->end, stolenBegin, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&target->lock);
+
+        if (remaining > 0) {
+            PoolWorker *worker = &pool->workers[workerId];
+            pthread_mutex_lock(&worker->lock);
+            __atomic_store_n(&worker->next, stolenBegin, __ATOMIC_RELAXED);
+            __atomic_store_n(&worker->end, stolenEnd, __ATOMIC_RELAXED);
+            worker->steals++;
+            pthread_mutex_unlock(&worker->lock);
+            if (pool->tracing) {
+                double now = getPoolTime() - pool->createdAt;
+                addTraceEvent(&worker->trace, POOL_STEAL_EVENT, now, now, victim, stolenEnd - stolenBegin);
+            }
+            return true;
+        }
+        // the victim emptied its range meanwhile; look again
+    }
+}
+
+
+static inline void *poolThreadFunction(void *arg) {
+
+    PoolThreadArg *argument = (PoolThreadArg *) arg;
+    WorkStealingPool *pool = argument->pool;
+    int workerId = argument->workerId;
+    free(argument);
+
+    if (pool->pinThreads) {
+        pinToProcessor(workerId);
+    }
+
+    PoolWorker *worker = &pool->workers[workerId];
+    long seenGeneration = 0;
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seenGeneration && !pool->stopping) {
+            pthread_cond_wait(&pool->jobReady, &pool->lock);
+        }
+        if (pool->stopping) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seenGeneration = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        long begin, end;
+        do {
+            while (takeOwnItems(worker, pool->grain, &begin, &end)) {
+                double taskStart = getPoolTime();
+                pool->task(pool->context, workerId, begin, end);
+                double taskEnd = getPoolTime();
+                worker->busySeconds += taskEnd - taskStart;
+                worker->itemsRun += end - begin;
+                worker->latencyCounts[getLatencyBucket(taskEnd - taskStart)]++;
+                if (pool->tracing) {
+                    addTraceEvent(&worker->trace, POOL_TASK_EVENT, taskStart - pool->createdAt, taskEnd - pool->createdAt, begin,
+                            end);
+                }
+            }
+        } while (stealItems(pool, workerId));
+
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finishedWorkers == pool->threadCount) {
+            pthread_cond_signal(&pool->jobDone);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+/**
+ * Starts a pool of threadCount threads; with pinThreads every thread is pinned to its own processor.
+ * */
+static inline WorkStealingPool *createPool(int threadCount, bool pinThreads) {
+
+    WorkStealingPool *pool = (WorkStealingPool *) malloc(sizeof(WorkStealingPool));
+    memset(pool, 0, sizeof(WorkStealingPool));
+    pool->threadCount = threadCount;
+    pool->pinThreads = pinThreads;
+    pool->createdAt = getPoolTime();
+    pool->threads = (pthread_t *) malloc(threadCount * sizeof(pthread_t));
+    if (posix_memalign((void **) &pool->workers, 64, threadCount * sizeof(PoolWorker)) != 0) {
+        printf("Could not allocate the workers of the thread pool.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(pool->workers, 0, threadCount * sizeof(PoolWorker));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->jobReady, NULL);
+    pthread_cond_init(&pool->jobDone, NULL);
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+        PoolThreadArg *argument = (PoolThreadArg *) malloc(sizeof(PoolThreadArg));
+        argument->pool = pool;
+        argument->workerId = i;
+        if (pthread_create(&pool->threads[i], NULL, poolThreadFunction, argument) != 0) {
+            printf("Could not start thread %d of the thread pool.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+
+/**
+ * Starts running task on the items [0, itemCount), grain items per call, and returns at once; the caller may do other work
+ * before it waits for the job with waitPool, and isPoolDone tells whether the workers are done.
+ * */
+static inline void startPool(WorkStealingPool *pool, long itemCount, long grain, PoolTask task, void *context) {
+
+    for (int i = 0; i < pool->threadCount; i++) {
+        PoolWorker *worker = &pool->workers[i];
+        worker->next = itemCount * i / pool->threadCount;
+        worker->end = itemCount * (i + 1) / pool->threadCount;
+        worker->itemsRun = 0;
+        worker->steals = 0;
+        worker->busySeconds = 0;
+        worker->idleSeconds = 0;
+        memset(worker->latencyCounts, 0, sizeof(worker->latencyCounts));
+    }
+
+    pool->itemCount = itemCount;
+    pool->jobStart = getPoolTime();
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->grain = (grain > 0) ? grain : 1;
+    pool->finishedWorkers = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->jobReady);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static inline bool isPoolDone(WorkStealingPool *pool) {
+
+    pthread_mutex_lock(&pool->lock);
+    bool done = (pool->finishedWorkers == pool->threadCount);
+    pthread_mutex_unlock(&pool->lock);
+    return done;
+}
+
+
+/**
+ * Waits for the job started by startPool. The statistics of the workers then describe this job: idleSeconds is the part of the
+ * job's wall time a worker did not spend in the task.
+ * */
+static inline void waitPool(WorkStealingPool *pool) {
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->finishedWorkers < pool->threadCount) {
+        pthread_cond_wait(&pool->jobDone, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    double jobEnd = getPoolTime();
+    for (int i = 0; i < pool->threadCount; i++) {
+        pool->workers[i].idleSeconds = (jobEnd - pool->jobStart) - pool->workers[i].busySeconds;
+    }
+    if (pool->tracing) {
+        addTraceEvent(&pool->jobTrace, POOL_JOB_EVENT, pool->jobStart - pool->createdAt, jobEnd - pool->createdAt, 0,
+                pool->itemCount);
+    }
+}
+
+
+/**
+ * Runs task on the items [0, itemCount), grain items per call, and returns when all of them have run.
+ * */
+static inline void runPool(WorkStealingPool *pool, long itemCount, long grain, PoolTask task, void *context) {
+    startPool(pool, itemCount, grain, task, context);
+    waitPool(pool);
+}
+
+
+/**
+ * Starts recording the task calls, steals and jobs of the pool for writePoolTrace. Call it between jobs.
+ * */
+static inline void enablePoolTrace(WorkStealingPool *pool) {
+    pool->tracing = true;
+}
+
+
+static inline void writeTraceEvents(FILE *file, const PoolTrace *trace, int threadId, bool *first) {
+    for (long i = 0; i < trace->count; i++) {
+        const PoolTraceEvent *event = &trace->events[i];
+        fprintf(file, "%s\n", *first ? "" : ",");
+        *first = false;
+        // the trace format counts in microseconds
+        double start = event->start * 1e6;
+        if (event->kind == POOL_TASK_EVENT) {
+            char name[64];
+            if (event->last - event->first == 1) {
+                snprintf(name, sizeof(name), "item %ld", event->first);
+            } else {
+                snprintf(name, sizeof(name), "items %ld-%ld", event->first, event->last - 1);
+            }
+            fprintf(file, "{\"name\":\"%s\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"first\":%ld,\"end\":%ld}}", name, threadId, start, (event->end - event->start) * 1e6,
+                    event->first, event->last);
+        } else if (event->kind == POOL_STEAL_EVENT) {
+            fprintf(file, "{\"name\":\"steal\",\"cat\":\"steal\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+                    "\"args\":{\"victim\":%ld,\"items\":%ld}}", threadId, start, event->first, event->last);
+        } else {
+            fprintf(file, "{\"name\":\"job\",\"cat\":\"job\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"items\":%ld}}", threadId, start, (event->end - event->start) * 1e6, event->last);
+        }
+    }
+}
+
+
+/**
+ * Writes the recorded events as a Chrome trace JSON file; returns false when the file cannot be written.
+ * */
+static inline bool writePoolTrace(const WorkStealingPool *pool, const char *path) {
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    for (int i = 0; i <= pool->threadCount; i++) {
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                first ? "" : ",", i, (i < pool->threadCount) ? "worker" : "jobs", i);
+        first = false;
+    }
+    for (int i = 0; i < pool->threadCount; i++) {
+        writeTraceEvents(file, &pool->workers[i].trace, i, &first);
+    }
+    writeTraceEvents(file, &pool->jobTrace, pool->threadCount, &first);
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+
+static inline void destroyPool(WorkStealingPool *pool) {
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->jobReady);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].trace.events);
+    }
+    free(pool->jobTrace.events);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->jobReady);
+    pthread_cond_destroy(&pool->jobDone);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
+
+#endif
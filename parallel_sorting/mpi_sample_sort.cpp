@@ -0,0 +1,740 @@
+/**
+ * Sorts the first count integers of a file across MPI ranks with a distributed sample sort.
+ *
+ * Every rank reads its own slice of the input: a binary array file is split by key index and a text file by byte range of the
+ * text of the first count keys, where a number belongs to the rank whose range holds its first byte. Each rank sorts its keys with the parallel sort library and
+ * contributes p - 1 regularly spaced samples; all ranks gather the samples and pick the same p - 1 splitters from them. The
+ * splitters cut every local array into p buckets, MPI_Alltoallv sends bucket r to rank r, and every rank merges the p sorted
+ * runs it received. Rank r then holds the r-th part of the sorted array.
+ *
+ * The result is gathered and printed by rank 0, written as one sorted file per rank, or reduced to a checksum. The time of every
+ * phase is measured on each rank and rank 0 prints its minimum, mean and maximum over the ranks.
+ *
+ * Usage: mpirun -np N ./mpi_sample_sort.o input-file-name count-of-the-number-of-integers-to-sort [options]
+ * */
+#include <mpi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "random_array.h"
+#include "parallel_sort.h"
+
+// the sort engines of the local sort that can be selected with the --sort option
+typedef enum {
+	SAMPLE_SORT_ENGINE,
+	RADIX_SORT_ENGINE
+} SortEngine;
+
+// the output formats that can be selected with the --output option
+typedef enum {
+	TEXT_OUTPUT,
+	BINARY_OUTPUT,
+	CHECKSUM_OUTPUT
+} OutputMode;
+
+typedef enum {
+	READ_PHASE,
+	LOCAL_SORT_PHASE,
+	SPLITTER_PHASE,
+	EXCHANGE_PHASE,
+	MERGE_PHASE,
+	OUTPUT_PHASE,
+	PHASE_COUNT
+} Phase;
+
+static const char *PHASE_NAMES[PHASE_COUNT] = { "read", "local sort", "splitters", "exchange", "merge", "output" };
+
+// keys formatted in one step of the text output
+#define OUTPUT_BLOCK_KEYS (1 << 18)
+
+// the number of threads of the local sort of every rank
+int THREAD_COUNT = 1;
+SortEngine SORT_ENGINE = SAMPLE_SORT_ENGINE;
+int RADIX_BITS = 8;
+OutputMode OUTPUT_MODE = TEXT_OUTPUT;
+// the gathered output goes to standard output unless an output file is given; per-rank files are named OUTPUT_FILE.rank
+const char *OUTPUT_FILE = NULL;
+bool PER_RANK_OUTPUT = false;
+
+int RANK = 0;
+int RANK_COUNT = 1;
+
+
+void printUsage() {
+	printf("Usage: mpirun -np N ./mpi_sample_sort.o input-file-name count-of-the-number-of-integers-to-sort [options]\n");
+	printf("Options:\n");
+	printf("\t--threads=N                             threads of the local sort of every rank (default: 1)\n");
+	printf("\t--sort=samplesort|radix                 local sort engine (default: samplesort)\n");
+	printf("\t--radix-bits=8|11                       digit width of the radix sort (default: 8)\n");
+	printf("\t--output=text|binary|checksum           how the sorted array is written (default: text)\n");
+	printf("\t--output-file=PATH                      write the sorted array to a file instead of standard output\n");
+	printf("\t--per-rank                              every rank writes its part to PATH.rank instead of gathering to rank 0\n");
+}
+
+
+/**
+ * Ends all ranks after printing the message. When everyone is true the error was found by this rank alone, so it prints the
+ * message and aborts the other ranks; otherwise all ranks call this together and rank 0 prints the message.
+ * */
+void exitWithError(const char *message, bool everyone) {
+	if ((everyone || RANK == 0) && message[0] != '\0') {
+		printf("%s\n", message);
+		fflush(stdout);
+	}
+	if (everyone) {
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	MPI_Finalize();
+	exit(1);
+}
+
+
+void parseOptions(int argc, char *argv[]) {
+
+	for (int i = 3; i < argc; i++) {
+		const char *value;
+		if ((value = getOptionValue(argv[i], "--threads")) != NULL) {
+			THREAD_COUNT = atoi(value);
+			if (THREAD_COUNT < 1) {
+				exitWithError("The thread count must be a positive integer.", false);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--sort")) != NULL) {
+			if (strcmp(value, "samplesort") == 0) {
+				SORT_ENGINE = SAMPLE_SORT_ENGINE;
+			}
+			else if (strcmp(value, "radix") == 0) {
+				SORT_ENGINE = RADIX_SORT_ENGINE;
+			}
+			else {
+				exitWithError("Unknown sort engine.", false);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--radix-bits")) != NULL) {
+			RADIX_BITS = atoi(value);
+			if (RADIX_BITS != 8 && RADIX_BITS != 11) {
+				exitWithError("The radix digit width must be 8 or 11 bits.", false);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--output")) != NULL) {
+			if (strcmp(value, "text") == 0) {
+				OUTPUT_MODE = TEXT_OUTPUT;
+			}
+			else if (strcmp(value, "binary") == 0) {
+				OUTPUT_MODE = BINARY_OUTPUT;
+			}
+			else if (strcmp(value, "checksum") == 0) {
+				OUTPUT_MODE = CHECKSUM_OUTPUT;
+			}
+			else {
+				exitWithError("Unknown output format.", false);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--output-file")) != NULL) {
+			OUTPUT_FILE = value;
+		}
+		else if (strcmp(argv[i], "--per-rank") == 0) {
+			PER_RANK_OUTPUT = true;
+		}
+		else {
+			if (RANK == 0) {
+				printf("Unknown option %s.\n", argv[i]);
+				printUsage();
+			}
+			exitWithError("", false);
+		}
+	}
+
+	if (PER_RANK_OUTPUT && (OUTPUT_FILE == NULL || OUTPUT_MODE == CHECKSUM_OUTPUT)) {
+		exitWithError("--per-rank needs --output-file and a text or binary output.", false);
+	}
+}
+
+
+/***************************************************************************************************************************************
+ *                        Reading the slice of a rank
+ * *************************************************************************************************************************************/
+
+/**
+ * Parses the numbers that start in data[start, end) into a new array and returns their count. A number may run past end; the
+ * number that starts before start and runs into the range belongs to the previous rank.
+ * */
+long parseSlice(const unsigned char *data, size_t size, size_t start, size_t end, int **keys) {
+
+	size_t position = start;
+	if (position > 0) {
+		while (position < size && !isSeparator(data[position - 1]) && position < end) {
+			position++;
+		}
+	}
+
+	// a number takes at least two bytes with its separator, except for the last one of the file
+	long capacity = (long) ((end - position) / 2 + 1);
+	int *values = (int *) malloc(capacity * sizeof(int));
+	long count = 0;
+
+	while (true) {
+		while (position < end && isSeparator(data[position])) {
+			position++;
+		}
+		if (position >= end) {
+			break;
+		}
+
+		bool negative = false;
+		if (data[position] == '-' || data[position] == '+') {
+			negative = (data[position] == '-');
+			position++;
+		}
+		size_t digitStart = position;
+		long long magnitude = 0;
+		while (position < size && data[position] >= '0' && data[position] <= '9' && magnitude <= 2147483648LL) {
+			magnitude = magnitude * 10 + (data[position] - '0');
+			position++;
+		}
+		if (position == digitStart || (position < size && !isSeparator(data[position]))
+				|| magnitude > (negative ? 2147483648LL : 2147483647LL)) {
+			exitWithError("Some error happened when reading numbers from file: the input holds something that is not an int.", true);
+		}
+		values[count++] = negative ? (int) -magnitude : (int) magnitude;
+	}
+
+	*keys = values;
+	return count;
+}
+
+
+/**
+ * The number of numbers that start in data[start, end).
+ * */
+long countSliceNumbers(const unsigned char *data, size_t start, size_t end) {
+	long count = 0;
+	bool previousSeparator = (start == 0 || isSeparator(data[start - 1]));
+	for (size_t position = start; position < end; position++) {
+		bool separator = isSeparator(data[position]);
+		count += (previousSeparator && !separator);
+		previousSeparator = separator;
+	}
+	return count;
+}
+
+
+/**
+ * The position just after the number-th (from 1) number that starts in data[start, end).
+ * */
+size_t findNumberEnd(const unsigned char *data, size_t size, size_t start, size_t end, long number) {
+	bool previousSeparator = (start == 0 || isSeparator(data[start - 1]));
+	size_t position = start;
+	for (; position < end; position++) {
+		bool separator = isSeparator(data[position]);
+		if (previousSeparator && !separator && --number == 0) {
+			break;
+		}
+		previousSeparator = separator;
+	}
+	while (position < size && !isSeparator(data[position])) {
+		position++;
+	}
+	return position;
+}
+
+
+/**
+ * The length of the text of the first count numbers of data, or size when it holds fewer. The ranks count the numbers of a
+ * window together, each a byte range of it; the first window is long enough for count compact keys, and windows of twice the
+ * previous length follow while fewer than count numbers were found, so only about the text of the keys is read.
+ * */
+size_t findPrefixEnd(const unsigned char *data, size_t size, long count) {
+
+	long *rankCounts = (long *) malloc(RANK_COUNT * sizeof(long));
+	long found = 0;
+	long windowKeys = count;
+	size_t windowStart = 0;
+	size_t prefixEnd = size;
+	while (found < count && windowStart < size) {
+		size_t windowEnd = getKeyWindowEnd(data, size, windowStart, windowKeys);
+		size_t start = windowStart + parallel_sort::getPartitionStart(windowEnd - windowStart, RANK, RANK_COUNT);
+		size_t end = windowStart + parallel_sort::getPartitionStart(windowEnd - windowStart, RANK + 1, RANK_COUNT);
+		long localCount = countSliceNumbers(data, start, end);
+		MPI_Allgather(&localCount, 1, MPI_LONG, rankCounts, 1, MPI_LONG, MPI_COMM_WORLD);
+
+		// the rank whose range holds the count-th number finds where it ends and tells the others
+		long before = found;
+		for (int rank = 0; rank < RANK; rank++) {
+			before += rankCounts[rank];
+		}
+		unsigned long long localEnd = 0;
+		if (before < count && before + localCount >= count) {
+			localEnd = findNumberEnd(data, size, start, end, count - before);
+		}
+		unsigned long long windowPrefixEnd = 0;
+		MPI_Allreduce(&localEnd, &windowPrefixEnd, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+		if (windowPrefixEnd > 0) {
+			prefixEnd = windowPrefixEnd;
+			break;
+		}
+
+		for (int rank = 0; rank < RANK_COUNT; rank++) {
+			found += rankCounts[rank];
+		}
+		windowStart = windowEnd;
+		windowKeys = (windowKeys < LONG_MAX / 2) ? windowKeys * 2 : LONG_MAX;
+	}
+	free(rankCounts);
+	return prefixEnd;
+}
+
+
+/**
+ * Reads the keys of this rank. Returns the number of keys and sets firstIndex to the global index of the first one; all
+ * ranks together read exactly the first count keys of the file.
+ * */
+long readSlice(const char *path, long count, int **keys, long *firstIndex) {
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		exitWithError("Could not open the file. probably the file does not exist.", true);
+	}
+	struct stat fileStatus;
+	fstat(fd, &fileStatus);
+	size_t size = fileStatus.st_size;
+
+	RandomArrayHeader header;
+	bool binary = pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) && isRandomArrayHeader(&header);
+	if (binary) {
+		if (header.version != RANDOM_ARRAY_VERSION || header.elementSize != sizeof(int)) {
+			exitWithError("The binary array file has an unsupported header.", true);
+		}
+		if (header.count < (uint64_t) count) {
+			if (RANK == 0) {
+				printf("Some error happened when reading numbers from file. Only read %llu items.\n",
+						(unsigned long long) header.count);
+			}
+			exitWithError("", false);
+		}
+		long start = parallel_sort::getPartitionStart(count, RANK, RANK_COUNT);
+		long length = parallel_sort::getPartitionStart(count, RANK + 1, RANK_COUNT) - start;
+		*keys = (int *) malloc((length > 0 ? length : 1) * sizeof(int));
+		size_t bytes = length * sizeof(int);
+		size_t bytesRead = 0;
+		while (bytesRead < bytes) {
+			ssize_t status = pread(fd, (char *) *keys + bytesRead, bytes - bytesRead, sizeof(header) + start * sizeof(int) + bytesRead);
+			if (status <= 0) {
+				exitWithError("Could not read the binary array file.", true);
+			}
+			bytesRead += status;
+		}
+		close(fd);
+		*firstIndex = start;
+		return length;
+	}
+
+	const unsigned char *data = NULL;
+	if (size > 0) {
+		void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			exitWithError("Could not map the input file into memory.", true);
+		}
+		data = (const unsigned char *) mapping;
+	}
+	// only the text of the first count keys is split, so that every rank gets about count / RANK_COUNT of them
+	size_t prefixEnd = (size > 0 && count > 0) ? findPrefixEnd(data, size, count) : 0;
+	size_t start = parallel_sort::getPartitionStart(prefixEnd, RANK, RANK_COUNT);
+	size_t end = parallel_sort::getPartitionStart(prefixEnd, RANK + 1, RANK_COUNT);
+	long parsed = (size > 0) ? parseSlice(data, size, start, end, keys) : 0;
+	if (size == 0) {
+		*keys = (int *) malloc(sizeof(int));
+	}
+	if (data != NULL) {
+		munmap((void *) data, size);
+	}
+	close(fd);
+
+	// the numbers of the ranks before this one give the global index of its first number, and only the first count are kept
+	long before = 0;
+	long total = 0;
+	MPI_Exscan(&parsed, &before, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	if (RANK == 0) {
+		before = 0;
+	}
+	MPI_Allreduce(&parsed, &total, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	if (total < count) {
+		if (RANK == 0) {
+			printf("Some error happened when reading numbers from file. Only read %ld items.\n", total);
+		}
+		exitWithError("", false);
+	}
+
+	*firstIndex = before;
+	if (before >= count) {
+		return 0;
+	}
+	return (before + parsed > count) ? count - before : parsed;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Sample sort
+ * *************************************************************************************************************************************/
+
+void sortLocalKeys(int *keys, long count) {
+	if (SORT_ENGINE == RADIX_SORT_ENGINE) {
+		parallel_sort::radixSort(keys, count, THREAD_COUNT, RADIX_BITS);
+	}
+	else {
+		parallel_sort::sampleSort(keys, count, THREAD_COUNT);
+	}
+}
+
+
+/**
+ * Chooses RANK_COUNT - 1 splitters from regular samples of the sorted local arrays of all ranks. Every rank gets the same
+ * splitters. A rank without keys contributes no samples.
+ * */
+void chooseSplitters(const int *keys, long count, int *splitters) {
+
+	int sampleCount = (count > 0) ? RANK_COUNT - 1 : 0;
+	int *samples = (int *) malloc((sampleCount > 0 ? sampleCount : 1) * sizeof(int));
+	for (int i = 0; i < sampleCount; i++) {
+		samples[i] = keys[(count * (i + 1)) / RANK_COUNT];
+	}
+
+	int *sampleCounts = (int *) malloc(RANK_COUNT * sizeof(int));
+	int *sampleOffsets = (int *) malloc(RANK_COUNT * sizeof(int));
+	MPI_Allgather(&sampleCount, 1, MPI_INT, sampleCounts, 1, MPI_INT, MPI_COMM_WORLD);
+	int allSampleCount = 0;
+	for (int rank = 0; rank < RANK_COUNT; rank++) {
+		sampleOffsets[rank] = allSampleCount;
+		allSampleCount += sampleCounts[rank];
+	}
+
+	int *allSamples = (int *) malloc((allSampleCount > 0 ? allSampleCount : 1) * sizeof(int));
+	MPI_Allgatherv(samples, sampleCount, MPI_INT, allSamples, sampleCounts, sampleOffsets, MPI_INT, MPI_COMM_WORLD);
+	std::sort(allSamples, allSamples + allSampleCount);
+
+	for (int i = 0; i < RANK_COUNT - 1; i++) {
+		splitters[i] = (allSampleCount > 0) ? allSamples[((long) (i + 1) * allSampleCount) / RANK_COUNT] : INT_MAX;
+	}
+
+	free(samples);
+	free(sampleCounts);
+	free(sampleOffsets);
+	free(allSamples);
+}
+
+
+/**
+ * Sends bucket r of the sorted local keys to rank r and receives the buckets of all ranks for this rank. receiveOffsets gets the
+ * start of the run of every source rank in the received keys. Returns the number of received keys.
+ * */
+long exchangeBuckets(const int *keys, long count, const int *splitters, int **received, int *receiveOffsets) {
+
+	int *sendCounts = (int *) malloc(RANK_COUNT * sizeof(int));
+	int *sendOffsets = (int *) malloc(RANK_COUNT * sizeof(int));
+	int *receiveCounts = (int *) malloc(RANK_COUNT * sizeof(int));
+
+	long bucketStart = 0;
+	for (int rank = 0; rank < RANK_COUNT; rank++) {
+		long bucketEnd = (rank < RANK_COUNT - 1) ? std::upper_bound(keys, keys + count, splitters[rank]) - keys : count;
+		if (bucketEnd < bucketStart) {
+			bucketEnd = bucketStart;
+		}
+		// MPI counts and displacements are ints
+		if (bucketEnd > INT_MAX) {
+			exitWithError("A rank holds more keys than one MPI message can address.", true);
+		}
+		sendCounts[rank] = (int) (bucketEnd - bucketStart);
+		sendOffsets[rank] = (int) bucketStart;
+		bucketStart = bucketEnd;
+	}
+
+	MPI_Alltoall(sendCounts, 1, MPI_INT, receiveCounts, 1, MPI_INT, MPI_COMM_WORLD);
+	long receivedCount = 0;
+	for (int rank = 0; rank < RANK_COUNT; rank++) {
+		if (receivedCount > INT_MAX) {
+			exitWithError("A rank receives more keys than one MPI message can address.", true);
+		}
+		receiveOffsets[rank] = (int) receivedCount;
+		receivedCount += receiveCounts[rank];
+	}
+	receiveOffsets[RANK_COUNT] = (int) receivedCount;
+
+	*received = (int *) malloc((receivedCount > 0 ? receivedCount : 1) * sizeof(int));
+	MPI_Alltoallv(keys, sendCounts, sendOffsets, MPI_INT, *received, receiveCounts, receiveOffsets, MPI_INT, MPI_COMM_WORLD);
+
+	free(sendCounts);
+	free(sendOffsets);
+	free(receiveCounts);
+	return receivedCount;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Output
+ * *************************************************************************************************************************************/
+
+/**
+ * Writes the keys in the selected format: a binary array file, or the keys as text on one line after the given title.
+ * */
+void writeKeys(int fd, const int *keys, long count, const char *title) {
+
+	if (OUTPUT_MODE == BINARY_OUTPUT) {
+		RandomArrayHeader header;
+		initRandomArrayHeader(&header, count);
+		writeFully(fd, (const char *) &header, sizeof(header));
+		writeFully(fd, (const char *) keys, count * sizeof(int));
+		return;
+	}
+
+	if (title != NULL) {
+		writeFully(fd, title, strlen(title));
+	}
+	char *text = (char *) malloc((size_t) OUTPUT_BLOCK_KEYS * MAX_KEY_TEXT_LENGTH);
+	for (long blockStart = 0; blockStart < count; blockStart += OUTPUT_BLOCK_KEYS) {
+		long blockEnd = (blockStart + OUTPUT_BLOCK_KEYS < count) ? blockStart + OUTPUT_BLOCK_KEYS : count;
+		size_t length = 0;
+		for (long i = blockStart; i < blockEnd; i++) {
+			length += formatKey(keys[i], text + length);
+		}
+		writeFully(fd, text, length);
+	}
+	writeFully(fd, "\n", 1);
+	free(text);
+}
+
+
+int createOutputFile(const char *path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		exitWithError("Could not create the output file.", true);
+	}
+	return fd;
+}
+
+
+/**
+ * Computes the checksum of the sorted array from the parts of all ranks and checks that the parts are sorted and in rank order.
+ * Rank 0 prints the result in the format of optimized_sort.cpp, so the two programs can be compared.
+ * */
+void writeChecksum(const int *keys, long count) {
+
+	long firstPosition = 0;
+	MPI_Exscan(&count, &firstPosition, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	if (RANK == 0) {
+		firstPosition = 0;
+	}
+
+	uint64_t checksum = 0;
+	long long sorted = 1;
+	for (long i = 0; i < count; i++) {
+		checksum += getChecksumTerm(firstPosition + i, keys[i]);
+		if (i > 0 && keys[i] < keys[i - 1]) {
+			sorted = 0;
+		}
+	}
+
+	// the count, first key, last key and sortedness of every part
+	long long part[4] = { count, count > 0 ? keys[0] : 0, count > 0 ? keys[count - 1] : 0, sorted };
+	long long *parts = (long long *) malloc(4 * RANK_COUNT * sizeof(long long));
+	MPI_Gather(part, 4, MPI_LONG_LONG, parts, 4, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+	uint64_t totalChecksum = 0;
+	MPI_Reduce(&checksum, &totalChecksum, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	if (RANK == 0) {
+		long totalCount = 0;
+		bool allSorted = true;
+		long long lastKey = LLONG_MIN;
+		for (int rank = 0; rank < RANK_COUNT; rank++) {
+			const long long *rankPart = parts + 4 * rank;
+			totalCount += rankPart[0];
+			allSorted = allSorted && rankPart[3];
+			if (rankPart[0] > 0) {
+				allSorted = allSorted && rankPart[1] >= lastKey;
+				lastKey = rankPart[2];
+			}
+		}
+		char summary[128];
+		int length = snprintf(summary, sizeof(summary), "The sorted array checksum is: %016llx (%ld keys, %s)\n",
+				(unsigned long long) totalChecksum, totalCount, allSorted ? "sorted" : "NOT sorted");
+		int fd = (OUTPUT_FILE != NULL) ? createOutputFile(OUTPUT_FILE) : STDOUT_FILENO;
+		fflush(stdout);
+		writeFully(fd, summary, length);
+		if (fd != STDOUT_FILENO) {
+			close(fd);
+		}
+	}
+	free(parts);
+}
+
+
+/**
+ * Gathers the parts of all ranks on rank 0, which writes the whole sorted array.
+ * */
+void writeGathered(const int *keys, long count) {
+
+	if (count > INT_MAX) {
+		exitWithError("A rank holds more keys than one MPI message can address.", true);
+	}
+	int partCount = (int) count;
+	int *partCounts = (int *) malloc(RANK_COUNT * sizeof(int));
+	int *partOffsets = (int *) malloc(RANK_COUNT * sizeof(int));
+	MPI_Gather(&partCount, 1, MPI_INT, partCounts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+	long totalCount = 0;
+	if (RANK == 0) {
+		for (int rank = 0; rank < RANK_COUNT; rank++) {
+			partOffsets[rank] = (int) totalCount;
+			totalCount += partCounts[rank];
+			if (totalCount > INT_MAX) {
+				exitWithError("The sorted array is too large to be gathered on one rank; use --per-rank.", true);
+			}
+		}
+	}
+
+	int *all = (int *) malloc((RANK == 0 && totalCount > 0 ? totalCount : 1) * sizeof(int));
+	MPI_Gatherv(keys, partCount, MPI_INT, all, partCounts, partOffsets, MPI_INT, 0, MPI_COMM_WORLD);
+
+	if (RANK == 0) {
+		int fd = (OUTPUT_FILE != NULL) ? createOutputFile(OUTPUT_FILE) : STDOUT_FILENO;
+		fflush(stdout);
+		writeKeys(fd, all, totalCount, "The sorted array is:\n");
+		if (fd != STDOUT_FILENO) {
+			close(fd);
+		}
+	}
+
+	free(all);
+	free(partCounts);
+	free(partOffsets);
+}
+
+
+void writePerRank(const int *keys, long count) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s.%d", OUTPUT_FILE, RANK);
+	int fd = createOutputFile(path);
+	writeKeys(fd, keys, count, NULL);
+	close(fd);
+}
+
+
+/**
+ * Prints the minimum, mean and maximum time of every phase over the ranks, and how evenly the keys were spread.
+ * */
+void reportPhaseTimes(const double *times, long sortedCount) {
+
+	double minTimes[PHASE_COUNT + 1], maxTimes[PHASE_COUNT + 1], sumTimes[PHASE_COUNT + 1];
+	double localTimes[PHASE_COUNT + 1];
+	localTimes[PHASE_COUNT] = 0;
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		localTimes[phase] = times[phase];
+		localTimes[PHASE_COUNT] += times[phase];
+	}
+	MPI_Reduce(localTimes, minTimes, PHASE_COUNT + 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+	MPI_Reduce(localTimes, maxTimes, PHASE_COUNT + 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	MPI_Reduce(localTimes, sumTimes, PHASE_COUNT + 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	long minCount, maxCount;
+	MPI_Reduce(&sortedCount, &minCount, 1, MPI_LONG, MPI_MIN, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&sortedCount, &maxCount, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+	long totalCount;
+	MPI_Reduce(&sortedCount, &totalCount, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	if (RANK == 0) {
+		printf("\nSample sort of %ld keys on %d ranks with %d threads each:\n", totalCount, RANK_COUNT, THREAD_COUNT);
+		printf("\t%-16s%14s%14s%14s\n", "phase", "min (s)", "mean (s)", "max (s)");
+		for (int phase = 0; phase <= PHASE_COUNT; phase++) {
+			printf("\t%-16s%14f%14f%14f\n", (phase < PHASE_COUNT) ? PHASE_NAMES[phase] : "total", minTimes[phase],
+					sumTimes[phase] / RANK_COUNT, maxTimes[phase]);
+		}
+		double averageCount = (double) totalCount / RANK_COUNT;
+		printf("Keys per rank after the exchange: min %ld, max %ld (%.2f times the average)\n", minCount, maxCount,
+				(averageCount > 0) ? maxCount / averageCount : 1.0);
+	}
+}
+
+
+int main(int argc, char *argv[]) {
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_size(MPI_COMM_WORLD, &RANK_COUNT);
+	MPI_Comm_rank(MPI_COMM_WORLD, &RANK);
+
+	if (argc < 3) {
+		if (RANK == 0) {
+			printf("You have not supplied enough command line parameters\n");
+			printUsage();
+		}
+		exitWithError("", false);
+	}
+	parseOptions(argc, argv);
+	long count = atol(argv[2]);
+
+	double times[PHASE_COUNT];
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	double start = MPI_Wtime();
+	int *keys;
+	long firstIndex;
+	long localCount = readSlice(argv[1], count, &keys, &firstIndex);
+	times[READ_PHASE] = MPI_Wtime() - start;
+
+	start = MPI_Wtime();
+	sortLocalKeys(keys, localCount);
+	times[LOCAL_SORT_PHASE] = MPI_Wtime() - start;
+
+	start = MPI_Wtime();
+	int *splitters = (int *) malloc(RANK_COUNT * sizeof(int));
+	chooseSplitters(keys, localCount, splitters);
+	times[SPLITTER_PHASE] = MPI_Wtime() - start;
+
+	start = MPI_Wtime();
+	int *received;
+	int *receiveOffsets = (int *) malloc((RANK_COUNT + 1) * sizeof(int));
+	long receivedCount = exchangeBuckets(keys, localCount, splitters, &received, receiveOffsets);
+	times[EXCHANGE_PHASE] = MPI_Wtime() - start;
+	free(keys);
+
+	// the received buckets are sorted runs, one from every rank
+	start = MPI_Wtime();
+	int *sorted = (int *) malloc((receivedCount > 0 ? receivedCount : 1) * sizeof(int));
+	const int **runBegins = (const int **) malloc(RANK_COUNT * sizeof(const int *));
+	const int **runEnds = (const int **) malloc(RANK_COUNT * sizeof(const int *));
+	for (int rank = 0; rank < RANK_COUNT; rank++) {
+		runBegins[rank] = received + receiveOffsets[rank];
+		runEnds[rank] = received + receiveOffsets[rank + 1];
+	}
+	parallel_sort::mergeSortedRuns(runBegins, runEnds, RANK_COUNT, sorted);
+	times[MERGE_PHASE] = MPI_Wtime() - start;
+	free(received);
+
+	start = MPI_Wtime();
+	if (OUTPUT_MODE == CHECKSUM_OUTPUT) {
+		writeChecksum(sorted, receivedCount);
+	}
+	else if (PER_RANK_OUTPUT) {
+		writePerRank(sorted, receivedCount);
+	}
+	else {
+		writeGathered(sorted, receivedCount);
+	}
+	times[OUTPUT_PHASE] = MPI_Wtime() - start;
+
+	reportPhaseTimes(times, receivedCount);
+
+	free(sorted);
+	free(splitters);
+	free(receiveOffsets);
+	free(runBegins);
+	free(runEnds);
+	MPI_Finalize();
+	return 0;
+}
@@ -1,21 +1,141 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <limits.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "random_array.h"
+#include "parallel_sort.h"
+
+// the sort algorithms and the thread helpers come from the parallel sort library; this file is the driver around them
+using parallel_sort::runInParallel;
+using parallel_sort::getPartitionStart;
+using parallel_sort::MIN_ITEMS_PER_THREAD;
+
+// the sort engines that can be selected with the --sort option
+typedef enum {
+	QSORT_ENGINE,
+	SAMPLE_SORT_ENGINE,
+	RADIX_SORT_ENGINE
+} SortEngine;
+
+// the ways of reading the input file that can be selected with the --reader option
+typedef enum {
+	MMAP_READER,
+	FSCANF_READER
+} InputReader;
+
+// the order statistics that can be asked for instead of the sorted array
+typedef enum {
+	NO_SELECTION,
+	TOP_K_SELECTION,
+	NTH_SELECTION,
+	QUANTILE_SELECTION
+} SelectionMode;
+
+// the output formats that can be selected with the --output option
+typedef enum {
+	TEXT_OUTPUT,
+	PRINTF_OUTPUT,
+	BINARY_OUTPUT,
+	CHECKSUM_OUTPUT
+} OutputMode;
+
+// the number of threads used by the parallel engines; by default this is the number of online cores
+int THREAD_COUNT = 1;
+SortEngine SORT_ENGINE = SAMPLE_SORT_ENGINE;
+InputReader INPUT_READER = MMAP_READER;
+OutputMode OUTPUT_MODE = TEXT_OUTPUT;
+// the sorted output goes to standard output unless an output file is given
+const char *OUTPUT_FILE = NULL;
+// the external sort keeps at most about MEMORY_BUDGET_MB megabytes of keys in memory and spills the rest to TEMP_DIRECTORY
+bool EXTERNAL_SORT = false;
+long MEMORY_BUDGET_MB = 1024;
+const char *TEMP_DIRECTORY = NULL;
+// the pipelined mode overlaps reading, sorting and printing; PIPELINE_CHUNK_KEYS is 0 to size the chunks automatically
+bool PIPELINE = false;
+long PIPELINE_CHUNK_KEYS = 0;
+// the selection modes: the k smallest or largest keys, the key of one rank, or the keys of a comma separated list of quantiles
+SelectionMode SELECTION_MODE = NO_SELECTION;
+long SELECTION_K = 0;
+bool SELECT_LARGEST = false;
+long SELECTION_NTH = 0;
+const char *SELECTION_QUANTILES = NULL;
+// the benchmark harness settings; the lists are comma separated
+bool BENCHMARK = false;
+int BENCHMARK_WARMUP = 1;
+const char *BENCHMARK_SIZES = NULL;
+const char *BENCHMARK_DISTRIBUTIONS = NULL;
+const char *BENCHMARK_REPORT = NULL;
+// the number of bits in one radix digit, either 8 (four passes) or 11 (three passes)
+int RADIX_BITS = 8;
 
 int compare(const void* numA, const void* numB);
 double * getTimesForReadSortAndPrint(char *argv[]);
+void parseOptions(int argc, char *argv[]);
+const char * getSortEngineName(SortEngine engine);
+int * readArray(const char *path, int count);
+void sortArray(int *array, int count);
+double getWallTime();
+void runBenchmark(char *argv[]);
+void runSelection(char *argv[]);
 
 int main(int argc, char *argv[]) {
 
 	if (argc < 4) {
 		printf("You have not supplied enough command line parameters\n");
-		printf("Usage: ./program-name ${input-file-path} ${number-of-integers-to-sort} ${number_of_iteration_for_avaraging}\n");
+		printf("Usage: ./program-name ${input-file-path} ${number-of-integers-to-sort} ${number_of_iteration_for_avaraging} [options]\n");
+		printf("Options:\n");
+		printf("\t--threads=N                             number of threads used by the parallel sort (default: number of cores)\n");
+		printf("\t--sort=qsort|samplesort|radix           sort engine to use (default: samplesort)\n");
+		printf("\t--radix-bits=8|11                       digit width of the radix sort (default: 8)\n");
+		printf("\t--reader=mmap|fscanf                    how the input file is read (default: mmap)\n");
+		printf("\t--output=text|printf|binary|checksum    how the sorted array is printed (default: text)\n");
+		printf("\t--output-file=PATH                      write the sorted array to a file instead of standard output\n");
+		printf("\t--external                              sort out of core, for inputs larger than the memory budget\n");
+		printf("\t--memory-budget=MB                      memory used for keys by the external sort (default: 1024)\n");
+		printf("\t--temp-dir=PATH                         directory of the external sort's run files (default: $TMPDIR or /tmp)\n");
+		printf("\t--pipeline                              overlap reading, sorting and printing, with per-stage timings\n");
+		printf("\t--chunk-keys=N                          keys per chunk of the pipelined mode (default: sized by thread count)\n");
+		printf("\t--top-k=K                               print only the K smallest keys, found in one streaming pass\n");
+		printf("\t--largest                               with --top-k, the K largest keys instead\n");
+		printf("\t--nth=N                                 print only the key of rank N, counted from 0\n");
+		printf("\t--quantiles=Q,Q,...                     print only the keys of the quantiles Q between 0 and 1\n");
+		printf("\t--benchmark                             measure the pipeline with warmups and percentile statistics\n");
+		printf("\t--warmup=N                              unmeasured benchmark iterations per case (default: 1)\n");
+		printf("\t--sizes=N,N,...                         benchmark input sizes (default: the count given)\n");
+		printf("\t--distributions=NAME,...                benchmark inputs: file or generated distributions (default: file)\n");
+		printf("\t--report=PATH                           write the benchmark results as CSV, or JSON for a .json path\n");
 		exit(-1);
 	}
 
+	parseOptions(argc, argv);
+
+	if (BENCHMARK) {
+		runBenchmark(argv);
+		return 0;
+	}
+	if (SELECTION_MODE != NO_SELECTION) {
+		runSelection(argv);
+		return 0;
+	}
+
 	int number_of_iteration = atoi(argv[3]);
-	double summation_of_times[3];
-	
+	double summation_of_times[3] = { 0, 0, 0 };
+
 	for (int i = 0; i < number_of_iteration; i++) {
 		double *times;
    		times = getTimesForReadSortAndPrint(argv);
@@ -25,15 +145,180 @@ int main(int argc, char *argv[]) {
 	}
 
 	printf("\n\nAverage time taken to read the input for %d iterations is: %f seconds\n", number_of_iteration, (summation_of_times[0]/number_of_iteration));
-	printf("\n\nAverage time taken to sort the array for %d iterations is: %f seconds\n", number_of_iteration, (summation_of_times[1]/number_of_iteration));
+	int sort_thread_count = (SORT_ENGINE == QSORT_ENGINE) ? 1 : THREAD_COUNT;
+	printf("\n\nAverage time taken to sort the array with %s (%d threads) for %d iterations is: %f seconds\n", getSortEngineName(SORT_ENGINE), sort_thread_count, number_of_iteration, (summation_of_times[1]/number_of_iteration));
 	printf("\n\nAverage time taken to print the sorted array for %d iterations is: %f seconds\n", number_of_iteration, (summation_of_times[2]/number_of_iteration));
 
 	return 0;
 }
 
 
+void parseOptions(int argc, char *argv[]) {
+
+	long coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+	THREAD_COUNT = (coreCount > 0) ? (int) coreCount : 1;
+
+	for (int i = 4; i < argc; i++) {
+		const char *value;
+		if ((value = getOptionValue(argv[i], "--threads")) != NULL) {
+			THREAD_COUNT = atoi(value);
+			if (THREAD_COUNT < 1) {
+				printf("The thread count must be a positive integer.\n");
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--sort")) != NULL) {
+			if (strcmp(value, "qsort") == 0) {
+				SORT_ENGINE = QSORT_ENGINE;
+			}
+			else if (strcmp(value, "samplesort") == 0) {
+				SORT_ENGINE = SAMPLE_SORT_ENGINE;
+			}
+			else if (strcmp(value, "radix") == 0) {
+				SORT_ENGINE = RADIX_SORT_ENGINE;
+			}
+			else {
+				printf("Unknown sort engine %s.\n", value);
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--radix-bits")) != NULL) {
+			RADIX_BITS = atoi(value);
+			if (RADIX_BITS != 8 && RADIX_BITS != 11) {
+				printf("The radix digit width must be 8 or 11 bits.\n");
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--reader")) != NULL) {
+			if (strcmp(value, "mmap") == 0) {
+				INPUT_READER = MMAP_READER;
+			}
+			else if (strcmp(value, "fscanf") == 0) {
+				INPUT_READER = FSCANF_READER;
+			}
+			else {
+				printf("Unknown input reader %s.\n", value);
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--output")) != NULL) {
+			if (strcmp(value, "text") == 0) {
+				OUTPUT_MODE = TEXT_OUTPUT;
+			}
+			else if (strcmp(value, "printf") == 0) {
+				OUTPUT_MODE = PRINTF_OUTPUT;
+			}
+			else if (strcmp(value, "binary") == 0) {
+				OUTPUT_MODE = BINARY_OUTPUT;
+			}
+			else if (strcmp(value, "checksum") == 0) {
+				OUTPUT_MODE = CHECKSUM_OUTPUT;
+			}
+			else {
+				printf("Unknown output format %s.\n", value);
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--output-file")) != NULL) {
+			OUTPUT_FILE = value;
+		}
+		else if (strcmp(argv[i], "--external") == 0) {
+			EXTERNAL_SORT = true;
+		}
+		else if ((value = getOptionValue(argv[i], "--memory-budget")) != NULL) {
+			MEMORY_BUDGET_MB = atol(value);
+			if (MEMORY_BUDGET_MB < 1) {
+				printf("The memory budget must be at least 1 MB.\n");
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--temp-dir")) != NULL) {
+			TEMP_DIRECTORY = value;
+		}
+		else if (strcmp(argv[i], "--pipeline") == 0) {
+			PIPELINE = true;
+		}
+		else if ((value = getOptionValue(argv[i], "--chunk-keys")) != NULL) {
+			PIPELINE_CHUNK_KEYS = atol(value);
+			if (PIPELINE_CHUNK_KEYS < 1) {
+				printf("The chunk size must be a positive number of keys.\n");
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--top-k")) != NULL) {
+			SELECTION_MODE = TOP_K_SELECTION;
+			SELECTION_K = atol(value);
+			if (SELECTION_K < 1) {
+				printf("--top-k needs a positive number of keys.\n");
+				exit(-1);
+			}
+		}
+		else if (strcmp(argv[i], "--largest") == 0) {
+			SELECT_LARGEST = true;
+		}
+		else if ((value = getOptionValue(argv[i], "--nth")) != NULL) {
+			SELECTION_MODE = NTH_SELECTION;
+			SELECTION_NTH = atol(value);
+			if (SELECTION_NTH < 0) {
+				printf("The rank of --nth cannot be negative.\n");
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--quantiles")) != NULL) {
+			SELECTION_MODE = QUANTILE_SELECTION;
+			SELECTION_QUANTILES = value;
+		}
+		else if (strcmp(argv[i], "--benchmark") == 0) {
+			BENCHMARK = true;
+		}
+		else if ((value = getOptionValue(argv[i], "--warmup")) != NULL) {
+			BENCHMARK_WARMUP = atoi(value);
+			if (BENCHMARK_WARMUP < 0) {
+				printf("The warmup iteration count cannot be negative.\n");
+				exit(-1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--sizes")) != NULL) {
+			BENCHMARK_SIZES = value;
+		}
+		else if ((value = getOptionValue(argv[i], "--distributions")) != NULL) {
+			BENCHMARK_DISTRIBUTIONS = value;
+		}
+		else if ((value = getOptionValue(argv[i], "--report")) != NULL) {
+			BENCHMARK_REPORT = value;
+		}
+		else {
+			printf("Unknown option %s.\n", argv[i]);
+			exit(-1);
+		}
+	}
+
+	if (PIPELINE && EXTERNAL_SORT) {
+		printf("--pipeline sorts in memory and cannot be combined with --external.\n");
+		exit(-1);
+	}
+	if (SELECTION_MODE != NO_SELECTION && (EXTERNAL_SORT || PIPELINE || BENCHMARK)) {
+		printf("--top-k, --nth and --quantiles cannot be combined with --external, --pipeline or --benchmark.\n");
+		exit(-1);
+	}
+}
+
+
+const char * getSortEngineName(SortEngine engine) {
+	switch (engine) {
+		case QSORT_ENGINE:
+			return "qsort";
+		case SAMPLE_SORT_ENGINE:
+			return "parallel samplesort";
+		case RADIX_SORT_ENGINE:
+			return "parallel LSD radix sort";
+	}
+	return "unknown";
+}
+
+
 int compare(const void* numA, const void* numB) {
-    
+
 	const int* num1 = (const int*)numA;
 	const int* num2 = (const int*)numB;
 
@@ -51,55 +336,2492 @@ int compare(const void* numA, const void* numB) {
 }
 
 
-double * getTimesForReadSortAndPrint(char *argv[]) {
+/**
+ * clock() adds up the CPU time of every thread, so the phases are timed with the monotonic wall clock instead, which unlike
+ * gettimeofday does not jump when the system time is adjusted.
+ * */
+double getWallTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
 
-	static double times[3];
 
-	clock_t start_time;
-	start_time = clock();
+/***************************************************************************************************************************************
+ *                        Memory-mapped input parser
+ *
+ * The input file is mapped into memory and cut into one byte range per thread. A range boundary that falls inside a number is
+ * moved forward to the start of the next number, so every number belongs to the range holding its first byte. Each thread
+ * first counts the numbers in its range, the counts give every thread the index of its first number, and then the threads
+ * parse their ranges straight into the array. Any byte up to and including the space character separates numbers, as in
+ * fscanf. Up to eight digits of a number are converted at once with 64-bit word (SWAR) arithmetic.
+ * *************************************************************************************************************************************/
 
-	FILE *fp;
-	if ((fp = fopen(argv[1], "r+")) == NULL) {
-			printf("Could not open the file. probably the file does not exist.\n");
-			exit(-1);
+// ranges smaller than this are not worth a thread of their own
+#define MIN_BYTES_PER_THREAD (1 << 20)
+
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	int *array;
+	long count;
+	size_t *rangeStarts;
+	// numbers found in each range, then turned into the index of the first number of each range
+	long *rangeFirstIndex;
+	// the index of the first number each thread failed to parse, or LONG_MAX
+	long *rangeFirstError;
+	// the position just after the last wanted number, set by the thread that parses it
+	size_t stopPosition;
+} ParseContext;
+
+
+/**
+ * Counts the positions in [start, end) where a number starts, that is a non-separator byte following a separator.
+ * previousIsSeparator tells whether the byte before start is a separator.
+ * */
+long countNumberStarts(const unsigned char *data, size_t start, size_t end, bool previousIsSeparator) {
+
+	long numberCount = 0;
+	size_t i = start;
+
+#if defined(__SSE2__)
+	// sixteen bytes at a time: the movemask gives one bit per byte that belongs to a number, and a number starts wherever a
+	// set bit follows a clear one
+	const __m128i separatorLimit = _mm_set1_epi8(' ');
+	unsigned int previousBit = previousIsSeparator ? 0 : 1;
+	for (; i + 16 <= end; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *) (data + i));
+		// a byte is part of a number when max(byte, ' ') differs from ' ', i.e. the unsigned byte is above ' '
+		__m128i isSeparatorByte = _mm_cmpeq_epi8(_mm_max_epu8(bytes, separatorLimit), separatorLimit);
+		unsigned int numberBits = ~((unsigned int) _mm_movemask_epi8(isSeparatorByte)) & 0xffff;
+		unsigned int startBits = numberBits & ~((numberBits << 1) | previousBit);
+		numberCount += __builtin_popcount(startBits);
+		previousBit = numberBits >> 15;
+	}
+	previousIsSeparator = (previousBit == 0);
+#endif
+
+	for (; i < end; i++) {
+		bool separator = isSeparator(data[i]);
+		if (!separator && previousIsSeparator) {
+			numberCount++;
+		}
+		previousIsSeparator = separator;
+	}
+	return numberCount;
+}
+
+
+/**
+ * Converts eight ASCII digits, the first one in the lowest byte of the word, into their value.
+ * */
+static inline unsigned int convertEightDigits(uint64_t digits) {
+	digits = (digits & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+	digits = (digits & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+	return (unsigned int) ((digits & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32);
+}
+
+
+/**
+ * Parses one number starting at data[position] and stores it in value. Returns the position just after the number, or 0 when
+ * the bytes up to the next separator do not form a valid int.
+ * */
+size_t parseNumber(const unsigned char *data, size_t size, size_t position, int *value) {
+
+	bool negative = false;
+	if (data[position] == '-' || data[position] == '+') {
+		negative = (data[position] == '-');
+		position++;
+	}
+
+	uint64_t magnitude = 0;
+	size_t digitStart = position;
+
+	// eight digits per step while a full word can be loaded without running past the mapping
+	while (position + 8 <= size) {
+		uint64_t word;
+		memcpy(&word, data + position, sizeof(word));
+		uint64_t digits = word ^ 0x3030303030303030ULL;
+		// a byte is a digit when both its value and its value + 6 stay below 16 after removing '0'; a carry out of a
+		// non-digit byte can only spoil the bytes above it, so the lowest non-digit byte is always found correctly
+		uint64_t nonDigits = (digits | (digits + 0x0606060606060606ULL)) & 0xF0F0F0F0F0F0F0F0ULL;
+		int digitCount = (nonDigits == 0) ? 8 : __builtin_ctzll(nonDigits) / 8;
+		if (digitCount == 0) {
+			break;
+		}
+		uint64_t padded = (digitCount == 8) ? digits : (digits << (8 * (8 - digitCount)));
+		uint64_t scale = 1;
+		for (int i = 0; i < digitCount; i++) {
+			scale *= 10;
 		}
+		magnitude = magnitude * scale + convertEightDigits(padded);
+		position += digitCount;
+		if (digitCount < 8 || magnitude > 2147483648ULL) {
+			break;
+		}
+	}
+	while (position < size && data[position] >= '0' && data[position] <= '9' && magnitude <= 2147483648ULL) {
+		magnitude = magnitude * 10 + (data[position] - '0');
+		position++;
+	}
 
-	int count = atoi(argv[2]);
-	int *array = (int *) malloc(count * sizeof(int));
+	if (position == digitStart || (position < size && !isSeparator(data[position]))) {
+		return 0;
+	}
+	if (magnitude > (negative ? 2147483648ULL : 2147483647ULL)) {
+		return 0;
+	}
+	*value = negative ? (int) (-(int64_t) magnitude) : (int) magnitude;
+	return position;
+}
+
+
+void countRangeNumbers(int threadId, int threadCount, void *context) {
+	ParseContext *parseContext = (ParseContext *) context;
+	size_t start = parseContext->rangeStarts[threadId];
+	size_t end = parseContext->rangeStarts[threadId + 1];
+	parseContext->rangeFirstIndex[threadId] = countNumberStarts(parseContext->data, start, end, true);
+}
+
+
+void parseRangeNumbers(int threadId, int threadCount, void *context) {
+
+	ParseContext *parseContext = (ParseContext *) context;
+	const unsigned char *data = parseContext->data;
+	size_t position = parseContext->rangeStarts[threadId];
+	size_t end = parseContext->rangeStarts[threadId + 1];
+	long index = parseContext->rangeFirstIndex[threadId];
+	int *array = parseContext->array;
+
+	parseContext->rangeFirstError[threadId] = LONG_MAX;
+
+	while (index < parseContext->count) {
+		while (position < end && isSeparator(data[position])) {
+			position++;
+		}
+		if (position >= end) {
+			break;
+		}
+		size_t next = parseNumber(data, parseContext->size, position, &array[index]);
+		if (next == 0) {
+			parseContext->rangeFirstError[threadId] = index;
+			break;
+		}
+		position = next;
+		index++;
+		if (index == parseContext->count) {
+			parseContext->stopPosition = position;
+		}
+	}
+}
+
+
+/**
+ * Parses the first count whitespace separated numbers of data into array using up to threadCount threads. Returns count when
+ * all of them were read, otherwise the number of items read before the first missing or malformed number; malformed tells
+ * which of the two stopped the parse. endOffset receives the position just after the last number read when count numbers
+ * were read, and size otherwise.
+ * */
+long parseIntegers(const char *data, size_t size, int *array, long count, int threadCount, size_t *endOffset, bool *malformed) {
+
+	if (threadCount > (long) (size / MIN_BYTES_PER_THREAD)) {
+		threadCount = (size / MIN_BYTES_PER_THREAD > 0) ? (int) (size / MIN_BYTES_PER_THREAD) : 1;
+	}
+
+	ParseContext parseContext;
+	parseContext.data = (const unsigned char *) data;
+	parseContext.size = size;
+	parseContext.array = array;
+	parseContext.count = count;
+	parseContext.rangeStarts = (size_t *) malloc((threadCount + 1) * sizeof(size_t));
+	parseContext.rangeFirstIndex = (long *) malloc(threadCount * sizeof(long));
+	parseContext.rangeFirstError = (long *) malloc(threadCount * sizeof(long));
+	parseContext.stopPosition = size;
+
+	// move every range start that falls inside a number to the start of the next one
+	parseContext.rangeStarts[0] = 0;
+	for (int i = 1; i < threadCount; i++) {
+		size_t start = getPartitionStart(size, i, threadCount);
+		if (start < parseContext.rangeStarts[i - 1]) {
+			start = parseContext.rangeStarts[i - 1];
+		}
+		while (start > 0 && start < size && !isSeparator(parseContext.data[start - 1])) {
+			start++;
+		}
+		parseContext.rangeStarts[i] = start;
+	}
+	parseContext.rangeStarts[threadCount] = size;
+
+	runInParallel(threadCount, countRangeNumbers, &parseContext);
+
+	long numberCount = 0;
+	for (int i = 0; i < threadCount; i++) {
+		long rangeCount = parseContext.rangeFirstIndex[i];
+		parseContext.rangeFirstIndex[i] = numberCount;
+		numberCount += rangeCount;
+	}
+
+	runInParallel(threadCount, parseRangeNumbers, &parseContext);
+
+	long itemsRead = (numberCount < count) ? numberCount : count;
+	*malformed = false;
+	for (int i = 0; i < threadCount; i++) {
+		if (parseContext.rangeFirstError[i] < itemsRead) {
+			itemsRead = parseContext.rangeFirstError[i];
+			*malformed = true;
+		}
+	}
+	*endOffset = (itemsRead == count) ? parseContext.stopPosition : size;
+
+	free(parseContext.rangeStarts);
+	free(parseContext.rangeFirstIndex);
+	free(parseContext.rangeFirstError);
+
+	return itemsRead;
+}
+
+
+/**
+ * Parses the first count numbers of data like parseIntegers, but only reads as much of data as they take: the first window is
+ * long enough for count compact keys, and windows of twice the previous length follow while fewer than count numbers were
+ * found. With advise, data is a memory mapping and every window is prefetched with MADV_WILLNEED before it is parsed.
+ * */
+long parseLeadingIntegers(const char *data, size_t size, int *array, long count, int threadCount, bool advise, size_t *endOffset,
+		bool *malformed) {
+
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	long itemsRead = 0;
+	long windowKeys = count;
+	size_t position = 0;
+	*malformed = false;
+	while (itemsRead < count && position < size) {
+		size_t windowEnd = getKeyWindowEnd((const unsigned char *) data, size, position, windowKeys);
+		if (advise) {
+			size_t pageStart = position / pageSize * pageSize;
+			madvise((void *) (data + pageStart), windowEnd - pageStart, MADV_WILLNEED);
+		}
+
+		size_t windowOffset;
+		itemsRead += parseIntegers(data + position, windowEnd - position, array + itemsRead, count - itemsRead, threadCount,
+				&windowOffset, malformed);
+		position += windowOffset;
+		if (*malformed) {
+			break;
+		}
+		windowKeys = (windowKeys < LONG_MAX / 2) ? windowKeys * 2 : LONG_MAX;
+	}
+	*endOffset = position;
+	return itemsRead;
+}
+
+/***************************************************************************************************************************************
+ *                        Memory-mapped input parser end
+ * *************************************************************************************************************************************/
+
+
+void exitWithReadError(long itemsRead) {
+	printf("Some error happened when reading numbers from file. Only read %ld items.\n", itemsRead);
+	exit(-1);
+}
 
+
+int * readArrayWithFscanf(const char *path, int count) {
+
+	FILE *fp;
+	if ((fp = fopen(path, "r")) == NULL) {
+		printf("Could not open the file. probably the file does not exist.\n");
+		exit(-1);
+	}
+
+	int *array = (int *) malloc(count * sizeof(int));
 	for (int i = 0; i < count; i++) {
 		int status = fscanf(fp, "%d", &array[i]);
 		if (status != 1) {
-			printf("Some error happened when reading numbers from file. Only read %d items.\n", i);
+			exitWithReadError(i);
+		}
+	}
+
+	fclose(fp);
+	return array;
+}
+
+
+int * readArrayWithMmap(const char *path, int count) {
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not open the file. probably the file does not exist.\n");
+		exit(-1);
+	}
+
+	struct stat fileStatus;
+	fstat(fd, &fileStatus);
+	size_t size = fileStatus.st_size;
+	if (size == 0) {
+		close(fd);
+		if (count > 0) {
+			exitWithReadError(0);
+		}
+		return (int *) malloc(sizeof(int));
+	}
+
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		printf("Could not map the input file into memory.\n");
+		exit(-1);
+	}
+	close(fd);
+
+	// only the part of the file that holds the count keys is prefetched and parsed
+	int *array = (int *) malloc(count * sizeof(int));
+	size_t endOffset;
+	bool malformed;
+	long itemsRead = parseLeadingIntegers((const char *) data, size, array, count, THREAD_COUNT, true, &endOffset, &malformed);
+	munmap(data, size);
+
+	if (itemsRead < count) {
+		exitWithReadError(itemsRead);
+	}
+	return array;
+}
+
+
+/**
+ * Reads count keys from a binary array file written by random_array_generator.o with a single bulk read after the header.
+ * */
+int * readArrayFromBinaryFile(int fd, int count) {
+
+	RandomArrayHeader header;
+	if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) || header.version != RANDOM_ARRAY_VERSION ||
+			header.elementSize != sizeof(int)) {
+		printf("The binary array file has an unsupported header.\n");
+		exit(-1);
+	}
+
+	int *array = (int *) malloc(count * sizeof(int));
+	size_t bytesToRead = ((header.count < (uint64_t) count) ? header.count : (uint64_t) count) * sizeof(int);
+	size_t bytesRead = 0;
+	while (bytesRead < bytesToRead) {
+		// a single read call returns at most about 2GB, so large arrays take a few calls
+		ssize_t status = pread(fd, (char *) array + bytesRead, bytesToRead - bytesRead, sizeof(header) + bytesRead);
+		if (status <= 0) {
+			break;
+		}
+		bytesRead += status;
+	}
+
+	if (bytesRead < (size_t) count * sizeof(int)) {
+		exitWithReadError(bytesRead / sizeof(int));
+	}
+	return array;
+}
+
+
+/**
+ * Binary array files are recognized by their header whatever reader is selected; text files go to the selected reader.
+ * */
+int * readArray(const char *path, int count) {
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not open the file. probably the file does not exist.\n");
+		exit(-1);
+	}
+	RandomArrayHeader header;
+	bool isBinary = pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) && isRandomArrayHeader(&header);
+	if (isBinary) {
+		int *array = readArrayFromBinaryFile(fd, count);
+		close(fd);
+		return array;
+	}
+	close(fd);
+
+	switch (INPUT_READER) {
+		case FSCANF_READER:
+			return readArrayWithFscanf(path, count);
+		case MMAP_READER:
+			return readArrayWithMmap(path, count);
+	}
+	return NULL;
+}
+
+
+/**
+ * Sorts the keys with the selected engine on up to threadCount threads.
+ * */
+void sortKeys(int *keys, long count, int threadCount) {
+	switch (SORT_ENGINE) {
+		case QSORT_ENGINE:
+			qsort(keys, count, sizeof(int), compare);
+			break;
+		case SAMPLE_SORT_ENGINE:
+			parallel_sort::sampleSort(keys, count, threadCount);
+			break;
+		case RADIX_SORT_ENGINE:
+			parallel_sort::radixSort(keys, count, threadCount, RADIX_BITS);
+			break;
+	}
+}
+
+
+void sortArray(int *array, int count) {
+	sortKeys(array, count, THREAD_COUNT);
+}
+
+
+/***************************************************************************************************************************************
+ *                        Buffered output writer
+ *
+ * The writer takes the sorted keys in one or more consecutive pieces. In the text format every thread formats a block of keys
+ * into its own reusable buffer with a two-digits-per-step itoa, and the buffers are then written in order with one write call
+ * each. The binary format writes a random array file header followed by the keys themselves, so the output can be fed back to
+ * this program. The checksum format writes nothing but a position dependent checksum of the keys and whether they are sorted,
+ * which lets benchmarks check the result without paying for terminal or disk output.
+ * *************************************************************************************************************************************/
+
+// keys formatted by one thread in one step; the text of a block needs at most MAX_KEY_TEXT_LENGTH bytes per key
+#define OUTPUT_BLOCK_KEYS (1 << 18)
+
+typedef struct {
+	OutputMode mode;
+	int fd;
+	int threadCount;
+	// one text buffer per thread and the length of the text formatted into it
+	char **threadBuffers;
+	size_t *threadLengths;
+	// the keys written so far, used as the position in the checksum
+	long position;
+	uint64_t checksum;
+	bool sorted;
+	int lastKey;
+	// partial checksums of the threads and the sortedness of their blocks while a piece is processed
+	uint64_t *threadChecksums;
+	bool *threadSorted;
+	// the piece being processed and the part of it that each thread handles in the current round
+	const int *keys;
+	long roundStart;
+	long blockLength;
+	long roundEnd;
+} OutputWriter;
+
+
+/**
+ * Opens the output for totalCount keys. The text formats start with the title "The sorted array is:" when withTitle is set;
+ * the selection modes print their own heading instead.
+ * */
+void openOutputWriter(OutputWriter *writer, long totalCount, bool withTitle) {
+
+	writer->mode = OUTPUT_MODE;
+	writer->threadCount = THREAD_COUNT;
+	writer->position = 0;
+	writer->checksum = 0;
+	writer->sorted = true;
+	writer->lastKey = INT_MIN;
+
+	writer->fd = STDOUT_FILENO;
+	if (OUTPUT_FILE != NULL) {
+		writer->fd = open(OUTPUT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (writer->fd < 0) {
+			printf("Could not create the output file %s.\n", OUTPUT_FILE);
 			exit(-1);
-		}	
+		}
 	}
+	// the raw writes below bypass stdio, so anything already printed has to go out first
+	fflush(stdout);
 
-	clock_t end_time;
-	end_time = clock();
-	double time_taken =  ((double) (end_time - start_time)) / CLOCKS_PER_SEC;
-	times[0] = time_taken;
+	writer->threadBuffers = (char **) malloc(writer->threadCount * sizeof(char *));
+	writer->threadLengths = (size_t *) malloc(writer->threadCount * sizeof(size_t));
+	writer->threadChecksums = (uint64_t *) malloc(writer->threadCount * sizeof(uint64_t));
+	writer->threadSorted = (bool *) malloc(writer->threadCount * sizeof(bool));
+	for (int i = 0; i < writer->threadCount; i++) {
+		writer->threadBuffers[i] = NULL;
+		if (writer->mode == TEXT_OUTPUT) {
+			writer->threadBuffers[i] = (char *) malloc((size_t) OUTPUT_BLOCK_KEYS * MAX_KEY_TEXT_LENGTH);
+		}
+	}
+
+	if (writer->mode == TEXT_OUTPUT && withTitle) {
+		const char *title = "The sorted array is:\n";
+		writeFully(writer->fd, title, strlen(title));
+	}
+	else if (writer->mode == PRINTF_OUTPUT && withTitle) {
+		printf("The sorted array is:\n");
+	}
+	else if (writer->mode == BINARY_OUTPUT) {
+		RandomArrayHeader header;
+		initRandomArrayHeader(&header, totalCount);
+		writeFully(writer->fd, (const char *) &header, sizeof(header));
+	}
+}
 
 
-	start_time = clock();
-	qsort(array, count, sizeof(int), compare);
-	end_time = clock();
-	time_taken =  ((double) (end_time - start_time)) / CLOCKS_PER_SEC;
-	times[1] = time_taken;
+void processOutputBlock(int threadId, int threadCount, void *context) {
 
+	OutputWriter *writer = (OutputWriter *) context;
+	long blockStart = writer->roundStart + threadId * writer->blockLength;
+	long blockEnd = blockStart + writer->blockLength;
+	if (blockEnd > writer->roundEnd) {
+		blockEnd = writer->roundEnd;
+	}
+	const int *keys = writer->keys;
 
-	start_time = clock();
-	printf("The sorted array is:\n");
-	for (int i = 0; i < count; i++) {
-		printf("%d ", array[i]);
-	} 
-	printf("\n");
-	end_time = clock();
-	time_taken =  ((double) (end_time - start_time)) / CLOCKS_PER_SEC;
-	times[2] = time_taken;
+	if (writer->mode == TEXT_OUTPUT) {
+		char *text = writer->threadBuffers[threadId];
+		size_t length = 0;
+		for (long i = blockStart; i < blockEnd; i++) {
+			length += formatKey(keys[i], text + length);
+		}
+		writer->threadLengths[threadId] = length;
+	}
+	else {
+		uint64_t checksum = 0;
+		bool sorted = true;
+		for (long i = blockStart; i < blockEnd; i++) {
+			checksum += getChecksumTerm(writer->position + i, keys[i]);
+			if (i > blockStart && keys[i - 1] > keys[i]) {
+				sorted = false;
+			}
+		}
+		writer->threadChecksums[threadId] = checksum;
+		writer->threadSorted[threadId] = sorted;
+	}
+}
+
+
+/**
+ * Writes the next count keys of the output.
+ * */
+void writeOutputKeys(OutputWriter *writer, const int *keys, long count) {
+
+	if (count <= 0) {
+		return;
+	}
+
+	if (writer->mode == PRINTF_OUTPUT) {
+		for (long i = 0; i < count; i++) {
+			printf("%d ", keys[i]);
+		}
+		writer->position += count;
+		return;
+	}
+	if (writer->mode == BINARY_OUTPUT) {
+		writeFully(writer->fd, (const char *) keys, count * sizeof(int));
+		writer->position += count;
+		return;
+	}
+
+	// the text and checksum formats process the keys in rounds of one block per thread
+	writer->keys = keys;
+	long roundLength = (long) writer->threadCount * OUTPUT_BLOCK_KEYS;
+	for (long roundStart = 0; roundStart < count; roundStart += roundLength) {
+		writer->roundStart = roundStart;
+		writer->roundEnd = (roundStart + roundLength < count) ? roundStart + roundLength : count;
+		long blockLength = (writer->roundEnd - roundStart + writer->threadCount - 1) / writer->threadCount;
+		int threadCount = writer->threadCount;
+		if (blockLength < (long) MIN_ITEMS_PER_THREAD) {
+			blockLength = writer->roundEnd - roundStart;
+			threadCount = 1;
+		}
+		writer->blockLength = blockLength;
+
+		runInParallel(threadCount, processOutputBlock, writer);
+
+		for (int i = 0; i < threadCount; i++) {
+			long blockStart = roundStart + i * blockLength;
+			if (blockStart >= writer->roundEnd) {
+				break;
+			}
+			if (writer->mode == TEXT_OUTPUT) {
+				writeFully(writer->fd, writer->threadBuffers[i], writer->threadLengths[i]);
+			}
+			else {
+				writer->checksum += writer->threadChecksums[i];
+				if (!writer->threadSorted[i] || (writer->position + blockStart > 0 && writer->lastKey > keys[blockStart])) {
+					writer->sorted = false;
+				}
+				long blockEnd = (blockStart + blockLength < writer->roundEnd) ? blockStart + blockLength : writer->roundEnd;
+				writer->lastKey = keys[blockEnd - 1];
+			}
+		}
+	}
+	writer->position += count;
+}
+
+
+void closeOutputWriter(OutputWriter *writer) {
+
+	if (writer->mode == TEXT_OUTPUT) {
+		writeFully(writer->fd, "\n", 1);
+	}
+	else if (writer->mode == PRINTF_OUTPUT) {
+		printf("\n");
+		fflush(stdout);
+	}
+	else if (writer->mode == CHECKSUM_OUTPUT) {
+		char summary[128];
+		int length = snprintf(summary, sizeof(summary), "The sorted array checksum is: %016llx (%ld keys, %s)\n",
+				(unsigned long long) writer->checksum, writer->position, writer->sorted ? "sorted" : "NOT sorted");
+		writeFully(writer->fd, summary, length);
+	}
+
+	if (writer->fd != STDOUT_FILENO) {
+		close(writer->fd);
+	}
+	for (int i = 0; i < writer->threadCount; i++) {
+		free(writer->threadBuffers[i]);
+	}
+	free(writer->threadBuffers);
+	free(writer->threadLengths);
+	free(writer->threadChecksums);
+	free(writer->threadSorted);
+}
+
+/***************************************************************************************************************************************
+ *                        Buffered output writer end
+ * *************************************************************************************************************************************/
+
+
+/***************************************************************************************************************************************
+ *                        External sort
+ *
+ * For inputs that do not fit in memory the keys are sorted in two phases. The run formation phase reads runs of keys that fit
+ * in the memory budget, sorts each run with the selected engine and spills it to an unlinked temporary file; a background
+ * thread reads the next run while the current one is sorted, and another one writes the sorted run while the next is read.
+ * The merge phase merges the runs with a loser tree. Every run has two input buffers, one that is being merged and one that a
+ * background thread refills from the run file, and the merged keys go through two output buffers, one that is being filled
+ * and one that a background thread writes out. When there are too many runs for the buffers of a single merge to fit in the
+ * budget, groups of runs are first merged into longer runs.
+ * *************************************************************************************************************************************/
+
+// the smallest merge buffer worth a read or write call; it limits how many runs one merge can take
+#define MIN_MERGE_BUFFER_KEYS (1 << 14)
+
+/**
+ * A background thread that runs requests one at a time in the order they were submitted. Each request has a done flag that
+ * the submitter waits on.
+ * */
+typedef struct {
+	void (*run)(void *arg);
+	void *arg;
+	bool *done;
+} IoRequest;
+
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	IoRequest *queue;
+	int capacity;
+	int head;
+	int length;
+	bool stopping;
+	// time the thread spent running requests
+	double busyTime;
+} IoThread;
+
+
+void *ioThreadFunction(void *arg) {
+
+	IoThread *io = (IoThread *) arg;
+	pthread_mutex_lock(&io->lock);
+	while (true) {
+		while (io->length == 0 && !io->stopping) {
+			pthread_cond_wait(&io->changed, &io->lock);
+		}
+		if (io->length == 0) {
+			break;
+		}
+		IoRequest request = io->queue[io->head];
+		io->head = (io->head + 1) % io->capacity;
+		io->length--;
+		pthread_mutex_unlock(&io->lock);
+
+		double start = getWallTime();
+		request.run(request.arg);
+		double busyTime = getWallTime() - start;
+
+		pthread_mutex_lock(&io->lock);
+		io->busyTime += busyTime;
+		*request.done = true;
+		pthread_cond_broadcast(&io->changed);
+	}
+	pthread_mutex_unlock(&io->lock);
+	return NULL;
+}
+
+
+void startIoThread(IoThread *io, int capacity) {
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->changed, NULL);
+	io->queue = (IoRequest *) malloc(capacity * sizeof(IoRequest));
+	io->capacity = capacity;
+	io->head = 0;
+	io->length = 0;
+	io->stopping = false;
+	io->busyTime = 0;
+	pthread_create(&io->thread, NULL, ioThreadFunction, (void *) io);
+}
+
+
+void submitIo(IoThread *io, void (*run)(void *arg), void *arg, bool *done) {
+	pthread_mutex_lock(&io->lock);
+	*done = false;
+	IoRequest request = { run, arg, done };
+	io->queue[(io->head + io->length) % io->capacity] = request;
+	io->length++;
+	pthread_cond_broadcast(&io->changed);
+	pthread_mutex_unlock(&io->lock);
+}
+
+
+void waitIo(IoThread *io, bool *done) {
+	pthread_mutex_lock(&io->lock);
+	while (!*done) {
+		pthread_cond_wait(&io->changed, &io->lock);
+	}
+	pthread_mutex_unlock(&io->lock);
+}
+
+
+void stopIoThread(IoThread *io) {
+	pthread_mutex_lock(&io->lock);
+	io->stopping = true;
+	pthread_cond_broadcast(&io->changed);
+	pthread_mutex_unlock(&io->lock);
+	pthread_join(io->thread, NULL);
+	pthread_mutex_destroy(&io->lock);
+	pthread_cond_destroy(&io->changed);
+	free(io->queue);
+}
+
+
+/**
+ * Reads the keys of the input file a piece at a time, from either a text file or a binary array file.
+ * */
+typedef struct {
+	bool binary;
+	int fd;
+	const unsigned char *map;
+	size_t size;
+	// the byte position of the next key
+	size_t position;
+	// the keys read so far and the keys still wanted
+	long keysRead;
+	long remaining;
+	// the number of threads that parse text
+	int threadCount;
+} InputStream;
+
+
+void openInputStream(InputStream *stream, const char *path, long count) {
+
+	stream->fd = open(path, O_RDONLY);
+	if (stream->fd < 0) {
+		printf("Could not open the file. probably the file does not exist.\n");
+		exit(-1);
+	}
+	struct stat fileStatus;
+	fstat(stream->fd, &fileStatus);
+	stream->size = fileStatus.st_size;
+	stream->keysRead = 0;
+	stream->remaining = count;
+	stream->threadCount = THREAD_COUNT;
+	stream->map = NULL;
+
+	RandomArrayHeader header;
+	stream->binary = pread(stream->fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) && isRandomArrayHeader(&header);
+	if (stream->binary) {
+		if (header.version != RANDOM_ARRAY_VERSION || header.elementSize != sizeof(int)) {
+			printf("The binary array file has an unsupported header.\n");
+			exit(-1);
+		}
+		stream->position = sizeof(header);
+		if (header.count < (uint64_t) count) {
+			stream->size = sizeof(header) + header.count * sizeof(int);
+		}
+	}
+	else {
+		stream->position = 0;
+		if (stream->size > 0) {
+			void *data = mmap(NULL, stream->size, PROT_READ, MAP_PRIVATE, stream->fd, 0);
+			if (data == MAP_FAILED) {
+				printf("Could not map the input file into memory.\n");
+				exit(-1);
+			}
+			madvise(data, stream->size, MADV_SEQUENTIAL);
+			stream->map = (const unsigned char *) data;
+		}
+	}
+}
+
+
+/**
+ * Reads the next keys of the stream, as many as fit in capacity, and returns how many were read.
+ * */
+long readInputKeys(InputStream *stream, int *keys, long capacity) {
+
+	long wanted = (capacity < stream->remaining) ? capacity : stream->remaining;
+	long keysRead = 0;
+
+	if (stream->binary) {
+		size_t bytesWanted = wanted * sizeof(int);
+		size_t bytesRead = 0;
+		while (bytesRead < bytesWanted) {
+			ssize_t status = pread(stream->fd, (char *) keys + bytesRead, bytesWanted - bytesRead, stream->position + bytesRead);
+			if (status <= 0) {
+				exitWithReadError(stream->keysRead + bytesRead / sizeof(int));
+			}
+			bytesRead += status;
+		}
+		stream->position += bytesRead;
+		keysRead = wanted;
+	}
+
+	while (!stream->binary && keysRead < wanted) {
+		if (stream->position >= stream->size) {
+			exitWithReadError(stream->keysRead + keysRead);
+		}
+		size_t windowEnd = getKeyWindowEnd(stream->map, stream->size, stream->position, wanted - keysRead);
+
+		size_t endOffset;
+		bool malformed;
+		long parsed = parseIntegers((const char *) stream->map + stream->position, windowEnd - stream->position, keys + keysRead,
+				wanted - keysRead, stream->threadCount, &endOffset, &malformed);
+		keysRead += parsed;
+		if (malformed) {
+			exitWithReadError(stream->keysRead + keysRead);
+		}
+
+		// the parsed part of the file will not be read again, so its pages can be dropped
+		size_t pageSize = sysconf(_SC_PAGESIZE);
+		size_t consumedPages = (stream->position + endOffset) / pageSize * pageSize;
+		size_t droppedPages = stream->position / pageSize * pageSize;
+		if (consumedPages > droppedPages) {
+			madvise((void *) (stream->map + droppedPages), consumedPages - droppedPages, MADV_DONTNEED);
+		}
+		stream->position += endOffset;
+	}
+
+	stream->keysRead += keysRead;
+	stream->remaining -= keysRead;
+	return keysRead;
+}
+
+
+void closeInputStream(InputStream *stream) {
+	if (stream->map != NULL) {
+		munmap((void *) stream->map, stream->size);
+	}
+	close(stream->fd);
+}
+
+
+typedef struct {
+	int fd;
+	long keyCount;
+} RunFile;
+
+typedef struct {
+	// statistics of one external sort
+	long runCount;
+	int mergePassCount;
+	uint64_t bytesSpilled;
+	double readTime;
+	double sortTime;
+	double mergeTime;
+} ExternalSortStats;
+
+
+RunFile createRunFile() {
+	const char *directory = (TEMP_DIRECTORY != NULL) ? TEMP_DIRECTORY : (getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp");
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/optimized_sort_run_XXXXXX", directory);
+	RunFile run;
+	run.fd = mkstemp(path);
+	if (run.fd < 0) {
+		printf("Could not create a temporary run file in %s.\n", directory);
+		exit(-1);
+	}
+	// the file lives on until it is closed, so no run file is left behind even if the program is killed
+	unlink(path);
+	run.keyCount = 0;
+	return run;
+}
+
+
+void appendToRunFile(RunFile *run, const int *keys, long count, ExternalSortStats *stats) {
+	size_t bytes = count * sizeof(int);
+	size_t written = 0;
+	while (written < bytes) {
+		ssize_t status = pwrite(run->fd, (const char *) keys + written, bytes - written, run->keyCount * sizeof(int) + written);
+		if (status <= 0) {
+			printf("Could not write a temporary run file; the temporary directory is probably full.\n");
+			exit(-1);
+		}
+		written += status;
+	}
+	run->keyCount += count;
+	stats->bytesSpilled += bytes;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Run formation
+ * *************************************************************************************************************************************/
+
+typedef struct {
+	InputStream *input;
+	int *keys;
+	long capacity;
+	long count;
+	double readTime;
+} RunReadRequest;
+
+typedef struct {
+	RunFile *run;
+	int *keys;
+	long count;
+	ExternalSortStats *stats;
+} RunWriteRequest;
+
+
+void readRun(void *arg) {
+	RunReadRequest *request = (RunReadRequest *) arg;
+	double start = getWallTime();
+	request->count = readInputKeys(request->input, request->keys, request->capacity);
+	request->readTime += getWallTime() - start;
+}
+
+
+void writeRun(void *arg) {
+	RunWriteRequest *request = (RunWriteRequest *) arg;
+	appendToRunFile(request->run, request->keys, request->count, request->stats);
+}
+
+
+/**
+ * Reads, sorts and spills the runs of the input. Returns the run files; runCount receives their number.
+ * */
+RunFile * formRuns(const char *path, long count, long runCapacity, long *runCount, ExternalSortStats *stats) {
+
+	InputStream input;
+	openInputStream(&input, path, count);
+
+	long maxRunCount = (count + runCapacity - 1) / runCapacity;
+	RunFile *runs = (RunFile *) malloc((maxRunCount > 0 ? maxRunCount : 1) * sizeof(RunFile));
+	int *buffers[2];
+	buffers[0] = (int *) malloc(runCapacity * sizeof(int));
+	buffers[1] = (int *) malloc(runCapacity * sizeof(int));
+
+	IoThread reader, writer;
+	startIoThread(&reader, 1);
+	startIoThread(&writer, 1);
+	RunReadRequest readRequest = { &input, buffers[0], runCapacity, 0, 0.0 };
+	RunWriteRequest writeRequest;
+	bool readDone = true, writeDone = true;
+
+	readRun(&readRequest);
+	long runsFormed = 0;
+	while (readRequest.count > 0) {
+		int *keys = readRequest.keys;
+		long keyCount = readRequest.count;
+		int *otherBuffer = (keys == buffers[0]) ? buffers[1] : buffers[0];
+
+		// the other buffer is free once the previous run is on disk; the next run is read into it while this one is sorted
+		waitIo(&writer, &writeDone);
+		readRequest.keys = otherBuffer;
+		readRequest.count = 0;
+		if (input.remaining > 0) {
+			submitIo(&reader, readRun, &readRequest, &readDone);
+		}
+
+		double start = getWallTime();
+		sortArray(keys, keyCount);
+		stats->sortTime += getWallTime() - start;
+
+		runs[runsFormed] = createRunFile();
+		writeRequest.run = &runs[runsFormed];
+		writeRequest.keys = keys;
+		writeRequest.count = keyCount;
+		writeRequest.stats = stats;
+		submitIo(&writer, writeRun, &writeRequest, &writeDone);
+		runsFormed++;
+
+		waitIo(&reader, &readDone);
+	}
+	waitIo(&writer, &writeDone);
+
+	stopIoThread(&reader);
+	stopIoThread(&writer);
+	closeInputStream(&input);
+	free(buffers[0]);
+	free(buffers[1]);
+
+	stats->readTime += readRequest.readTime;
+	*runCount = runsFormed;
+	return runs;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Run merging
+ * *************************************************************************************************************************************/
+
+// the key of a run that has no keys left; it loses against every real key
+#define EXHAUSTED_RUN_KEY LLONG_MAX
+
+typedef struct {
+	RunFile *run;
+	// the next position of the run file to read into a buffer
+	long nextFileKey;
+	int *buffers[2];
+	long bufferCounts[2];
+	bool bufferReady[2];
+	int current;
+	long cursor;
+	long capacity;
+} MergeInput;
+
+typedef struct {
+	MergeInput *input;
+	int buffer;
+	// the position of the first key to read from the run file
+	long fileKey;
+} MergeReadRequest;
+
+typedef struct {
+	// where the merged keys go: a run file of an intermediate pass, or the output writer in the final pass
+	RunFile *run;
+	OutputWriter *writer;
+	ExternalSortStats *stats;
+	int *keys;
+	long count;
+} MergeWriteRequest;
+
+
+void fillMergeBuffer(void *arg) {
+	MergeReadRequest *request = (MergeReadRequest *) arg;
+	MergeInput *input = request->input;
+	int *keys = input->buffers[request->buffer];
+	long count = input->bufferCounts[request->buffer];
+	size_t bytes = count * sizeof(int);
+	size_t bytesRead = 0;
+	while (bytesRead < bytes) {
+		ssize_t status = pread(input->run->fd, (char *) keys + bytesRead, bytes - bytesRead,
+				request->fileKey * sizeof(int) + bytesRead);
+		if (status <= 0) {
+			printf("Could not read back a temporary run file.\n");
+			exit(-1);
+		}
+		bytesRead += status;
+	}
+}
+
+
+void writeMergedKeys(void *arg) {
+	MergeWriteRequest *request = (MergeWriteRequest *) arg;
+	if (request->run != NULL) {
+		appendToRunFile(request->run, request->keys, request->count, request->stats);
+	}
+	else {
+		writeOutputKeys(request->writer, request->keys, request->count);
+	}
+}
+
+
+/**
+ * Asks the reader to load the next part of the run file into the given buffer of the input; returns false at the end of the file.
+ * */
+bool requestMergeBuffer(IoThread *reader, MergeInput *input, MergeReadRequest *request, int buffer) {
+	long count = input->run->keyCount - input->nextFileKey;
+	if (count > input->capacity) {
+		count = input->capacity;
+	}
+	if (count <= 0) {
+		input->bufferCounts[buffer] = 0;
+		input->bufferReady[buffer] = true;
+		return false;
+	}
+	input->bufferCounts[buffer] = count;
+	request->input = input;
+	request->buffer = buffer;
+	request->fileKey = input->nextFileKey;
+	input->nextFileKey += count;
+	submitIo(reader, fillMergeBuffer, request, &input->bufferReady[buffer]);
+	return true;
+}
+
+
+/**
+ * Returns the next key of the input, after moving to its other buffer if the current one is used up.
+ * */
+static inline long long getMergeInputKey(IoThread *reader, MergeInput *input, MergeReadRequest *requests) {
+	if (input->cursor == input->bufferCounts[input->current]) {
+		// refill the used buffer in the background and continue with the other one
+		int used = input->current;
+		input->current = 1 - used;
+		input->cursor = 0;
+		waitIo(reader, &input->bufferReady[input->current]);
+		if (input->bufferCounts[input->current] > 0) {
+			requestMergeBuffer(reader, input, &requests[used], used);
+		}
+		else {
+			input->bufferCounts[used] = 0;
+		}
+		if (input->bufferCounts[input->current] == 0) {
+			return EXHAUSTED_RUN_KEY;
+		}
+	}
+	return input->buffers[input->current][input->cursor];
+}
+
+
+/**
+ * Replays the matches on the path from a leaf to the root after the key of that leaf changed. The internal nodes 1..k - 1 hold
+ * the loser of their match and tree[0] the overall winner; leaf i sits below node (k + i) / 2.
+ * */
+static inline void replayLoserTree(int *tree, const long long *keys, int leafCount, int leaf) {
+	int winner = leaf;
+	for (int node = (leaf + leafCount) / 2; node >= 1; node /= 2) {
+		if (keys[tree[node]] < keys[winner]) {
+			int loser = winner;
+			winner = tree[node];
+			tree[node] = loser;
+		}
+	}
+	tree[0] = winner;
+}
+
+
+void buildLoserTree(int *tree, const long long *keys, int leafCount) {
+	int *winners = (int *) malloc(2 * leafCount * sizeof(int));
+	for (int i = 0; i < leafCount; i++) {
+		winners[leafCount + i] = i;
+	}
+	for (int node = leafCount - 1; node >= 1; node--) {
+		int left = winners[2 * node];
+		int right = winners[2 * node + 1];
+		if (keys[left] <= keys[right]) {
+			winners[node] = left;
+			tree[node] = right;
+		}
+		else {
+			winners[node] = right;
+			tree[node] = left;
+		}
+	}
+	tree[0] = (leafCount > 1) ? winners[1] : 0;
+	free(winners);
+}
+
+
+/**
+ * Merges runCount runs with bufferKeys keys per buffer. The merged keys go to the output run if it is given and to the
+ * output writer otherwise.
+ * */
+void mergeRuns(RunFile *runs, int runCount, long bufferKeys, RunFile *outputRun, OutputWriter *writer, ExternalSortStats *stats) {
+
+	IoThread reader, writerThread;
+	startIoThread(&reader, 2 * runCount);
+	startIoThread(&writerThread, 2);
+
+	MergeInput *inputs = (MergeInput *) malloc(runCount * sizeof(MergeInput));
+	MergeReadRequest *requests = (MergeReadRequest *) malloc(2 * runCount * sizeof(MergeReadRequest));
+	long long *leafKeys = (long long *) malloc(runCount * sizeof(long long));
+	int *tree = (int *) malloc(runCount * sizeof(int));
+
+	for (int i = 0; i < runCount; i++) {
+		MergeInput *input = &inputs[i];
+		input->run = &runs[i];
+		input->nextFileKey = 0;
+		input->capacity = bufferKeys;
+		input->buffers[0] = (int *) malloc(bufferKeys * sizeof(int));
+		input->buffers[1] = (int *) malloc(bufferKeys * sizeof(int));
+		input->current = 0;
+		input->cursor = 0;
+		requestMergeBuffer(&reader, input, &requests[2 * i], 0);
+		requestMergeBuffer(&reader, input, &requests[2 * i + 1], 1);
+	}
+	for (int i = 0; i < runCount; i++) {
+		waitIo(&reader, &inputs[i].bufferReady[0]);
+		leafKeys[i] = (inputs[i].bufferCounts[0] > 0) ? inputs[i].buffers[0][0] : EXHAUSTED_RUN_KEY;
+	}
+	buildLoserTree(tree, leafKeys, runCount);
+
+	int *outputBuffers[2];
+	outputBuffers[0] = (int *) malloc(bufferKeys * sizeof(int));
+	outputBuffers[1] = (int *) malloc(bufferKeys * sizeof(int));
+	bool outputWritten[2] = { true, true };
+	MergeWriteRequest writeRequests[2];
+	int outputCurrent = 0;
+	long outputCount = 0;
+	int *output = outputBuffers[0];
+
+	while (leafKeys[tree[0]] != EXHAUSTED_RUN_KEY) {
+		int winner = tree[0];
+		output[outputCount++] = (int) leafKeys[winner];
+
+		MergeInput *input = &inputs[winner];
+		input->cursor++;
+		leafKeys[winner] = getMergeInputKey(&reader, input, &requests[2 * winner]);
+		replayLoserTree(tree, leafKeys, runCount, winner);
+
+		if (outputCount == bufferKeys) {
+			MergeWriteRequest *request = &writeRequests[outputCurrent];
+			request->run = outputRun;
+			request->writer = writer;
+			request->stats = stats;
+			request->keys = output;
+			request->count = outputCount;
+			submitIo(&writerThread, writeMergedKeys, request, &outputWritten[outputCurrent]);
+			outputCurrent = 1 - outputCurrent;
+			waitIo(&writerThread, &outputWritten[outputCurrent]);
+			output = outputBuffers[outputCurrent];
+			outputCount = 0;
+		}
+	}
+	if (outputCount > 0) {
+		MergeWriteRequest *request = &writeRequests[outputCurrent];
+		request->run = outputRun;
+		request->writer = writer;
+		request->stats = stats;
+		request->keys = output;
+		request->count = outputCount;
+		submitIo(&writerThread, writeMergedKeys, request, &outputWritten[outputCurrent]);
+	}
+	waitIo(&writerThread, &outputWritten[0]);
+	waitIo(&writerThread, &outputWritten[1]);
+
+	stopIoThread(&reader);
+	stopIoThread(&writerThread);
+	for (int i = 0; i < runCount; i++) {
+		free(inputs[i].buffers[0]);
+		free(inputs[i].buffers[1]);
+	}
+	free(inputs);
+	free(requests);
+	free(leafKeys);
+	free(tree);
+	free(outputBuffers[0]);
+	free(outputBuffers[1]);
+}
+
+
+/**
+ * Sorts the first count keys of the file within the memory budget and prints them. times receives the read, sort and print
+ * times; in external mode the print time is the time of the merge phase, which produces the output.
+ * */
+void externalSort(const char *path, long count, double *times) {
+
+	ExternalSortStats stats;
+	memset(&stats, 0, sizeof(stats));
+	long budgetKeys = (long) (MEMORY_BUDGET_MB * 1024 * 1024 / sizeof(int));
+
+	// two run buffers, plus the scratch space of the same size that the parallel engines need
+	long runCapacity = budgetKeys / 3;
+	if (runCapacity < MIN_MERGE_BUFFER_KEYS) {
+		runCapacity = MIN_MERGE_BUFFER_KEYS;
+	}
+
+	long runCount;
+	double start = getWallTime();
+	RunFile *runs = formRuns(path, count, runCapacity, &runCount, &stats);
+	double formationTime = getWallTime() - start;
+	stats.runCount = runCount;
+
+	// a merge needs two buffers per run and two output buffers
+	long maxFanIn = budgetKeys / (2 * MIN_MERGE_BUFFER_KEYS) - 1;
+	if (maxFanIn < 2) {
+		maxFanIn = 2;
+	}
+
+	start = getWallTime();
+	while (runCount > maxFanIn) {
+		// an intermediate pass merges groups of maxFanIn runs into longer runs
+		long mergedCount = (runCount + maxFanIn - 1) / maxFanIn;
+		RunFile *mergedRuns = (RunFile *) malloc(mergedCount * sizeof(RunFile));
+		for (long group = 0; group < mergedCount; group++) {
+			long first = group * maxFanIn;
+			int groupSize = (int) ((runCount - first < maxFanIn) ? runCount - first : maxFanIn);
+			mergedRuns[group] = createRunFile();
+			mergeRuns(runs + first, groupSize, budgetKeys / (2 * groupSize + 2), &mergedRuns[group], NULL, &stats);
+			for (int i = 0; i < groupSize; i++) {
+				close(runs[first + i].fd);
+			}
+		}
+		free(runs);
+		runs = mergedRuns;
+		runCount = mergedCount;
+		stats.mergePassCount++;
+	}
+
+	OutputWriter writer;
+	openOutputWriter(&writer, count, true);
+	if (runCount > 0) {
+		mergeRuns(runs, (int) runCount, budgetKeys / (2 * runCount + 2), NULL, &writer, &stats);
+	}
+	closeOutputWriter(&writer);
+	stats.mergePassCount++;
+	stats.mergeTime = getWallTime() - start;
+
+	for (long i = 0; i < runCount; i++) {
+		close(runs[i].fd);
+	}
+	free(runs);
+
+	times[0] = stats.readTime;
+	times[1] = stats.sortTime;
+	times[2] = stats.mergeTime;
+
+	double mergedMegabytes = (double) count * sizeof(int) * stats.mergePassCount / (1024 * 1024);
+	printf("\nExternal sort: %ld runs formed in %f seconds, %.1f MB spilled, %d merge passes in %f seconds (%.1f MB/s)\n",
+			stats.runCount, formationTime, stats.bytesSpilled / (1024.0 * 1024.0), stats.mergePassCount, stats.mergeTime,
+			(stats.mergeTime > 0) ? mergedMegabytes / stats.mergeTime : 0.0);
+}
+
+/***************************************************************************************************************************************
+ *                        External sort end
+ * *************************************************************************************************************************************/
+
+
+/***************************************************************************************************************************************
+ *                        Pipelined sort
+ *
+ * --pipeline overlaps the phases instead of running read, sort and print one after another. A read stage parses the input a chunk
+ * at a time, and a pool of sort threads sorts every chunk as soon as it is parsed, so sorting runs while the disk and the parser
+ * are still busy. A merge stage merges the sorted chunks with a loser tree into blocks of output keys, and a write stage formats
+ * and writes each block while the next one is merged, so the smallest keys are written long before the merge is done. The merge
+ * cannot emit its first key before every chunk is sorted, because any chunk may hold the smallest key.
+ *
+ * The stages are connected by bounded queues. Every stage records the time it was busy and the time it waited on a queue, and
+ * every queue records how full it was: a queue that is usually full has a slow consumer and one that is usually empty a slow
+ * producer, which shows the stage that is the bottleneck.
+ * *************************************************************************************************************************************/
+
+// the number of output blocks the merge stage can fill ahead of the write stage
+#define PIPELINE_OUTPUT_BLOCKS 4
+// the chunks are sized so that every sort thread gets about this many of them, within the limits below
+#define PIPELINE_CHUNKS_PER_SORT_THREAD 4
+#define MIN_PIPELINE_CHUNK_KEYS (1 << 16)
+#define MAX_PIPELINE_CHUNK_KEYS (1 << 22)
+
+/**
+ * A bounded blocking queue of pointers. Popping from a closed and empty queue returns NULL.
+ * */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	void **items;
+	int capacity;
+	int head;
+	int length;
+	bool closed;
+	// the number of pushes, the sum and the maximum of the queue length just after each push, and the time producers and
+	// consumers spent waiting for room or for items
+	long pushCount;
+	long lengthSum;
+	int maxLength;
+	double producerWaitTime;
+	double consumerWaitTime;
+} PipelineQueue;
+
+typedef struct {
+	int *keys;
+	long count;
+	// the position of the next key to merge
+	long cursor;
+} PipelineChunk;
+
+typedef struct {
+	int *keys;
+	long count;
+} PipelineBlock;
+
+typedef struct {
+	// the time the stage's threads spent working and waiting on queues, summed over its threads, and the time since the
+	// start of the pipeline at which its last thread finished
+	double busyTime;
+	double waitTime;
+	double finishTime;
+} PipelineStage;
+
+typedef struct {
+	InputStream stream;
+	long count;
+	int *keys;
+	PipelineChunk *chunks;
+	long chunkCount;
+	long chunkKeys;
+	PipelineBlock blocks[PIPELINE_OUTPUT_BLOCKS];
+	long blockKeys;
+	OutputWriter writer;
+	int sortThreadCount;
+	// parsed chunks go to the sort threads, sorted chunks to the merge stage, merged blocks to the write stage, and the written
+	// blocks back to the merge stage
+	PipelineQueue parsedChunks;
+	PipelineQueue sortedChunks;
+	PipelineQueue mergedBlocks;
+	PipelineQueue freeBlocks;
+	pthread_mutex_t statsLock;
+	double startTime;
+	PipelineStage readStage;
+	PipelineStage sortStage;
+	PipelineStage mergeStage;
+	PipelineStage writeStage;
+} Pipeline;
+
+
+void initPipelineQueue(PipelineQueue *queue, int capacity) {
+	memset(queue, 0, sizeof(PipelineQueue));
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->changed, NULL);
+	queue->items = (void **) malloc(capacity * sizeof(void *));
+	queue->capacity = capacity;
+}
+
+
+void destroyPipelineQueue(PipelineQueue *queue) {
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->changed);
+	free(queue->items);
+}
+
+
+/**
+ * Adds an item, waiting while the queue is full, and returns the time waited.
+ * */
+double pushPipelineQueue(PipelineQueue *queue, void *item) {
+	double waitTime = 0;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->length == queue->capacity) {
+		double start = getWallTime();
+		while (queue->length == queue->capacity) {
+			pthread_cond_wait(&queue->changed, &queue->lock);
+		}
+		waitTime = getWallTime() - start;
+		queue->producerWaitTime += waitTime;
+	}
+	queue->items[(queue->head + queue->length) % queue->capacity] = item;
+	queue->length++;
+	queue->pushCount++;
+	queue->lengthSum += queue->length;
+	if (queue->length > queue->maxLength) {
+		queue->maxLength = queue->length;
+	}
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+	return waitTime;
+}
+
+
+/**
+ * Takes the oldest item, waiting while the queue is empty but open, and returns the time waited. The item is NULL once the queue
+ * is closed and empty.
+ * */
+double popPipelineQueue(PipelineQueue *queue, void **item) {
+	double waitTime = 0;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->length == 0 && !queue->closed) {
+		double start = getWallTime();
+		while (queue->length == 0 && !queue->closed) {
+			pthread_cond_wait(&queue->changed, &queue->lock);
+		}
+		waitTime = getWallTime() - start;
+		queue->consumerWaitTime += waitTime;
+	}
+	*item = NULL;
+	if (queue->length > 0) {
+		*item = queue->items[queue->head];
+		queue->head = (queue->head + 1) % queue->capacity;
+		queue->length--;
+		pthread_cond_broadcast(&queue->changed);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return waitTime;
+}
+
+
+void closePipelineQueue(PipelineQueue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = true;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+/**
+ * Adds the times of one stage thread to the stage. start is when the thread started working.
+ * */
+void finishPipelineStage(Pipeline *pipeline, PipelineStage *stage, double start, double waitTime) {
+	double end = getWallTime();
+	pthread_mutex_lock(&pipeline->statsLock);
+	stage->busyTime += end - start - waitTime;
+	stage->waitTime += waitTime;
+	if (end - pipeline->startTime > stage->finishTime) {
+		stage->finishTime = end - pipeline->startTime;
+	}
+	pthread_mutex_unlock(&pipeline->statsLock);
+}
+
+
+void runReadStage(Pipeline *pipeline) {
+	double start = getWallTime();
+	double waitTime = 0;
+	for (long i = 0; i < pipeline->chunkCount; i++) {
+		PipelineChunk *chunk = &pipeline->chunks[i];
+		readInputKeys(&pipeline->stream, chunk->keys, chunk->count);
+		waitTime += pushPipelineQueue(&pipeline->parsedChunks, chunk);
+	}
+	closePipelineQueue(&pipeline->parsedChunks);
+	finishPipelineStage(pipeline, &pipeline->readStage, start, waitTime);
+}
+
+
+void runSortStage(Pipeline *pipeline) {
+	double start = getWallTime();
+	double waitTime = 0;
+	while (true) {
+		void *item;
+		waitTime += popPipelineQueue(&pipeline->parsedChunks, &item);
+		if (item == NULL) {
+			break;
+		}
+		PipelineChunk *chunk = (PipelineChunk *) item;
+		// the chunks are sorted concurrently, so each one is sorted on a single thread
+		sortKeys(chunk->keys, chunk->count, 1);
+		waitTime += pushPipelineQueue(&pipeline->sortedChunks, chunk);
+	}
+	finishPipelineStage(pipeline, &pipeline->sortStage, start, waitTime);
+}
+
+
+void runMergeStage(Pipeline *pipeline) {
+
+	double start = getWallTime();
+	double waitTime = 0;
+	long chunkCount = pipeline->chunkCount;
+	for (long i = 0; i < chunkCount; i++) {
+		void *item;
+		waitTime += popPipelineQueue(&pipeline->sortedChunks, &item);
+	}
+
+	long long *leafKeys = (long long *) malloc((chunkCount + 1) * sizeof(long long));
+	int *tree = (int *) malloc((chunkCount + 1) * sizeof(int));
+	for (long i = 0; i < chunkCount; i++) {
+		leafKeys[i] = (pipeline->chunks[i].count > 0) ? pipeline->chunks[i].keys[0] : EXHAUSTED_RUN_KEY;
+	}
+	if (chunkCount > 0) {
+		buildLoserTree(tree, leafKeys, (int) chunkCount);
+	}
+
+	PipelineBlock *block = NULL;
+	while (chunkCount > 0 && leafKeys[tree[0]] != EXHAUSTED_RUN_KEY) {
+		if (block == NULL) {
+			void *item;
+			waitTime += popPipelineQueue(&pipeline->freeBlocks, &item);
+			block = (PipelineBlock *) item;
+			block->count = 0;
+		}
+
+		int winner = tree[0];
+		block->keys[block->count++] = (int) leafKeys[winner];
+		PipelineChunk *chunk = &pipeline->chunks[winner];
+		chunk->cursor++;
+		leafKeys[winner] = (chunk->cursor < chunk->count) ? chunk->keys[chunk->cursor] : EXHAUSTED_RUN_KEY;
+		replayLoserTree(tree, leafKeys, (int) chunkCount, winner);
+
+		if (block->count == pipeline->blockKeys) {
+			waitTime += pushPipelineQueue(&pipeline->mergedBlocks, block);
+			block = NULL;
+		}
+	}
+	if (block != NULL) {
+		waitTime += pushPipelineQueue(&pipeline->mergedBlocks, block);
+	}
+	closePipelineQueue(&pipeline->mergedBlocks);
+
+	free(leafKeys);
+	free(tree);
+	finishPipelineStage(pipeline, &pipeline->mergeStage, start, waitTime);
+}
+
+
+void runWriteStage(Pipeline *pipeline) {
+	double start = getWallTime();
+	double waitTime = 0;
+	while (true) {
+		void *item;
+		waitTime += popPipelineQueue(&pipeline->mergedBlocks, &item);
+		if (item == NULL) {
+			break;
+		}
+		PipelineBlock *block = (PipelineBlock *) item;
+		writeOutputKeys(&pipeline->writer, block->keys, block->count);
+		waitTime += pushPipelineQueue(&pipeline->freeBlocks, block);
+	}
+	finishPipelineStage(pipeline, &pipeline->writeStage, start, waitTime);
+}
+
+
+void printPipelineStage(const char *name, const PipelineStage *stage, int threadCount) {
+	printf("\t%-16s%8d%14f%14f%18f\n", name, threadCount, stage->busyTime, stage->waitTime, stage->finishTime);
+}
+
+
+void printPipelineQueue(const char *name, const PipelineQueue *queue) {
+	printf("\t%-16s%8d%14.2f%12d%20f%20f\n", name, queue->capacity,
+			(queue->pushCount > 0) ? (double) queue->lengthSum / queue->pushCount : 0.0, queue->maxLength,
+			queue->producerWaitTime, queue->consumerWaitTime);
+}
+
+
+/**
+ * Sorts the first count keys of the file with the read, sort, merge and write stages running concurrently and prints them. times
+ * receives the wall time until the last chunk was read, from then until the last chunk was sorted, and from then until the
+ * output was written, so the three add up to the total time like the phases of the other modes.
+ * */
+void pipelinedSort(const char *path, long count, double *times) {
+
+	Pipeline pipeline;
+	pipeline.count = count;
+	openInputStream(&pipeline.stream, path, count);
+
+	// text is parsed by about half of the threads while the other half sorts; binary input needs no parsing
+	int parseThreadCount = pipeline.stream.binary ? 1 : (THREAD_COUNT + 1) / 2;
+	pipeline.stream.threadCount = parseThreadCount;
+	pipeline.sortThreadCount = pipeline.stream.binary ? THREAD_COUNT : THREAD_COUNT - parseThreadCount;
+	if (pipeline.sortThreadCount < 1) {
+		pipeline.sortThreadCount = 1;
+	}
+
+	pipeline.chunkKeys = PIPELINE_CHUNK_KEYS;
+	if (pipeline.chunkKeys <= 0) {
+		pipeline.chunkKeys = count / (PIPELINE_CHUNKS_PER_SORT_THREAD * pipeline.sortThreadCount);
+		if (pipeline.chunkKeys < MIN_PIPELINE_CHUNK_KEYS) {
+			pipeline.chunkKeys = MIN_PIPELINE_CHUNK_KEYS;
+		}
+		else if (pipeline.chunkKeys > MAX_PIPELINE_CHUNK_KEYS) {
+			pipeline.chunkKeys = MAX_PIPELINE_CHUNK_KEYS;
+		}
+	}
+	pipeline.chunkCount = (count + pipeline.chunkKeys - 1) / pipeline.chunkKeys;
+
+	pipeline.keys = (int *) malloc(count * sizeof(int));
+	pipeline.chunks = (PipelineChunk *) malloc(pipeline.chunkCount * sizeof(PipelineChunk));
+	for (long i = 0; i < pipeline.chunkCount; i++) {
+		long chunkStart = i * pipeline.chunkKeys;
+		pipeline.chunks[i].keys = pipeline.keys + chunkStart;
+		pipeline.chunks[i].count = (count - chunkStart < pipeline.chunkKeys) ? count - chunkStart : pipeline.chunkKeys;
+		pipeline.chunks[i].cursor = 0;
+	}
+
+	// a block is one round of the output writer, so every block is formatted by all of its threads
+	pipeline.blockKeys = (long) THREAD_COUNT * OUTPUT_BLOCK_KEYS;
+	initPipelineQueue(&pipeline.parsedChunks, 2 * pipeline.sortThreadCount);
+	initPipelineQueue(&pipeline.sortedChunks, (pipeline.chunkCount > 0) ? (int) pipeline.chunkCount : 1);
+	initPipelineQueue(&pipeline.mergedBlocks, PIPELINE_OUTPUT_BLOCKS);
+	initPipelineQueue(&pipeline.freeBlocks, PIPELINE_OUTPUT_BLOCKS);
+	for (int i = 0; i < PIPELINE_OUTPUT_BLOCKS; i++) {
+		pipeline.blocks[i].keys = (int *) malloc(pipeline.blockKeys * sizeof(int));
+		pushPipelineQueue(&pipeline.freeBlocks, &pipeline.blocks[i]);
+	}
+	pipeline.freeBlocks.pushCount = 0;
+	pipeline.freeBlocks.lengthSum = 0;
+	pipeline.freeBlocks.maxLength = 0;
+
+	pthread_mutex_init(&pipeline.statsLock, NULL);
+	memset(&pipeline.readStage, 0, sizeof(PipelineStage));
+	memset(&pipeline.sortStage, 0, sizeof(PipelineStage));
+	memset(&pipeline.mergeStage, 0, sizeof(PipelineStage));
+	memset(&pipeline.writeStage, 0, sizeof(PipelineStage));
+
+	pipeline.startTime = getWallTime();
+	openOutputWriter(&pipeline.writer, count, true);
+
+	// thread 0 reads, the last two threads merge and write, and the ones in between sort
+	runInParallel(pipeline.sortThreadCount + 3, [&pipeline](int threadId, int threadCount) {
+		if (threadId == 0) {
+			runReadStage(&pipeline);
+		}
+		else if (threadId == threadCount - 2) {
+			runMergeStage(&pipeline);
+		}
+		else if (threadId == threadCount - 1) {
+			runWriteStage(&pipeline);
+		}
+		else {
+			runSortStage(&pipeline);
+		}
+	});
+
+	closeOutputWriter(&pipeline.writer);
+	double totalTime = getWallTime() - pipeline.startTime;
+
+	// the merge stage starts merging once the last chunk is sorted
+	double sortedTime = pipeline.sortStage.finishTime;
+	times[0] = pipeline.readStage.finishTime;
+	times[1] = sortedTime - pipeline.readStage.finishTime;
+	times[2] = totalTime - sortedTime;
+
+	// the bottleneck is the stage with the most busy time per thread
+	const char *stageNames[4] = { "read", "sort", "merge", "write" };
+	double stageLoads[4] = { pipeline.readStage.busyTime, pipeline.sortStage.busyTime / pipeline.sortThreadCount,
+			pipeline.mergeStage.busyTime, pipeline.writeStage.busyTime };
+	int bottleneck = 0;
+	for (int i = 1; i < 4; i++) {
+		if (stageLoads[i] > stageLoads[bottleneck]) {
+			bottleneck = i;
+		}
+	}
+
+	printf("\nPipeline: %ld chunks of up to %ld keys, %d parse threads, %d sort threads, done in %f seconds, busiest stage: %s\n",
+			pipeline.chunkCount, pipeline.chunkKeys, pipeline.stream.binary ? 0 : parseThreadCount, pipeline.sortThreadCount,
+			totalTime, stageNames[bottleneck]);
+	printf("\t%-16s%8s%14s%14s%18s\n", "stage", "threads", "busy (s)", "waiting (s)", "finished at (s)");
+	printPipelineStage("read", &pipeline.readStage, 1);
+	printPipelineStage("sort", &pipeline.sortStage, pipeline.sortThreadCount);
+	printPipelineStage("merge", &pipeline.mergeStage, 1);
+	printPipelineStage("write", &pipeline.writeStage, 1);
+	printf("\t%-16s%8s%14s%12s%20s%20s\n", "queue", "size", "mean length", "max length", "producer wait (s)",
+			"consumer wait (s)");
+	printPipelineQueue("parsed chunks", &pipeline.parsedChunks);
+	printPipelineQueue("sorted chunks", &pipeline.sortedChunks);
+	printPipelineQueue("merged blocks", &pipeline.mergedBlocks);
+	printPipelineQueue("free blocks", &pipeline.freeBlocks);
+
+	closeInputStream(&pipeline.stream);
+	destroyPipelineQueue(&pipeline.parsedChunks);
+	destroyPipelineQueue(&pipeline.sortedChunks);
+	destroyPipelineQueue(&pipeline.mergedBlocks);
+	destroyPipelineQueue(&pipeline.freeBlocks);
+	pthread_mutex_destroy(&pipeline.statsLock);
+	for (int i = 0; i < PIPELINE_OUTPUT_BLOCKS; i++) {
+		free(pipeline.blocks[i].keys);
+	}
+	free(pipeline.chunks);
+	free(pipeline.keys);
+}
+
+/***************************************************************************************************************************************
+ *                        Pipelined sort end
+ * *************************************************************************************************************************************/
+
+
+/***************************************************************************************************************************************
+ *                        Selection modes
+ *
+ * --top-k, --nth and --quantiles answer questions about a few order statistics without sorting the array. --top-k streams the
+ * input a block at a time through bounded heaps, so besides the block being parsed it keeps only k keys per thread. --nth and
+ * --quantiles read the whole array and pick the wanted ranks with parallel_sort::selectRanks in about one parallel pass. To show
+ * what the answers would cost with the full sort, a child process first runs the read and sort phases on the same input and
+ * reports its time, its peak memory and a checksum of its answers; the parent then runs the selection and compares.
+ * *************************************************************************************************************************************/
+
+// keys parsed per step of the streaming top-k
+#define SELECTION_BLOCK_KEYS (1 << 20)
+
+typedef struct {
+	double readTime;
+	double sortTime;
+	uint64_t answerChecksum;
+	long peakKilobytes;
+} FullSortReference;
+
+struct GreaterKey {
+	bool operator()(int a, int b) const {
+		return a > b;
+	}
+};
+
+
+/**
+ * Fills ranks with the ranks wanted by --nth or --quantiles, and quantiles with the quantile of each, and returns their number.
+ * A quantile q is the key of rank floor(q * (count - 1)).
+ * */
+long getSelectionRanks(long count, size_t **ranks, double **quantiles) {
+
+	if (SELECTION_MODE == NTH_SELECTION) {
+		*ranks = (size_t *) malloc(sizeof(size_t));
+		*quantiles = (double *) malloc(sizeof(double));
+		(*ranks)[0] = SELECTION_NTH;
+		(*quantiles)[0] = -1;
+		if (SELECTION_NTH >= count) {
+			printf("The rank of --nth must be below the count of %ld keys.\n", count);
+			exit(-1);
+		}
+		return 1;
+	}
+
+	long rankCount = 1;
+	for (const char *c = SELECTION_QUANTILES; *c != '\0'; c++) {
+		rankCount += (*c == ',');
+	}
+	*ranks = (size_t *) malloc(rankCount * sizeof(size_t));
+	*quantiles = (double *) malloc(rankCount * sizeof(double));
+	const char *value = SELECTION_QUANTILES;
+	for (long j = 0; j < rankCount; j++) {
+		char *end;
+		double quantile = strtod(value, &end);
+		if (end == value || quantile < 0.0 || quantile > 1.0 || (*end != ',' && *end != '\0')) {
+			printf("The quantiles must be numbers between 0 and 1.\n");
+			exit(-1);
+		}
+		(*quantiles)[j] = quantile;
+		(*ranks)[j] = (size_t) (quantile * (count - 1));
+		value = end + 1;
+	}
+	return rankCount;
+}
+
+
+uint64_t getAnswerChecksum(const int *answers, long count) {
+	uint64_t checksum = 0;
+	for (long i = 0; i < count; i++) {
+		checksum += getChecksumTerm(i, answers[i]);
+	}
+	return checksum;
+}
+
+
+/**
+ * Runs the read and sort phases of the normal mode in a child process and returns its phase times, its peak resident memory and
+ * the checksum of the answers read off the sorted array. The child starts before the parent has allocated anything large, so its
+ * peak memory is that of the full sort path alone.
+ * */
+FullSortReference runFullSortReference(const char *path, long count, const size_t *ranks, long rankCount) {
+
+	int channel[2];
+	if (pipe(channel) != 0) {
+		printf("Could not create a pipe for the full sort reference.\n");
+		exit(-1);
+	}
+	fflush(stdout);
+	pid_t child = fork();
+	if (child < 0) {
+		printf("Could not start the full sort reference.\n");
+		exit(-1);
+	}
+
+	if (child == 0) {
+		close(channel[0]);
+		FullSortReference reference;
+		double start = getWallTime();
+		int *array = readArray(path, count);
+		reference.readTime = getWallTime() - start;
+		start = getWallTime();
+		sortArray(array, count);
+		reference.sortTime = getWallTime() - start;
+
+		if (SELECTION_MODE == TOP_K_SELECTION) {
+			long k = (SELECTION_K < count) ? SELECTION_K : count;
+			// the k largest keys are reported in increasing order as well
+			reference.answerChecksum = getAnswerChecksum(array + (SELECT_LARGEST ? count - k : 0), k);
+		}
+		else {
+			int *answers = (int *) malloc(rankCount * sizeof(int));
+			for (long j = 0; j < rankCount; j++) {
+				answers[j] = array[ranks[j]];
+			}
+			reference.answerChecksum = getAnswerChecksum(answers, rankCount);
+			free(answers);
+		}
+		bool sent = write(channel[1], &reference, sizeof(reference)) == (ssize_t) sizeof(reference);
+		_exit(sent ? 0 : 1);
+	}
+
+	close(channel[1]);
+	FullSortReference reference;
+	bool received = read(channel[0], &reference, sizeof(reference)) == (ssize_t) sizeof(reference);
+	close(channel[0]);
+	int status;
+	struct rusage usage;
+	wait4(child, &status, 0, &usage);
+	if (!received || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("The full sort reference run failed.\n");
+		exit(-1);
+	}
+	reference.peakKilobytes = usage.ru_maxrss;
+	return reference;
+}
+
+
+/**
+ * Streams the first count keys of the file through bounded heaps and writes the k first keys in the given order to answers.
+ * Returns the number of answers; times receives the time spent reading and the time spent selecting.
+ * */
+template <typename Compare>
+long streamTopKeys(const char *path, long count, long k, int *answers, double *times, Compare order) {
+
+	InputStream stream;
+	openInputStream(&stream, path, count);
+	int *block = (int *) malloc(SELECTION_BLOCK_KEYS * sizeof(int));
+	int *heaps = (int *) malloc((size_t) THREAD_COUNT * k * sizeof(int));
+	size_t *heapSizes = (size_t *) calloc(THREAD_COUNT, sizeof(size_t));
+
+	times[0] = 0;
+	times[1] = 0;
+	long keysDone = 0;
+	while (keysDone < count) {
+		double start = getWallTime();
+		long keysRead = readInputKeys(&stream, block, SELECTION_BLOCK_KEYS);
+		times[0] += getWallTime() - start;
+
+		start = getWallTime();
+		parallel_sort::offerSmallest(block, keysRead, k, heaps, heapSizes, THREAD_COUNT, order);
+		times[1] += getWallTime() - start;
+		keysDone += keysRead;
+	}
+
+	double start = getWallTime();
+	long answerCount = parallel_sort::collectSmallest(heaps, heapSizes, THREAD_COUNT, k, answers, order);
+	times[1] += getWallTime() - start;
+
+	closeInputStream(&stream);
+	free(block);
+	free(heaps);
+	free(heapSizes);
+	return answerCount;
+}
+
+
+void runSelection(char *argv[]) {
+
+	const char *path = argv[1];
+	long count = atol(argv[2]);
+	int iterations = atoi(argv[3]);
+	if (count < 1 || iterations < 1) {
+		printf("The selection modes need at least one key and one iteration.\n");
+		exit(-1);
+	}
+
+	size_t *ranks = NULL;
+	double *quantiles = NULL;
+	long answerCapacity;
+	long rankCount = 0;
+	if (SELECTION_MODE == TOP_K_SELECTION) {
+		answerCapacity = (SELECTION_K < count) ? SELECTION_K : count;
+	}
+	else {
+		rankCount = getSelectionRanks(count, &ranks, &quantiles);
+		answerCapacity = rankCount;
+	}
+
+	FullSortReference reference = runFullSortReference(path, count, ranks, rankCount);
+
+	int *answers = (int *) malloc(answerCapacity * sizeof(int));
+	long answerCount = 0;
+	double summationOfTimes[3] = { 0, 0, 0 };
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		double times[3];
+		if (SELECTION_MODE == TOP_K_SELECTION) {
+			if (SELECT_LARGEST) {
+				answerCount = streamTopKeys(path, count, answerCapacity, answers, times, GreaterKey());
+				std::reverse(answers, answers + answerCount);
+			}
+			else {
+				answerCount = streamTopKeys(path, count, answerCapacity, answers, times, parallel_sort::Less<int>());
+			}
+		}
+		else {
+			double start = getWallTime();
+			int *array = readArray(path, count);
+			times[0] = getWallTime() - start;
+			start = getWallTime();
+			parallel_sort::selectRanks(array, count, ranks, rankCount, answers, THREAD_COUNT);
+			times[1] = getWallTime() - start;
+			free(array);
+			answerCount = rankCount;
+		}
+
+		double start = getWallTime();
+		if (SELECTION_MODE == TOP_K_SELECTION) {
+			printf("The %ld %s keys in increasing order:\n", answerCount, SELECT_LARGEST ? "largest" : "smallest");
+			OutputWriter writer;
+			openOutputWriter(&writer, answerCount, false);
+			writeOutputKeys(&writer, answers, answerCount);
+			closeOutputWriter(&writer);
+		}
+		else {
+			for (long j = 0; j < rankCount; j++) {
+				if (SELECTION_MODE == NTH_SELECTION) {
+					printf("The key of rank %zu is: %d\n", ranks[j], answers[j]);
+				}
+				else {
+					printf("The %g quantile (rank %zu) is: %d\n", quantiles[j], ranks[j], answers[j]);
+				}
+			}
+		}
+		times[2] = getWallTime() - start;
+
+		for (int j = 0; j < 3; j++) {
+			summationOfTimes[j] += times[j];
+		}
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	bool answersMatch = getAnswerChecksum(answers, answerCount) == reference.answerChecksum;
+	const char *method = (SELECTION_MODE == TOP_K_SELECTION) ? "streaming bounded heaps" : "parallel sample select";
+
+	printf("\n\nAverage time taken to read the input for %d iterations is: %f seconds\n", iterations, summationOfTimes[0] / iterations);
+	printf("\n\nAverage time taken to select with %s (%d threads) for %d iterations is: %f seconds\n", method, THREAD_COUNT,
+			iterations, summationOfTimes[1] / iterations);
+	printf("\n\nAverage time taken to print the answers for %d iterations is: %f seconds\n", iterations,
+			summationOfTimes[2] / iterations);
+	printf("\n\nThe full sort path with %s took %f seconds to read and %f seconds to sort, with a peak memory of %.1f MB.\n",
+			getSortEngineName(SORT_ENGINE), reference.readTime, reference.sortTime, reference.peakKilobytes / 1024.0);
+	printf("The selection took %f seconds to read and select, with a peak memory of %.1f MB. The answers %s the full sort.\n",
+			(summationOfTimes[0] + summationOfTimes[1]) / iterations, usage.ru_maxrss / 1024.0,
+			answersMatch ? "match" : "DO NOT match");
+
+	free(answers);
+	free(ranks);
+	free(quantiles);
+}
+
+/***************************************************************************************************************************************
+ *                        Selection modes end
+ * *************************************************************************************************************************************/
+
+
+/***************************************************************************************************************************************
+ *                        Benchmark harness
+ *
+ * --benchmark runs the read, sort and print pipeline for every combination of the requested sizes and key distributions. The
+ * input of a combination is loaded or generated once and cached in memory: text inputs stay as text, so every iteration still
+ * parses them, and binary inputs are copied. Warmup iterations run first and are not measured. For each phase the harness
+ * reports the minimum, median, 95th percentile and maximum time over the measured iterations, and it checks every sorted
+ * array through the checksum of the output writer.
+ * *************************************************************************************************************************************/
+
+#define BENCHMARK_PHASE_COUNT 3
+
+static const char *BENCHMARK_PHASE_NAMES[BENCHMARK_PHASE_COUNT] = { "read", "sort", "print" };
+
+typedef struct {
+	// text to parse, or NULL when the keys of a binary file are cached instead
+	char *text;
+	size_t textLength;
+	int *keys;
+	long count;
+} BenchmarkInput;
+
+typedef struct {
+	double min;
+	double median;
+	double p95;
+	double max;
+	double mean;
+} PhaseStats;
+
+typedef struct {
+	KeyGenerator generator;
+	long count;
+	int *keys;
+	// the text of each thread's part of the keys
+	char **threadTexts;
+	size_t *threadLengths;
+} InputGenerationContext;
+
+
+void generateInputPart(int threadId, int threadCount, void *context) {
+
+	InputGenerationContext *generation = (InputGenerationContext *) context;
+	long start = getPartitionStart(generation->count, threadId, threadCount);
+	long end = getPartitionStart(generation->count, threadId + 1, threadCount);
+
+	char *text = (char *) malloc((end - start) * MAX_KEY_TEXT_LENGTH + 1);
+	size_t length = 0;
+	for (long i = start; i < end; i++) {
+		length += formatKey(generateKey(&generation->generator, i), text + length);
+	}
+	generation->threadTexts[threadId] = text;
+	generation->threadLengths[threadId] = length;
+}
+
+
+/**
+ * Generates count keys of the distribution as the text that random_array_generator.o would write.
+ * */
+void generateBenchmarkInput(BenchmarkInput *input, KeyDistribution distribution, long count) {
+
+	InputGenerationContext generation;
+	memset(&generation.generator, 0, sizeof(generation.generator));
+	generation.generator.distribution = distribution;
+	generation.generator.seed = 1;
+	generation.generator.count = count;
+	generation.generator.unsortedPercent = 1.0;
+	generation.generator.uniqueKeys = 16;
+	generation.generator.zipfExponent = 1.0;
+	initKeyGenerator(&generation.generator);
+	generation.count = count;
+	generation.threadTexts = (char **) malloc(THREAD_COUNT * sizeof(char *));
+	generation.threadLengths = (size_t *) malloc(THREAD_COUNT * sizeof(size_t));
+
+	runInParallel(THREAD_COUNT, generateInputPart, &generation);
+
+	input->textLength = 0;
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		input->textLength += generation.threadLengths[i];
+	}
+	input->text = (char *) malloc(input->textLength + 1);
+	size_t offset = 0;
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		memcpy(input->text + offset, generation.threadTexts[i], generation.threadLengths[i]);
+		offset += generation.threadLengths[i];
+		free(generation.threadTexts[i]);
+	}
+	input->keys = NULL;
+	input->count = count;
+
+	free(generation.threadTexts);
+	free(generation.threadLengths);
+}
+
+
+/**
+ * Caches the input file in memory: the keys of a binary array file, or the text of the first count keys of a text file, so that
+ * the read phase of every size parses only the keys it sorts.
+ * */
+void loadBenchmarkInput(BenchmarkInput *input, const char *path, long count) {
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not open the file. probably the file does not exist.\n");
+		exit(-1);
+	}
+	input->count = count;
+	input->text = NULL;
+	input->keys = NULL;
+
+	RandomArrayHeader header;
+	if (pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) && isRandomArrayHeader(&header)) {
+		input->keys = readArrayFromBinaryFile(fd, count);
+		close(fd);
+		return;
+	}
+
+	struct stat fileStatus;
+	fstat(fd, &fileStatus);
+	size_t size = fileStatus.st_size;
+	input->textLength = 0;
+	input->text = (char *) malloc(1);
+	if (size == 0) {
+		close(fd);
+		if (count > 0) {
+			exitWithReadError(0);
+		}
+		return;
+	}
+
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		printf("Could not map the input file into memory.\n");
+		exit(-1);
+	}
+	close(fd);
+
+	// the keys are parsed once here to find where the count-th one ends, and only the text up to there is kept
+	int *keys = (int *) malloc((count > 0 ? count : 1) * sizeof(int));
+	bool malformed;
+	long itemsRead = parseLeadingIntegers((const char *) data, size, keys, count, THREAD_COUNT, true, &input->textLength,
+			&malformed);
+	free(keys);
+	if (itemsRead < count) {
+		exitWithReadError(itemsRead);
+	}
+	free(input->text);
+	input->text = (char *) malloc(input->textLength + 1);
+	memcpy(input->text, data, input->textLength);
+	munmap(data, size);
+}
+
+
+void freeBenchmarkInput(BenchmarkInput *input) {
+	free(input->text);
+	free(input->keys);
+}
+
+
+/**
+ * The read phase of one iteration: parses the cached text, or copies the cached keys.
+ * */
+int * readBenchmarkInput(const BenchmarkInput *input) {
+
+	int *array = (int *) malloc(input->count * sizeof(int));
+	if (input->keys != NULL) {
+		memcpy(array, input->keys, input->count * sizeof(int));
+		return array;
+	}
+
+	size_t endOffset;
+	bool malformed;
+	long itemsRead = parseIntegers(input->text, input->textLength, array, input->count, THREAD_COUNT, &endOffset, &malformed);
+	if (itemsRead < input->count) {
+		exitWithReadError(itemsRead);
+	}
+	return array;
+}
+
+
+int compareDoubles(const void* numA, const void* numB) {
+	double a = *(const double *) numA;
+	double b = *(const double *) numB;
+	return (a > b) - (a < b);
+}
+
+
+PhaseStats getPhaseStats(const double *samples, int sampleCount) {
+
+	double *sorted = (double *) malloc(sampleCount * sizeof(double));
+	memcpy(sorted, samples, sampleCount * sizeof(double));
+	qsort(sorted, sampleCount, sizeof(double), compareDoubles);
+
+	PhaseStats stats;
+	stats.min = sorted[0];
+	stats.max = sorted[sampleCount - 1];
+	stats.median = (sampleCount % 2 == 1) ? sorted[sampleCount / 2] : (sorted[sampleCount / 2 - 1] + sorted[sampleCount / 2]) / 2;
+	// nearest rank percentile
+	int p95Rank = (int) ceil(0.95 * sampleCount);
+	stats.p95 = sorted[(p95Rank > 0 ? p95Rank : 1) - 1];
+	stats.mean = 0;
+	for (int i = 0; i < sampleCount; i++) {
+		stats.mean += sorted[i];
+	}
+	stats.mean /= sampleCount;
+
+	free(sorted);
+	return stats;
+}
+
+
+/**
+ * Runs one iteration of the pipeline on the cached input; times receives the phase times. Returns whether the output was
+ * sorted, and checksum receives the output checksum.
+ * */
+bool runBenchmarkIteration(const BenchmarkInput *input, double *times, uint64_t *checksum) {
+
+	double start_time = getWallTime();
+	int *array = readBenchmarkInput(input);
+	times[0] = getWallTime() - start_time;
+
+	start_time = getWallTime();
+	sortArray(array, input->count);
+	times[1] = getWallTime() - start_time;
+
+	// the print phase is timed with the selected output format; the checksum is computed separately so that every format
+	// is checked, and it is not part of the measured time
+	start_time = getWallTime();
+	OutputWriter writer;
+	openOutputWriter(&writer, input->count, true);
+	writeOutputKeys(&writer, array, input->count);
+	closeOutputWriter(&writer);
+	times[2] = getWallTime() - start_time;
+
+	OutputMode selectedMode = OUTPUT_MODE;
+	const char *selectedFile = OUTPUT_FILE;
+	OUTPUT_MODE = CHECKSUM_OUTPUT;
+	OUTPUT_FILE = "/dev/null";
+	openOutputWriter(&writer, input->count, true);
+	writeOutputKeys(&writer, array, input->count);
+	closeOutputWriter(&writer);
+	OUTPUT_MODE = selectedMode;
+	OUTPUT_FILE = selectedFile;
+
+	free(array);
+	*checksum = writer.checksum;
+	return writer.sorted && writer.position == input->count;
+}
+
+
+void writeBenchmarkReportRow(FILE *report, bool json, bool firstRow, long size, const char *distribution, const char *phase,
+		int iterations, const PhaseStats *stats, bool verified) {
+
+	int threadCount = (SORT_ENGINE == QSORT_ENGINE) ? 1 : THREAD_COUNT;
+	if (json) {
+		fprintf(report, "%s\n  {\"size\": %ld, \"distribution\": \"%s\", \"engine\": \"%s\", \"threads\": %d, \"phase\": \"%s\", "
+				"\"iterations\": %d, \"min_seconds\": %.9f, \"median_seconds\": %.9f, \"p95_seconds\": %.9f, "
+				"\"max_seconds\": %.9f, \"mean_seconds\": %.9f, \"verified\": %s}",
+				firstRow ? "" : ",", size, distribution, getSortEngineName(SORT_ENGINE), threadCount, phase, iterations,
+				stats->min, stats->median, stats->p95, stats->max, stats->mean, verified ? "true" : "false");
+	}
+	else {
+		fprintf(report, "%ld,%s,%s,%d,%s,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%s\n", size, distribution, getSortEngineName(SORT_ENGINE),
+				threadCount, phase, iterations, stats->min, stats->median, stats->p95, stats->max, stats->mean,
+				verified ? "true" : "false");
+	}
+}
+
+
+void runBenchmark(char *argv[]) {
+
+	int iterations = atoi(argv[3]);
+	if (iterations < 1) {
+		printf("The benchmark needs at least one iteration.\n");
+		exit(-1);
+	}
+	if (EXTERNAL_SORT) {
+		printf("The benchmark harness measures the in-memory pipeline; --external cannot be combined with --benchmark.\n");
+		exit(-1);
+	}
+	if (PIPELINE) {
+		printf("The benchmark harness reads its inputs from memory; --pipeline cannot be combined with --benchmark.\n");
+		exit(-1);
+	}
+	// the sorted arrays are only checked, not kept, unless an output file was asked for
+	if (OUTPUT_FILE == NULL) {
+		OUTPUT_FILE = "/dev/null";
+	}
+
+	// the sizes and distributions default to the count and the file given on the command line
+	char defaultSizes[32];
+	snprintf(defaultSizes, sizeof(defaultSizes), "%s", argv[2]);
+	char *sizes = strdup(BENCHMARK_SIZES != NULL ? BENCHMARK_SIZES : defaultSizes);
+	char *distributions = strdup(BENCHMARK_DISTRIBUTIONS != NULL ? BENCHMARK_DISTRIBUTIONS : "file");
+
+	FILE *report = NULL;
+	bool json = false;
+	if (BENCHMARK_REPORT != NULL) {
+		if ((report = fopen(BENCHMARK_REPORT, "w")) == NULL) {
+			printf("Could not create the report file %s.\n", BENCHMARK_REPORT);
+			exit(-1);
+		}
+		size_t length = strlen(BENCHMARK_REPORT);
+		json = length >= 5 && strcmp(BENCHMARK_REPORT + length - 5, ".json") == 0;
+		if (json) {
+			fprintf(report, "[");
+		}
+		else {
+			fprintf(report, "size,distribution,engine,threads,phase,iterations,min_seconds,median_seconds,p95_seconds,max_seconds,mean_seconds,verified\n");
+		}
+	}
+	bool firstRow = true;
+
+	printf("Benchmarking %s with %d threads: %d warmup and %d measured iterations per case\n", getSortEngineName(SORT_ENGINE),
+			(SORT_ENGINE == QSORT_ENGINE) ? 1 : THREAD_COUNT, BENCHMARK_WARMUP, iterations);
+
+	double *samples = (double *) malloc(BENCHMARK_PHASE_COUNT * iterations * sizeof(double));
+	char *sizesState = NULL;
+	for (char *size = strtok_r(sizes, ",", &sizesState); size != NULL; size = strtok_r(NULL, ",", &sizesState)) {
+		long count = atol(size);
+		char *distributionList = strdup(distributions);
+		char *distributionsState = NULL;
+		for (char *distribution = strtok_r(distributionList, ",", &distributionsState); distribution != NULL;
+				distribution = strtok_r(NULL, ",", &distributionsState)) {
+
+			BenchmarkInput input;
+			if (strcmp(distribution, "file") == 0) {
+				loadBenchmarkInput(&input, argv[1], count);
+			}
+			else {
+				int keyDistribution = findKeyDistribution(distribution);
+				if (keyDistribution < 0) {
+					printf("Unknown key distribution %s.\n", distribution);
+					exit(-1);
+				}
+				generateBenchmarkInput(&input, (KeyDistribution) keyDistribution, count);
+			}
+
+			bool verified = true;
+			uint64_t firstChecksum = 0;
+			for (int i = 0; i < BENCHMARK_WARMUP + iterations; i++) {
+				double times[BENCHMARK_PHASE_COUNT];
+				uint64_t checksum;
+				verified = runBenchmarkIteration(&input, times, &checksum) && verified;
+				if (i == 0) {
+					firstChecksum = checksum;
+				}
+				verified = verified && checksum == firstChecksum;
+				if (i >= BENCHMARK_WARMUP) {
+					for (int phase = 0; phase < BENCHMARK_PHASE_COUNT; phase++) {
+						samples[phase * iterations + i - BENCHMARK_WARMUP] = times[phase];
+					}
+				}
+			}
+
+			printf("\nsize %ld, distribution %s: %s\n", count, distribution, verified ? "output verified" : "OUTPUT NOT SORTED");
+			for (int phase = 0; phase < BENCHMARK_PHASE_COUNT; phase++) {
+				PhaseStats stats = getPhaseStats(samples + phase * iterations, iterations);
+				printf("\t%-6s min %f  median %f  p95 %f  max %f seconds\n", BENCHMARK_PHASE_NAMES[phase], stats.min, stats.median,
+						stats.p95, stats.max);
+				if (report != NULL) {
+					writeBenchmarkReportRow(report, json, firstRow, count, distribution, BENCHMARK_PHASE_NAMES[phase], iterations,
+							&stats, verified);
+					firstRow = false;
+				}
+			}
+			freeBenchmarkInput(&input);
+		}
+		free(distributionList);
+	}
+
+	if (report != NULL) {
+		if (json) {
+			fprintf(report, "\n]\n");
+		}
+		fclose(report);
+	}
+	free(samples);
+	free(sizes);
+	free(distributions);
+}
+
+/***************************************************************************************************************************************
+ *                        Benchmark harness end
+ * *************************************************************************************************************************************/
+
+
+double * getTimesForReadSortAndPrint(char *argv[]) {
+
+	static double times[3];
+
+	// the external and pipelined modes stream the keys, so only they take more keys than an int counts
+	long count = strtol(argv[2], NULL, 10);
+	if (count < 1) {
+		printf("The count of the numbers to sort must be a positive integer.\n");
+		exit(-1);
+	}
+	if (EXTERNAL_SORT) {
+		externalSort(argv[1], count, times);
+		return times;
+	}
+	if (PIPELINE) {
+		pipelinedSort(argv[1], count, times);
+		return times;
+	}
+	if (count > INT_MAX) {
+		printf("Sorting more than %d numbers needs --external or --pipeline.\n", INT_MAX);
+		exit(-1);
+	}
+
+	double start_time;
+	start_time = getWallTime();
+
+	int *array = readArray(argv[1], count);
+
+	double end_time;
+	end_time = getWallTime();
+	double time_taken = end_time - start_time;
+	times[0] = time_taken;
+
+
+	start_time = getWallTime();
+	sortArray(array, count);
+	end_time = getWallTime();
+	time_taken = end_time - start_time;
+	times[1] = time_taken;
+
+
+	start_time = getWallTime();
+	OutputWriter writer;
+	openOutputWriter(&writer, count, true);
+	writeOutputKeys(&writer, array, count);
+	closeOutputWriter(&writer);
+	end_time = getWallTime();
+	time_taken = end_time - start_time;
+	times[2] = time_taken;
 
 
-	fclose(fp);
 	free(array);
 
 	return times;
@@ -0,0 +1,857 @@
+/**
+ * A header-only parallel sort library. It provides
+ *
+ *     sampleSort(data, count, threadCount[, less])                    comparison sort of any trivially copyable type
+ *     radixSort(data, count, threadCount[, digitBits[, keyOf]])       LSD radix sort of integer and floating point keys
+ *     sortKeyValues(records, count, threadCount[, digitBits])         radix sort of KeyValue records by key, stable
+ *     sortIndicesByKey(keys, indices, count, threadCount[, digitBits])  row indices ordered by their keys, stable
+ *     mergeSortedRuns(runBegins, runEnds, runCount, output[, less])   k-way merge of sorted runs
+ *     offerSmallest / collectSmallest(...)                            the k smallest records of a stream, with bounded heaps
+ *     selectRanks(data, count, ranks, rankCount, results, threadCount[, less])  records of given ranks without sorting
+ *
+ * The comparator of sampleSort and the key extractor of radixSort are template parameters, so they are inlined into the
+ * sorting loops instead of being called through a function pointer the way qsort calls its compare function. Integer keys of
+ * 8 to 64 bits, signed or not, and float and double keys are supported. Floating point keys are ordered with negative numbers
+ * first, -0.0 before 0.0 in the radix sort, and every NaN after all numbers.
+ *
+ * The algorithms are described with the functions below. They create their threads with pthreads on every call, with the
+ * calling thread taking part as thread 0.
+ * */
+#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <type_traits>
+
+namespace parallel_sort {
+
+// below this many items per thread a parallel algorithm is not worth its setup cost and uses fewer threads
+const size_t MIN_ITEMS_PER_THREAD = 4096;
+
+/***************************************************************************************************************************************
+ *                        Thread helpers
+ * *************************************************************************************************************************************/
+
+template <typename Work>
+struct WorkerArg {
+	const Work *work;
+	int threadId;
+	int threadCount;
+};
+
+
+template <typename Work>
+void *workerThreadFunction(void *arg) {
+	WorkerArg<Work> *argument = (WorkerArg<Work> *) arg;
+	(*argument->work)(argument->threadId, argument->threadCount);
+	return NULL;
+}
+
+
+/**
+ * Runs work(threadId, threadCount) on threadCount threads and waits for all of them. The calling thread takes part as thread 0
+ * so a single-threaded run does not create any thread at all.
+ * */
+template <typename Work>
+void runInParallel(int threadCount, const Work &work) {
+
+	if (threadCount <= 1) {
+		work(0, 1);
+		return;
+	}
+
+	pthread_t *threads = (pthread_t *) malloc(threadCount * sizeof(pthread_t));
+	WorkerArg<Work> *threadArgs = (WorkerArg<Work> *) malloc(threadCount * sizeof(WorkerArg<Work>));
+
+	for (int i = 0; i < threadCount; i++) {
+		threadArgs[i].work = &work;
+		threadArgs[i].threadId = i;
+		threadArgs[i].threadCount = threadCount;
+	}
+	for (int i = 1; i < threadCount; i++) {
+		pthread_create(&threads[i], NULL, workerThreadFunction<Work>, (void *) &threadArgs[i]);
+	}
+
+	work(0, threadCount);
+
+	for (int i = 1; i < threadCount; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+	free(threadArgs);
+}
+
+
+/**
+ * The same for C style worker functions that take their shared state as a context pointer.
+ * */
+inline void runInParallel(int threadCount, void (*work)(int threadId, int threadCount, void *context), void *context) {
+	runInParallel(threadCount, [work, context](int threadId, int threadCount) { work(threadId, threadCount, context); });
+}
+
+
+/**
+ * Returns the first index of the part that is assigned to a thread when count items are split evenly.
+ * */
+inline size_t getPartitionStart(size_t count, int partitionId, int partitionCount) {
+	return (count * partitionId) / partitionCount;
+}
+
+
+/**
+ * Limits the thread count so that every thread gets at least MIN_ITEMS_PER_THREAD items.
+ * */
+inline int getUsefulThreadCount(size_t count, int threadCount) {
+	size_t usefulCount = count / MIN_ITEMS_PER_THREAD;
+	if ((size_t) threadCount > usefulCount) {
+		return (usefulCount > 0) ? (int) usefulCount : 1;
+	}
+	return (threadCount > 0) ? threadCount : 1;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Orders and keys
+ * *************************************************************************************************************************************/
+
+/**
+ * The default order: operator<, except that for floating point types every NaN comes after all numbers, which makes it a
+ * strict weak order that the sorts can rely on.
+ * */
+template <typename T, bool isFloatingPoint = std::is_floating_point<T>::value>
+struct Less {
+	bool operator()(const T &a, const T &b) const {
+		return a < b;
+	}
+};
+
+template <typename T>
+struct Less<T, true> {
+	bool operator()(const T &a, const T &b) const {
+		return a < b || (!isnan(a) && isnan(b));
+	}
+};
+
+
+/**
+ * RadixTraits<Key>::toBits maps a key to an unsigned integer whose unsigned order is the order of the keys.
+ * */
+template <typename Key, typename Enable = void>
+struct RadixTraits;
+
+template <typename Key>
+struct RadixTraits<Key, typename std::enable_if<std::is_integral<Key>::value>::type> {
+	typedef typename std::make_unsigned<Key>::type Bits;
+
+	static Bits toBits(Key key) {
+		// flipping the sign bit of a signed key moves the negative keys below the positive ones
+		const Bits signBit = std::is_signed<Key>::value ? (Bits) ((Bits) 1 << (sizeof(Bits) * 8 - 1)) : (Bits) 0;
+		return (Bits) key ^ signBit;
+	}
+};
+
+template <typename Key>
+struct RadixTraits<Key, typename std::enable_if<std::is_floating_point<Key>::value>::type> {
+	typedef typename std::conditional<sizeof(Key) == 4, uint32_t, uint64_t>::type Bits;
+
+	static Bits toBits(Key key) {
+		const Bits signBit = (Bits) 1 << (sizeof(Bits) * 8 - 1);
+		if (isnan(key)) {
+			// all NaNs, whatever their sign and payload, sort after every number
+			return ~(Bits) 0;
+		}
+		Bits bits;
+		memcpy(&bits, &key, sizeof(bits));
+		// negative numbers are stored as sign and magnitude, so all their bits are flipped to reverse their order
+		return (bits & signBit) ? ~bits : (bits | signBit);
+	}
+};
+
+
+template <typename T>
+struct Identity {
+	const T &operator()(const T &record) const {
+		return record;
+	}
+};
+
+
+/**
+ * A key with a payload, for example a row index, that is sorted by the key.
+ * */
+template <typename Key, typename Value>
+struct KeyValue {
+	Key key;
+	Value value;
+};
+
+struct KeyOfKeyValue {
+	template <typename Record>
+	auto operator()(const Record &record) const -> decltype(record.key) {
+		return record.key;
+	}
+};
+
+
+/***************************************************************************************************************************************
+ *                        K-way merge
+ * *************************************************************************************************************************************/
+
+/**
+ * Restores the min-heap order of run indices (keyed by the current head of each run) below the given node.
+ * */
+template <typename Record, typename Compare>
+void siftDownRunHeap(int *heap, int heapSize, const Record **heads, int node, const Compare &less) {
+	while (true) {
+		int smallest = node;
+		int left = 2 * node + 1;
+		int right = left + 1;
+		if (left < heapSize && less(*heads[heap[left]], *heads[heap[smallest]])) smallest = left;
+		if (right < heapSize && less(*heads[heap[right]], *heads[heap[smallest]])) smallest = right;
+		if (smallest == node) break;
+		std::swap(heap[node], heap[smallest]);
+		node = smallest;
+	}
+}
+
+
+/**
+ * Merges runCount sorted runs into output using a binary min-heap of run heads.
+ * */
+template <typename Record, typename Compare>
+void mergeSortedRuns(const Record **runBegins, const Record **runEnds, int runCount, Record *output, Compare less) {
+
+	const Record **heads = (const Record **) malloc(runCount * sizeof(const Record *));
+	int *heap = (int *) malloc(runCount * sizeof(int));
+	int heapSize = 0;
+
+	for (int run = 0; run < runCount; run++) {
+		heads[run] = runBegins[run];
+		if (heads[run] < runEnds[run]) {
+			heap[heapSize++] = run;
+		}
+	}
+	for (int i = heapSize / 2 - 1; i >= 0; i--) {
+		siftDownRunHeap(heap, heapSize, heads, i, less);
+	}
+
+	while (heapSize > 0) {
+		int run = heap[0];
+		*output++ = *heads[run]++;
+		if (heads[run] == runEnds[run]) {
+			heap[0] = heap[--heapSize];
+		}
+		siftDownRunHeap(heap, heapSize, heads, 0, less);
+	}
+
+	free(heads);
+	free(heap);
+}
+
+
+template <typename Record>
+void mergeSortedRuns(const Record **runBegins, const Record **runEnds, int runCount, Record *output) {
+	mergeSortedRuns(runBegins, runEnds, runCount, output, Less<Record>());
+}
+
+
+/***************************************************************************************************************************************
+ *                        Parallel samplesort
+ *
+ * The array is cut into one chunk per thread and every thread sorts its chunk. Each thread then contributes evenly spaced
+ * samples from its sorted chunk (regular sampling) and the sorted samples give threadCount - 1 splitters. The splitters cut
+ * every chunk into threadCount buckets, and finally thread b merges bucket b of all chunks into its final position. For
+ * distinct keys regular sampling keeps every bucket below about twice the average, so all phases scale with the thread count.
+ * *************************************************************************************************************************************/
+
+template <typename Record, typename Compare>
+void sampleSort(Record *data, size_t count, int threadCount, Compare less) {
+
+	static_assert(std::is_trivially_copyable<Record>::value, "sampleSort moves records with memcpy");
+
+	threadCount = getUsefulThreadCount(count, threadCount);
+	if (threadCount <= 1) {
+		std::sort(data, data + count, less);
+		return;
+	}
+
+	Record *buffer = (Record *) malloc(count * sizeof(Record));
+	int sampleCount = threadCount * (threadCount - 1);
+	Record *samples = (Record *) malloc(sampleCount * sizeof(Record));
+	Record *splitters = (Record *) malloc((threadCount - 1) * sizeof(Record));
+	// bucketBounds[chunk * (threadCount + 1) + bucket] is the index inside the chunk where the bucket starts
+	size_t *bucketBounds = (size_t *) malloc(threadCount * (threadCount + 1) * sizeof(size_t));
+	// bucketOffsets[bucket] is the index in the sorted output where the bucket starts
+	size_t *bucketOffsets = (size_t *) malloc((threadCount + 1) * sizeof(size_t));
+
+	runInParallel(threadCount, [&](int threadId, int threadCount) {
+		size_t chunkStart = getPartitionStart(count, threadId, threadCount);
+		size_t chunkLength = getPartitionStart(count, threadId + 1, threadCount) - chunkStart;
+		Record *chunk = data + chunkStart;
+		std::sort(chunk, chunk + chunkLength, less);
+		for (int i = 0; i < threadCount - 1; i++) {
+			samples[threadId * (threadCount - 1) + i] = chunk[(chunkLength * (i + 1)) / threadCount];
+		}
+	});
+
+	// choose evenly spaced splitters from the sorted samples
+	std::sort(samples, samples + sampleCount, less);
+	for (int i = 0; i < threadCount - 1; i++) {
+		splitters[i] = samples[((i + 1) * sampleCount) / threadCount];
+	}
+
+	runInParallel(threadCount, [&](int threadId, int threadCount) {
+		size_t chunkStart = getPartitionStart(count, threadId, threadCount);
+		size_t chunkLength = getPartitionStart(count, threadId + 1, threadCount) - chunkStart;
+		const Record *chunk = data + chunkStart;
+		size_t *bounds = bucketBounds + threadId * (threadCount + 1);
+		bounds[0] = 0;
+		for (int bucket = 1; bucket < threadCount; bucket++) {
+			bounds[bucket] = std::upper_bound(chunk, chunk + chunkLength, splitters[bucket - 1], less) - chunk;
+		}
+		bounds[threadCount] = chunkLength;
+	});
+
+	bucketOffsets[0] = 0;
+	for (int bucket = 0; bucket < threadCount; bucket++) {
+		size_t bucketLength = 0;
+		for (int chunk = 0; chunk < threadCount; chunk++) {
+			const size_t *bounds = bucketBounds + chunk * (threadCount + 1);
+			bucketLength += bounds[bucket + 1] - bounds[bucket];
+		}
+		bucketOffsets[bucket + 1] = bucketOffsets[bucket] + bucketLength;
+	}
+
+	runInParallel(threadCount, [&](int bucket, int threadCount) {
+		const Record **runBegins = (const Record **) malloc(threadCount * sizeof(const Record *));
+		const Record **runEnds = (const Record **) malloc(threadCount * sizeof(const Record *));
+		for (int chunk = 0; chunk < threadCount; chunk++) {
+			const Record *chunkStart = data + getPartitionStart(count, chunk, threadCount);
+			const size_t *bounds = bucketBounds + chunk * (threadCount + 1);
+			runBegins[chunk] = chunkStart + bounds[bucket];
+			runEnds[chunk] = chunkStart + bounds[bucket + 1];
+		}
+		mergeSortedRuns(runBegins, runEnds, threadCount, buffer + bucketOffsets[bucket], less);
+		free(runBegins);
+		free(runEnds);
+	});
+
+	// every thread has to finish reading the chunks before the merged buckets can be copied back over them
+	runInParallel(threadCount, [&](int bucket, int) {
+		size_t bucketStart = bucketOffsets[bucket];
+		memcpy(data + bucketStart, buffer + bucketStart, (bucketOffsets[bucket + 1] - bucketStart) * sizeof(Record));
+	});
+
+	free(buffer);
+	free(samples);
+	free(splitters);
+	free(bucketBounds);
+	free(bucketOffsets);
+}
+
+
+template <typename Record>
+void sampleSort(Record *data, size_t count, int threadCount) {
+	sampleSort(data, count, threadCount, Less<Record>());
+}
+
+
+/***************************************************************************************************************************************
+ *                        Parallel LSD radix sort
+ *
+ * Records are sorted by the unsigned image of their key (see RadixTraits). A first read of the array builds the digit
+ * histograms of all passes at once; a pass whose digit is the same for every key would not move anything and is skipped.
+ * Every executed pass then counts the digits of each thread's chunk, turns the counts into per-thread output offsets and
+ * scatters the chunk. The scatter goes through a cache line sized staging buffer per bucket so that the destination is written
+ * a full line at a time instead of one record at a time. Every pass is stable, so records with equal keys keep their order.
+ * *************************************************************************************************************************************/
+
+// the size of the staging buffer of one bucket
+const size_t SCATTER_LINE_BYTES = 64;
+
+template <typename Record, typename KeyOf>
+void radixSort(Record *data, size_t count, int threadCount, int digitBits, KeyOf keyOf) {
+
+	static_assert(std::is_trivially_copyable<Record>::value, "radixSort moves records with memcpy");
+
+	typedef typename std::decay<decltype(keyOf(*data))>::type Key;
+	typedef typename RadixTraits<Key>::Bits Bits;
+
+	if (count < 2) {
+		return;
+	}
+	threadCount = getUsefulThreadCount(count, threadCount);
+
+	const int keyBits = sizeof(Bits) * 8;
+	const int passCount = (keyBits + digitBits - 1) / digitBits;
+	const size_t bucketCount = (size_t) 1 << digitBits;
+	const Bits mask = (Bits) (bucketCount - 1);
+	const size_t lineRecords = (SCATTER_LINE_BYTES / sizeof(Record) > 4) ? SCATTER_LINE_BYTES / sizeof(Record) : 4;
+
+	Record *buffer = (Record *) malloc(count * sizeof(Record));
+	// threadHistograms[(threadId * passCount + pass) * bucketCount + digit] counts the digits of the thread's chunk
+	size_t *threadHistograms = (size_t *) malloc(threadCount * passCount * bucketCount * sizeof(size_t));
+	// threadOffsets[threadId * bucketCount + digit] is where the thread writes its next record with that digit in this pass
+	size_t *threadOffsets = (size_t *) malloc(threadCount * bucketCount * sizeof(size_t));
+
+	runInParallel(threadCount, [&](int threadId, int threadCount) {
+		size_t chunkStart = getPartitionStart(count, threadId, threadCount);
+		size_t chunkEnd = getPartitionStart(count, threadId + 1, threadCount);
+		size_t *histograms = threadHistograms + threadId * passCount * bucketCount;
+		memset(histograms, 0, passCount * bucketCount * sizeof(size_t));
+		for (size_t i = chunkStart; i < chunkEnd; i++) {
+			Bits bits = RadixTraits<Key>::toBits(keyOf(data[i]));
+			// the histograms of the passes are separate tables, so the increments of one key are independent
+			for (int pass = 0; pass < passCount; pass++) {
+				histograms[pass * bucketCount + ((bits >> (pass * digitBits)) & mask)]++;
+			}
+		}
+	});
+
+	Record *source = data;
+	Record *destination = buffer;
+	bool sourceIsUnchanged = true;
+	for (int pass = 0; pass < passCount; pass++) {
+
+		// skip the pass when all keys share the same digit
+		bool digitIsConstant = false;
+		for (size_t digit = 0; digit < bucketCount && !digitIsConstant; digit++) {
+			size_t digitCount = 0;
+			for (int thread = 0; thread < threadCount; thread++) {
+				digitCount += threadHistograms[(thread * passCount + pass) * bucketCount + digit];
+			}
+			digitIsConstant = (digitCount == count);
+		}
+		if (digitIsConstant) {
+			continue;
+		}
+
+		const int shift = pass * digitBits;
+		const size_t *passHistograms;
+		if (sourceIsUnchanged) {
+			// the chunks still hold the records that the first read counted, so those histograms are still valid
+			passHistograms = threadHistograms + pass * bucketCount;
+		}
+		else {
+			// the histogram of this pass is rebuilt in the slot of pass 0, which is not needed once a pass has run
+			runInParallel(threadCount, [&](int threadId, int threadCount) {
+				size_t chunkStart = getPartitionStart(count, threadId, threadCount);
+				size_t chunkEnd = getPartitionStart(count, threadId + 1, threadCount);
+				size_t *histogram = threadHistograms + threadId * passCount * bucketCount;
+				memset(histogram, 0, bucketCount * sizeof(size_t));
+				for (size_t i = chunkStart; i < chunkEnd; i++) {
+					histogram[(RadixTraits<Key>::toBits(keyOf(source[i])) >> shift) & mask]++;
+				}
+			});
+			passHistograms = threadHistograms;
+		}
+
+		// records with a smaller digit come first, and within a digit the records of thread t come before those of thread
+		// t + 1, which keeps every pass stable
+		size_t offset = 0;
+		for (size_t digit = 0; digit < bucketCount; digit++) {
+			for (int thread = 0; thread < threadCount; thread++) {
+				threadOffsets[thread * bucketCount + digit] = offset;
+				offset += passHistograms[thread * passCount * bucketCount + digit];
+			}
+		}
+
+		runInParallel(threadCount, [&](int threadId, int threadCount) {
+			size_t chunkStart = getPartitionStart(count, threadId, threadCount);
+			size_t chunkEnd = getPartitionStart(count, threadId + 1, threadCount);
+			size_t *offsets = threadOffsets + threadId * bucketCount;
+			Record *lines = (Record *) aligned_alloc(SCATTER_LINE_BYTES,
+					(bucketCount * lineRecords * sizeof(Record) + SCATTER_LINE_BYTES - 1) / SCATTER_LINE_BYTES * SCATTER_LINE_BYTES);
+			uint8_t *lineFill = (uint8_t *) calloc(bucketCount, sizeof(uint8_t));
+
+			for (size_t i = chunkStart; i < chunkEnd; i++) {
+				size_t digit = (RadixTraits<Key>::toBits(keyOf(source[i])) >> shift) & mask;
+				Record *line = lines + digit * lineRecords;
+				line[lineFill[digit]++] = source[i];
+				if (lineFill[digit] == lineRecords) {
+					memcpy(destination + offsets[digit], line, lineRecords * sizeof(Record));
+					offsets[digit] += lineRecords;
+					lineFill[digit] = 0;
+				}
+			}
+			for (size_t digit = 0; digit < bucketCount; digit++) {
+				memcpy(destination + offsets[digit], lines + digit * lineRecords, lineFill[digit] * sizeof(Record));
+			}
+
+			free(lines);
+			free(lineFill);
+		});
+
+		std::swap(source, destination);
+		sourceIsUnchanged = false;
+	}
+
+	if (source != data) {
+		runInParallel(threadCount, [&](int threadId, int threadCount) {
+			size_t chunkStart = getPartitionStart(count, threadId, threadCount);
+			size_t chunkEnd = getPartitionStart(count, threadId + 1, threadCount);
+			memcpy(data + chunkStart, source + chunkStart, (chunkEnd - chunkStart) * sizeof(Record));
+		});
+	}
+
+	free(buffer);
+	free(threadHistograms);
+	free(threadOffsets);
+}
+
+
+template <typename Key>
+void radixSort(Key *data, size_t count, int threadCount, int digitBits = 8) {
+	radixSort(data, count, threadCount, digitBits, Identity<Key>());
+}
+
+
+/**
+ * Sorts key and value records by their key; records with equal keys keep their order.
+ * */
+template <typename Key, typename Value>
+void sortKeyValues(KeyValue<Key, Value> *records, size_t count, int threadCount, int digitBits = 8) {
+	radixSort(records, count, threadCount, digitBits, KeyOfKeyValue());
+}
+
+
+/**
+ * Fills indices with 0..count - 1 ordered by keys[index], so that keys[indices[0]] is the smallest key. Equal keys keep the
+ * order of their indices. The keys themselves are not moved.
+ * */
+template <typename Key, typename Index>
+void sortIndicesByKey(const Key *keys, Index *indices, size_t count, int threadCount, int digitBits = 8) {
+
+	KeyValue<Key, Index> *records = (KeyValue<Key, Index> *) malloc(count * sizeof(KeyValue<Key, Index>));
+	int usefulThreadCount = getUsefulThreadCount(count, threadCount);
+
+	runInParallel(usefulThreadCount, [&](int threadId, int threadCount) {
+		size_t end = getPartitionStart(count, threadId + 1, threadCount);
+		for (size_t i = getPartitionStart(count, threadId, threadCount); i < end; i++) {
+			records[i].key = keys[i];
+			records[i].value = (Index) i;
+		}
+	});
+
+	sortKeyValues(records, count, threadCount, digitBits);
+
+	runInParallel(usefulThreadCount, [&](int threadId, int threadCount) {
+		size_t end = getPartitionStart(count, threadId + 1, threadCount);
+		for (size_t i = getPartitionStart(count, threadId, threadCount); i < end; i++) {
+			indices[i] = records[i].value;
+		}
+	});
+
+	free(records);
+}
+
+
+/***************************************************************************************************************************************
+ *                        Selection
+ *
+ * Selecting a few order statistics does not need a full sort. offerSmallest keeps the k smallest records in one bounded heap per
+ * thread, so the k smallest of a stream of any length can be found in a single pass with memory for k records per thread.
+ * selectRanks finds the records of given ranks in an array in about one parallel pass: a random sample brackets every wanted
+ * rank between two sample records (the idea of Floyd and Rivest's SELECT), every thread counts the records below each bracket
+ * and collects the few records inside it, and the wanted ranks are then selected from the collected records alone with
+ * std::nth_element, an introselect. A bracket misses its rank only with a tiny probability, and such a rank is then selected from
+ * the whole array instead.
+ * *************************************************************************************************************************************/
+
+// the number of records sampled to bracket the wanted ranks, and the half width of a bracket in samples, about five standard
+// deviations of the position of a rank among the samples
+const size_t SELECTION_SAMPLE_COUNT = 1 << 16;
+const size_t SELECTION_BRACKET_SAMPLES = 640;
+
+
+/**
+ * Replaces the top of a binary heap ordered by less and restores the heap order.
+ * */
+template <typename Record, typename Compare>
+void replaceHeapTop(Record *heap, size_t size, const Record &record, const Compare &less) {
+	size_t node = 0;
+	while (true) {
+		size_t child = 2 * node + 1;
+		if (child >= size) {
+			break;
+		}
+		if (child + 1 < size && less(heap[child], heap[child + 1])) {
+			child++;
+		}
+		if (!less(record, heap[child])) {
+			break;
+		}
+		heap[node] = heap[child];
+		node = child;
+	}
+	heap[node] = record;
+}
+
+
+/**
+ * Offers count records to threadCount bounded heaps that keep the k smallest records by less; heap t is stored at heaps + t * k
+ * and holds heapSizes[t] records, with its largest record first. Called once per block, the heaps keep the k smallest records of
+ * a whole stream; collectSmallest then combines them.
+ * */
+template <typename Record, typename Compare>
+void offerSmallest(const Record *data, size_t count, size_t k, Record *heaps, size_t *heapSizes, int threadCount, Compare less) {
+
+	if (k == 0) {
+		return;
+	}
+	runInParallel(getUsefulThreadCount(count, threadCount), [&](int threadId, int threadCount) {
+		size_t end = getPartitionStart(count, threadId + 1, threadCount);
+		Record *heap = heaps + threadId * k;
+		size_t size = heapSizes[threadId];
+		for (size_t i = getPartitionStart(count, threadId, threadCount); i < end; i++) {
+			if (size < k) {
+				heap[size++] = data[i];
+				std::push_heap(heap, heap + size, less);
+			}
+			else if (less(data[i], heap[0])) {
+				replaceHeapTop(heap, k, data[i], less);
+			}
+		}
+		heapSizes[threadId] = size;
+	});
+}
+
+
+/**
+ * Writes the k smallest records of the heaps filled by offerSmallest to output in order and returns their number, which is less
+ * than k when fewer records were offered.
+ * */
+template <typename Record, typename Compare>
+size_t collectSmallest(const Record *heaps, const size_t *heapSizes, int threadCount, size_t k, Record *output, Compare less) {
+
+	size_t total = 0;
+	for (int thread = 0; thread < threadCount; thread++) {
+		total += heapSizes[thread];
+	}
+	Record *all = (Record *) malloc((total > 0 ? total : 1) * sizeof(Record));
+	size_t position = 0;
+	for (int thread = 0; thread < threadCount; thread++) {
+		memcpy(all + position, heaps + thread * k, heapSizes[thread] * sizeof(Record));
+		position += heapSizes[thread];
+	}
+
+	size_t resultCount = (total < k) ? total : k;
+	std::partial_sort(all, all + resultCount, all + total, less);
+	memcpy(output, all, resultCount * sizeof(Record));
+	free(all);
+	return resultCount;
+}
+
+
+/**
+ * Selects the records of the given ranks, counted from 0 in the order of less, from a part of the array in which every wanted
+ * rank is known to lie. ranks must be increasing; the part is reordered.
+ * */
+template <typename Record, typename Compare>
+void selectSortedRanks(Record *data, size_t count, const size_t *ranks, size_t rankCount, Record *results, Compare less) {
+	// every nth_element leaves the records after the selected one no smaller, so the next rank is searched after it
+	size_t first = 0;
+	for (size_t j = 0; j < rankCount; j++) {
+		std::nth_element(data + first, data + ranks[j], data + count, less);
+		results[j] = data[ranks[j]];
+		first = ranks[j] + 1;
+	}
+}
+
+
+/**
+ * Writes the record of rank ranks[j], counted from 0 in the order of less, to results[j] for every j, as if the array was sorted
+ * and results[j] = data[ranks[j]]. The ranks need not be sorted and must be below count. The array itself is not changed.
+ * */
+template <typename Record, typename Compare>
+void selectRanks(const Record *data, size_t count, const size_t *ranks, size_t rankCount, Record *results, int threadCount,
+		Compare less) {
+
+	static_assert(std::is_trivially_copyable<Record>::value, "selectRanks copies records with memcpy");
+
+	if (rankCount == 0) {
+		return;
+	}
+
+	// the wanted ranks in increasing order, remembering where each result goes
+	size_t *order = (size_t *) malloc(rankCount * sizeof(size_t));
+	for (size_t j = 0; j < rankCount; j++) {
+		order[j] = j;
+	}
+	std::sort(order, order + rankCount, [ranks](size_t a, size_t b) { return ranks[a] < ranks[b]; });
+	size_t *sortedRanks = (size_t *) malloc(rankCount * sizeof(size_t));
+	Record *sortedResults = (Record *) malloc(rankCount * sizeof(Record));
+	for (size_t j = 0; j < rankCount; j++) {
+		sortedRanks[j] = ranks[order[j]];
+	}
+
+	threadCount = getUsefulThreadCount(count, threadCount);
+	size_t sampleCount = (count < SELECTION_SAMPLE_COUNT) ? count : SELECTION_SAMPLE_COUNT;
+
+	if (sampleCount <= 2 * SELECTION_BRACKET_SAMPLES) {
+		// a small array is simply selected from a copy
+		Record *copy = (Record *) malloc(count * sizeof(Record));
+		memcpy(copy, data, count * sizeof(Record));
+		selectSortedRanks(copy, count, sortedRanks, rankCount, sortedResults, less);
+		free(copy);
+	}
+	else {
+		// a random sample, drawn with the splitmix64 sequence so that runs are repeatable
+		Record *samples = (Record *) malloc(sampleCount * sizeof(Record));
+		uint64_t state = 0x9E3779B97F4A7C15ULL;
+		for (size_t i = 0; i < sampleCount; i++) {
+			uint64_t random = (state += 0x9E3779B97F4A7C15ULL);
+			random = (random ^ (random >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			random = (random ^ (random >> 27)) * 0x94D049BB133111EBULL;
+			samples[i] = data[(random ^ (random >> 31)) % count];
+		}
+		std::sort(samples, samples + sampleCount, less);
+
+		// the bracket [low, high] of every rank, where a missing bound stands for the end of the order; brackets that overlap are
+		// joined into one group, so the groups are disjoint and increasing
+		size_t *groupOfRank = (size_t *) malloc(rankCount * sizeof(size_t));
+		Record *groupLows = (Record *) malloc(rankCount * sizeof(Record));
+		Record *groupHighs = (Record *) malloc(rankCount * sizeof(Record));
+		bool *groupHasLow = (bool *) malloc(rankCount * sizeof(bool));
+		bool *groupHasHigh = (bool *) malloc(rankCount * sizeof(bool));
+		size_t groupCount = 0;
+		for (size_t j = 0; j < rankCount; j++) {
+			size_t samplePosition = (size_t) ((double) sortedRanks[j] / count * sampleCount);
+			bool hasLow = samplePosition >= SELECTION_BRACKET_SAMPLES;
+			bool hasHigh = samplePosition + SELECTION_BRACKET_SAMPLES < sampleCount;
+			const Record &low = samples[hasLow ? samplePosition - SELECTION_BRACKET_SAMPLES : 0];
+			const Record &high = samples[hasHigh ? samplePosition + SELECTION_BRACKET_SAMPLES : 0];
+			size_t last = groupCount - 1;
+			if (groupCount > 0 && (!groupHasHigh[last] || !hasLow || !less(groupHighs[last], low))) {
+				groupHasHigh[last] = hasHigh;
+				groupHighs[last] = high;
+			}
+			else {
+				groupLows[groupCount] = low;
+				groupHighs[groupCount] = high;
+				groupHasLow[groupCount] = hasLow;
+				groupHasHigh[groupCount] = hasHigh;
+				groupCount++;
+			}
+			groupOfRank[j] = groupCount - 1;
+		}
+
+		// regionCounts[thread * (2 * groupCount + 1) + 2 * g] counts the records below group g, and the odd entries the records
+		// inside the groups, which are also collected
+		size_t regionCount = 2 * groupCount + 1;
+		size_t *regionCounts = (size_t *) calloc(threadCount * regionCount, sizeof(size_t));
+		Record **candidates = (Record **) calloc(threadCount * groupCount, sizeof(Record *));
+		size_t *candidateCapacities = (size_t *) calloc(threadCount * groupCount, sizeof(size_t));
+
+		runInParallel(threadCount, [&](int threadId, int threadCount) {
+			size_t *counts = regionCounts + threadId * regionCount;
+			Record **threadCandidates = candidates + threadId * groupCount;
+			size_t *capacities = candidateCapacities + threadId * groupCount;
+			size_t end = getPartitionStart(count, threadId + 1, threadCount);
+			for (size_t i = getPartitionStart(count, threadId, threadCount); i < end; i++) {
+				const Record &record = data[i];
+				// the first group whose high bound is not below the record
+				size_t low = 0, high = groupCount;
+				while (low < high) {
+					size_t middle = (low + high) / 2;
+					if (groupHasHigh[middle] && less(groupHighs[middle], record)) {
+						low = middle + 1;
+					}
+					else {
+						high = middle;
+					}
+				}
+				size_t group = low;
+				if (group == groupCount || (groupHasLow[group] && less(record, groupLows[group]))) {
+					counts[2 * group]++;
+					continue;
+				}
+				size_t &candidateCount = counts[2 * group + 1];
+				if (candidateCount == capacities[group]) {
+					capacities[group] = (capacities[group] > 0) ? 2 * capacities[group] : 1024;
+					threadCandidates[group] = (Record *) realloc(threadCandidates[group], capacities[group] * sizeof(Record));
+				}
+				threadCandidates[group][candidateCount++] = record;
+			}
+		});
+
+		// the records below every group and the candidates of every group over all threads
+		size_t below = 0;
+		size_t j = 0;
+		for (size_t group = 0; group < groupCount; group++) {
+			size_t candidateCount = 0;
+			for (int thread = 0; thread < threadCount; thread++) {
+				below += regionCounts[thread * regionCount + 2 * group];
+				candidateCount += regionCounts[thread * regionCount + 2 * group + 1];
+			}
+			Record *groupCandidates = (Record *) malloc((candidateCount > 0 ? candidateCount : 1) * sizeof(Record));
+			size_t position = 0;
+			for (int thread = 0; thread < threadCount; thread++) {
+				size_t threadCandidateCount = regionCounts[thread * regionCount + 2 * group + 1];
+				memcpy(groupCandidates + position, candidates[thread * groupCount + group], threadCandidateCount * sizeof(Record));
+				position += threadCandidateCount;
+			}
+
+			size_t groupStart = j;
+			while (j < rankCount && groupOfRank[j] == group) {
+				j++;
+			}
+			bool bracketed = true;
+			size_t *localRanks = (size_t *) malloc((j - groupStart) * sizeof(size_t));
+			for (size_t r = groupStart; r < j; r++) {
+				bracketed = bracketed && sortedRanks[r] >= below && sortedRanks[r] < below + candidateCount;
+				localRanks[r - groupStart] = sortedRanks[r] - below;
+			}
+			if (bracketed) {
+				selectSortedRanks(groupCandidates, candidateCount, localRanks, j - groupStart, sortedResults + groupStart, less);
+			}
+			else {
+				// the sample was unlucky for this group; select its ranks from the whole array
+				Record *copy = (Record *) malloc(count * sizeof(Record));
+				memcpy(copy, data, count * sizeof(Record));
+				selectSortedRanks(copy, count, sortedRanks + groupStart, j - groupStart, sortedResults + groupStart, less);
+				free(copy);
+			}
+			free(localRanks);
+			free(groupCandidates);
+			below += candidateCount;
+		}
+
+		for (size_t i = 0; i < (size_t) threadCount * groupCount; i++) {
+			free(candidates[i]);
+		}
+		free(candidates);
+		free(candidateCapacities);
+		free(regionCounts);
+		free(groupOfRank);
+		free(groupLows);
+		free(groupHighs);
+		free(groupHasLow);
+		free(groupHasHigh);
+		free(samples);
+	}
+
+	for (size_t j = 0; j < rankCount; j++) {
+		results[order[j]] = sortedResults[j];
+	}
+	free(order);
+	free(sortedRanks);
+	free(sortedResults);
+}
+
+
+template <typename Record>
+void selectRanks(const Record *data, size_t count, const size_t *ranks, size_t rankCount, Record *results, int threadCount) {
+	selectRanks(data, count, ranks, rankCount, results, threadCount, Less<Record>());
+}
+
+}
+
+#endif
@@ -0,0 +1,367 @@
+/**
+ * Shared definitions for the random input arrays of the sorting programs: the binary array file format written by
+ * random_array_generator.cpp and read by optimized_sort.cpp and mpi_sample_sort.cpp, the checksum of sorted arrays, the text form
+ * of the keys and the writing of the output, the command line options, and the key distributions the generator can produce.
+ *
+ * Every key is a pure function of (distribution, seed, count, index), so any thread can generate any part of the array and
+ * the output does not depend on the number of threads used.
+ * */
+#ifndef RANDOM_ARRAY_H
+#define RANDOM_ARRAY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+/***************************************************************************************************************************************
+ *                        Binary array file format
+ *
+ * A binary array file is this header followed by count keys stored as little-endian 32-bit signed integers.
+ * *************************************************************************************************************************************/
+
+#define RANDOM_ARRAY_MAGIC "PSORTARR"
+#define RANDOM_ARRAY_VERSION 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t elementSize;
+	uint64_t count;
+} RandomArrayHeader;
+
+
+static inline void initRandomArrayHeader(RandomArrayHeader *header, uint64_t count) {
+	memcpy(header->magic, RANDOM_ARRAY_MAGIC, sizeof(header->magic));
+	header->version = RANDOM_ARRAY_VERSION;
+	header->elementSize = sizeof(int32_t);
+	header->count = count;
+}
+
+
+static inline bool isRandomArrayHeader(const RandomArrayHeader *header) {
+	return memcmp(header->magic, RANDOM_ARRAY_MAGIC, sizeof(header->magic)) == 0;
+}
+
+
+/**
+ * A checksum term that depends on both the key and its position, so that the sum over all keys of a sorted array changes when
+ * keys are misplaced and can still be computed in parallel parts, by threads or by MPI ranks.
+ * */
+static inline uint64_t getChecksumTerm(long position, int key) {
+	uint64_t term = (uint64_t) position * 0x9E3779B97F4A7C15ULL + (uint32_t) key;
+	term ^= term >> 31;
+	term *= 0xBF58476D1CE4E5B9ULL;
+	return term ^ (term >> 29);
+}
+
+
+/***************************************************************************************************************************************
+ *                        Text keys, output and options
+ * *************************************************************************************************************************************/
+
+// the longest text form of an int key plus its separator
+#define MAX_KEY_TEXT_LENGTH 12
+
+static const char DIGIT_PAIRS[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+
+/**
+ * Writes the decimal form of value followed by a space and returns the number of characters written, at most
+ * MAX_KEY_TEXT_LENGTH.
+ * */
+static inline int formatKey(int32_t value, char *output) {
+
+	char digits[MAX_KEY_TEXT_LENGTH];
+	char *digitStart = digits + MAX_KEY_TEXT_LENGTH;
+	uint32_t magnitude = (value < 0) ? 0u - (uint32_t) value : (uint32_t) value;
+
+	// the digits are produced from the back, two at a time
+	while (magnitude >= 100) {
+		uint32_t pair = (magnitude % 100) * 2;
+		magnitude /= 100;
+		digitStart -= 2;
+		digitStart[0] = DIGIT_PAIRS[pair];
+		digitStart[1] = DIGIT_PAIRS[pair + 1];
+	}
+	if (magnitude >= 10) {
+		digitStart -= 2;
+		digitStart[0] = DIGIT_PAIRS[magnitude * 2];
+		digitStart[1] = DIGIT_PAIRS[magnitude * 2 + 1];
+	}
+	else {
+		*--digitStart = '0' + magnitude;
+	}
+	if (value < 0) {
+		*--digitStart = '-';
+	}
+
+	int length = digits + MAX_KEY_TEXT_LENGTH - digitStart;
+	memcpy(output, digitStart, length);
+	output[length] = ' ';
+	return length + 1;
+}
+
+
+// the keys of a text file are separated by spaces, newlines or any other control character
+static inline bool isSeparator(unsigned char character) {
+	return character <= ' ';
+}
+
+
+/**
+ * The end of a window of text that starts at position and is long enough for keyCount keys written compactly, extended to the
+ * next separator so that it does not cut a number in two.
+ * */
+static inline size_t getKeyWindowEnd(const unsigned char *data, size_t size, size_t position, long keyCount) {
+	size_t windowEnd = size;
+	if ((size_t) keyCount < (size - position) / MAX_KEY_TEXT_LENGTH) {
+		windowEnd = position + (size_t) keyCount * MAX_KEY_TEXT_LENGTH;
+	}
+	while (windowEnd < size && !isSeparator(data[windowEnd])) {
+		windowEnd++;
+	}
+	return windowEnd;
+}
+
+
+/**
+ * Writes all length bytes of data to fd, retrying the short writes of pipes and large files, and ends the program when the
+ * output cannot be written.
+ * */
+static inline void writeFully(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t status = write(fd, data, length);
+		if (status <= 0) {
+			printf("Could not write the output.\n");
+			exit(-1);
+		}
+		data += status;
+		length -= status;
+	}
+}
+
+
+/**
+ * Returns the value part of a "--name=value" command line option, or NULL if the argument is not that option.
+ * */
+static inline const char * getOptionValue(const char *argument, const char *name) {
+	size_t length = strlen(name);
+	if (strncmp(argument, name, length) == 0 && argument[length] == '=') {
+		return argument + length + 1;
+	}
+	return NULL;
+}
+
+
+/***************************************************************************************************************************************
+ *                        Key distributions
+ * *************************************************************************************************************************************/
+
+typedef enum {
+	// count distinct keys from 0..count in random order, what "shuf -i 0-count -n count" produced
+	PERMUTATION_DISTRIBUTION,
+	// keys drawn uniformly from the whole int range, negative keys included
+	UNIFORM_DISTRIBUTION,
+	// 0, 1, 2, ... count - 1
+	SORTED_DISTRIBUTION,
+	// count - 1, count - 2, ... 0
+	REVERSE_SORTED_DISTRIBUTION,
+	// sorted, except that a given percentage of the keys is replaced by a random key from 0..count - 1
+	NEARLY_SORTED_DISTRIBUTION,
+	// keys drawn uniformly from only a few distinct values 0..uniqueKeys - 1
+	FEW_UNIQUE_DISTRIBUTION,
+	// key k - 1 drawn with probability proportional to 1 / k^exponent for k in 1..count, so small keys repeat a lot
+	ZIPF_DISTRIBUTION
+} KeyDistribution;
+
+typedef struct {
+	KeyDistribution distribution;
+	uint64_t seed;
+	uint64_t count;
+	// used by the nearly sorted distribution
+	double unsortedPercent;
+	// used by the few unique distribution
+	uint32_t uniqueKeys;
+	// used by the Zipf distribution
+	double zipfExponent;
+	// derived values, filled in by initKeyGenerator
+	int permutationHalfBits;
+	double zipfHIntegralX1;
+	double zipfHIntegralCount;
+	double zipfS;
+} KeyGenerator;
+
+
+static const char *KEY_DISTRIBUTION_NAMES[] = {
+	"permutation", "uniform", "sorted", "reverse", "nearly-sorted", "few-unique", "zipf"
+};
+#define KEY_DISTRIBUTION_COUNT 7
+
+
+/**
+ * Returns the distribution with the given name, or -1 if there is none.
+ * */
+static inline int findKeyDistribution(const char *name) {
+	for (int i = 0; i < KEY_DISTRIBUTION_COUNT; i++) {
+		if (strcmp(name, KEY_DISTRIBUTION_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+static inline uint64_t mixBits(uint64_t value) {
+	// the splitmix64 finalizer
+	value ^= value >> 30;
+	value *= 0xBF58476D1CE4E5B9ULL;
+	value ^= value >> 27;
+	value *= 0x94D049BB133111EBULL;
+	value ^= value >> 31;
+	return value;
+}
+
+
+/**
+ * The index-th 64-bit random value of the stream selected by seed and stream.
+ * */
+static inline uint64_t getRandomBits(uint64_t seed, uint64_t stream, uint64_t index) {
+	return mixBits(seed + mixBits(stream * 0x9E3779B97F4A7C15ULL + index));
+}
+
+
+static inline double getRandomUnit(uint64_t seed, uint64_t stream, uint64_t index) {
+	return (getRandomBits(seed, stream, index) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * A bijection on [0, 2^(2 * halfBits)) built from a four round Feistel network.
+ * */
+static inline uint64_t permuteBits(uint64_t value, int halfBits, uint64_t seed) {
+	uint64_t halfMask = (1ULL << halfBits) - 1;
+	uint64_t left = value >> halfBits;
+	uint64_t right = value & halfMask;
+	for (int round = 0; round < 4; round++) {
+		uint64_t next = left ^ (mixBits(right + seed + round * 0x632BE59BD9B4E019ULL) & halfMask);
+		left = right;
+		right = next;
+	}
+	return (left << halfBits) | right;
+}
+
+
+// helpers of the Zipf sampler: log1p(x) / x and expm1(x) / x without the loss of precision near 0
+static inline double zipfHelper1(double x) {
+	return (fabs(x) > 1e-8) ? log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+}
+
+static inline double zipfHelper2(double x) {
+	return (fabs(x) > 1e-8) ? expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+}
+
+static inline double zipfH(const KeyGenerator *generator, double x) {
+	return exp(-generator->zipfExponent * log(x));
+}
+
+static inline double zipfHIntegral(const KeyGenerator *generator, double x) {
+	double logX = log(x);
+	return zipfHelper2((1.0 - generator->zipfExponent) * logX) * logX;
+}
+
+static inline double zipfHIntegralInverse(const KeyGenerator *generator, double x) {
+	double t = x * (1.0 - generator->zipfExponent);
+	if (t < -1.0) {
+		t = -1.0;
+	}
+	return exp(zipfHelper1(t) * x);
+}
+
+
+static inline void initKeyGenerator(KeyGenerator *generator) {
+
+	int bits = 2;
+	while (bits < 64 && (1ULL << bits) <= generator->count) {
+		bits += 2;
+	}
+	generator->permutationHalfBits = bits / 2;
+
+	if (generator->distribution == ZIPF_DISTRIBUTION) {
+		double count = (generator->count > 0) ? (double) generator->count : 1.0;
+		generator->zipfHIntegralX1 = zipfHIntegral(generator, 1.5) - 1.0;
+		generator->zipfHIntegralCount = zipfHIntegral(generator, count + 0.5);
+		generator->zipfS = 2.0 - zipfHIntegralInverse(generator, zipfHIntegral(generator, 2.5) - zipfH(generator, 2.0));
+	}
+}
+
+
+/**
+ * Draws a Zipf rank in 1..count with the rejection-inversion method of Hörmann and Derflinger, which needs no table and takes a
+ * small constant number of tries on average.
+ * */
+static inline uint64_t drawZipfRank(const KeyGenerator *generator, uint64_t index) {
+	for (uint64_t attempt = 0; ; attempt++) {
+		double unit = getRandomUnit(generator->seed, index, attempt);
+		double u = generator->zipfHIntegralCount + unit * (generator->zipfHIntegralX1 - generator->zipfHIntegralCount);
+		double x = zipfHIntegralInverse(generator, u);
+		uint64_t rank = (uint64_t) (x + 0.5);
+		if (rank < 1) {
+			rank = 1;
+		}
+		else if (rank > generator->count) {
+			rank = generator->count;
+		}
+		if (rank - x <= generator->zipfS || u >= zipfHIntegral(generator, rank + 0.5) - zipfH(generator, (double) rank)) {
+			return rank;
+		}
+	}
+}
+
+
+/**
+ * Returns the key at the given index of the array described by the generator.
+ * */
+static inline int32_t generateKey(const KeyGenerator *generator, uint64_t index) {
+
+	switch (generator->distribution) {
+		case PERMUTATION_DISTRIBUTION: {
+			// walk the cycle of the bijection until it lands inside 0..count, which maps 0..count - 1 onto distinct keys
+			uint64_t value = index;
+			do {
+				value = permuteBits(value, generator->permutationHalfBits, generator->seed);
+			} while (value > generator->count);
+			return (int32_t) value;
+		}
+		case UNIFORM_DISTRIBUTION:
+			return (int32_t) (uint32_t) getRandomBits(generator->seed, 0, index);
+		case SORTED_DISTRIBUTION:
+			return (int32_t) index;
+		case REVERSE_SORTED_DISTRIBUTION:
+			return (int32_t) (generator->count - 1 - index);
+		case NEARLY_SORTED_DISTRIBUTION:
+			if (getRandomUnit(generator->seed, 0, index) * 100.0 < generator->unsortedPercent) {
+				return (int32_t) (getRandomBits(generator->seed, 1, index) % generator->count);
+			}
+			return (int32_t) index;
+		case FEW_UNIQUE_DISTRIBUTION:
+			return (int32_t) (getRandomBits(generator->seed, 0, index) % generator->uniqueKeys);
+		case ZIPF_DISTRIBUTION:
+			return (int32_t) (drawZipfRank(generator, index) - 1);
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,250 @@
+/**
+ * Generates an array of random integers for the sorting programs and writes it to a file. This replaces the old
+ * random-array-generator.sh script: the keys are generated by all cores, several key distributions are available, and besides
+ * the space separated text format of the script the array can be written in a binary format that optimized_sort.cpp loads with
+ * a single read.
+ *
+ * Usage: ./random_array_generator.o count filename [options]
+ * */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "random_array.h"
+
+// keys generated by one thread in one step; the steps bound the memory use for arrays of any size
+#define KEYS_PER_BLOCK (1 << 20)
+
+typedef enum {
+	TEXT_FORMAT,
+	BINARY_FORMAT
+} OutputFormat;
+
+int THREAD_COUNT = 1;
+OutputFormat OUTPUT_FORMAT = TEXT_FORMAT;
+KeyGenerator KEY_GENERATOR;
+
+typedef struct {
+	int threadId;
+	int outputFile;
+	uint64_t roundStart;
+	// the text of the keys of the thread's block and its length, or the keys themselves in the binary format
+	char *buffer;
+	size_t bufferLength;
+	// where the block goes in the output file
+	off_t fileOffset;
+} BlockArg;
+
+
+void printUsage() {
+	printf("Usage: ./random_array_generator.o count filename [options]\n");
+	printf("Options:\n");
+	printf("\t--distribution=NAME         permutation, uniform, sorted, reverse, nearly-sorted, few-unique or zipf (default: permutation)\n");
+	printf("\t--format=text|binary        output file format (default: text)\n");
+	printf("\t--threads=N                 number of generating threads (default: number of cores)\n");
+	printf("\t--seed=N                    random seed; the same seed gives the same array (default: 1)\n");
+	printf("\t--unsorted-percent=P        percentage of out of place keys for nearly-sorted (default: 1)\n");
+	printf("\t--unique-keys=N             number of distinct keys for few-unique (default: 16)\n");
+	printf("\t--zipf-exponent=S           skew of the zipf distribution (default: 1.0)\n");
+}
+
+
+void parseOptions(int argc, char *argv[]) {
+
+	long coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+	THREAD_COUNT = (coreCount > 0) ? (int) coreCount : 1;
+
+	KEY_GENERATOR.distribution = PERMUTATION_DISTRIBUTION;
+	KEY_GENERATOR.seed = 1;
+	KEY_GENERATOR.unsortedPercent = 1.0;
+	KEY_GENERATOR.uniqueKeys = 16;
+	KEY_GENERATOR.zipfExponent = 1.0;
+
+	for (int i = 3; i < argc; i++) {
+		const char *value;
+		if ((value = getOptionValue(argv[i], "--distribution")) != NULL) {
+			int distribution = findKeyDistribution(value);
+			if (distribution < 0) {
+				printf("Unknown key distribution %s.\n", value);
+				exit(1);
+			}
+			KEY_GENERATOR.distribution = (KeyDistribution) distribution;
+		}
+		else if ((value = getOptionValue(argv[i], "--format")) != NULL) {
+			if (strcmp(value, "text") == 0) {
+				OUTPUT_FORMAT = TEXT_FORMAT;
+			}
+			else if (strcmp(value, "binary") == 0) {
+				OUTPUT_FORMAT = BINARY_FORMAT;
+			}
+			else {
+				printf("Unknown output format %s.\n", value);
+				exit(1);
+			}
+		}
+		else if ((value = getOptionValue(argv[i], "--threads")) != NULL) {
+			THREAD_COUNT = atoi(value);
+		}
+		else if ((value = getOptionValue(argv[i], "--seed")) != NULL) {
+			KEY_GENERATOR.seed = strtoull(value, NULL, 10);
+		}
+		else if ((value = getOptionValue(argv[i], "--unsorted-percent")) != NULL) {
+			KEY_GENERATOR.unsortedPercent = atof(value);
+		}
+		else if ((value = getOptionValue(argv[i], "--unique-keys")) != NULL) {
+			KEY_GENERATOR.uniqueKeys = (uint32_t) atol(value);
+		}
+		else if ((value = getOptionValue(argv[i], "--zipf-exponent")) != NULL) {
+			KEY_GENERATOR.zipfExponent = atof(value);
+		}
+		else {
+			printf("Unknown option %s.\n", argv[i]);
+			printUsage();
+			exit(1);
+		}
+	}
+
+	if (THREAD_COUNT < 1 || KEY_GENERATOR.uniqueKeys < 1 || KEY_GENERATOR.zipfExponent <= 0.0) {
+		printf("The thread count, the unique key count and the zipf exponent must be positive.\n");
+		exit(1);
+	}
+}
+
+
+void *generateBlock(void *arg) {
+
+	BlockArg *argument = (BlockArg *) arg;
+	uint64_t blockStart = argument->roundStart + (uint64_t) argument->threadId * KEYS_PER_BLOCK;
+	uint64_t blockEnd = blockStart + KEYS_PER_BLOCK;
+	if (blockEnd > KEY_GENERATOR.count) {
+		blockEnd = KEY_GENERATOR.count;
+	}
+
+	argument->bufferLength = 0;
+	if (blockStart >= blockEnd) {
+		return NULL;
+	}
+
+	if (OUTPUT_FORMAT == BINARY_FORMAT) {
+		int32_t *keys = (int32_t *) argument->buffer;
+		for (uint64_t i = blockStart; i < blockEnd; i++) {
+			keys[i - blockStart] = generateKey(&KEY_GENERATOR, i);
+		}
+		argument->bufferLength = (blockEnd - blockStart) * sizeof(int32_t);
+	}
+	else {
+		char *text = argument->buffer;
+		size_t length = 0;
+		for (uint64_t i = blockStart; i < blockEnd; i++) {
+			length += formatKey(generateKey(&KEY_GENERATOR, i), text + length);
+		}
+		argument->bufferLength = length;
+	}
+	return NULL;
+}
+
+
+void *writeBlock(void *arg) {
+
+	BlockArg *argument = (BlockArg *) arg;
+	size_t written = 0;
+	while (written < argument->bufferLength) {
+		ssize_t status = pwrite(argument->outputFile, argument->buffer + written, argument->bufferLength - written,
+				argument->fileOffset + written);
+		if (status <= 0) {
+			printf("Could not write the output file.\n");
+			exit(1);
+		}
+		written += status;
+	}
+	return NULL;
+}
+
+
+/**
+ * Runs function on every block argument, one thread per block.
+ * */
+void runOnBlocks(void *(*function)(void *), BlockArg *blockArgs) {
+
+	pthread_t *threads = (pthread_t *) malloc(THREAD_COUNT * sizeof(pthread_t));
+	for (int i = 1; i < THREAD_COUNT; i++) {
+		pthread_create(&threads[i], NULL, function, (void *) &blockArgs[i]);
+	}
+	function((void *) &blockArgs[0]);
+	for (int i = 1; i < THREAD_COUNT; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+}
+
+
+int main(int argc, char *argv[]) {
+
+	if (argc < 3) {
+		printf("Please supply all parameters\n");
+		printUsage();
+		exit(1);
+	}
+
+	KEY_GENERATOR.count = strtoull(argv[1], NULL, 10);
+	parseOptions(argc, argv);
+	initKeyGenerator(&KEY_GENERATOR);
+
+	int outputFile = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (outputFile < 0) {
+		printf("Could not create the output file %s.\n", argv[2]);
+		exit(1);
+	}
+
+	off_t fileOffset = 0;
+	if (OUTPUT_FORMAT == BINARY_FORMAT) {
+		RandomArrayHeader header;
+		initRandomArrayHeader(&header, KEY_GENERATOR.count);
+		if (write(outputFile, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+			printf("Could not write the output file.\n");
+			exit(1);
+		}
+		fileOffset = sizeof(header);
+	}
+
+	BlockArg *blockArgs = (BlockArg *) malloc(THREAD_COUNT * sizeof(BlockArg));
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		blockArgs[i].threadId = i;
+		blockArgs[i].outputFile = outputFile;
+		blockArgs[i].buffer = (char *) malloc((size_t) KEYS_PER_BLOCK * MAX_KEY_TEXT_LENGTH);
+	}
+
+	// every round generates one block per thread in parallel, then writes the blocks at their offsets in parallel
+	for (uint64_t roundStart = 0; roundStart < KEY_GENERATOR.count; roundStart += (uint64_t) THREAD_COUNT * KEYS_PER_BLOCK) {
+		for (int i = 0; i < THREAD_COUNT; i++) {
+			blockArgs[i].roundStart = roundStart;
+		}
+		runOnBlocks(generateBlock, blockArgs);
+		for (int i = 0; i < THREAD_COUNT; i++) {
+			blockArgs[i].fileOffset = fileOffset;
+			fileOffset += blockArgs[i].bufferLength;
+		}
+		runOnBlocks(writeBlock, blockArgs);
+	}
+
+	if (OUTPUT_FORMAT == TEXT_FORMAT) {
+		// end the single line of numbers like the old script did
+		if (pwrite(outputFile, "\n", 1, fileOffset) != 1) {
+			printf("Could not write the output file.\n");
+			exit(1);
+		}
+	}
+
+	close(outputFile);
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		free(blockArgs[i].buffer);
+	}
+	free(blockArgs);
+
+	return 0;
+}